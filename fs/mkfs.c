@@ -4,8 +4,16 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the host's names, before xv6's headers take them over
+typedef struct stat hoststat;
+typedef struct dirent hostdirent;
 
 #define stat xv6_stat  // avoid clash with host struct stat
+#define dirent xv6_dirent  // and struct dirent
 #include "include/types.h"
 #include "include/fs.h"
 #include "include/stat.h"
@@ -19,27 +27,34 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+//
+// The image is built in memory, mapped from the output file, so blocks
+// are written with plain stores and each input file goes in with one copy.
+// A file's data blocks are laid out one after the other, then the
+// indirect blocks that point at them.
+
+// Geometry, overridable with -s, -l and -i.
+int fssize = FSSIZE;  // Size of the image in blocks
+int ninodes = NINODES;
+int nlog = LOGSIZE+1; // Log header plus the most data blocks the kernel will log
+int nbitmap;
+int ninodeblocks;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;    // the image, fssize blocks
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
-void wsect(uint, void*);
-void winode(uint, struct dinode*);
-void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void ifill(uint inum, char *p, uint n);
+void dirdone(uint inum);
+void import(uint dir, char *path, char *name);
 
 // ensure intel byte order
 ushort
@@ -65,55 +80,121 @@ xint(uint x)
   return y;
 }
 
+// Block b of the image.
+char*
+blk(uint b)
+{
+  assert(b < fssize);
+  return img + (off_t)b * BSIZE;
+}
+
+// On-disk inode inum, in the image.
+struct dinode*
+dinode(uint inum)
+{
+  assert(inum < ninodes);
+  return (struct dinode*)blk(IBLOCK(inum, sb)) + inum % IPB;
+}
+
+// The next free block.
+uint
+newblock(void)
+{
+  if(freeblock >= fssize){
+    fprintf(stderr, "mkfs: out of blocks, make the image bigger with -s\n");
+    exit(1);
+  }
+  return freeblock++;
+}
+
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
+  int i;
+  uint rootino;
   struct dirent de;
-  char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while((i = getopt(argc, argv, "s:l:i:")) != -1){
+    switch(i){
+    case 's':
+      fssize = atoi(optarg);
+      break;
+    case 'l':
+      nlog = atoi(optarg);
+      break;
+    case 'i':
+      ninodes = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+usage:
+    fprintf(stderr, "Usage: mkfs [-s blocks] [-l logblocks] [-i inodes] fs.img files-or-dirs...\n");
+    exit(1);
+  }
+  // the kernel can't use a log bigger than its in-memory header,
+  // and needs at least room for one full FS op
+  if(nlog < MAXOPBLOCKS+1 || nlog > LOGSIZE+1){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n", MAXOPBLOCKS+1, LOGSIZE+1);
+    exit(1);
+  }
+  // inode numbers have to fit in a dirent
+  if(ninodes < ROOTINO+1 || ninodes > 65535){
+    fprintf(stderr, "mkfs: inodes must be %d to 65535\n", ROOTINO+1);
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
+  // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  if(fssize <= nmeta){
+    fprintf(stderr, "mkfs: %d blocks is too small\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
+
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
     perror(argv[1]);
     exit(1);
   }
+  // a fresh file of the right size reads as zeroes, with no need to write them
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+  img = mmap(0, (size_t)fssize * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
-
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
-  memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(blk(1), &sb, sizeof(sb));
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -129,177 +210,254 @@ main(int argc, char *argv[])
   iappend(rootino, &de, sizeof(de));
 
   for(i = 2; i < argc; i++){
-    // get rid of "user/"
+    // get rid of "user/", "kernel/", ...
     char *shortname;
-    if(strncmp(argv[i], "user/", 5) == 0)
-      shortname = argv[i] + 5;
+    if((shortname = strrchr(argv[i], '/')) != 0)
+      shortname++;
     else
       shortname = argv[i];
-
-    assert(index(shortname, '/') == 0);
-
-    if((fd = open(argv[i], 0)) < 0){
-      perror(argv[i]);
-      exit(1);
-    }
-
-    // Skip leading _ in name when writing to file system.
-    // The binaries are named _rm, _cat, etc. to keep the
-    // build operating system from trying to execute them
-    // in place of system binaries like rm and cat.
-    if(shortname[0] == '_')
-      shortname += 1;
-
-    inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
-
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
-
-    close(fd);
+    import(rootino, argv[i], shortname);
   }
-
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirdone(rootino);
 
   balloc(freeblock);
 
+  if(msync(img, (size_t)fssize * BSIZE, MS_SYNC) < 0 || munmap(img, (size_t)fssize * BSIZE) < 0){
+    perror("msync");
+    exit(1);
+  }
+  close(fsfd);
   exit(0);
 }
 
-void
-wsect(uint sec, void *buf)
+uint
+ialloc(ushort type)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
+  uint inum = freeinode++;
+  struct dinode *din;
+
+  if(inum >= ninodes){
+    fprintf(stderr, "mkfs: out of inodes, make more with -i\n");
     exit(1);
   }
+  din = dinode(inum);
+  bzero(din, sizeof(*din));
+  din->type = xshort(type);
+  din->nlink = xshort(1);
+  din->size = xint(0);
+  return inum;
 }
 
 void
-winode(uint inum, struct dinode *ip)
-{
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
-  wsect(bn, buf);
-}
-
-void
-rinode(uint inum, struct dinode *ip)
+balloc(int used)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
-}
+  uchar *buf;
+  int i, b;
 
-void
-rsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
-    exit(1);
+  printf("balloc: first %d blocks have been allocated\n", used);
+  assert(used < nbitmap*BPB);
+  for(b = 0; b*BPB < used; b++){
+    buf = (uchar*)blk(xint(sb.bmapstart)+b);
+    for(i = 0; i < BPB && b*BPB + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", xint(sb.bmapstart)+b);
   }
 }
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Return entry n of the indirect block ind, setting it to
+// b if it is unset (or to a new block, if b is 0).
 uint
-ialloc(ushort type)
+indirect(uint ind, uint n, uint b)
 {
-  uint inum = freeinode++;
-  struct dinode din;
+  uint *a;
 
-  bzero(&din, sizeof(din));
-  din.type = xshort(type);
-  din.nlink = xshort(1);
-  din.size = xint(0);
-  winode(inum, &din);
-  return inum;
+  a = (uint*)blk(ind);
+  if(a[n] == 0)
+    a[n] = xint(b ? b : newblock());
+  return xint(a[n]);
 }
 
-void
-balloc(int used)
+// Return the block holding byte fbn*BSIZE of din, setting it
+// to b if there is none yet (or to a new block, if b is 0).
+uint
+bmap(struct dinode *din, uint fbn, uint b)
 {
-  uchar buf[BSIZE];
-  int i;
+  uint x;
 
-  printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0)
+      din->addrs[fbn] = xint(b ? b : newblock());
+    return xint(din->addrs[fbn]);
+  }
+  if(fbn < NDIRECT + NINDIRECT){
+    if(xint(din->addrs[NDIRECT]) == 0)
+      din->addrs[NDIRECT] = xint(newblock());
+    return indirect(xint(din->addrs[NDIRECT]), fbn - NDIRECT, b);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  if(xint(din->addrs[NDIRECT+1]) == 0)
+    din->addrs[NDIRECT+1] = xint(newblock());
+  x = fbn - NDIRECT - NINDIRECT;
+  return indirect(indirect(xint(din->addrs[NDIRECT+1]), x / NINDIRECT, 0), x % NINDIRECT, b);
 }
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
-
+// Append n bytes at p to inode inum, a block at a time.
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
-  struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
+  struct dinode *din;
+  char buf[INLINESIZE];
   uint x;
 
-  rinode(inum, &din);
-  off = xint(din.size);
+  din = dinode(inum);
+  off = xint(din->size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  if(off + n <= INLINESIZE){
+    // small enough to live in the inode, see INLINESIZE
+    bcopy(p, (char*)din->addrs + off, n);
+    din->size = xint(off + n);
+    return;
+  }
+  if(off > 0 && off <= INLINESIZE){
+    // outgrowing the inode: move what is inline to a block first
+    bcopy(din->addrs, buf, off);
+    bzero(din->addrs, sizeof(din->addrs));
+    x = newblock();
+    din->addrs[0] = xint(x);
+    bcopy(buf, blk(x), off);
+  }
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(din, fbn, 0);
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    bcopy(p, blk(x) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
   }
-  din.size = xint(off);
-  winode(inum, &din);
+  din->size = xint(off);
+}
+
+// Give the empty inode inum the n bytes at p, in consecutive blocks.
+void
+ifill(uint inum, char *p, uint n)
+{
+  struct dinode *din;
+  uint first, nb, fbn;
+
+  din = dinode(inum);
+  assert(xint(din->size) == 0);
+  if(n <= INLINESIZE){
+    bcopy(p, din->addrs, n);
+    din->size = xint(n);
+    return;
+  }
+  nb = (n + BSIZE - 1) / BSIZE;
+  if(nb > MAXFILE || nb > fssize - freeblock){
+    fprintf(stderr, "mkfs: no room for a %u byte file\n", n);
+    exit(1);
+  }
+  first = freeblock;
+  freeblock += nb;
+  memmove(blk(first), p, n);
+  for(fbn = 0; fbn < nb; fbn++)
+    bmap(din, fbn, first + fbn);
+  din->size = xint(n);
+}
+
+// Round up the size of directory inum, as the kernel expects of a
+// directory that has outgrown its inode.
+void
+dirdone(uint inum)
+{
+  struct dinode *din;
+  uint off;
+
+  din = dinode(inum);
+  off = xint(din->size);
+  if(off > INLINESIZE){
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din->size = xint(off);
+  }
+}
+
+// Add the host file or directory at path to directory dir as name,
+// and for a directory everything in it.
+void
+import(uint dir, char *path, char *name)
+{
+  char *p, *sub;
+  struct dirent de;
+  struct dinode *din;
+  hostdirent *e;
+  hoststat st;
+  uint inum;
+  DIR *d;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    perror(path);
+    exit(1);
+  }
+
+  // Skip leading _ in name when writing to file system.
+  // The binaries are named _rm, _cat, etc. to keep the
+  // build operating system from trying to execute them
+  // in place of system binaries like rm and cat.
+  if(name[0] == '_')
+    name += 1;
+  assert(index(name, '/') == 0);
+
+  inum = ialloc(S_ISDIR(st.st_mode) ? T_DIR : T_FILE);
+  bzero(&de, sizeof(de));
+  de.inum = xshort(inum);
+  strncpy(de.name, name, DIRSIZ);
+  iappend(dir, &de, sizeof(de));
+
+  if(S_ISDIR(st.st_mode)){
+    bzero(&de, sizeof(de));
+    de.inum = xshort(inum);
+    strcpy(de.name, ".");
+    iappend(inum, &de, sizeof(de));
+    de.inum = xshort(dir);
+    strcpy(de.name, "..");
+    iappend(inum, &de, sizeof(de));
+    din = dinode(dir);
+    din->nlink = xshort(xshort(din->nlink) + 1);
+
+    if((d = fdopendir(fd)) == 0){
+      perror(path);
+      exit(1);
+    }
+    while((e = readdir(d)) != 0){
+      if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+        continue;
+      if((sub = malloc(strlen(path) + strlen(e->d_name) + 2)) == 0){
+        perror("malloc");
+        exit(1);
+      }
+      sprintf(sub, "%s/%s", path, e->d_name);
+      import(inum, sub, e->d_name);
+      free(sub);
+    }
+    closedir(d);
+    dirdone(inum);
+    return;
+  }
+
+  if(st.st_size > 0){
+    p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED){
+      perror(path);
+      exit(1);
+    }
+    ifill(inum, p, st.st_size);
+    munmap(p, st.st_size);
+  }
+  close(fd);
 }
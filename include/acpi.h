@@ -0,0 +1,71 @@
+// See the ACPI specification, 5.2: the tables mpinit() reads the processors
+// and the I/O APIC from, when the firmware has them (see mp.c).
+
+struct acpirsdp {       // root system description pointer
+  uchar signature[8];           // "RSD PTR "
+  uchar checksum;               // first 20 bytes add up to 0
+  uchar oemid[6];
+  uchar revision;               // 0 for ACPI 1.0, 2 for 2.0 and later
+  uint rsdt;                    // phys addr of the RSDT
+  // ACPI 2.0 and later only
+  uint length;
+  uint64 xsdt;                  // phys addr of the XSDT
+  uchar xchecksum;              // all length bytes add up to 0
+  uchar reserved[3];
+} __attribute__((packed));
+
+struct acpihdr {        // header every system description table starts with
+  uchar signature[4];           // "RSDT", "XSDT", "APIC", ...
+  uint length;                  // of the whole table, this header included
+  uchar revision;
+  uchar checksum;               // all length bytes add up to 0
+  uchar oemid[6];
+  uchar oemtableid[8];
+  uint oemrevision;
+  uint creatorid;
+  uint creatorrevision;
+} __attribute__((packed));
+
+// The RSDT is the header followed by 32-bit phys addrs of the other tables,
+// the XSDT the same with 64-bit ones.
+
+struct acpimadt {       // multiple APIC description table, "APIC"
+  struct acpihdr hdr;
+  uint lapicaddr;               // phys addr of the local APICs
+  uint flags;
+    #define MADT_PCAT 0x01        // there are 8259 PICs too
+  // entries follow, each starting with type and length
+} __attribute__((packed));
+
+struct madtlapic {      // MADT_LAPIC: one per processor
+  uchar type;
+  uchar length;                 // 8
+  uchar acpiid;                 // processor's ACPI id
+  uchar apicid;                 // local APIC id
+  uint flags;
+    #define MADT_ENABLED 0x01     // usable
+    #define MADT_ONLINE  0x02     // not enabled, but could be brought online
+} __attribute__((packed));
+
+struct madtioapic {     // MADT_IOAPIC: one per I/O APIC
+  uchar type;
+  uchar length;                 // 12
+  uchar apicid;                 // I/O APIC id
+  uchar reserved;
+  uint addr;                    // phys addr of its registers
+  uint gsibase;                 // first global system interrupt it handles
+} __attribute__((packed));
+
+struct madtlapicaddr {  // MADT_LAPICADDR: overrides madt->lapicaddr
+  uchar type;
+  uchar length;                 // 12
+  ushort reserved;
+  uint64 addr;
+} __attribute__((packed));
+
+// MADT entry types
+#define MADT_LAPIC     0x00
+#define MADT_IOAPIC    0x01
+#define MADT_ISO       0x02  // interrupt source override, see ioapic.c
+#define MADT_LAPICADDR 0x05
+#define MADT_X2APIC    0x09  // processor with a 32-bit x2APIC id
@@ -15,7 +15,7 @@
 
 // Hard drives are usually physically divided into sectors, traditionally of 512 bytes
 // OS can collect these into larger blocks, which are multiples of the sector size
-// xv6 uses 512-byte blocks for simplicity
+// xv6 uses 512-byte blocks for simplicity, or 4KB ones built with make BSIZE=4096
 // block 0 usually contains the boot sector, so it's not used by xv6
 // xv6 actually stores the boot loader and kernel code on an entirely separate physical disk
 // block 1 is called the superblock - it contains metadata about the file system (total size, log size, number of files, their locations)
@@ -30,11 +30,13 @@ struct buf {
   uint blockno;
   struct sleeplock lock; // protect buffer
   uint refcnt; // processes using this buffer
-  struct buf *prev; // buffer LRU cache doubly-linked list of buffers
+  struct buf *prev; // buffer cache hash bucket doubly-linked LRU list of buffers
   struct buf *next;
   struct buf *qnext; // disk driver singly-linked queue of buffers waiting to be read/written
-  uchar data[BSIZE];
+  uchar *data; // BSIZE bytes, kept apart so a buffer's header doesn't make it span pages
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read in progress that nobody waits for, released by ideintr()
+#define B_PRIVATE 0x10  // not in the cache: a copy log.c writes with bwritev()
 
@@ -2,19 +2,39 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct irqstat;
+struct logstat;
+struct pcifunc;
 struct pipe;
+struct pkt;
+struct polltab;
 struct proc;
+struct procinfo;
+struct profsample;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct slabcache;
+struct sock;
+struct sockaddr_in;
 struct stat;
 struct superblock;
+struct traceev;
+struct trapframe;
+struct trapstat;
+struct vmstat;
 
 // bio.c
 void            binit(void);
+void            bgrow(uint);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            breadahead(uint, uint);
+void            brelseasync(struct buf*);
+void            bcachestat(struct vmstat*);
 
 // console.c
 void            consoleinit(void);
@@ -22,6 +42,9 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// devstat.c
+void            statinit(void);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -33,6 +56,20 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filepoll(struct file*, int, struct polltab*);
+
+// framebuffer.c
+extern int      fbcons;
+void            fbinit(void);
+void            fbflush(void);
+void            fbputc(int);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint, uint);
+int             futexwake(uint, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -41,9 +78,12 @@ struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
+void            dcacheforget(struct inode*, char*);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -57,15 +97,37 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idestat(struct vmstat*);
+
+// virtio.c
+extern int      virtioirq;
+void            virtioinit(void);
+void            virtiointr(void);
+void            virtiorw(struct buf*);
+void            virtiostat(struct vmstat*);
+
+// e1000.c
+extern int      e1000irq;
+void            e1000init(void);
+void            e1000intr(void);
+int             e1000tx(struct pkt*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+int             irqroute(int, int);
+int             irqcpu(int);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kzalloc(void);
+int             kzerofill(void);
 void            kfree(char*);
+void            kincref(char*);
+int             krefcount(char*);
+int             kfreecount(void);
+void            kmemstat(struct vmstat*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -78,7 +140,11 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
-void            lapicstartap(uchar, uint);
+void            lapicstartaps(uint);
+void            lapicipi(uchar, int);
+uint64          cyc2ns(uint64);
+uint64          nsecs(void);
+void            lapiconeshot(uint64);
 void            microdelay(int);
 
 // log.c
@@ -86,49 +152,126 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            begin_opn(int);
+void            end_opn(int);
+int             logopmax(void);
+void            logstat(struct logstat*);
+void            logtick(void);
+uint            loggen(void);
+void            logwait(uint);
+
+// mmap.c
+uint            mmap(struct file*, uint, uint, int, int);
+int             munmap(uint, uint);
+int             invma(struct proc*, uint);
+int             vmarange(struct proc*, uint, uint);
+int             vmafault(struct proc*, uint);
+uint            mmapbase(struct proc*);
+int             mmapcopy(struct proc*, struct proc*);
+void            mmapexit(struct proc*);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// net.c
+void            netinit(void);
+void            netattach(uchar*);
+struct pkt*     pktalloc(void);
+void            pktfree(struct pkt*);
+char*           pktpush(struct pkt*, uint);
+char*           pktpull(struct pkt*, uint);
+int             nettx(struct pkt*);
+void            netrx(struct pkt*);
+void            netstat(struct vmstat*);
+int             udptx(struct pkt*, ushort, uint, ushort);
+
+// pci.c
+uint            pciread(struct pcifunc*, int);
+void            pciwrite(struct pcifunc*, int, uint);
+int             pcifind(int, int, int, int, struct pcifunc*);
+void            pcienable(struct pcifunc*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+void            pcacheforget(struct inode*);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+int             pipeempty(struct pipe*);
+void            pipeinit(void);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipepoll(struct pipe*, int, int, struct polltab*);
+
+// prof.c
+int             profile(int, struct profsample*, int);
+void            profsample(struct trapframe*);
+
+// trace.c
+void            tracerec(int, uint, uint);
+int             tracectl(int, struct traceev*, int);
 
 //PAGEBREAK: 16
 // proc.c
+int             clone(uint, uint, uint, uint);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             join(void**);
 int             growproc(int);
 int             kill(int);
+struct cpu*     lapiccpu(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+struct proc*    kthread(char*, void (*)(void));
+int             sleepns(uint64);
+int             timerintr(void);
 void            pinit(void);
+void            pollbegin(struct polltab*);
+void            pollwait(struct polltab*, void*, int*);
+void            pollend(struct polltab*, int, uint64);
 void            procdump(void);
+int             procinfo(struct procinfo*, int);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+int             setsched(int, int, int);
+int             setaffinity(int, uint*);
 void            sleep(void*, struct spinlock*);
+void            sleepexcl(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// sock.c
+void            sockinit(void);
+int             sockalloc(struct file**);
+int             sockbind(struct sock*, ushort);
+void            sockclose(struct sock*);
+int             sockdeliver(struct pkt*, ushort);
+int             socksend(struct sock*, char*, int, uint, ushort);
+int             sockrecvn(struct sock*, struct pkt**, int);
+int             sockread(struct sock*, char*, int, struct sockaddr_in*);
+int             sockpoll(struct sock*, int, struct polltab*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(void);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -136,9 +279,16 @@ void            popcli(void);
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// slab.c
+void            slabinit(struct slabcache*, char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -151,16 +301,21 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             fetchptr(uint, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
 void            syscall(void);
 
 // timer.c
 void            timerinit(void);
 
 // trap.c
+void            sysenterinit(void);
 void            idtinit(void);
+void            latcount(int, int, uint64);
+int             trapstat(struct trapstat*);
+int             irqstat(struct irqstat*);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -169,22 +324,46 @@ extern struct spinlock tickslock;
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartputcsync(int);
+void            uartwrite(char*, int);
+
+// usercopy.S
+int             ucopy(void*, const void*, uint);
+int             ucopystr(char*, const char*, uint);
 
 // vm.c
 void            seginit(void);
+void            bootseginit(void);
 void            kvmalloc(void);
+char*           kvmmapfb(uint, uint);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+int             intext(struct proc*, uint);
+int             textfault(struct proc*, uint);
+int             prefault(struct proc*, uint, uint, int);
+uint*           walkpgdir(pde_t*, const void*, int); // returns a pte_t*
+int             mappages(pde_t*, void*, uint, uint, int);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             uvmshare(pde_t*, pde_t*, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             cowfault(pde_t*, uint);
+int             lazyfault(pde_t*, uint, uint);
+int             uvmmapped(pde_t*, uint, uint);
+void            uvmlock(pde_t*);
+void            uvmunlock(pde_t*);
+void            uvmflush(pde_t*, uint, uint, int);
+void            tlbintr(void);
+void            uvmdetach(pde_t*, uint, uint);
+void            uvmreap(pde_t*, uint, uint);
+void            uvmunmap(pde_t*, uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -1,9 +1,10 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_SOCK } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
+  struct sock *sock;
   struct inode *ip;
   uint off;
 };
@@ -14,6 +15,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // Next on the hash chain, or the free list if ref == 0
+  struct inode **pprev; // The pointer to this inode on its hash chain
+  struct inode *lnext; // Idle (ref == 0 but valid) inodes, least recently used first
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,16 +27,24 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint raoff;         // offset a sequential reader would read next
+  uint rablock;       // next file block not yet read ahead
+  uint gen;           // log batch holding the latest change, for fsync
+  uint lastblock;     // block balloc() last gave this inode, where it continues
+  int pcached;        // the page cache may hold pages of it
 };
 
 // table mapping major device number to
 // device functions
 struct devsw {
-  int (*read)(struct inode*, char*, int);
+  int (*read)(struct inode*, char*, uint, int); // with the file offset
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*, int, struct polltab*); // as pipepoll(); 0 if never blocks
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define DEVSTAT 2
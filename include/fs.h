@@ -3,7 +3,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 512  // block size, a multiple of the sector size up to a page; see the Makefile
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks | free bit map | data blocks]
@@ -20,9 +22,10 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -31,9 +34,14 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses, then indirect and double-indirect blocks
 };
 
+// A file of at most INLINESIZE bytes keeps its data in addrs[] instead
+// of in blocks, so reading it takes no block beyond the inode's own.
+// Files only grow (until freed), so the size alone says which it is.
+#define INLINESIZE ((NDIRECT+2) * sizeof(uint))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -0,0 +1,8 @@
+// Interrupt counts and routing, as returned by the irqstat() system call.
+// Counts are since boot, by cpu and by IRQ number (vector - T_IRQ0,
+// the inter-processor ones included).
+struct irqstat {
+  int ncpu;
+  int cpu[NIRQ];              // cpu the I/O APIC sends input i to, -1 if disabled
+  uint count[NCPU][NIRQ];
+};
@@ -0,0 +1,12 @@
+// File system log counters, as returned by the logstat() system call.
+// All counts are since boot.
+struct logstat {
+  uint ops;         // FS ops started (begin_op())
+  uint opwaits;     // begin_op() calls that had to wait for a commit or log space
+  uint writes;      // log_write() calls
+  uint absorbed;    // log_write() calls for a block already in the transaction
+  uint commits;     // transactions committed
+  uint logged;      // blocks written to the log by those commits
+  uint maxcommit;   // most blocks in a single commit
+  uint commitkcyc;  // TSC cycles spent in commit(), in units of 1024
+};
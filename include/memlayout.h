@@ -1,6 +1,7 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
+#define BOOTMAP 0x1000000           // Memory entrypgdir maps, 4 superpages: the kernel must fit in it
 #define PHYSTOP 0xE000000           // Top physical memory
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
 // local APIC mapped at 0xFEE00xxx (each core can only access its own)
@@ -0,0 +1,11 @@
+// Memory mappings, for mmap().
+#define PROT_NONE      0x0   // reserve the range; any access faults
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define PROT_EXEC      0x4   // x86 can't forbid executing readable memory, so this changes nothing
+
+#define MAP_SHARED     0x01  // writes go to the file, and are seen by fork()ed children
+#define MAP_PRIVATE    0x02  // writes make a private copy of the page
+#define MAP_ANONYMOUS  0x20  // zero-filled memory, no file (fd is ignored)
+
+#define MAP_FAILED     ((void*)-1)
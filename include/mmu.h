@@ -2,6 +2,7 @@
 // x86 memory management unit (MMU).
 
 // Eflags register
+#define FL_TF           0x00000100      // Trap Flag
 #define FL_IF           0x00000200      // Interrupt Enable
 
 // Control Register flags
@@ -10,16 +11,25 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
+
+// Model specific registers for sysenter (see sysenterinit())
+#define MSR_SYSENTER_CS  0x174          // kernel %cs; %ss and the user segments follow it
+#define MSR_SYSENTER_ESP 0x175          // kernel stack
+#define MSR_SYSENTER_EIP 0x176          // entry point
 
 // various segment selectors.
+// sysenter and sysexit take the kernel data and both user segments to
+// come right after SEG_KCODE, in this order.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_KCPU  6  // kernel %gs: this cpu's struct cpu, see mycpu()
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor. GDTR points to an array of these.
@@ -91,6 +101,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SUPERPGSIZE     (PGSIZE*NPTENTRIES) // bytes mapped by a 4MB page (PTE_PS in a pde)
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -102,7 +113,12 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_PWT         0x008   // Write-Through (with PAT: selects PAT entry 1)
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global: lcr3() leaves it in the TLB (with CR4_PGE)
+#define PTE_SHARED      0x400   // Shared mapping, fork() doesn't make it copy-on-write (software bit)
+#define PTE_COW         0x800   // Copy-on-write (one of the bits available to software)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
@@ -0,0 +1,80 @@
+// Packet buffers, passed between the network driver (e1000.c) and
+// the protocols (net.c) without copying.
+// A packet is a page from kalloc(): this header at the start, then the
+// frame. The card receives straight into the page at PKTHEAD, and the
+// protocols pull their headers off the front (see pktpull()). Going out,
+// they fill in the payload at PKTHEAD and push headers in front of it
+// (pktpush()) into the room left there, and the card sends from the page.
+
+#define PKTHEAD   128   // offset of the frame in a fresh packet's page
+#define PKTRXSIZE 2048  // most the card writes into a receive buffer
+
+struct pkt {
+  struct pkt *next;     // in a queue of packets
+  char *data;           // first byte of the frame (or of what is left of it)
+  uint len;             // bytes from data on
+  uint faddr;           // a received datagram's sender, in host byte order
+  ushort fport;
+};
+
+// The headers are in network byte order; these swap to and from it.
+#define htons(x) ((ushort)(((x) & 0xFF) << 8 | ((x) >> 8 & 0xFF)))
+#define ntohs(x) htons(x)
+#define htonl(x) ((uint)(x) << 24 | ((uint)(x) & 0xFF00) << 8 | \
+                  ((uint)(x) >> 8 & 0xFF00) | (uint)(x) >> 24)
+#define ntohl(x) htonl(x)
+
+#define ETHADDRLEN 6
+
+// Ethernet frame header
+struct eth {
+  uchar dst[ETHADDRLEN];
+  uchar src[ETHADDRLEN];
+  ushort type;
+} __attribute__((packed));
+#define ETH_IP    0x0800
+#define ETH_ARP   0x0806
+
+// ARP packet, for IPv4 over ethernet
+struct arp {
+  ushort hrd;           // ARP_ETHER
+  ushort pro;           // ETH_IP
+  uchar hln;            // ETHADDRLEN
+  uchar pln;            // 4
+  ushort op;
+  uchar sha[ETHADDRLEN]; // sender
+  uint sip;
+  uchar tha[ETHADDRLEN]; // target
+  uint tip;
+} __attribute__((packed));
+#define ARP_ETHER   1
+#define ARP_REQUEST 1
+#define ARP_REPLY   2
+
+// IPv4 header, without options
+struct ip {
+  uchar vhl;            // version << 4 | header length in words
+  uchar tos;
+  ushort len;           // of the whole datagram
+  ushort id;
+  ushort off;           // flags and fragment offset
+  uchar ttl;
+  uchar proto;
+  ushort sum;
+  uint src;
+  uint dst;
+} __attribute__((packed));
+#define IP_MF      0x2000  // more fragments
+#define IP_OFFMASK 0x1FFF
+#define IP_UDP     17
+
+// UDP header
+struct udp {
+  ushort sport;
+  ushort dport;
+  ushort len;           // header and payload
+  ushort sum;           // 0: none
+} __attribute__((packed));
+
+// Largest UDP payload that fits an ethernet frame unfragmented
+#define UDPMAX (1500 - sizeof(struct ip) - sizeof(struct udp))
@@ -1,14 +1,44 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // processes in the static process table, see pgrow()
+#define NPROCMAX   4096  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
-#define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NCPU         64  // maximum number of CPUs
+#define NCPUWORDS ((NCPU+31)/32)  // uints in a cpu mask, a bit per CPU (see setaffinity())
+#define CACHELINE    64  // bytes; per-cpu data and hot locks get lines of their own
+#define NOFILE       16  // open files per process, until its table outgrows them
+#define NOFILEMAX  1024  // most open files per process: a page of pointers
+#define NINODE       50  // active i-nodes in the static inode cache, see iget()
+#define NIHASH      257  // inode cache hash buckets (prime)
+#define NIIDLE      200  // unreferenced inodes the inode cache keeps valid, see iput()
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // longest path a system call takes, nul included
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      126  // max data blocks in on-disk log (as many as the header block can list)
+#define NBUF          64  // disk block cache buffers available at boot, see bgrow()
+#define NREADAHEAD     8  // blocks read ahead of a sequential reader
+#define NSEG           2  // program segments exec() can leave to be paged in from the file
+#define NVMA          16  // memory mappings per process, see mmap()
+#define BALLOCWIN      8  // blocks balloc() leaves after a new file extent for it to grow into
+#define NBUCKET     1031  // buffer cache hash buckets (prime, to spread blocknos)
+#define BCHAIN         4  // most buffers per hash bucket, on average
+#define BCACHEFRAC     8  // most of free memory (1/BCACHEFRAC) the buffer cache grows to
+#define LAZYSBRK      1  // sbrk() grows the heap without allocating; pages are zeroed on first touch
+#define GROUPCOMMIT   1  // commit the log from a kernel thread, in batches
+#define COMMITTICKS   3  // longest a finished FS op waits for its batch to commit
+#define TICKNS  10000000  // length of a scheduler tick, in nanoseconds
+#define FBWIDTH    1024  // framebuffer mode entry.S asks a multiboot boot loader for
+#define FBHEIGHT    768
+#define IDEDMA        1  // use bus-master DMA when the IDE controller supports it
+#define IDEMERGE     32  // most adjacent blocks the IDE driver transfers in one command
+#define DEFERMEM      1  // kinit2() hands memory to the allocator as it is used, not all at boot
+#define ZEROPAGES   128  // free pages the idle loop keeps zeroed for kzalloc()
+#define PIPEPAGES     4  // pages of buffer per pipe
+#define NWAITQ       61  // sleep channel hash buckets (prime, to spread addresses)
+#define NPIDHASH     64  // process table hash buckets, by pid
+#define QBATCH       10  // time slice of a SCHED_BATCH process, in ticks
+#define BATCHSHARE    4  // a waiting batch process runs at least every BATCHSHARE picks
+#define MIGRATENS 500000  // an idle cpu doesn't steal a process that ran less than this long ago
+#define SLEEPSPIN  20000  // most TSC cycles acquiresleep() spins on a running holder before sleeping
+#define FSSIZE       1000  // default size of file system in blocks, see mkfs -s
 
@@ -0,0 +1,24 @@
+// PCI configuration space, reached through the legacy x86 mechanism:
+// write the address of a config register to CONFIG_ADDRESS (0xCF8),
+// then read or write its value at CONFIG_DATA (0xCFC).
+
+#define PCI_ANY        -1     // matches any vendor, device or class in pcifind()
+
+// standard config space header registers (byte offsets)
+#define PCI_ID         0x00   // device id << 16 | vendor id
+#define PCI_COMMAND    0x04   // status << 16 | command
+  #define PCI_CMD_IO     0x1    // respond to I/O space accesses
+  #define PCI_CMD_MEM    0x2    // respond to memory space accesses
+  #define PCI_CMD_MASTER 0x4    // may act as bus master (DMA)
+#define PCI_CLASS      0x08   // class << 24 | subclass << 16 | prog if << 8 | revision
+#define PCI_BAR0       0x10   // the six base address registers follow
+#define PCI_INTR       0x3C   // interrupt pin << 8 | interrupt line
+
+// One function of a device found on the bus.
+struct pcifunc {
+  int bus, dev, func;
+  ushort vendor, device;
+  uchar class, subclass, progif;
+  uint bar[6];        // base address registers as read, flag bits included
+  uchar irq;          // interrupt line the BIOS assigned
+};
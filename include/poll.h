@@ -0,0 +1,15 @@
+// poll(): wait for any of several file descriptors to be ready.
+
+struct pollfd {
+  int fd;
+  short events;       // what to wait for
+  short revents;      // what is ready, set by poll()
+};
+
+#define POLLIN    0x01  // read won't block
+#define POLLOUT   0x04  // write won't block
+#define POLLERR   0x08  // write will fail: nobody reads the other end (always reported)
+#define POLLHUP   0x10  // the other end is closed (always reported)
+#define POLLNVAL  0x20  // fd isn't open (always reported)
+
+#define NPOLLFD   64    // most fds one poll() looks at
@@ -6,7 +6,10 @@
 // Thus see 'started', 'proc' properties
 // The scheduler isn't itself a process - it uses the 'kpgdir' page directory and has its own context - we
 // store the context in 'scheduler' property
+// Each struct cpu is cache-line aligned, so that no two cpus write the
+// same line, and the kernel's %gs points at its cpu's (see seginit()).
 struct cpu {
+  struct cpu *self;            // This struct, at %gs:0
   uchar apicid;                // Local APIC ID (local interrupt controller)
   struct context *scheduler;   // kernel context at the top of scheduler stack
   struct taskstate ts;         // Used by x86 to find stack for interrupt (TSS)
@@ -15,7 +18,20 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
-};
+  volatile int idle;           // Halted in scheduler() with nothing to run (ptable.lock)
+  volatile int kick;           // A wakeup IPI is on its way; don't halt
+  pde_t *pgdir;                // Page table loaded in %cr3
+  volatile uint tlbflush;      // Another cpu changed that page table, see uvmflush()
+  uint tlbstart, tlbend;       // The range it changed
+  int sysenter;                // Has sysenter set up, see sysenterinit()
+  uint64 idlens;               // Nanoseconds spent halted in the idle loop
+  // Timer queue: min-heap on deadline of the processes that went to
+  // sleep on this cpu for a while, protected by ptable.lock.
+  struct proc *timerq[NPROCMAX];
+  int ntimer;
+  uint64 nexttick;             // When the next scheduler tick is due
+  uint64 armed;                // Deadline the lapic timer is set for, 0 if off
+} __attribute__((aligned(CACHELINE)));
 
 // mp.c
 extern struct cpu cpus[NCPU];
@@ -67,13 +83,65 @@ struct proc {
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *kids;           // Children (and threads) that haven't exited, linked by knext
+  struct proc *zombies;        // Those that have, for wait() and join() to reap
+  struct proc *knext;          // Next on its parent's kids or zombies list
+  struct proc **kprev;         // The pointer to this process on that list
+  struct proc *leader;         // Thread group leader: itself, or the process whose clone() made us
+  int threaded;                // Group has more than one thread, so shares ofile and vma (see clone())
+  struct file *argf;           // File argfd() holds a reference to for the current syscall, if threaded
+  void *ustack;                // User stack passed to clone(), handed back by join()
   struct trapframe *tf;        // Trap frame for interrupts or current syscall
   struct context *context;     // Process context at the top of its stack
   void *chan;                  // If non-zero, sleeping on chan
+  int excl;                    // Sleeping with sleepexcl(), so wakeup() wakes only one such
+  int pollwoken;               // A channel poll() waits on had a wakeup, see pollwait()
   int killed;                  // If non-zero, have been killed/should be killed soon
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files: ofile0, or a page once that is full
+  int nofile;                  // Size of ofile
+  struct file *ofile0[NOFILE];
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file, for pages of it not read in yet
+  struct execseg {             // Where those pages come from, see textfault()
+    uint va;                   // page aligned start in memory
+    uint off;                  // file offset of va
+    uint filesz;               // bytes from the file; the rest of the segment is zero
+    int perm;                  // PTE_COW if writable, else 0
+  } seg[NSEG];
+  int nseg;
+  struct vma {                 // Memory mappings, see mmap()
+    uint start;                // page aligned
+    uint end;                  // end of the range, 0 if the slot is free
+    int prot;                  // PROT_* in mman.h
+    int flags;                 // MAP_* in mman.h
+    struct file *f;            // Mapped file, 0 if anonymous
+    uint off;                  // file offset of start
+  } vma[NVMA];
   char name[16];               // Process name (debugging)
+  int cpu;                     // CPU whose run queue the process goes on when RUNNABLE
+  uint affinity[NCPUWORDS];    // CPUs it may run on, a bit each, see setaffinity()
+  struct proc *rqnext;         // Next process on that run queue
+  int class;                   // Scheduling class, SCHED_* in sched.h
+  int nice;                    // 0 to NICE_MAX, shortens the time slice
+  int slice;                   // Timer ticks left before the process must yield
+  uint64 deadline;             // When a timed sleep ends, see sleepns()
+  int tcpu;                    // CPU whose timer queue holds the process
+  int tidx;                    // Its place in that queue, -1 if not queued
+  struct proc *wnext;          // Next sleeper in the wait queue for chan's hash
+  struct proc **wprev;         // The pointer to this process in that queue
+  struct proc *pnext;          // Next in ptable's list of all process slots
+  struct proc *hnext;          // Next in ptable's hash chain for the pid
+  struct proc **hprev;         // The pointer to this process in that chain
+  struct proc *freenext;       // Next UNUSED slot, while this one is UNUSED
+  // resource use, reported by procinfo()
+  uint64 runcyc;               // TSC cycles spent running, up to oncpu
+  uint64 oncpu;                // TSC when it last started running
+  uint64 offcpu;               // TSC when it last stopped, to tell if its cache is warm
+  uint nvcsw;                  // times it gave up the cpu to sleep or exit
+  uint nivcsw;                 // times it was preempted, or yielded
+  uint nfault;                 // page faults
+  uint nbread;                 // disk blocks read
+  uint nbwrite;                // disk blocks written
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -81,3 +149,20 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+// and mmap() places mappings from KERNBASE down, above the heap.
+
+// A channel poll() waits on, queued for wakeup() to find (see proc.c).
+struct pollent {
+  void *chan;
+  struct proc *p;
+  int *count;                  // decremented when the entry goes, if not 0
+  struct pollent *next;
+  struct pollent **prev;
+};
+
+// The entries of one poll().
+struct polltab {
+  struct pollent *e;
+  int n;
+  int max;
+};
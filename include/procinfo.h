@@ -0,0 +1,19 @@
+// One process, as reported by the procinfo() system call.
+struct procinfo {
+  int pid;
+  int ppid;       // parent's pid, 0 if none
+  char state[8];  // e.g. "run", "sleep"
+  int class;      // scheduling class, SCHED_* in sched.h
+  int nice;
+  int cpu;        // CPU it last ran on, -1 if it hasn't yet
+  uint affinity[NCPUWORDS];  // CPUs it may run on, a bit each (bit i%32 of word i/32)
+  uint sz;        // size of user memory (bytes)
+  char name[16];
+  uint64 cycles;  // TSC cycles run
+  uint ms;        // the same in milliseconds
+  uint nvcsw;     // voluntary context switches: sleeps
+  uint nivcsw;    // involuntary ones: preemptions and yields
+  uint nfault;    // page faults
+  uint nbread;    // disk blocks read
+  uint nbwrite;   // disk blocks written
+};
@@ -0,0 +1,13 @@
+// Kernel profiler samples, for the profile() system call.
+#define PROF_STOP   0   // stop taking samples
+#define PROF_START  1   // forget the samples so far and start taking them
+#define PROF_READ   2   // copy out the samples taken, and forget them
+
+#define PROFDEPTH   4   // pcs per sample
+#define PROFSIZE 1024   // samples each cpu keeps; older ones are overwritten
+
+struct profsample {
+  int pid;                // process interrupted, 0 if none (the scheduler)
+  int user;               // interrupted in user mode: pc[0] is a user address
+  uint pc[PROFDEPTH];     // the interrupted eip, then its kernel callers, 0 after the last
+};
@@ -0,0 +1,35 @@
+// Submission and completion rings, for ringenter().
+// The process queues operations at sq[sqtail % RINGSIZE] and bumps sqtail;
+// ringenter() carries them out in order, advancing sqhead, and posts each
+// result at cq[cqtail % RINGSIZE], bumping cqtail, for the process to
+// take from cqhead on. All four counters only ever grow.
+
+#define RINGSIZE 64
+
+#define RING_READ   1  // read(fd, addr, n), or pread() at off unless off is -1
+#define RING_WRITE  2  // write(fd, addr, n), or pwrite() at off unless off is -1
+#define RING_OPEN   3  // open(addr, n)
+#define RING_CLOSE  4  // close(fd)
+
+struct ringsqe {
+  int op;
+  int fd;
+  char *addr;
+  int n;
+  int off;
+  uint data;           // returned in the completion
+};
+
+struct ringcqe {
+  uint data;
+  int res;             // what the system call would have returned
+};
+
+struct ring {
+  uint sqhead;         // advanced by the kernel
+  uint sqtail;         // advanced by the process
+  uint cqhead;         // advanced by the process
+  uint cqtail;         // advanced by the kernel
+  struct ringsqe sq[RINGSIZE];
+  struct ringcqe cq[RINGSIZE];
+};
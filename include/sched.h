@@ -0,0 +1,9 @@
+// Scheduling classes, for setsched().
+// Each CPU runs its interactive processes before its batch ones,
+// but batch processes get much longer time slices, so they switch
+// (and refill their caches) far less often.
+#define SCHED_INTERACTIVE 0  // one-tick slices, runs first; the default
+#define SCHED_BATCH       1  // QBATCH-tick slices, runs when no interactive process can
+#define NSCHED            2
+
+#define NICE_MAX 19          // nice runs from 0 (default) to NICE_MAX; nicer processes get shorter slices
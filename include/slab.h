@@ -0,0 +1,18 @@
+// Object caches for kernel structures smaller than a page, see slab.c.
+
+#define MAGSIZE 16   // free objects each cpu keeps on hand per cache
+
+struct slabobj;
+
+struct slabcache {
+  struct spinlock lock;    // protects free and the counts
+  char *name;
+  uint size;               // object size, a multiple of 8
+  struct slabobj *free;    // the depot: free objects no cpu has on hand
+  int nfree;
+  int npages;              // pages taken from kalloc(), never given back
+  struct magazine {        // a cpu's own free objects, used with interrupts off
+    void *obj[MAGSIZE];
+    int n;
+  } __attribute__((aligned(CACHELINE))) mag[NCPU];
+};
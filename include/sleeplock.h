@@ -19,11 +19,14 @@
 
 // Long-term locks for processes
 struct sleeplock {
-  uint locked;       // Is the lock held? Just like spin-locks
+  uint locked;       // Is the lock held (exclusively)? Just like spin-locks
+  int readers;       // Processes holding it shared
+  int wwait;         // Processes waiting to hold it exclusively
   struct spinlock lk; // spinlock protecting this sleep lock (i.e. protecting 'locked' field)
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // The same, for acquiresleep() to see whether it is running
 };
 
@@ -0,0 +1,24 @@
+// UDP sockets: socket(), bind(), sendto(), recvfrom() and recvmmsg(),
+// see sock.c.
+
+#define AF_INET     2
+#define SOCK_DGRAM  2
+
+// An IPv4 address and UDP port. Unlike BSD's, both are in host byte order.
+struct sockaddr_in {
+  ushort family;      // AF_INET
+  ushort port;
+  uint addr;
+};
+
+#define INADDR_ANY       0
+#define IPADDR(a, b, c, d) ((uint)(a)<<24 | (uint)(b)<<16 | (uint)(c)<<8 | (uint)(d))
+#define INADDR_LOOPBACK  IPADDR(127, 0, 0, 1)
+
+// One datagram for recvmmsg(): buf and len on the way in, from and
+// the datagram's length (at most len is copied) on the way out.
+struct mmsg {
+  char *buf;
+  int len;
+  struct sockaddr_in from;
+};
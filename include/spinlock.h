@@ -1,11 +1,25 @@
 // Mutual exclusion lock.
+// A ticket lock: each acquirer takes a ticket, and waits for its number to be served,
+// so CPUs get the lock in the order they asked for it, and the waiters only read
+// the lock while it is held (one cache line transfer per hand-off, not a storm of xchgs).
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Ticket the next acquirer gets
+  uint owner;        // Ticket being served; held while owner != next
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+  struct lockstat *stat; // Contention counters, shared by all locks of the same name
 };
 
+// Per lock name profile, shown by lockdump() (^L on the console).
+// Updated while holding the lock, so names used by many locks at
+// once (e.g. "pipe") may lose some counts.
+struct lockstat {
+  char *name;
+  uint nacquire;     // acquisitions
+  uint ncontended;   // acquisitions that had to wait
+  uint64 spin;       // cycles spent waiting
+};
@@ -20,3 +20,32 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fsync  22
+#define SYS_sync   23
+#define SYS_logstat 24
+#define SYS_setsched 25
+#define SYS_procinfo 26
+#define SYS_nanosleep 27
+#define SYS_mmap   28
+#define SYS_munmap 29
+#define SYS_clone  30
+#define SYS_join   31
+#define SYS_futexwait 32
+#define SYS_futexwake 33
+#define SYS_readv  34
+#define SYS_writev 35
+#define SYS_pread  36
+#define SYS_pwrite 37
+#define SYS_ringenter 38
+#define SYS_trapstat 39
+#define SYS_profile 40
+#define SYS_trace 41
+#define SYS_socket 42
+#define SYS_bind 43
+#define SYS_sendto 44
+#define SYS_recvfrom 45
+#define SYS_recvmmsg 46
+#define SYS_poll 47
+#define SYS_irqstat 48
+#define SYS_irqroute 49
+#define SYS_setaffinity 50
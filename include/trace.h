@@ -0,0 +1,26 @@
+// Kernel event trace records, for the trace() system call.
+#define TRACE_STOP   0   // stop recording events
+#define TRACE_START  1   // record events (the default from boot on)
+#define TRACE_CLEAR  2   // forget the events recorded so far
+#define TRACE_READ   3   // copy out the events recorded
+
+#define TRACESIZE 2048   // events each cpu keeps; older ones are overwritten
+
+// event types, and what arg[0] and arg[1] hold
+#define TR_SWITCH     1  // pid switched from, pid switched to (0: the scheduler)
+#define TR_SLEEP      2  // chan
+#define TR_WAKEUP     3  // chan, pid woken
+#define TR_BHIT       4  // dev, blockno: bget() found the block cached
+#define TR_BMISS      5  // dev, blockno: bget() recycled a buffer for it
+#define TR_DISKSTART  6  // blockno, 1 if a write: queued for the disk
+#define TR_DISKDONE   7  // blockno, 1 if a write: the disk finished it
+#define TR_COMMIT     8  // log batch, blocks: commit starts
+#define TR_COMMITDONE 9  // log batch, blocks: commit is on disk
+
+struct traceev {
+  uint64 ns;          // nsecs() when it happened
+  ushort type;        // TR_*
+  ushort cpu;
+  int pid;            // process running, 0 if none
+  uint arg[2];
+};
@@ -67,5 +67,10 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_TLB         29 // IPI sent by uvmflush() to cpus using a page table it changed
+#define IRQ_WAKE        30 // IPI sent by wakeup() to an idle, halted CPU
 #define IRQ_SPURIOUS    31 // 0xFF interrupt number for spurious interrupts
+#define NIRQ            32 // IRQ numbers, counted by each cpu
+
+#define IRQ_ANYCPU      -1 // ioapicenable(): whichever cpu has the fewest devices
 
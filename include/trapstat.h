@@ -0,0 +1,14 @@
+// Trap and system call latency histograms, as returned by the trapstat()
+// system call. Counts are since boot, summed over all cpus. Bin b counts
+// those that took from 2^(b+LATSHIFT) up to 2^(b+LATSHIFT+1) TSC cycles;
+// bin 0 also has the quicker ones, the last bin the slower ones.
+#define NLATBIN   24
+#define LATSHIFT   6
+#define NTRAPLAT  65   // trap numbers 0 to T_SYSCALL
+#define NSYSLAT   64   // system call numbers
+
+struct trapstat {
+  uint cycns;                   // nanoseconds per 1024 TSC cycles
+  uint trap[NTRAPLAT][NLATBIN]; // by trap number, system calls included
+  uint sys[NSYSLAT][NLATBIN];   // by system call number
+};
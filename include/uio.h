@@ -0,0 +1,7 @@
+// Vectored I/O, for readv() and writev().
+struct iovec {
+  void *base;
+  uint len;
+};
+
+#define IOV_MAX 16   // most buffers one call takes
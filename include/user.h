@@ -1,9 +1,22 @@
 struct stat;
 struct rtcdate;
+struct logstat;
+struct trapstat;
+struct profsample;
+struct traceev;
+struct procinfo;
+struct iovec;
+struct ring;
+struct sockaddr_in;
+struct mmsg;
+struct pollfd;
+struct irqstat;
 
 // system calls
 int fork(void);
 int exit(void) __attribute__((noreturn));
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
 int wait(void);
 int pipe(int*);
 int write(int, const void*, int);
@@ -23,17 +36,75 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fsync(int);
+int sync(void);
+int logstat(struct logstat*);
+int setsched(int, int, int);
+int setaffinity(int, uint*);
+int procinfo(struct procinfo*, int);
+int nanosleep(int, int);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int clone(void(*)(void*), void*, void*, uint);
+int join(void**);
+int futexwait(volatile uint*, uint);
+int futexwake(volatile uint*, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int ringenter(struct ring*, int);
+int trapstat(struct trapstat*);
+int profile(int, struct profsample*, int);
+int trace(int, struct traceev*, int);
+int socket(int, int, int);
+int bind(int, struct sockaddr_in*);
+int sendto(int, const void*, int, struct sockaddr_in*);
+int recvfrom(int, void*, int, struct sockaddr_in*);
+int recvmmsg(int, struct mmsg*, int);
+int poll(struct pollfd*, int, int);
+int irqstat(struct irqstat*);
+int irqroute(int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
+void* memchr(const void*, int, uint);
 int strcmp(const char*, const char*);
 void printf(int, const char*, ...);
+void fflush(int);
+void fflushall(void);
 char* gets(char*, int max);
+char* fgets(int, char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
+void* memcpy(void*, const void*, uint);
+int memcmp(const void*, const void*, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+
+// thread.c
+typedef struct {
+  volatile uint locked;
+} lock_t;
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
+typedef struct {
+  volatile uint locked;
+} mutex_t;
+typedef struct {
+  volatile uint seq;
+} cond_t;
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
+int thread_create(void (*)(void*), void*);
+int thread_join(void);
@@ -0,0 +1,15 @@
+// System-wide counters rendered by the stat device (see devstat.c).
+// Gauges are as of now, counts since boot.
+struct vmstat {
+  uint pgfree;      // free physical pages
+  uint pgzeroed;    // of those, zeroed ahead for kzalloc()
+  uint nbuf;        // buffer cache size
+  uint bhits;       // bget() found the block cached
+  uint bmisses;     // bget() recycled a buffer for it
+  uint dreads;      // blocks read from disk
+  uint dwrites;     // blocks written to disk
+  uint dqueue;      // disk requests queued or in progress
+  uint netrx;       // packets received
+  uint nettx;       // packets sent
+  uint netdrop;     // packets dropped, either way
+};
@@ -9,6 +9,24 @@ inb(ushort port)
   return data;
 }
 
+static inline ushort
+inw(ushort port)
+{
+  ushort data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -23,6 +41,50 @@ insl(int port, void *addr, int cnt)
                "memory", "cc");
 }
 
+// read the time-stamp counter, which counts CPU cycles since reset
+static inline uint64
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+// what cpuid says for leaf (subleaf 0)
+static inline void
+rcpuid(uint leaf, uint *a, uint *b, uint *c, uint *d)
+{
+  asm volatile("cpuid" : "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) : "a" (leaf), "c" (0));
+}
+
+// read and write model-specific register msr
+static inline uint64
+rdmsr(uint msr)
+{
+  uint lo, hi;
+
+  asm volatile("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+  return ((uint64)hi << 32) | lo;
+}
+
+static inline void
+wrmsr(uint msr, uint64 v)
+{
+  asm volatile("wrmsr" : : "c" (msr), "a" ((uint)v), "d" ((uint)(v >> 32)));
+}
+
+// Divide a 64-bit n by d where the quotient fits in 32 bits
+// (n>>32 < d); gcc would call into libgcc for a plain uint64 '/'.
+static inline uint
+divl(uint64 n, uint d)
+{
+  uint q, r;
+
+  asm volatile("divl %4" : "=a" (q), "=d" (r) : "a" ((uint)n), "d" ((uint)(n >> 32)), "rm" (d));
+  return q;
+}
+
 static inline void
 outb(ushort port, uchar data)
 {
@@ -35,6 +97,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -63,6 +131,45 @@ stosl(void *addr, int data, int cnt)
                "memory", "cc");
 }
 
+// Copy cnt bytes (movsb) or longs (movsl) upward from src to dst.
+static inline void
+movsb(void *dst, const void *src, int cnt)
+{
+  asm volatile("cld; rep movsb" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
+static inline void
+movsl(void *dst, const void *src, int cnt)
+{
+  asm volatile("cld; rep movsl" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
+// Copy downward, for overlapping moves to a higher address: dst and
+// src point at the last byte (movsbr) or long (movslr) to copy.
+static inline void
+movsbr(void *dst, const void *src, int cnt)
+{
+  asm volatile("std; rep movsb; cld" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
+static inline void
+movslr(void *dst, const void *src, int cnt)
+{
+  asm volatile("std; rep movsl; cld" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
 struct segdesc;
 
 static inline void
@@ -112,6 +219,15 @@ loadgs(ushort v)
   asm volatile("movw %0, %%gs" : : "r" (v));
 }
 
+// reads the word at %gs:0, see mycpu()
+static inline uint
+readgs0(void)
+{
+  uint v;
+  asm volatile("movl %%gs:0, %0" : "=r" (v));
+  return v;
+}
+
 // clear interrupt flag
 static inline void
 cli(void)
@@ -126,6 +242,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one. sti only takes effect
+// after the following instruction, so an interrupt that is already
+// pending wakes the hlt instead of slipping in before it.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 // atomic exchange operation
 static inline uint
 xchg(volatile uint *addr, uint newval)
@@ -141,6 +266,25 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add v to *addr, returning the old value.
+static inline uint
+xadd(volatile uint *addr, uint v)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (v), "+m" (*addr) :
+               :
+               "cc");
+  return v;
+}
+
+// Tell the CPU this is a spin loop: saves power, and avoids the
+// memory order violation (pipeline flush) on leaving the loop.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
 static inline uint
 rcr2(void)
 {
@@ -155,6 +299,35 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
+static inline uint
+rcr4(void)
+{
+  uint val;
+  asm volatile("movl %%cr4,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr4(uint val)
+{
+  asm volatile("movl %0,%%cr4" : : "r" (val));
+}
+
+// invalidate the TLB entry for a single virtual address
+static inline void
+invlpg(void *addr)
+{
+  asm volatile("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and trapasm.S, and passed to trap().
@@ -1,58 +1,217 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritev to write many buffers in one go.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// * breadahead starts reading a block that will be needed soon
+//     without waiting for it or keeping the buffer.
+//
+// The implementation uses three state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: nobody is waiting for the read in progress;
+//     the disk interrupt releases the buffer when it's done.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "trace.h"
+#include "vmstat.h"
 
-struct {
+// Buffers are hashed on (dev, blockno) into NBUCKET buckets.
+// Each bucket has its own lock and its own LRU list, so lookups
+// of different blocks don't contend and don't scan the whole cache.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  // Linked list of the bucket's buffers, through prev/next.
+  // mru is most recently used, lru least.
+  struct buf *mru;
+  struct buf *lru;
+} __attribute__((aligned(CACHELINE))); // neighbouring buckets' locks don't share a line
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  // serializes buffer recycling: a process moving a buffer from one
+  // bucket to another holds this lock and so is the only one ever
+  // holding two bucket locks at once, which rules out deadlock.
+  struct spinlock lock __attribute__((aligned(CACHELINE)));
+  struct buf buf[NBUF]; // enough to mount the file system, bgrow() adds the rest
+  uchar data[NBUF][BSIZE];
+  int nbuf;
+  struct bucket bucket[NBUCKET];
+  // counters for the stat device, updated atomically rather than under a lock
+  uint hits __attribute__((aligned(CACHELINE))), misses, reads, writes; // a line of their own
 } bcache;
 
+static void bput(struct buf*);
+static void badd(struct buf*);
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % NBUCKET];
+}
+
+// unlink b from bk's list. Caller holds bk->lock.
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->mru = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+  else
+    bk->lru = b->prev;
+}
+
+// insert b at the MRU end of bk's list. Caller holds bk->lock.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->mru;
+  if(bk->mru)
+    bk->mru->prev = b;
+  else
+    bk->lru = b;
+  bk->mru = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Deal the buffers out across the buckets; they migrate
+  // to wherever they're needed as blocks are recycled.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->data = bcache.data[b - bcache.buf];
+    badd(b);
+  }
+}
+
+// Put a new, empty buffer into the cache.
+static void
+badd(struct buf *b)
+{
+  struct bucket *bk;
+
+  initsleeplock(&b->lock, "buffer");
+  bk = &bcache.bucket[bcache.nbuf++ % NBUCKET];
+  acquire(&bk->lock);
+  bpush(bk, b);
+  release(&bk->lock);
+}
+
+// Grow the cache to suit a file system of nblocks blocks, once the
+// superblock has been read and all of memory is free for use: one
+// buffer per block, but using no more than 1/BCACHEFRAC of free
+// memory, and keeping hash chains short.
+void
+bgrow(uint nblocks)
+{
+  char *p, *d;
+  int n, target, nd;
+  uint i;
+  struct buf *b;
+
+  target = kfreecount() / BCACHEFRAC * PGSIZE / (sizeof(struct buf) + BSIZE);
+  if(target > nblocks)
+    target = nblocks;
+  if(target > NBUCKET * BCHAIN)
+    target = NBUCKET * BCHAIN;
+
+  acquire(&bcache.lock);  // keep recyclers out while buffers are added
+  // a page of headers, then pages of data blocks for them
+  nd = 0;
+  d = 0;
+  for(n = bcache.nbuf; n < target; ){
+    if((p = kalloc()) == 0)
+      break;
+    memset(p, 0, PGSIZE);
+    for(i = 0; i < PGSIZE / sizeof(struct buf) && n < target; i++, n++){
+      if(nd == 0){
+        if((d = kalloc()) == 0){
+          if(i == 0)  // no buffer in this header page was added
+            kfree(p);
+          goto out;
+        }
+        nd = PGSIZE / BSIZE;
+      }
+      b = (struct buf*)p + i;
+      b->data = (uchar*)d;
+      d += BSIZE;
+      nd--;
+      badd(b);
+    }
   }
+out:
+  release(&bcache.lock);
+}
+
+// Look for block on device dev in bucket bk.
+// Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->mru; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Look for block on device dev in bucket bk, and take a
+// reference to it if found. Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = blookup(bk, dev, blockno)) != 0)
+    b->refcnt++;
+  return b;
+}
+
+// Find the least recently used reusable buffer in bk.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+// Caller holds bk->lock.
+static struct buf*
+bvictim(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->lru; b; b = b->prev)
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      return b;
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -62,34 +221,85 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk, *other;
+  int i;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // this is the common case, and only needs the one bucket lock
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    __sync_fetch_and_add(&bcache.hits, 1);
+    tracerec(TR_BHIT, dev, blockno);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // someone else may have cached the block while no lock was held,
+  // so look again once we are the only process recycling
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    __sync_fetch_and_add(&bcache.hits, 1);
+    tracerec(TR_BHIT, dev, blockno);
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // prefer a buffer already in this bucket, then steal one from
+  // the next bucket along that has a free buffer
+  if((b = bvictim(bk)) == 0){
+    for(i = 1; i < NBUCKET; i++){
+      other = &bcache.bucket[(bk - bcache.bucket + i) % NBUCKET];
+      acquire(&other->lock);
+      if((b = bvictim(other)) != 0){
+        bunlink(other, b);
+        release(&other->lock);
+        bpush(bk, b);
+        break;
+      }
+      release(&other->lock);
     }
+    if(b == 0)
+      panic("bget: no buffers");
+  }
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.lock);
+  __sync_fetch_and_add(&bcache.misses, 1);
+  tracerec(TR_BMISS, dev, blockno);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Hand b to the driver of its disk: the file system disk is on
+// virtio when QEMU provides a virtio disk, everything else on IDE.
+static void
+diskrw(struct buf *b)
+{
+  struct proc *p;
+
+  if((p = myproc()) != 0){
+    if(b->flags & B_DIRTY)
+      p->nbwrite++;
+    else
+      p->nbread++;
   }
-  panic("bget: no buffers");
+  __sync_fetch_and_add((b->flags & B_DIRTY) ? &bcache.writes : &bcache.reads, 1);
+  if(b->dev == ROOTDEV && virtioirq)
+    virtiorw(b);
+  else
+    iderw(b);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -100,11 +310,37 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    diskrw(b);
   }
   return b;
 }
 
+// Start reading the indicated block into the cache without waiting for it.
+// Does nothing if the block is already cached (or on its way in).
+// The disk interrupt releases the buffer once the read completes.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  // cheap check first so a sequential reader doesn't lock buffers it already has
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  diskrw(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,11 +348,48 @@ bwrite(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  diskrw(b);
+}
+
+// Write the n locked buffers in bs to disk, and wait for them all.
+// They are queued at once, in block order, so the disk takes them in
+// one sweep (and the IDE driver merges runs of adjacent blocks into a
+// single transfer) rather than each being started and waited for in turn.
+// Sorts bs. The caller keeps the buffers locked, as with bwrite().
+void
+bwritev(struct buf **bs, int n)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int i, j;
+
+  for(i = 1; i < n; i++){
+    b = bs[i];
+    for(j = i; j > 0 && bs[j-1]->blockno > b->blockno; j--)
+      bs[j] = bs[j-1];
+    bs[j] = b;
+  }
+  for(i = 0; i < n; i++){
+    b = bs[i];
+    if(!holdingsleep(&b->lock))
+      panic("bwritev");
+    // the disk interrupt releases the lock and a reference once the
+    // write is done; give it a reference of its own to drop
+    if((b->flags & B_PRIVATE) == 0){
+      bk = bhash(b->dev, b->blockno);
+      acquire(&bk->lock);
+      b->refcnt++;
+      release(&bk->lock);
+    }
+    b->flags |= B_DIRTY | B_ASYNC;
+    diskrw(b);
+  }
+  // take each lock back as its write finishes
+  for(i = 0; i < n; i++)
+    acquiresleep(&bs[i]->lock);
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,21 +397,48 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
+// Release a buffer whose asynchronous read just completed.
+// Called from the disk interrupt, which holds the buffer's sleep-lock on behalf
+// of the process that started the read, so there is no holder to check.
+void
+brelseasync(struct buf *b)
+{
+  releasesleep(&b->lock);
+  if((b->flags & B_PRIVATE) == 0)
+    bput(b);
+}
+
+// Drop a reference to an unlocked buffer.
+// Move to the head of the MRU list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  // b can't change buckets while we hold a reference to it
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(bk, b);
+    bpush(bk, b);
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 //PAGEBREAK!
 // Blank page.
 
+// Fill in the buffer cache counts of *st, for the stat device.
+void
+bcachestat(struct vmstat *st)
+{
+  st->nbuf = bcache.nbuf;
+  st->bhits = bcache.hits;
+  st->bmisses = bcache.misses;
+  st->dreads = bcache.reads;
+  st->dwrites = bcache.writes;
+}
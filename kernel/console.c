@@ -14,8 +14,10 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
 
 static void consputc(int);
+static void cgacursor(void);
 
 static int panicked = 0;
 
@@ -98,6 +100,7 @@ cprintf(char *fmt, ...)
       break;
     }
   }
+  cgacursor();
 
   if(locking)
     release(&cons.lock);
@@ -127,17 +130,27 @@ panic(char *s)
 #define BACKSPACE 0x100
 #define CRTPORT 0x3d4
 static ushort *crt = (ushort*)P2V(0xb8000);  // CGA memory
+static int cgapos = -1;  // cursor position: col + 80*row, -1 until read from the hardware
 
+// Put c in the CGA buffer. The hardware cursor only follows when
+// cgacursor() is called, once per write rather than per character
+// (every port access is expensive in a virtual machine).
 static void
 cgaputc(int c)
 {
   int pos;
 
-  // Cursor position: col + 80*row.
-  outb(CRTPORT, 14);
-  pos = inb(CRTPORT+1) << 8;
-  outb(CRTPORT, 15);
-  pos |= inb(CRTPORT+1);
+  if(fbcons){
+    fbputc(c);
+    return;
+  }
+  if(cgapos < 0){
+    outb(CRTPORT, 14);
+    cgapos = inb(CRTPORT+1) << 8;
+    outb(CRTPORT, 15);
+    cgapos |= inb(CRTPORT+1);
+  }
+  pos = cgapos;
 
   if(c == '\n')
     pos += 80 - pos%80;
@@ -149,17 +162,30 @@ cgaputc(int c)
   if(pos < 0 || pos > 25*80)
     panic("pos under/overflow");
 
-  if((pos/80) >= 24){  // Scroll up.
+  if((pos/80) >= 24){  // Scroll up; memmove and memset work a word at a time.
     memmove(crt, crt+80, sizeof(crt[0])*23*80);
     pos -= 80;
     memset(crt+pos, 0, sizeof(crt[0])*(24*80 - pos));
   }
 
+  crt[pos] = ' ' | 0x0700;
+  cgapos = pos;
+}
+
+// Move the hardware cursor to where output left off.
+static void
+cgacursor(void)
+{
+  if(fbcons){
+    fbflush();
+    return;
+  }
+  if(cgapos < 0)
+    return;
   outb(CRTPORT, 14);
-  outb(CRTPORT+1, pos>>8);
+  outb(CRTPORT+1, cgapos>>8);
   outb(CRTPORT, 15);
-  outb(CRTPORT+1, pos);
-  crt[pos] = ' ' | 0x0700;
+  outb(CRTPORT+1, cgapos);
 }
 
 void
@@ -171,10 +197,13 @@ consputc(int c)
       ;
   }
 
+  // panic() turns off cons.locking, and can't rely on the uart's interrupt
+  void (*putc)(int) = cons.locking ? uartputc : uartputcsync;
+
   if(c == BACKSPACE){
-    uartputc('\b'); uartputc(' '); uartputc('\b');
+    putc('\b'); putc(' '); putc('\b');
   } else
-    uartputc(c);
+    putc(c);
   cgaputc(c);
 }
 
@@ -188,10 +217,12 @@ struct {
 
 #define C(x)  ((x)-'@')  // Control-x
 
+#define CONSCHUNK 256  // bytes a read or write copies to or from user memory at once
+
 void
 consoleintr(int (*getc)(void))
 {
-  int c, doprocdump = 0;
+  int c, doprocdump = 0, dolockdump = 0;
 
   acquire(&cons.lock);
   while((c = getc()) >= 0){
@@ -200,6 +231,9 @@ consoleintr(int (*getc)(void))
       // procdump() locks cons.lock indirectly; invoke later
       doprocdump = 1;
       break;
+    case C('L'):  // Lock profile; like procdump(), it takes cons.lock
+      dolockdump = 1;
+      break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
             input.buf[(input.e-1) % INPUT_BUF] != '\n'){
@@ -226,22 +260,27 @@ consoleintr(int (*getc)(void))
       break;
     }
   }
+  cgacursor();
   release(&cons.lock);
   if(doprocdump) {
     procdump();  // now call procdump() wo. cons.lock held
   }
+  if(dolockdump)
+    lockdump();
 }
 
 int
-consoleread(struct inode *ip, char *dst, int n)
+consoleread(struct inode *ip, char *dst, uint off, int n)
 {
+  char buf[CONSCHUNK];
   uint target;
-  int c;
+  int c, m, done;
 
   iunlock(ip);
   target = n;
+  done = 0;
   acquire(&cons.lock);
-  while(n > 0){
+  while(n > 0 && !done){
     while(input.r == input.w){
       if(myproc()->killed){
         release(&cons.lock);
@@ -250,19 +289,32 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       sleep(&input.r, &cons.lock);
     }
-    c = input.buf[input.r++ % INPUT_BUF];
-    if(c == C('D')){  // EOF
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        input.r--;
+    for(m = 0; m < n && m < sizeof(buf) && input.r != input.w; ){
+      c = input.buf[input.r++ % INPUT_BUF];
+      if(c == C('D')){  // EOF
+        if(m > 0 || n < target){
+          // Save ^D for next time, to make sure
+          // caller gets a 0-byte result.
+          input.r--;
+        }
+        done = 1;
+        break;
+      }
+      buf[m++] = c;
+      if(c == '\n'){
+        done = 1;
+        break;
       }
-      break;
     }
-    *dst++ = c;
-    --n;
-    if(c == '\n')
-      break;
+    // copied out without cons.lock, since the copy may fault
+    release(&cons.lock);
+    if(ucopy(dst, buf, m) < 0){
+      ilock(ip);
+      return -1;
+    }
+    dst += m;
+    n -= m;
+    acquire(&cons.lock);
   }
   release(&cons.lock);
   ilock(ip);
@@ -273,18 +325,52 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  char kbuf[CONSCHUNK];
+  int i, j, m;
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  for(i = 0; i < n; i += m){
+    // copied in before taking cons.lock, since the copy may fault
+    m = n - i < sizeof(kbuf) ? n - i : sizeof(kbuf);
+    if(ucopy(kbuf, buf + i, m) < 0){
+      ilock(ip);
+      return -1;
+    }
+    acquire(&cons.lock);
+    if(panicked){
+      cli();
+      for(;;)
+        ;
+    }
+    // a chunk at once: one pass through the uart's ring, one cursor update
+    uartwrite(kbuf, m);
+    for(j = 0; j < m; j++)
+      cgaputc(kbuf[j] & 0xff);
+    cgacursor();
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
 }
 
+// A read waits for a whole line (or ^D); writes never wait.
+static int
+consolepoll(struct inode *ip, int events, struct polltab *pt)
+{
+  int r;
+
+  r = events & POLLOUT;
+  if(events & POLLIN){
+    acquire(&cons.lock);
+    pollwait(pt, &input.r, 0);
+    if(input.r != input.w)
+      r |= POLLIN;
+    release(&cons.lock);
+  }
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -292,8 +378,9 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
-  ioapicenable(IRQ_KBD, 0);
+  ioapicenable(IRQ_KBD, IRQ_ANYCPU);
 }
 
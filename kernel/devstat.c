@@ -0,0 +1,87 @@
+// The stat device: reading it gives the kernel's global counters,
+// one "name value" line each, for tools like vmstat. Each read renders
+// them afresh, so read the whole thing at once for a consistent set.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "logstat.h"
+#include "vmstat.h"
+
+static char*
+put(char *p, char *name, uint v)
+{
+  char num[10];
+  int i;
+
+  while(*name)
+    *p++ = *name++;
+  *p++ = ' ';
+  i = 0;
+  do {
+    num[i++] = '0' + v % 10;
+  } while((v /= 10) != 0);
+  while(i > 0)
+    *p++ = num[--i];
+  *p++ = '\n';
+  return p;
+}
+
+static int
+statread(struct inode *ip, char *dst, uint off, int n)
+{
+  struct vmstat st;
+  struct logstat ls;
+  char *buf, *p;
+  uint len;
+
+  memset(&st, 0, sizeof(st));
+  kmemstat(&st);
+  bcachestat(&st);
+  idestat(&st);
+  virtiostat(&st);
+  netstat(&st);
+  logstat(&ls);
+
+  if((buf = kalloc()) == 0)
+    return -1;
+  p = buf;
+  p = put(p, "pgfree", st.pgfree);
+  p = put(p, "pgzeroed", st.pgzeroed);
+  p = put(p, "nbuf", st.nbuf);
+  p = put(p, "bhits", st.bhits);
+  p = put(p, "bmisses", st.bmisses);
+  p = put(p, "dreads", st.dreads);
+  p = put(p, "dwrites", st.dwrites);
+  p = put(p, "dqueue", st.dqueue);
+  p = put(p, "netrx", st.netrx);
+  p = put(p, "nettx", st.nettx);
+  p = put(p, "netdrop", st.netdrop);
+  p = put(p, "logops", ls.ops);
+  p = put(p, "logopwaits", ls.opwaits);
+  p = put(p, "logwrites", ls.writes);
+  p = put(p, "logabsorbed", ls.absorbed);
+  p = put(p, "logcommits", ls.commits);
+  p = put(p, "logblocks", ls.logged);
+  p = put(p, "ticks", ticks);
+  len = p - buf;
+
+  if(off >= len)
+    n = 0;
+  else if(n > len - off)
+    n = len - off;
+  if(ucopy(dst, buf + off, n) < 0)
+    n = -1;
+  kfree(buf);
+  return n;
+}
+
+void
+statinit(void)
+{
+  devsw[DEVSTAT].read = statread;
+}
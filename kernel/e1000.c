@@ -0,0 +1,287 @@
+// Driver for the Intel 82540EM gigabit ethernet card (e1000), which QEMU
+// emulates (make NET=1 attaches one).
+// The driver and the card share two rings of descriptors in memory, one for
+// transmitting and one for receiving, each pointing at a packet buffer (see
+// net.h). The card fills receive buffers and sends transmit buffers on its
+// own, and the driver only moves the tail registers that tell it how far it
+// may go, once per batch of packets rather than once per packet.
+// Packets are never copied: a full receive buffer is handed up to net.c as
+// it is, and a fresh page takes its place in the ring; a packet to send goes
+// into the ring as it is, and is freed once the card is done with it.
+// Interrupts are moderated (E1000_ITR), so under load each one finds a batch
+// of packets in the ring, and sending reclaims finished transmit descriptors
+// itself, without an interrupt for them.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "pci.h"
+#include "net.h"
+
+#define E1000_VENDOR    0x8086
+#define E1000_DEV       0x100e  // 82540EM
+
+// registers, as indices of 32-bit words in the memory space at BAR0
+#define E1000_CTRL      (0x0000/4)
+  #define CTRL_SLU        (1<<6)    // set link up
+  #define CTRL_RST        (1<<26)   // reset
+#define E1000_ICR       (0x00C0/4)  // interrupt cause, reading clears it
+#define E1000_ITR       (0x00C4/4)  // interrupt throttling, in 256ns units
+#define E1000_IMS       (0x00D0/4)  // interrupt mask set
+#define E1000_IMC       (0x00D8/4)  // interrupt mask clear
+  #define ICR_LSC         (1<<2)    // link status change
+  #define ICR_RXDMT0      (1<<4)    // receive ring running low
+  #define ICR_RXO         (1<<6)    // receive ring overrun
+  #define ICR_RXT0        (1<<7)    // packets received
+#define E1000_RCTL      (0x0100/4)
+  #define RCTL_EN         (1<<1)
+  #define RCTL_BAM        (1<<15)   // accept broadcasts
+  #define RCTL_SZ_2048    (0<<16)   // receive buffers of PKTRXSIZE bytes
+  #define RCTL_SECRC      (1<<26)   // strip the CRC
+#define E1000_TCTL      (0x0400/4)
+  #define TCTL_EN         (1<<1)
+  #define TCTL_PSP        (1<<3)    // pad short packets
+  #define TCTL_CT_SHIFT   4
+  #define TCTL_COLD_SHIFT 12
+#define E1000_TIPG      (0x0410/4)  // transmit inter-packet gap
+#define E1000_RDBAL     (0x2800/4)  // receive ring: physical address, length
+#define E1000_RDBAH     (0x2804/4)
+#define E1000_RDLEN     (0x2808/4)
+#define E1000_RDH       (0x2810/4)  // next descriptor the card fills
+#define E1000_RDT       (0x2818/4)  // the card stops short of this one
+#define E1000_RDTR      (0x2820/4)  // receive interrupt delay
+#define E1000_TDBAL     (0x3800/4)  // transmit ring, likewise
+#define E1000_TDBAH     (0x3804/4)
+#define E1000_TDLEN     (0x3808/4)
+#define E1000_TDH       (0x3810/4)  // next descriptor the card sends
+#define E1000_TDT       (0x3818/4)  // one past the last one the driver queued
+#define E1000_MTA       (0x5200/4)  // multicast table, 128 words
+#define E1000_RA        (0x5400/4)  // receive address 0: low 4 bytes, then high 2 and AV
+  #define RAH_AV          (1u<<31)  // address valid
+
+// Transmit descriptor (legacy format)
+struct txdesc {
+  uint64 addr;
+  ushort length;
+  uchar cso;
+  uchar cmd;
+  uchar status;
+  uchar css;
+  ushort special;
+};
+#define TXD_CMD_EOP     0x01    // end of packet
+#define TXD_CMD_IFCS    0x02    // insert the CRC
+#define TXD_CMD_RS      0x08    // report status: set DD when sent
+#define TXD_STAT_DD     0x01    // descriptor done
+
+// Receive descriptor
+struct rxdesc {
+  uint64 addr;
+  ushort length;
+  ushort csum;
+  uchar status;
+  uchar errors;
+  ushort special;
+};
+#define RXD_STAT_DD     0x01
+#define RXD_STAT_EOP    0x02
+
+#define NTXDESC 256     // a page of descriptors each
+#define NRXDESC 256
+#define ITRVAL  (1000000000 / (256 * 20000))  // at most 20000 interrupts a second
+
+static struct txdesc txring[NTXDESC] __attribute__((aligned(PGSIZE)));
+static struct rxdesc rxring[NRXDESC] __attribute__((aligned(PGSIZE)));
+
+int e1000irq;           // interrupt line of the card, 0 if there is none
+
+static struct {
+  volatile uint *regs;
+  uchar mac[ETHADDRLEN];
+  struct spinlock txlock;
+  struct pkt *txpkt[NTXDESC];  // what each transmit descriptor sends
+  uint txtail;          // next descriptor to queue a packet in
+  uint txclean;         // oldest descriptor that may not be done yet
+  struct spinlock rxlock;
+  struct pkt *rxpkt[NRXDESC];  // what each receive descriptor receives into
+  uint rxnext;          // next descriptor the card will fill
+} e1000;
+
+// Give up the packets in transmit descriptors the card is done with.
+// Caller holds txlock.
+static void
+txreclaim(void)
+{
+  struct txdesc *d;
+
+  while(e1000.txclean != e1000.txtail){
+    d = &txring[e1000.txclean];
+    if(!(d->status & TXD_STAT_DD))
+      break;
+    pktfree(e1000.txpkt[e1000.txclean]);
+    e1000.txpkt[e1000.txclean] = 0;
+    e1000.txclean = (e1000.txclean + 1) % NTXDESC;
+  }
+}
+
+// Look for an e1000 card and bring it up.
+// Needs kalloc() for the receive buffers, so comes after kinit2().
+void
+e1000init(void)
+{
+  struct pcifunc f;
+  struct pkt *p;
+  uint base, ral, rah;
+  int i;
+
+  if(pcifind(E1000_VENDOR, E1000_DEV, PCI_ANY, PCI_ANY, &f) < 0 || (f.bar[0] & 1))
+    return;
+  base = f.bar[0] & ~0xF;
+  // the kernel maps DEVSPACE at its own address; qemu puts the registers there
+  if(base < DEVSPACE){
+    cprintf("e1000: registers at 0x%x out of reach\n", base);
+    return;
+  }
+  initlock(&e1000.txlock, "e1000tx");
+  initlock(&e1000.rxlock, "e1000rx");
+  pcienable(&f);
+  e1000.regs = (volatile uint*)base;
+
+  e1000.regs[E1000_IMC] = ~0;
+  e1000.regs[E1000_CTRL] |= CTRL_RST;
+  microdelay(1000);
+  e1000.regs[E1000_IMC] = ~0; // reset turned interrupts back on
+
+  // reset leaves the address from the EEPROM in receive address 0
+  ral = e1000.regs[E1000_RA];
+  rah = e1000.regs[E1000_RA+1];
+  for(i = 0; i < 4; i++)
+    e1000.mac[i] = ral >> (8*i);
+  e1000.mac[4] = rah;
+  e1000.mac[5] = rah >> 8;
+  e1000.regs[E1000_RA+1] = rah | RAH_AV;
+  for(i = 0; i < 128; i++)
+    e1000.regs[E1000_MTA+i] = 0;
+
+  memset(txring, 0, sizeof(txring));
+  e1000.regs[E1000_TDBAL] = V2P(txring);
+  e1000.regs[E1000_TDBAH] = 0;
+  e1000.regs[E1000_TDLEN] = sizeof(txring);
+  e1000.regs[E1000_TDH] = e1000.regs[E1000_TDT] = 0;
+  e1000.regs[E1000_TCTL] = TCTL_EN | TCTL_PSP | (0x10 << TCTL_CT_SHIFT) | (0x40 << TCTL_COLD_SHIFT);
+  e1000.regs[E1000_TIPG] = 10 | (8<<10) | (6<<20);
+
+  memset(rxring, 0, sizeof(rxring));
+  for(i = 0; i < NRXDESC; i++){
+    if((p = pktalloc()) == 0)
+      panic("e1000init");
+    e1000.rxpkt[i] = p;
+    rxring[i].addr = V2P(p->data);
+  }
+  e1000.regs[E1000_RDBAL] = V2P(rxring);
+  e1000.regs[E1000_RDBAH] = 0;
+  e1000.regs[E1000_RDLEN] = sizeof(rxring);
+  e1000.regs[E1000_RDH] = 0;
+  e1000.regs[E1000_RDT] = NRXDESC - 1;
+  e1000.regs[E1000_RDTR] = 0; // ITR does the batching
+  e1000.regs[E1000_RCTL] = RCTL_EN | RCTL_BAM | RCTL_SZ_2048 | RCTL_SECRC;
+
+  e1000.regs[E1000_CTRL] |= CTRL_SLU;
+  e1000.regs[E1000_ITR] = ITRVAL;
+  e1000.regs[E1000_IMS] = ICR_RXT0 | ICR_RXO | ICR_RXDMT0 | ICR_LSC;
+  (void)e1000.regs[E1000_ICR];
+
+  e1000irq = f.irq;
+  ioapicenable(e1000irq, IRQ_ANYCPU);
+  netattach(e1000.mac);
+  cprintf("e1000: %x:%x:%x:%x:%x:%x irq %d\n", e1000.mac[0], e1000.mac[1],
+          e1000.mac[2], e1000.mac[3], e1000.mac[4], e1000.mac[5], e1000irq);
+}
+
+// Queue packet p, a whole ethernet frame, for sending, and hand it over:
+// it is freed once sent. Returns -1 (and frees it) if the ring is full.
+int
+e1000tx(struct pkt *p)
+{
+  struct txdesc *d;
+  uint i;
+
+  acquire(&e1000.txlock);
+  i = e1000.txtail;
+  if((i + 1) % NTXDESC == e1000.txclean){
+    txreclaim();
+    if((i + 1) % NTXDESC == e1000.txclean){
+      release(&e1000.txlock);
+      pktfree(p);
+      return -1;
+    }
+  }
+  d = &txring[i];
+  d->addr = V2P(p->data);
+  d->length = p->len;
+  d->cmd = TXD_CMD_EOP | TXD_CMD_IFCS | TXD_CMD_RS;
+  d->status = 0;
+  e1000.txpkt[i] = p;
+  e1000.txtail = (i + 1) % NTXDESC;
+  __sync_synchronize(); // the descriptor before the tail
+  e1000.regs[E1000_TDT] = e1000.txtail;
+  release(&e1000.txlock);
+  return 0;
+}
+
+// Interrupt handler: take every packet the card has received since the last
+// one, put fresh buffers in the ring, and pass the packets up to netrx().
+void
+e1000intr(void)
+{
+  struct pkt *p, *np, *head, **tail;
+  struct rxdesc *d;
+  uint i, n;
+
+  if(e1000.regs == 0)
+    return;
+  (void)e1000.regs[E1000_ICR]; // acknowledge; packets that arrive later interrupt again
+
+  head = 0;
+  tail = &head;
+  n = 0;
+  acquire(&e1000.rxlock);
+  for(;;){
+    i = e1000.rxnext;
+    d = &rxring[i];
+    if(!(d->status & RXD_STAT_DD))
+      break;
+    __sync_synchronize(); // the rest of the descriptor only after DD
+    p = e1000.rxpkt[i];
+    // frames too big for one buffer aren't expected, with no jumbo frames
+    if((d->status & RXD_STAT_EOP) && d->errors == 0 && (np = pktalloc()) != 0){
+      p->len = d->length;
+      *tail = p;
+      tail = &p->next;
+      e1000.rxpkt[i] = np;
+      d->addr = V2P(np->data);
+    }
+    // otherwise the card gets the same buffer back: the packet is dropped
+    d->status = 0;
+    e1000.rxnext = (i + 1) % NRXDESC;
+    n++;
+  }
+  if(n > 0){
+    __sync_synchronize(); // the descriptors before the tail
+    e1000.regs[E1000_RDT] = (e1000.rxnext + NRXDESC - 1) % NRXDESC;
+  }
+  release(&e1000.rxlock);
+  *tail = 0;
+
+  for(p = head; p; p = np){
+    np = p->next;
+    p->next = 0;
+    netrx(p);
+  }
+}
@@ -11,15 +11,20 @@
 int
 exec(char *path, char **argv)
 {
-  char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
+  char *s, *last, *stack;
+  int i, off, nseg;
+  uint argc, sz, sp, base, n, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *oldexe;
   struct proghdr ph;
+  struct execseg seg[NSEG];
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
+  // the other threads (see clone()) would go on running in the old memory
+  if(curproc->threaded)
+    return -1;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -27,7 +32,7 @@ exec(char *path, char **argv)
     cprintf("exec: fail\n");
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip); // exec only reads the file
   pgdir = 0;
 
   // Check ELF header
@@ -40,7 +45,10 @@ exec(char *path, char **argv)
     goto bad;
 
   // Load program into memory.
+  // Rather, leave it in the file: textfault() maps the pages of up to
+  // NSEG segments as they are touched, and only the rest are read now.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -50,32 +58,50 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz >= KERNBASE || ph.vaddr < sz)
+      goto bad;
+    if(nseg < NSEG){
+      // lazyfault() zero-fills the pages past the file part, as it does for sbrk()
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].perm = (ph.flags & ELF_PROG_FLAG_WRITE) ? PTE_COW : 0;
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+      goto bad;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  iunlockshared(ip);
   end_op();
-  ip = 0;
+  // keep the reference to ip, for textfault()
 
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible.  Use the second as the user stack.
   sz = PGROUNDUP(sz);
   if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
-    goto bad;
+    goto badexe;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
 
   // Push argument strings, prepare rest of stack in ustack.
+  // They all go in the one stack page, written through the kernel's
+  // mapping of it, rather than a copyout() page walk for each string.
+  base = sz - PGSIZE;
+  stack = uva2ka(pgdir, (char*)base);
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
-      goto bad;
-    sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
+      goto badexe;
+    n = strlen(argv[argc]) + 1;
+    if(n > sp - base)
+      goto badexe;
+    sp = (sp - n) & ~3;
+    memmove(stack + (sp - base), argv[argc], n);
     ustack[3+argc] = sp;
   }
   ustack[3+argc] = 0;
@@ -84,9 +110,11 @@ exec(char *path, char **argv)
   ustack[1] = argc;
   ustack[2] = sp - (argc+1)*4;  // argv pointer
 
-  sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
+  n = (3+argc+1) * 4;
+  if(n > sp - base)
+    goto badexe;
+  sp -= n;
+  memmove(stack + (sp - base), ustack, n);
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
@@ -95,21 +123,40 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
+  mmapexit(curproc);
   oldpgdir = curproc->pgdir;
+  oldexe = curproc->exe;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  curproc->exe = ip;
+  curproc->nseg = nseg;
+  memmove(curproc->seg, seg, sizeof(seg));
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
   return 0;
 
  bad:
   if(pgdir)
     freevm(pgdir);
   if(ip){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     end_op();
   }
   return -1;
+
+ badexe:
+  // past the file reading, but exec can still fail (e.g. no memory for the stack)
+  freevm(pgdir);
+  begin_op();
+  iput(ip);
+  end_op();
+  return -1;
 }
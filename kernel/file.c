@@ -5,21 +5,30 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
+#include "slab.h"
+#include "stat.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
+// Files come from an object cache (see slab.c) and go back to it
+// when the last reference is closed; ftable.lock protects the
+// reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slabcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.cache, "filecache", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +37,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if((f = slaballoc(&ftable.cache)) != 0){
+    memset(f, 0, sizeof(*f));
+    f->ref = 1;
   }
-  release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +73,12 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
+  else if(ff.type == FD_SOCK)
+    sockclose(ff.sock);
   else if(ff.type == FD_INODE){
     begin_op();
     iput(ff.ip);
@@ -84,9 +91,9 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     return 0;
   }
   return -1;
@@ -102,6 +109,8 @@ fileread(struct file *f, char *addr, int n)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
+  if(f->type == FD_SOCK)
+    return sockread(f->sock, addr, n, 0);
   if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
@@ -123,26 +132,31 @@ filewrite(struct file *f, char *addr, int n)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
+  if(f->type == FD_SOCK)
+    return -1; // no connect(), so nowhere to send to without sendto()
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, up to 3 indirect blocks, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    // the biggest op the log allows keeps large writes
+    // from being split into many small transactions.
+    int nblocks = logopmax();
+    int max = ((nblocks-1-3-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opn(nblocks);
       ilock(f->ip);
       if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nblocks);
 
       if(r < 0)
         break;
@@ -155,3 +169,154 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+// Read into the n buffers of iov in turn, from f at byte off, or, if off
+// is -1, from f->off on, advancing it. Returns the bytes read, which
+// fall short of the buffers only at the end of the file (or of what a
+// pipe holds), or -1. Only an inode is read at an offset.
+// The inode is locked once for all the buffers.
+int
+filereadv(struct file *f, struct iovec *iov, int n, int off)
+{
+  int i, r, total;
+  uint pos;
+
+  if(f->readable == 0)
+    return -1;
+  total = 0;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    for(i = 0; i < n; i++){
+      if(iov[i].len == 0)
+        continue;
+      // a pipe returns what it has; only wait for more before the first byte
+      if(total > 0 && pipeempty(f->pipe))
+        break;
+      if((r = piperead(f->pipe, iov[i].base, iov[i].len)) < 0)
+        return total > 0 ? total : -1;
+      total += r;
+      if(r < iov[i].len)
+        break;
+    }
+    return total;
+  }
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    pos = off >= 0 ? off : f->off;
+    for(i = 0; i < n; i++){
+      if((r = readi(f->ip, iov[i].base, pos, iov[i].len)) < 0){
+        total = total > 0 ? total : -1;
+        break;
+      }
+      pos += r;
+      total += r;
+      if(r < iov[i].len)
+        break;
+    }
+    if(off < 0 && total > 0)
+      f->off = pos;
+    iunlock(f->ip);
+    return total;
+  }
+  if(f->type == FD_SOCK)
+    return -1; // datagrams don't split across buffers; see sys_recvmmsg()
+  panic("filereadv");
+}
+
+// Write the n buffers of iov in turn to f at byte off, or, if off is -1,
+// at f->off on, advancing it. Returns the bytes written, or -1.
+// As many buffers as fit go into one log transaction (see filewrite()),
+// so a vector of small records commits as one write would.
+int
+filewritev(struct file *f, struct iovec *iov, int n, int off)
+{
+  int i, r, total, want, nblocks, max, room;
+  uint pos, done, n1;
+
+  if(f->writable == 0)
+    return -1;
+  want = 0;
+  for(i = 0; i < n; i++)
+    want += iov[i].len;
+  total = 0;
+  if(f->type == FD_PIPE){
+    if(off >= 0)
+      return -1;
+    for(i = 0; i < n; i++){
+      if(iov[i].len == 0)
+        continue;
+      if(pipewrite(f->pipe, iov[i].base, iov[i].len) < 0)
+        return -1;
+      total += iov[i].len;
+    }
+    return total;
+  }
+  if(f->type == FD_INODE){
+    nblocks = logopmax();
+    max = ((nblocks-1-3-2) / 2) * BSIZE;
+    i = 0;
+    done = 0; // bytes of iov[i] written
+    r = 0;
+    while(i < n && r >= 0){
+      begin_opn(nblocks);
+      ilock(f->ip);
+      pos = off >= 0 ? off + total : f->off;
+      for(room = max; i < n && room > 0; room -= n1){
+        n1 = iov[i].len - done;
+        if(n1 > room)
+          n1 = room;
+        if(n1 > 0 && (r = writei(f->ip, (char*)iov[i].base + done, pos, n1)) != n1){
+          if(r >= 0)
+            panic("short filewritev");
+          break;
+        }
+        pos += n1;
+        total += n1;
+        done += n1;
+        if(done == iov[i].len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off < 0)
+        f->off = pos;
+      iunlock(f->ip);
+      end_opn(nblocks);
+    }
+    return total == want ? total : -1;
+  }
+  if(f->type == FD_SOCK)
+    return -1;
+  panic("filewritev");
+}
+
+
+// Which of events (POLLIN, POLLOUT) a read or write of f wouldn't block
+// for now, with POLLERR and POLLHUP as for pipepoll(). pt collects the
+// channels to wait on for the rest. Files on disk never block.
+int
+filepoll(struct file *f, int events, struct polltab *pt)
+{
+  struct inode *ip;
+  int r, major;
+
+  if(!f->readable)
+    events &= ~POLLIN;
+  if(!f->writable)
+    events &= ~POLLOUT;
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events, pt);
+  if(f->type == FD_SOCK)
+    return sockpoll(f->sock, events, pt);
+  if(f->type == FD_INODE){
+    ip = f->ip;
+    ilock(ip);
+    major = ip->type == T_DEV ? ip->major : -1;
+    iunlock(ip);
+    r = events & (POLLIN|POLLOUT);
+    if(major >= 0 && major < NDEV && devsw[major].poll)
+      r = devsw[major].poll(ip, events, pt);
+    return r;
+  }
+  panic("filepoll");
+}
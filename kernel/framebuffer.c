@@ -17,3 +17,191 @@
 // accessing the framebuffer
 // the multiboot header provided in the documentation already has a struct multiboot_tag_framebuffer
 // this is provided by grub in a 'framebuffer_info' tag
+// xv6 uses the original multiboot protocol, whose information structure has the same
+// framebuffer fields; entry.S asks for a 32-bit linear framebuffer and records where the boot
+// loader left the information.
+// Booted by xv6's own boot block (or without a framebuffer), the console stays on CGA text.
+
+// drawing a console on the framebuffer
+// - the screen is a grid of 8x16 character cells, and the console keeps the characters that
+//   should be in them, like the CGA buffer
+//   - an 8x8 font, every row drawn twice, comes from the BIOS ROM at 0xFFA6E, where it has been
+//     since the IBM PC
+// - framebuffer memory is slow, reading it painfully so - never read it (no scrolling by copying
+//   pixels) and write only what changed
+//   - cells written since the last update are tracked as a dirty range, and of those only the ones
+//     whose character differs from what's on the screen get redrawn, once per console write
+//   - the 8 pixels of each possible glyph row are cached, so drawing a row is one 32-byte copy
+//   - vm.c maps the framebuffer write-combining, so those copies go out as burst writes
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+
+#define MB_MAGIC      0x2BADB002  // in %eax when a multiboot boot loader started the kernel
+#define MB_FB         (1<<12)     // info flags: framebuffer fields are valid
+
+// the part of the multiboot information structure we use
+struct mbinfo {
+  uint flags;
+  uint unused[21];    // memory, boot device, modules, symbols, memory map, drives, ...
+  uint64 fbaddr;      // offset 88
+  uint fbpitch;       // bytes per line
+  uint fbwidth;
+  uint fbheight;
+  uchar fbbpp;
+  uchar fbtype;       // 1: direct RGB
+  uchar rpos, rsize, gpos, gsize, bpos, bsize; // where each color is in a pixel
+} __attribute__((packed));
+
+uint mbmagic, mbaddr; // %eax and %ebx at entry, saved by entry.S
+
+#define BACKSPACE     0x100       // as in console.c
+#define FONT          0xFFA6E     // physical address of the BIOS 8x8 font, characters 0-127
+#define GW            8           // cell size in pixels
+#define GH            16
+#define FBCOLS        160
+#define FBROWS        64
+
+int fbcons;           // is the console on the framebuffer?
+
+static struct {
+  uint *base;
+  uint pitch;         // in pixels
+  int cols, rows;
+  uchar *font;
+  uchar text[FBROWS*FBCOLS];  // what should be on the screen
+  uchar shown[FBROWS*FBCOLS]; // what is
+  int pos;            // cursor
+  int shownpos;       // where the cursor is drawn
+  int dlo, dhi;       // cells [dlo, dhi) may have changed since the last fbflush()
+  uint span[2][256][GW]; // glyph cache: pixels of each row bitmap, normal and inverted (cursor)
+} fb;
+
+static uint
+fbcolor(struct mbinfo *mb, int r, int g, int b)
+{
+  return (r >> (8 - mb->rsize)) << mb->rpos |
+         (g >> (8 - mb->gsize)) << mb->gpos |
+         (b >> (8 - mb->bsize)) << mb->bpos;
+}
+
+// Take over the console if the boot loader set up a framebuffer we can draw on.
+// Called first thing in main(): the information may lie in memory kinit1() frees,
+// and the mapping has to be in kmap[] before kvmalloc().
+void
+fbinit(void)
+{
+  struct mbinfo *mb;
+  uint fg, bg;
+  int i, x;
+
+  // until kvmalloc() only the first BOOTMAP bytes of physical memory are mapped
+  if(mbmagic != MB_MAGIC || mbaddr + sizeof(*mb) > BOOTMAP)
+    return;
+  mb = (struct mbinfo*)P2V(mbaddr);
+  if(!(mb->flags & MB_FB) || mb->fbtype != 1 || mb->fbbpp != 32 || (mb->fbaddr >> 32))
+    return;
+  // make sure the font is there: blank space, solid block (character 219)
+  fb.font = (uchar*)P2V(FONT);
+  for(i = 0; i < 8; i++)
+    if(fb.font[' '*8 + i] != 0 || fb.font[219*8 + i] != 0xFF)
+      return;
+  if((fb.base = (uint*)kvmmapfb((uint)mb->fbaddr, mb->fbpitch * mb->fbheight)) == 0)
+    return;
+
+  fb.pitch = mb->fbpitch / 4;
+  fb.cols = mb->fbwidth / GW < FBCOLS ? mb->fbwidth / GW : FBCOLS;
+  fb.rows = mb->fbheight / GH < FBROWS ? mb->fbheight / GH : FBROWS;
+  fg = fbcolor(mb, 0xAA, 0xAA, 0xAA); // light grey on black, like CGA's 0x07
+  bg = fbcolor(mb, 0, 0, 0);
+  for(i = 0; i < 256; i++)
+    for(x = 0; x < GW; x++){
+      fb.span[0][i][x] = (i & (0x80 >> x)) ? fg : bg;
+      fb.span[1][i][x] = (i & (0x80 >> x)) ? bg : fg;
+    }
+  // shown[] is all 0, so the first fbflush() clears the whole grid
+  memset(fb.text, ' ', sizeof(fb.text));
+  fb.dlo = 0;
+  fb.dhi = fb.rows * fb.cols;
+  fb.shownpos = -1;
+  fbcons = 1;
+}
+
+static void
+fbset(int i, int c)
+{
+  fb.text[i] = c;
+  if(i < fb.dlo)
+    fb.dlo = i;
+  if(i >= fb.dhi)
+    fb.dhi = i + 1;
+}
+
+// Put c on the console; it reaches the screen at the next fbflush().
+// Caller holds cons.lock.
+void
+fbputc(int c)
+{
+  int pos;
+
+  pos = fb.pos;
+  if(c == '\n')
+    pos += fb.cols - pos%fb.cols;
+  else if(c == BACKSPACE){
+    if(pos > 0) --pos;
+  } else
+    fbset(pos++, c);
+
+  if(pos >= fb.rows*fb.cols){  // Scroll up, in text[] only.
+    memmove(fb.text, fb.text + fb.cols, (fb.rows-1)*fb.cols);
+    memset(fb.text + (fb.rows-1)*fb.cols, ' ', fb.cols);
+    pos -= fb.cols;
+    fb.dlo = 0;
+    fb.dhi = fb.rows * fb.cols;
+  }
+
+  fbset(pos, ' ');
+  fb.pos = pos;
+}
+
+static void
+fbdraw(int i, int inverse)
+{
+  uchar *g;
+  uint *p;
+  int y;
+
+  g = fb.font + (fb.text[i] < 128 ? fb.text[i] : '?') * 8;
+  p = fb.base + (i / fb.cols) * GH * fb.pitch + (i % fb.cols) * GW;
+  for(y = 0; y < GH; y++, p += fb.pitch)
+    memmove(p, fb.span[inverse][g[y/2]], sizeof(fb.span[0][0]));
+}
+
+// Bring the screen up to date with text[], and draw the cursor.
+// Caller holds cons.lock.
+void
+fbflush(void)
+{
+  int i;
+
+  for(i = fb.dlo; i < fb.dhi; i++)
+    if(fb.text[i] != fb.shown[i] && i != fb.pos && i != fb.shownpos){
+      fbdraw(i, 0);
+      fb.shown[i] = fb.text[i];
+    }
+  if(fb.shownpos != fb.pos){
+    if(fb.shownpos >= 0){
+      fbdraw(fb.shownpos, 0);
+      fb.shown[fb.shownpos] = fb.text[fb.shownpos];
+    }
+    fbdraw(fb.pos, 1);
+    fb.shown[fb.pos] = fb.text[fb.pos];
+    fb.shownpos = fb.pos;
+  }
+  fb.dlo = fb.rows * fb.cols;
+  fb.dhi = 0;
+}
@@ -23,6 +23,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void readahead(struct inode*, uint);
+static void dcachepurge(uint, uint);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -52,29 +54,64 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Where balloc() and ialloc() look for free blocks and inodes
+// first: just after the last ones they handed out (next fit),
+// rather than from the start of the disk every time. Only hints,
+// so they need no lock.
+static uint bcursor;
+static uint icursor;
+
+// Allocate the first free block in [from, to), or return 0.
 static uint
-balloc(uint dev)
+bscan(uint dev, uint from, uint to)
 {
   int b, bi, m;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  for(b = from - from % BPB; b < to; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(bi = b < from ? from - b : 0; bi < BPB && b + bi < to; bi++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xFF && bi + 8 <= BPB){
+        bi += 7;  // whole byte in use
+        continue;
+      }
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
         return b + bi;
       }
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  return 0;
+}
+
+// Allocate a zeroed disk block for ip.
+// A file that grows gets the block right after its previous one if
+// that is free, so appends end up contiguous. Otherwise the block comes
+// from the cursor, which then skips BALLOCWIN blocks ahead: the next
+// file to need a new place starts beyond them, leaving ip room to grow
+// into without two appenders interleaving their blocks.
+static uint
+balloc(struct inode *ip)
+{
+  uint b, start;
+
+  b = 0;
+  if(ip->lastblock && ip->lastblock + 1 < sb.size)
+    b = bscan(ip->dev, ip->lastblock + 1, ip->lastblock + 2);
+  if(b == 0){
+    start = bcursor < sb.size ? bcursor : 0;
+    if((b = bscan(ip->dev, start, sb.size)) == 0 &&
+       (b = bscan(ip->dev, 0, start)) == 0)
+      panic("balloc: out of blocks");
+    bcursor = b + BALLOCWIN;
+  }
+  ip->lastblock = b;
+  bzero(ip->dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -129,8 +166,8 @@ bfree(int dev, uint b)
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid, and it stays valid until
+//   iput() frees the inode or iget() recycles the entry.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -162,27 +199,101 @@ bfree(int dev, uint b)
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// The cache starts as the static array of NINODE entries and grows by
+// a page of entries from kalloc when all are in use. Entries in use
+// are on a hash chain by (dev, inum), so iget() looks at only a few.
+// An entry whose last reference goes away stays on its chain, still
+// valid, on the idle list: opening the file again then costs no
+// bread(). Once NIIDLE are idle, iget() recycles the least recently
+// used of them rather than growing the cache. Entries holding no inode
+// are on the free list. icache.lock protects the lists and ip->next,
+// ip->pprev, ip->lnext and ip->lprev.
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *free;
+  struct inode *lru;  // idle list, least recently used first
+  struct inode *mru;
+  int nidle;
 } icache;
 
+// Directory entry cache: remembers what dirlookup() found,
+// (dev, directory inum, name) -> inum, or 0 if the name isn't there,
+// so repeated lookups skip reading and scanning the directory.
+// A name hashes to a set of DCWAYS entries, replaced round robin.
+// dirlookup() adds entries holding the directory's lock, shared.
+// Changes to directories hold it exclusively, and correct the
+// cache: dirlink(), sys_unlink() through dcacheforget(), and
+// iput() freeing a directory.
+#define DCSETS 64
+#define DCWAYS 4
+
+struct dcent {
+  uint dev;
+  uint dir;           // 0: unused (no inode 0)
+  uint inum;
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  struct dcent ent[DCSETS][DCWAYS];
+  uchar next[DCSETS]; // way to replace next
+} dcache;
+
+#define IHASH(dev, inum) (&icache.hash[((dev) * 31 + (inum)) % NIHASH])
+
+// Put n new entries starting at ip on the free list.
+static void
+iaddfree(struct inode *ip, int n)
+{
+  for(ip += n - 1; n > 0; n--, ip--){
+    initsleeplock(&ip->lock, "inode");
+    ip->next = icache.free;
+    icache.free = ip;
+  }
+}
+
+// Take ip off the idle list. Caller holds icache.lock.
+static void
+iidleunlink(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lru = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.mru = ip->lprev;
+  icache.nidle--;
+}
+
+// Take ip off its hash chain. Caller holds icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  if(ip->next)
+    ip->next->pprev = ip->pprev;
+  *ip->pprev = ip->next;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  initlock(&dcache.lock, "dcache");
+  iaddfree(icache.inode, NINODE);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  bgrow(sb.size);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -194,20 +305,28 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int inum, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  // every inode once, starting at the cursor, one bread() per inode block
+  inum = icursor >= 1 && icursor < sb.ninodes ? icursor : 1;
+  for(n = 0; n < sb.ninodes - 1; ){
     bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
+    do {
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        brelse(bp);
+        icursor = inum + 1;
+        return iget(dev, inum);
+      }
+      n++;
+      if(++inum >= sb.ninodes)
+        inum = 1;
+    } while(inum % IPB != 0 && inum != 1 && n < sb.ninodes - 1);
     brelse(bp);
   }
   panic("ialloc: no inodes");
@@ -233,6 +352,7 @@ iupdate(struct inode *ip)
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
+  ip->gen = loggen();
 }
 
 // Find the inode with number inum on device dev
@@ -241,31 +361,44 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **chain;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  chain = IHASH(dev, inum);
+  for(ip = *chain; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        iidleunlink(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Use a free entry, else recycle the least recently used idle one
+  // if there are enough of them, else grow the cache.
+  if(icache.free == 0 && icache.nidle < NIIDLE &&
+     (ip = (struct inode*)kalloc()) != 0){
+    memset(ip, 0, PGSIZE);
+    iaddfree(ip, PGSIZE / sizeof(*ip));
+  }
+  if((ip = icache.free) != 0)
+    icache.free = ip->next;
+  else if((ip = icache.lru) != 0){
+    iidleunlink(ip);
+    iunhash(ip);
+  } else
     panic("iget: no inodes");
-
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = *chain;
+  if(ip->next)
+    ip->next->pprev = &ip->next;
+  ip->pprev = chain;
+  *chain = ip;
   release(&icache.lock);
 
   return ip;
@@ -305,6 +438,13 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->raoff = 0;
+    ip->rablock = 0;
+    ip->lastblock = 0;
+    // pages may have been cached before the inode last left the icache
+    ip->pcached = 1;
+    // changes made before the inode left the cache may still be in the current batch
+    ip->gen = loggen();
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -321,6 +461,35 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode for reading: other readers may hold it too.
+// Enough for dirlookup(), readi() and stati(), which only look
+// (readi()'s readahead hint may race, which costs at most a
+// useless or missed readahead).
+// Reading the inode from disk takes the lock exclusively.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  while(ip->valid == 0){
+    releasesleepshared(&ip->lock);
+    ilock(ip);
+    iunlock(ip);
+    acquiresleepshared(&ip->lock);
+  }
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->lock.readers < 1 || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -338,6 +507,9 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      // the inum may come back as another directory; its names must not
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,7 +519,24 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid){
+      // keep it for the next iget(), at the recently used end
+      ip->lnext = 0;
+      ip->lprev = icache.mru;
+      if(icache.mru)
+        icache.mru->lnext = ip;
+      else
+        icache.lru = ip;
+      icache.mru = ip;
+      icache.nidle++;
+    } else {
+      // off its hash chain, onto the free list
+      iunhash(ip);
+      ip->next = icache.free;
+      icache.free = ip;
+    }
+  }
   release(&icache.lock);
 }
 
@@ -365,19 +554,40 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The last NDINDIRECT
+// blocks are listed in the indirect blocks that block
+// ip->addrs[NDIRECT+1] lists. A file of up to INLINESIZE bytes
+// has no blocks: its data is in ip->addrs[] itself, and a write
+// that grows it past that moves the data out to its first block.
+
+// Return entry n of indirect block addr, allocating the
+// block it refers to if necessary.
+static uint
+bindirect(struct inode *ip, uint addr, uint n)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[n]) == 0){
+    a[n] = addr = balloc(ip);
+    log_write(bp);
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip);
     return addr;
   }
   bn -= NDIRECT;
@@ -385,20 +595,44 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = balloc(ip);
+    return bindirect(ip, addr, bn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block it lists.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip);
+    addr = bindirect(ip, addr, bn / NINDIRECT);
+    return bindirect(ip, addr, bn % NINDIRECT);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks below it, depth levels of them.
+static void
+ifree(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      ifree(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -407,10 +641,15 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
+  pcacheforget(ip);
+  if(ip->size <= INLINESIZE){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -419,23 +658,20 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    ifree(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    ifree(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
 
   ip->size = 0;
   iupdate(ip);
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared is enough.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -448,17 +684,18 @@ stati(struct inode *ip, struct stat *st)
 
 //PAGEBREAK!
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared is enough.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
+  int seq;
   struct buf *bp;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
       return -1;
-    return devsw[ip->major].read(ip, dst, n);
+    return devsw[ip->major].read(ip, dst, off, n);
   }
 
   if(off > ip->size || off + n < off)
@@ -466,15 +703,52 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->size <= INLINESIZE){
+    if(ucopy(dst, (char*)ip->addrs + off, n) < 0)
+      return -1;
+    return n;
+  }
+
+  seq = (off == ip->raoff);
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+    if(ucopy(dst, bp->data + off%BSIZE, m) < 0){
+      brelse(bp);
+      return -1;
+    }
     brelse(bp);
   }
+
+  // a read that starts where the last one ended is probably part of a
+  // sequential scan, so start fetching the blocks after it
+  if(seq)
+    readahead(ip, off / BSIZE);
+  else
+    ip->rablock = 0;
+  ip->raoff = off;
   return n;
 }
 
+// Queue asynchronous reads of the NREADAHEAD blocks after file
+// block bn, so the disk works on them while the caller copies out
+// the current ones. Blocks already requested are skipped.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, last;
+
+  last = bn + NREADAHEAD;
+  // never read past the end of the file: bmap() would allocate
+  if(last > (ip->size + BSIZE - 1) / BSIZE)
+    last = (ip->size + BSIZE - 1) / BSIZE;
+  for(b = ip->rablock > bn ? ip->rablock : bn; b < last; b++)
+    breadahead(ip->dev, bmap(ip, b));
+  if(b > ip->rablock)
+    ip->rablock = b;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -482,7 +756,9 @@ int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
+  int r;
   struct buf *bp;
+  char data[INLINESIZE];
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -492,22 +768,51 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE) // overflows 32 bits with big blocks
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+  r = 0;
+  if(off + n <= INLINESIZE){
+    // still fits in the inode; copied in whole or not at all
+    if(ucopy(data, src, n) < 0)
+      return -1;
+    memmove((char*)ip->addrs + off, data, n);
+    off += n;
+    if(off > ip->size)
+      ip->size = off;
+    if(n > 0)
+      iupdate(ip);
+  } else {
+    if(ip->size <= INLINESIZE && ip->size > 0){
+      // outgrowing the inode: move the data out to a block first
+      memmove(data, ip->addrs, ip->size);
+      memset(ip->addrs, 0, sizeof(ip->addrs));
+      bp = bread(ip->dev, bmap(ip, 0));
+      memmove(bp->data, data, ip->size);
+      log_write(bp);
+      brelse(bp);
+    }
+    for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = ucopy(bp->data + off%BSIZE, src, m);
+      log_write(bp);
+      brelse(bp);
+      if(r < 0)
+        break;
+    }
   }
 
+  if(n > 0)
+    pcacheforget(ip);
   if(n > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  if(n > 0)
+    ip->gen = loggen();
+  // a failed copy left off at the end of what was written
+  return r < 0 ? -1 : n;
 }
 
 //PAGEBREAK!
@@ -519,8 +824,83 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+static struct dcent*
+dcset(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return dcache.ent[h % DCSETS];
+}
+
+// Look name up in directory dir; returns 1 and sets *inum if cached.
+static int
+dclookup(uint dev, uint dir, char *name, uint *inum)
+{
+  struct dcent *e, *set;
+
+  acquire(&dcache.lock);
+  set = dcset(dev, dir, name);
+  for(e = set; e < set + DCWAYS; e++)
+    if(e->dir == dir && e->dev == dev && namecmp(name, e->name) == 0){
+      *inum = e->inum;
+      release(&dcache.lock);
+      return 1;
+    }
+  release(&dcache.lock);
+  return 0;
+}
+
+// Record that name in directory dir is inode inum (0: no such name).
+static void
+dcenter(uint dev, uint dir, char *name, uint inum)
+{
+  struct dcent *e, *set;
+  int h;
+
+  acquire(&dcache.lock);
+  set = dcset(dev, dir, name);
+  for(e = set; e < set + DCWAYS; e++)
+    if(e->dir == dir && e->dev == dev && namecmp(name, e->name) == 0)
+      break;
+  if(e == set + DCWAYS){
+    h = set - dcache.ent[0];
+    e = set + dcache.next[h / DCWAYS];
+    dcache.next[h / DCWAYS] = (dcache.next[h / DCWAYS] + 1) % DCWAYS;
+    e->dev = dev;
+    e->dir = dir;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  release(&dcache.lock);
+}
+
+// name is gone from directory dp. Caller holds dp->lock.
+void
+dcacheforget(struct inode *dp, char *name)
+{
+  dcenter(dp->dev, dp->inum, name, 0);
+}
+
+// Drop everything cached about the names in directory dir.
+static void
+dcachepurge(uint dev, uint dir)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent[0]; e < dcache.ent[DCSETS]; e++)
+    if(e->dir == dir && e->dev == dev)
+      e->dir = 0;
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared is enough.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -530,6 +910,10 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // the cache doesn't know offsets
+  if(poff == 0 && dclookup(dp->dev, dp->inum, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -540,10 +924,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcenter(dp->dev, dp->inum, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dcenter(dp->dev, dp->inum, name, 0);
   return 0;
 }
 
@@ -573,6 +959,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp->dev, dp->inum, name, inum);
 
   return 0;
 }
@@ -631,22 +1018,24 @@ namex(char *path, int nameiparent, char *name)
   else
     ip = idup(myproc()->cwd);
 
+  // lookups only read the directories, so many can walk the same ones at once
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
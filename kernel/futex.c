@@ -0,0 +1,113 @@
+// Futexes: a process waits on a word of user memory until another wakes it.
+//
+// User locks (see thread.c) live in ordinary memory and are taken with an
+// atomic instruction; only a thread that has to wait makes a system call,
+// futexwait(addr, val), which sleeps as long as *addr still holds val, and
+// only one that sees it may have waiters calls futexwake(addr, n).
+//
+// The sleep channel is the kernel address of the word, through the direct
+// map, so that processes sharing the page (threads, or processes with a
+// MAP_SHARED mapping of it) meet on the same channel whatever address each
+// one has it at. A copy-on-write page is copied before waiting on it: the
+// waker's store would copy it anyway, and leave the waiter on the old page.
+// A page that another fork() then makes copy-on-write again can still
+// strand a waiter that way; callers loop on the value, so a lost wakeup only
+// lasts until the next one.
+//
+// The check of *addr and going to sleep happen under one of a few locks,
+// picked by the channel, which futexwake() takes too; that is what keeps a
+// wakeup between the waiter's check and its sleep from being lost.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NFUTEXLOCK 16
+
+static struct spinlock futexlocks[NFUTEXLOCK];
+
+static struct spinlock*
+futexlock(char *key)
+{
+  return &futexlocks[((uint)key / sizeof(uint)) % NFUTEXLOCK];
+}
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXLOCK; i++)
+    initlock(&futexlocks[i], "futex");
+}
+
+// The channel for the word at user address addr of p: its kernel address.
+// Returns 0 if it can't be mapped writable (or read-only, if it is).
+static char*
+futexkey(struct proc *p, uint addr)
+{
+  pte_t *pte;
+  char *key;
+  uint v;
+  int cow;
+
+  for(;;){
+    // fault the page in, as a user access would
+    if(ucopy(&v, (void*)addr, sizeof(v)) < 0)
+      return 0;
+    uvmlock(p->pgdir);
+    pte = walkpgdir(p->pgdir, (char*)addr, 0);
+    if(pte && (*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U) && !(*pte & PTE_COW)){
+      key = (char*)P2V(PTE_ADDR(*pte)) + (addr & (PGSIZE-1));
+      uvmunlock(p->pgdir);
+      return key;
+    }
+    cow = pte && (*pte & PTE_COW);
+    uvmunlock(p->pgdir);
+    if(!cow || cowfault(p->pgdir, addr) < 0)
+      return 0;
+  }
+}
+
+// Sleep until woken by futexwake() on addr, if the word there still holds val.
+// Returns -1 if it doesn't, or if the process is killed, else 0 once woken,
+// whether or not the word changed meanwhile.
+int
+futexwait(uint addr, uint val)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  char *key;
+
+  if(addr % sizeof(uint) != 0 || (key = futexkey(p, addr)) == 0)
+    return -1;
+  lk = futexlock(key);
+  acquire(lk);
+  if(*(uint*)key != val || p->killed){
+    release(lk);
+    return -1;
+  }
+  sleep(key, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake up to n processes waiting on addr. Returns how many were woken.
+int
+futexwake(uint addr, int n)
+{
+  struct spinlock *lk;
+  char *key;
+
+  if(addr % sizeof(uint) != 0 || n <= 0 || (key = futexkey(myproc(), addr)) == 0)
+    return -1;
+  lk = futexlock(key);
+  acquire(lk);
+  n = wakeupn(key, n);
+  release(lk);
+  return n;
+}
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver: bus-master DMA when the PCI IDE controller supports it,
+// else programmed I/O, with an elevator queue.
 // IDE device provides access to disks connected to the PC standard IDE controller
 // IDE is now falling out of fashion in favor of SCSI and SATA
 
@@ -14,6 +15,9 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "trace.h"
+#include "vmstat.h"
 
 // Driver - code that manages a hardware device
 // - tells device to performs operations
@@ -23,8 +27,10 @@
 // - a driver executes concurrently with the device it manages
 // - device interface can be complex and poorly documented
 
-// Modern disk drivers usually talk to the disk via DMA, but for simplicity xv6 uses port I/O
-// Much slower, and requires active participation from the CPU
+// Modern disk drivers usually talk to the disk via DMA; port I/O is much slower, and requires active
+// participation from the CPU. This driver uses the PCI bus-master DMA interface of the IDE controller
+// when there is one (IDEDMA): the CPU only fills in a table of physical memory regions and starts the
+// transfer, and the controller moves the data and interrupts when done.
 
 // inb/outb read/write a byte from a port
 // Storage disks have all kinds of standardized specifications, including IDE (Integrated Drive Electronics) and ATA (Advanced Technolocy Attachment)
@@ -53,15 +59,46 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_SETMUL 0xc6
+
+// bus master registers of a channel, at the controller's BAR4 (primary channel first)
+#define BM_CMD        0     // bit 0 starts/stops the transfer, bit 3 set = disk to memory
+#define BM_STATUS     2     // write 1s to clear the error and interrupt bits
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_START      0x01
+#define BM_READ       0x08
+#define BM_ERR        0x02
+#define BM_INTR       0x04
+
+// Physical region descriptor: one physically contiguous piece of a DMA
+// transfer, which may not cross a 64KB boundary. The table itself must
+// not cross one either, hence aligning it to its (power of 2) size.
+struct prd {
+  uint addr;
+  ushort len;         // bytes, 0 means 64KB
+  ushort flags;
+};
+#define PRD_EOT       0x8000 // last entry of the table
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// With DMA the command in progress covers the first nactive bufs,
+// adjacent blocks merged into a single transfer.
+// The rest of the queue is kept in elevator order: ascending from the
+// current block, then wrapping around to the lowest.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue; // queue of buffers waiting to synchronized with disk
+static int nactive;
+static int nqueued;  // bufs on idequeue, for the stat device
 
 static int havedisk1; // running with only disk 0 (boot loader and kernel) or also disk 1 (user file system)
+static int bmbase;    // bus master I/O base, 0 if the disk is driven by PIO
+#define IDEKEY(b) (((b)->dev & 1) << 28 | (b)->blockno) // position on the disks, for the elevator
+static struct prd prdt[2*IDEMERGE] __attribute__((aligned(2*IDEMERGE*sizeof(struct prd))));
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -77,15 +114,44 @@ idewait(int checkerr)
   return 0;
 }
 
+// Tell the drives the block size, so READ/WRITE MULTIPLE move a whole
+// block per interrupt. The drives' interrupt is off meanwhile, or
+// ideintr() would take it for the end of a transfer. Returns -1 if a
+// drive refuses.
+static int
+idesetmul(void)
+{
+  int i, r;
+
+  r = 0;
+  outb(0x3f6, 2);  // nIEN
+  for(i = havedisk1; i >= 0; i--){
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f2, BSIZE/SECTOR_SIZE);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    if(idewait(1) < 0)
+      r = -1;
+  }
+  outb(0x3f6, 0);
+  return r;
+}
+
 void
 ideinit(void)
 {
+  struct pcifunc f;
   int i;
 
   initlock(&idelock, "ide");
-  // tell I/O interrupt controller to forward all disk interrupts to the last CPU
-  // enable IDE_IRQ interrupt on the last CPU
-  ioapicenable(IRQ_IDE, ncpu - 1);
+  // PCI class 1 (mass storage) subclass 1 is an IDE controller; an I/O BAR4
+  // means it can be a bus master
+  if(IDEDMA && pcifind(PCI_ANY, PCI_ANY, 0x01, 0x01, &f) == 0 && (f.bar[4] & 1)){
+    pcienable(&f);
+    bmbase = f.bar[4] & ~3;
+  }
+  // tell I/O interrupt controller to forward all disk interrupts to one CPU,
+  // picked so the devices are spread over the CPUs (see ioapicenable())
+  ioapicenable(IRQ_IDE, IRQ_ANYCPU);
   idewait(0);
 
   // Check if disk 1 is present
@@ -108,29 +174,73 @@ ideinit(void)
     }
   }
 
+  // Without DMA, blocks bigger than a sector go with READ/WRITE MULTIPLE,
+  // which move a whole block per interrupt once the drives are told its size
+  if(!bmbase && BSIZE > SECTOR_SIZE && idesetmul() < 0)
+    panic("ide: set multiple");
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
+// Add PRD entries for len bytes of kernel memory at va, splitting
+// them at 64KB boundaries. Returns the next free entry.
+static struct prd*
+prdadd(struct prd *d, char *va, uint len)
+{
+  uint pa, n;
+
+  for(pa = V2P(va); len > 0; pa += n, len -= n, d++){
+    n = 0x10000 - (pa & 0xFFFF);
+    if(n > len)
+      n = len;
+    d->addr = pa;
+    d->len = n & 0xFFFF;
+    d->flags = 0;
+  }
+  return d;
+}
+
 // Start the request for b.  Caller must hold idelock.
 // i.e. read/write a buffer to/from disk
+// With DMA, also take in the bufs queued right behind b for the blocks
+// that follow it, as long as they go the same direction, and transfer
+// them all with one command.
 static void
 idestart(struct buf *b)
 {
+  struct buf *last;
+  struct prd *d;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE) // buffer block number maximum limit
+  if(b->blockno >= (1<<28) / (BSIZE/SECTOR_SIZE)) // most a 28-bit sector number can address
     panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE; // just 1 on xv6, change if we want higher disk throughput
+  int sector_per_block =  BSIZE/SECTOR_SIZE; // 1 unless built with bigger blocks (see fs.h)
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL; // single vs multi-sector command
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if (!bmbase && sector_per_block > 16) panic("idestart"); // most QEMU does with READ MULTIPLE
+
+  nactive = 1;
+  if(bmbase){
+    d = prdadd(prdt, (char*)b->data, BSIZE);
+    for(last = b; nactive < IDEMERGE && last->qnext; last = last->qnext, nactive++){
+      if(last->qnext->dev != b->dev || last->qnext->blockno != last->blockno + 1 ||
+         (last->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+        break;
+      d = prdadd(d, (char*)last->qnext->data, BSIZE);
+    }
+    d[-1].flags = PRD_EOT;
+    outl(bmbase + BM_PRDT, V2P(prdt));
+    outb(bmbase + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    outb(bmbase + BM_STATUS, BM_ERR | BM_INTR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // tell disk controller to generate interrupt once done by setting device control register
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, (nactive * sector_per_block) & 0xff);  // number of sectors, 0 meaning 256
   // hard drive geometry
   // - many stacked circular surfaces
   // - each surface has a head
@@ -142,7 +252,10 @@ idestart(struct buf *b)
   outb(0x1f4, (sector >> 8) & 0xff); // cylinder low register
   outb(0x1f5, (sector >> 16) & 0xff); // cylinder high register
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f)); // drive/head register
-  if(b->flags & B_DIRTY){
+  if(bmbase){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(bmbase + BM_CMD, ((b->flags & B_DIRTY) ? 0 : BM_READ) | BM_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
     // write data from string, 4 bytes at a time
     outsl(0x1f0, b->data, BSIZE/4);
@@ -157,27 +270,56 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int st, n;
 
   // First queued buffer is the active request.
   // don't use a sleep lock because this is an interrupt handler function, so interrupts are disabled
   // requests are stored in the global idequeue linked list, interrupt usually means disk is done with the most recent request
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(idequeue == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed DIRTY flag set
-  // using CPU instructions to move data to/from device hardware is called programmed I/O
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(bmbase){
+    // stop the bus master and acknowledge both it and the drive
+    st = inb(bmbase + BM_STATUS);
+    outb(bmbase + BM_CMD, 0);
+    outb(bmbase + BM_STATUS, BM_ERR | BM_INTR);
+    if((st & BM_ERR) || idewait(1) < 0){
+      // the blocks aren't lost: do the transfer over, by programmed I/O
+      // from now on if READ MULTIPLE can take the block size (see idestart())
+      cprintf("ide: dma error, status 0x%x\n", st);
+      if(BSIZE/SECTOR_SIZE <= 16 && (BSIZE == SECTOR_SIZE || idesetmul() == 0))
+        bmbase = 0;
+      idestart(idequeue);
+      release(&idelock);
+      return;
+    }
+  }
 
-  // Wake process sleeping on a channel for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  for(n = nactive; n > 0; n--){
+    b = idequeue;
+    idequeue = b->qnext;
+    nqueued--;
+
+    // Read data if needed DIRTY flag set
+    // using CPU instructions to move data to/from device hardware is called programmed I/O
+    if(!bmbase && !(b->flags & B_DIRTY) && idewait(1) >= 0)
+      insl(0x1f0, b->data, BSIZE/4);
+
+    // Wake process sleeping on a channel for this buf.
+    tracerec(TR_DISKDONE, b->blockno, (b->flags & B_DIRTY) != 0);
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      // readahead, nobody is sleeping on it; hand the buffer back to the cache
+      b->flags &= ~B_ASYNC;
+      brelseasync(b);
+    } else
+      wakeup(b);
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -186,10 +328,19 @@ ideintr(void)
   release(&idelock);
 }
 
+// Add the requests waiting for the disk to *st, for the stat device.
+void
+idestat(struct vmstat *st)
+{
+  st->dqueue += nqueued;
+}
+
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return once the read is queued; ideintr()
+// releases the buffer when it completes.
 // mechanism for kernel and user threads to read/write disk data without calling static idestart()
 // processes should never call this directly, it only gets called by the buffer cache code
 // i.e. processes only use the universal I/O API
@@ -200,6 +351,8 @@ void
 iderw(struct buf *b)
 {
   struct buf **pp;
+  uint pos;
+  int i;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -210,19 +363,33 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Insert b into idequeue behind the active bufs, in elevator order.
+  // Measuring every block's distance upward from the active one, with
+  // unsigned wraparound, sorts the ones below it after the ones above.
   // In the Style of Linux Torvalds
   // https://github.com/mkirchner/linked-list-good-taste
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  pp = &idequeue;
+  pos = idequeue ? IDEKEY(idequeue) : 0;
+  for(i = 0; i < nactive && *pp; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp && IDEKEY(*pp) - pos <= IDEKEY(b) - pos; pp = &(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
+  nqueued++;
+  tracerec(TR_DISKSTART, b->blockno, (b->flags & B_DIRTY) != 0);
 
   // if other buffers are in front, ideintr() means each disk interrupt start the disk on the next operation
   // otherwise, start the disk
   if(idequeue == b)
     idestart(b);
 
+  // readahead doesn't wait, ideintr() releases the buffer when the read is done
+  if(b->flags & B_ASYNC){
+    release(&idelock);
+    return;
+  }
+
   // Now this process just has to wait for the request to finish.
   // wait until buffer has been synchronized with disk
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
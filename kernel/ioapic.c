@@ -42,8 +42,17 @@
 //   - 11 - level-triggered
 // - bits 4-15 - reserved, must be 0
 
+// Each input goes to one cpu. Drivers ask for IRQ_ANYCPU, and ioapicenable()
+// spreads the devices over the cpus, so that interrupt work doesn't all land
+// on one; irqroute() moves an input later (see user/irq.c), and irqstat()
+// in trap.c reports the routing with the cpus' interrupt counts.
+
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
 #include "traps.h"
 
 #define IOAPIC  0xFEC00000   // Default physical address of IO APIC
@@ -85,6 +94,12 @@
 
 volatile struct ioapic *ioapic;
 
+static struct {
+  struct spinlock lock;  // the register window, and cpu[]
+  int maxintr;
+  int cpu[NIRQ];         // where each enabled input goes, -1 if disabled
+} irqs;
+
 // IO APIC MMIO structure: write reg, then read or write data.
 // Note - alternative to MMIO is called PMIO (port-mapped)
 struct ioapic {
@@ -112,8 +127,12 @@ ioapicinit(void)
 {
   int i, id, maxintr;
 
+  initlock(&irqs.lock, "ioapic");
   ioapic = (volatile struct ioapic*)IOAPIC;
   maxintr = (ioapicread(REG_VER) >> 16) & 0xFF;
+  irqs.maxintr = maxintr < NIRQ ? maxintr : NIRQ - 1;
+  for(i = 0; i < NIRQ; i++)
+    irqs.cpu[i] = -1;
   id = ioapicread(REG_ID) >> 24;
   if(id != ioapicid)
     cprintf("ioapicinit: id isn't equal to ioapicid; not a MP\n");
@@ -126,12 +145,64 @@ ioapicinit(void)
   }
 }
 
+// The cpu with the fewest inputs routed to it, the highest numbered of
+// those: cpu 0 has the scheduler tick's extra work (see trap()).
+// Caller holds irqs.lock.
+static int
+leastbusy(void)
+{
+  int n[NCPU], i, c;
+
+  memset(n, 0, sizeof(n));
+  for(i = 0; i < NIRQ; i++)
+    if(irqs.cpu[i] >= 0)
+      n[irqs.cpu[i]]++;
+  c = ncpu - 1;
+  for(i = ncpu - 1; i >= 0; i--)
+    if(n[i] < n[c])
+      c = i;
+  return c;
+}
+
 void
-ioapicenable(int irq, int cpunum)
+ioapicenable(int irq, int cpu)
 {
+  if(irq < 0 || irq > irqs.maxintr)
+    panic("ioapicenable");
+  acquire(&irqs.lock);
+  if(cpu == IRQ_ANYCPU || cpu < 0 || cpu >= ncpu)
+    cpu = leastbusy();
+  irqs.cpu[irq] = cpu;
   // Mark interrupt edge-triggered, active high,
-  // enabled, and routed to the given cpunum,
-  // which happens to be that cpu's APIC ID.
+  // enabled, and routed to that cpu's APIC ID.
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
-  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+  ioapicwrite(REG_TABLE+2*irq+1, cpus[cpu].apicid << 24);
+  release(&irqs.lock);
+}
+
+// Send enabled input irq to cpu from now on. Returns -1 if either is bad.
+// An interrupt already on its way to the old cpu is still handled there.
+int
+irqroute(int irq, int cpu)
+{
+  if(irq < 0 || irq > irqs.maxintr || cpu < 0 || cpu >= ncpu)
+    return -1;
+  acquire(&irqs.lock);
+  if(irqs.cpu[irq] < 0){
+    release(&irqs.lock);
+    return -1;
+  }
+  irqs.cpu[irq] = cpu;
+  ioapicwrite(REG_TABLE+2*irq+1, cpus[cpu].apicid << 24);
+  release(&irqs.lock);
+  return 0;
+}
+
+// The cpu input irq goes to, or -1 if it is disabled, for irqstat().
+int
+irqcpu(int irq)
+{
+  if(irq < 0 || irq > irqs.maxintr)
+    return -1;
+  return irqs.cpu[irq];
 }
@@ -8,6 +8,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "vmstat.h"
 
 void freerange(void *vstart, void *vend); // compiler assumes implicit "extern" for each function declaration
 extern char end[]; // first address after the kernel, loaded from ELF file
@@ -17,12 +19,36 @@ struct run {
   struct run *next;
 };
 
-struct { // unnamed struct type
+// Per-CPU cache of free pages
+// kalloc()/kfree() normally only touch the cache of the CPU they run on, so CPUs don't fight over
+// kmem.lock on every page
+// pages move between a cache and the global freelist KBATCH at a time
+// each cache still has its own lock, but it is only contended when another CPU steals from it
+#define KBATCH 32  // pages moved to/from the global pool at once
+#define KZBATCH 8  // pages kzerofill() zeroes before looking for work again
+struct kcache {
   struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} __attribute__((aligned(CACHELINE))); // a cpu's own, so it doesn't share a line with another's
+
+struct { // unnamed struct type
+  struct spinlock lock __attribute__((aligned(CACHELINE)));
   int use_lock; // in the early stages of the kernel we only use a single CPU and interrupts are disabled
                 // plus locks add overhead and acquire() needs to call mycpu() which we haven't defined yet
-  struct run *freelist;
+  struct run *freelist; // global pool, protected by lock
+  int nfree; // pages in the global pool
+  struct kcache cache[NCPU]; // only used once use_lock is set
+  struct run *zeroed; // pages already zeroed for kzalloc(), protected by lock
+  int nzeroed;
+  char *deferred; // with DEFERMEM, memory from here to deferend has never been
+  char *deferend; // handed out or freed; taken KBATCH pages at a time, under lock
+  // number of page tables mapping each physical page, so copy-on-write fork can share pages
+  // updated with atomic instructions rather than a lock since every fork and exit touches it
+  uint ref[PHYSTOP/PGSIZE] __attribute__((aligned(CACHELINE)));
 } kmem;
+
+static void kdrain(struct kcache *kc);
 // To get a better page directory, we need to assign a page of memory for it (the current one is just loaded
 // from the ELF file), a page for each page table, and a page for each mapped entry in the page tables
 // Thus need bookkeeping to track which pages have already been assigned
@@ -32,15 +58,15 @@ struct { // unnamed struct type
 // i.e. free all memory between 'end' and PHYSTOP
 // Another bootstrap problem - each page has to store the pointer to the next free page, meaning we have
 // to write to the page, meaning the page must already be mapped
-// The trick is that we do have some physical memory we can write to - between 'end' and 4MB
+// The trick is that we do have some physical memory we can write to - between 'end' and BOOTMAP
 // We can free that part for now, allocate some of those pages for a fresh page directory and some pages,
 // then use those pages to map the rest of physical memory, then come back later and free those pages
 
 // Context coming in
 // Bootloader set up GDT to ignore segmentation
 // Entry code set up barebones paging with an entrypgdir
-// Initial entrypgdir only maps first 4MB of physical memory in a huge page
-// Before we set up a new one and allocate pages in it, everything has to happen in the first 4MB
+// Initial entrypgdir only maps first BOOTMAP (16MB) of physical memory in huge pages
+// Before we set up a new one and allocate pages in it, everything has to happen in the first BOOTMAP
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -48,21 +74,32 @@ struct { // unnamed struct type
 // after installing a full page table that maps them on all cores.
 
 // initialize lock for the free list but don't use it
-// called from main() with end-4MB
+// called from main() with end-BOOTMAP
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cache[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
 
 // use lock to allocate and free pages once we have multiple CPUs, a scheduler, interrupts, etc.
-// called from main() with 4MB-PHYSTOP (at this point these vaddrs map identically to paddrs)
+// called from main() with BOOTMAP-PHYSTOP (at this point these vaddrs map identically to paddrs)
+// With DEFERMEM the range isn't walked at all: krefill() carves pages
+// off it when the free lists run dry, so boot doesn't touch every page
+// of physical memory and each page is first written by whoever uses it.
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  if(DEFERMEM){
+    kmem.deferred = (char*)PGROUNDUP((uint)vstart);
+    kmem.deferend = (char*)vend;
+  } else
+    freerange(vstart, vend);
   kmem.use_lock = 1;
 }
 
@@ -72,8 +109,10 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p)/PGSIZE] = 1; // as if it had been returned by kalloc()
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
@@ -84,25 +123,150 @@ freerange(void *vstart, void *vend)
 // and its page tables
 // i.e. this is a page allocator, not a heap allocator
 // though many heap allocator implementations use linked lists of free heap regions in the same way
+// A page shared copy-on-write is only really freed once the last reference is dropped
 void
 kfree(char *v)
 {
+  struct kcache *kc;
   struct run *r;
 
   // the only addresses we'll use above the top of physical memory are for memory-mapped I/O devices and we shouldn't be freeing those pages anyway
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
-  // Fill with junk to catch dangling refs.
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1) > 0)
+    return;
+
+#ifdef POISON
+  // Fill with junk to catch dangling refs (make POISON=1).
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+    return;
+  }
+
+  // stay on this CPU while we use its cache
+  pushcli();
+  kc = &kmem.cache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree >= 2*KBATCH)
+    kdrain(kc);
+  release(&kc->lock);
+  popcli();
+}
+
+// Take up to max pages off the list *lp, returning them as a separate list with the count in *np.
+static struct run*
+ktake(struct run **lp, int max, int *np)
+{
+  struct run *head, *tail;
+  int n;
+
+  if((head = *lp) == 0){
+    *np = 0;
+    return 0;
+  }
+  tail = head;
+  for(n = 1; n < max && tail->next; n++)
+    tail = tail->next;
+  *lp = tail->next;
+  tail->next = 0;
+  *np = n;
+  return head;
+}
+
+// Give KBATCH pages from a CPU cache back to the global pool so other CPUs can use them.
+// Caller must hold kc->lock.
+static void
+kdrain(struct kcache *kc)
+{
+  struct run *list, *tail;
+  int n;
+
+  list = ktake(&kc->freelist, KBATCH, &n);
+  kc->nfree -= n;
+  for(tail = list; tail->next; tail = tail->next)
+    ;
+
+  acquire(&kmem.lock);
+  tail->next = kmem.freelist;
+  kmem.freelist = list;
+  kmem.nfree += n;
+  release(&kmem.lock);
+}
+
+// Carve up to max never-used pages off the deferred range into a list, with the count in *np.
+// Caller must hold kmem.lock.
+static struct run*
+kcarve(int max, int *np)
+{
+  struct run *head, *r;
+  int n;
+
+  head = 0;
+  for(n = 0; n < max && kmem.deferred + PGSIZE <= kmem.deferend; n++){
+    r = (struct run*)kmem.deferred;
+    kmem.deferred += PGSIZE;
+    r->next = head;
+    head = r;
+  }
+  *np = n;
+  return head;
+}
+
+// Refill the cache of CPU id, first from the global pool and the deferred range, then by
+// stealing half of another CPU's cache. Returns one page for the caller or 0 if all memory is in use.
+// Called with interrupts disabled and without holding any kmem locks, so that two CPUs
+// stealing from each other can't deadlock.
+static struct run*
+krefill(int id)
+{
+  struct kcache *kc, *victim;
+  struct run *list, *r, *tail;
+  int n, i;
+
+  acquire(&kmem.lock);
+  list = ktake(&kmem.freelist, KBATCH, &n);
+  kmem.nfree -= n;
+  if(list == 0)
+    list = kcarve(KBATCH, &n);
+  release(&kmem.lock);
+
+  for(i = 1; list == 0 && i < ncpu; i++){
+    victim = &kmem.cache[(id + i) % ncpu];
+    acquire(&victim->lock);
+    list = ktake(&victim->freelist, (victim->nfree + 1) / 2, &n);
+    victim->nfree -= n;
+    release(&victim->lock);
+  }
+  if(list == 0)
+    return 0;
+
+  // keep the first page for the caller, cache the rest
+  r = list;
+  list = list->next;
+  n--;
+  if(list){
+    for(tail = list; tail->next; tail = tail->next)
+      ;
+    kc = &kmem.cache[id];
+    acquire(&kc->lock);
+    tail->next = kc->freelist;
+    kc->freelist = list;
+    kc->nfree += n;
+    release(&kc->lock);
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -110,16 +274,126 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  struct kcache *kc;
+  struct run *r;
+  int id;
+
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+      kmem.ref[V2P(r)/PGSIZE] = 1;
+    }
+    return (char*)r;
+  }
+
+  pushcli();
+  id = cpuid();
+  kc = &kmem.cache[id];
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  if(r == 0)
+    r = krefill(id);
+  popcli();
+  if(r){
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+  // last resort: the pool of zeroed pages
+  return kmem.zeroed ? kzalloc() : 0;
+}
+
+// Allocate a zeroed page, from the pool that kzerofill() fills while
+// a CPU is idle if it has one, else by zeroing a page from kalloc().
+char*
+kzalloc(void)
+{
+  struct run *r;
+  char *v;
+
+  r = 0;
+  if(kmem.use_lock && kmem.zeroed){
+    acquire(&kmem.lock);
+    if((r = kmem.zeroed) != 0){
+      kmem.zeroed = r->next;
+      kmem.nzeroed--;
+    }
+    release(&kmem.lock);
+  }
+  if(r){
+    r->next = 0; // the only word of the page that isn't zero
+    return (char*)r;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero a few free pages for the kzalloc() pool, up to ZEROPAGES.
+// Called from the idle loop; returns the number of pages zeroed,
+// 0 once the pool is full or memory is short.
+int
+kzerofill(void)
 {
   struct run *r;
+  int n;
 
-  if(kmem.use_lock)
+  for(n = 0; n < KZBATCH; n++){
+    if(kmem.nzeroed >= ZEROPAGES || kfreecount() < 2*ZEROPAGES)
+      break;
+    if((r = (struct run*)kalloc()) == 0)
+      break;
+    memset(r, 0, PGSIZE);
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    r->next = kmem.zeroed;
+    kmem.zeroed = r;
+    kmem.nzeroed++;
     release(&kmem.lock);
-  return (char*)r;
+  }
+  return n;
 }
 
+// Add a reference to a page already returned by kalloc(), e.g. when fork() shares it with a child.
+// Each reference is dropped with kfree().
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+  __sync_fetch_and_add(&kmem.ref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to page v. Only meaningful while the caller holds one of them.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Approximate number of free pages, for callers deciding whether an allocation could succeed.
+// Reads the counters without their locks, so the answer may be stale by a few pages.
+int
+kfreecount(void)
+{
+  int i, n;
+
+  n = kmem.nfree + kmem.nzeroed + (kmem.deferend - kmem.deferred) / PGSIZE;
+  for(i = 0; i < NCPU; i++)
+    n += kmem.cache[i].nfree;
+  return n;
+}
+
+// Fill in the page counts of *st, for the stat device.
+void
+kmemstat(struct vmstat *st)
+{
+  st->pgfree = kfreecount();
+  st->pgzeroed = kmem.nzeroed;
+}
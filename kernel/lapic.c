@@ -178,6 +178,7 @@
   #define DEASSERT   0x00000000
   #define LEVEL      0x00008000   // Level triggered
   #define BCAST      0x00080000   // Send to all APICs, including self.
+  #define OTHERS     0x000C0000   // Send to all APICs, excluding self.
   #define BUSY       0x00001000
   #define FIXED      0x00000000
 #define ICRHI   (0x0310/4)   // Interrupt Command [63:32]
@@ -198,6 +199,16 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+// Timer calibration, done once by the boot CPU in lapicinit().
+// nanoseconds and lapic timer counts are derived from a TSC and a
+// lapic count by multiplying with a 20-bit fixed-point factor, since
+// the kernel has no 64-bit division.
+#define PITHZ     1193182      // input clock of the 8253 PIT
+static uint lapictick;         // lapic timer counts per TICKNS
+static uint lapicmul;          // lapic counts per ns, << 20
+static uint tscmul;            // ns per TSC cycle, << 20
+static uint64 tsc0;            // TSC at calibration: nsecs() == 0
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -206,6 +217,73 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+// Measure the lapic timer and the TSC against one TICKNS of the PIT,
+// whose frequency is fixed: run PIT channel 2 (gated through port 0x61,
+// not wired to any interrupt) in one-shot mode and spin until its
+// output goes high.
+static void
+calibrate(void)
+{
+  uint c0, c1, latch;
+  uint64 t0, t1;
+
+  latch = PITHZ / (1000000000 / TICKNS);
+  outb(0x61, (inb(0x61) & ~0x02) | 0x01); // gate on, speaker off
+  outb(0x43, 0xB0);                       // channel 2, lo/hi byte, mode 0
+  outb(0x42, latch & 0xFF);
+  outb(0x42, latch >> 8);
+
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, 0xFFFFFFFF);
+  c0 = lapic[TCCR];
+  t0 = rdtsc();
+  while((inb(0x61) & 0x20) == 0)
+    ;
+  c1 = lapic[TCCR];
+  t1 = rdtsc();
+  lapicw(TICR, 0);
+
+  lapictick = c0 - c1;
+  lapicmul = divl((uint64)lapictick << 20, TICKNS);
+  tscmul = divl((uint64)TICKNS << 20, (uint)(t1 - t0));
+  tsc0 = rdtsc();
+}
+
+// Convert a number of TSC cycles to nanoseconds.
+uint64
+cyc2ns(uint64 d)
+{
+  return (((uint64)(uint)d * tscmul) >> 20) + (((uint64)(uint)(d >> 32) * tscmul) << 12);
+}
+
+// Nanoseconds since the boot CPU calibrated its timer.
+uint64
+nsecs(void)
+{
+  return cyc2ns(rdtsc() - tsc0);
+}
+
+// Make this CPU's timer interrupt once, ns nanoseconds from now.
+// ns == 0 stops the timer. Waits longer than a second are cut short
+// so the count fits in 32 bits; the caller just rearms.
+void
+lapiconeshot(uint64 ns)
+{
+  uint count;
+
+  if(!lapic)
+    return;
+  if(ns == 0){
+    lapicw(TICR, 0);
+    return;
+  }
+  if(ns > 1000000000)
+    ns = 1000000000;
+  count = (ns * lapicmul) >> 20;
+  lapicw(TICR, count > 0 ? count : 1);
+}
+
 void
 lapicinit(void)
 {
@@ -215,14 +293,16 @@ lapicinit(void)
   // Enable local APIC; set spurious interrupt vector to interrupt 0xFF
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-  // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  if(lapictick == 0)
+    calibrate();
+
+  // The timer counts down at bus frequency from lapic[TICR] and then
+  // issues interrupt 32, once: timerintr() rearms it for the next tick
+  // or sleep deadline, and leaves it off on an idle CPU with nothing
+  // to wait for. Start with a single tick.
   lapicw(TDCR, X1);
-  // interrupt 32 in periodic mode
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, lapictick);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -280,10 +360,12 @@ microdelay(int us)
 #define CMOS_PORT    0x70
 #define CMOS_RETURN  0x71
 
-// Start additional processor running entry code at addr.
-// See Appendix B of MultiProcessor Specification.
+// Start all the other processors at once, running entry code at addr:
+// one broadcast of the INIT and STARTUPs the MultiProcessor Specification
+// (Appendix B) sends each processor, so that they boot side by side and
+// the waits below happen once, not once per processor.
 void
-lapicstartap(uchar apicid, uint addr)
+lapicstartaps(uint addr)
 {
   int i;
   ushort *wrv;
@@ -298,11 +380,12 @@ lapicstartap(uchar apicid, uint addr)
   wrv[1] = addr >> 4;
 
   // "Universal startup algorithm."
-  // Send INIT (level-triggered) interrupt to reset other CPU.
-  lapicw(ICRHI, apicid<<24);
-  lapicw(ICRLO, INIT | LEVEL | ASSERT);
+  // Send INIT (level-triggered) interrupt to reset the other CPUs.
+  // The de-assert goes to all, as in lapicinit().
+  lapicw(ICRHI, 0);
+  lapicw(ICRLO, OTHERS | INIT | LEVEL | ASSERT);
   microdelay(200);
-  lapicw(ICRLO, INIT | LEVEL);
+  lapicw(ICRLO, BCAST | INIT | LEVEL);
   microdelay(100);    // should be 10ms, but too slow in Bochs!
 
   // Send startup IPI (twice!) to enter code.
@@ -311,12 +394,23 @@ lapicstartap(uchar apicid, uint addr)
   // should be ignored, but it is part of the official Intel algorithm.
   // Bochs complains about the second one.  Too bad for Bochs.
   for(i = 0; i < 2; i++){
-    lapicw(ICRHI, apicid<<24);
-    lapicw(ICRLO, STARTUP | (addr>>12));
+    lapicw(ICRHI, 0);
+    lapicw(ICRLO, OTHERS | STARTUP | (addr>>12));
     microdelay(200);
   }
 }
 
+// Send a fixed interrupt with the given vector to the CPU whose local
+// APIC is apicid, and wait until the local APIC has delivered it.
+void
+lapicipi(uchar apicid, int vector)
+{
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 #define CMOS_STATA   0x0a
 #define CMOS_STATB   0x0b
 #define CMOS_UIP    (1 << 7)        // RTC update in progress
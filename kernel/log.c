@@ -5,6 +5,11 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "x86.h"
+#include "logstat.h"
+#include "trace.h"
+
+#define WBATCH 32  // blocks written to disk together, see bwritev()
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -20,6 +25,12 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// With GROUPCOMMIT set, end_op() never commits itself. A
+// kernel thread, the committer, commits the accumulated batch
+// of operations once it has waited COMMITTICKS or the log is
+// nearly full, so many small operations share one commit and
+// their callers don't wait for the disk.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,6 +39,17 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// The log is double-buffered in memory. Closing a batch first copies
+// its blocks into their log buffers, which stay pinned in the cache,
+// then lets new ops in to fill the next batch (lh) while the closed
+// one (wlh) is written to the log and installed. A block the next batch
+// has changed meanwhile is installed from a private copy of what was
+// committed, and keeps the next batch's changes in the cache. FS ops so
+// only wait for the copying, not for the disk.
+// Both the log blocks and the installs to their home locations are
+// written WBATCH at a time with bwritev(), so a commit is a few sorted
+// bursts of disk writes rather than two waits on the disk per block.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -40,15 +62,30 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // most data blocks the log holds at once
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks the outstanding ops may still write
+  int committing;  // closing a batch, please wait.
+  int opwait;      // begin_opn() callers asleep on &log
+  int writing;     // in commit(), writing wlh
   int dev;
-  struct logheader lh;
+  int commitreq;   // commit the batch now rather than when it ages
+  uint batchstart; // ticks when the first block of the batch was logged
+  uint gen;        // number of the batch being built, starting at 1
+  uint committed;  // number of the last batch made durable
+  struct logstat stat;
+  struct logheader lh;  // the batch being built
+  struct logheader wlh; // the batch being committed, or recovered
+  struct buf shadow[WBATCH]; // copies install_trans() writes, see above
+  uchar shadowdata[WBATCH][BSIZE];
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void commitbatch(void);
+static void committer(void);
+static void opsleep(void);
 
 void
 initlog(int dev)
@@ -57,27 +94,77 @@ initlog(int dev)
     panic("initlog: too big logheader");
 
   struct superblock sb;
+  int i;
   initlock(&log.lock, "log");
+  for (i = 0; i < WBATCH; i++){
+    initsleeplock(&log.shadow[i].lock, "logshadow");
+    log.shadow[i].data = log.shadowdata[i];
+  }
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  // the header block lists at most LOGSIZE blocks
+  log.cap = log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
+  if(log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.gen = 1;
   recover_from_log();
+  if(GROUPCOMMIT && kthread("logcommit", committer) == 0)
+    panic("initlog: committer");
+}
+
+// Is blockno in the batch being built? Caller holds its buffer
+// locked, so no op can add it meanwhile.
+static int
+inbatch(int blockno)
+{
+  int i, r;
+
+  r = 0;
+  acquire(&log.lock);
+  for (i = 0; i < log.lh.n; i++)
+    if (log.lh.block[i] == blockno)
+      r = 1;
+  release(&log.lock);
+  return r;
 }
 
 // Copy committed blocks from log to their home location
 static void
 install_trans(void)
 {
-  int tail;
+  struct buf *lbuf, *dbuf, *bs[WBATCH], *s;
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.wlh.n; tail += n) {
+    n = log.wlh.n - tail < WBATCH ? log.wlh.n - tail : WBATCH;
+    for (i = 0; i < n; i++) {
+      lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf = bread(log.dev, log.wlh.block[tail+i]); // read dst
+      if (inbatch(dbuf->blockno)) {
+        // dst holds the next batch's changes; write what was committed
+        s = &log.shadow[i];
+        acquiresleep(&s->lock);
+        s->dev = dbuf->dev;
+        s->blockno = dbuf->blockno;
+        s->flags = B_VALID | B_PRIVATE;
+        memmove(s->data, lbuf->data, BSIZE);
+        brelse(dbuf);
+        bs[i] = s;
+      } else {
+        memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+        bs[i] = dbuf;
+      }
+      brelse(lbuf);
+    }
+    bwritev(bs, n);  // write dsts to disk
+    for (i = 0; i < n; i++) {
+      if (bs[i]->flags & B_PRIVATE)
+        releasesleep(&bs[i]->lock);
+      else
+        brelse(bs[i]);
+    }
   }
 }
 
@@ -88,9 +175,9 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.wlh.n = lh->n;
+  for (i = 0; i < log.wlh.n; i++) {
+    log.wlh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -104,9 +191,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.wlh.n;
+  for (i = 0; i < log.wlh.n; i++) {
+    hb->block[i] = log.wlh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,7 +204,7 @@ recover_from_log(void)
 {
   read_head();
   install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
+  log.wlh.n = 0;
   write_head(); // clear the log
 }
 
@@ -125,35 +212,92 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Most blocks a single op may reserve with begin_opn():
+// half the log, so a big op still leaves room for others.
+int
+logopmax(void)
+{
+  return log.cap / 2 > MAXOPBLOCKS ? log.cap / 2 : MAXOPBLOCKS;
+}
+
+// Start an FS op that writes at most n blocks, n <= logopmax().
+void
+begin_opn(int n)
+{
+  if(n > logopmax())
+    panic("begin_opn: too many blocks");
   acquire(&log.lock);
+  log.stat.ops++;
+  if(log.committing || log.lh.n + log.reserved + n > log.cap)
+    log.stat.opwaits++;
   while(1){
     if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+      opsleep();
+    } else if(log.lh.n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      if(GROUPCOMMIT && log.lh.n > 0){
+        log.commitreq = 1;
+        wakeup(&log.lh);
+      }
+      opsleep();
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      // the wakeup that let us in only woke one; the next may fit too
+      if(log.opwait > 0 && log.lh.n + log.reserved < log.cap)
+        wakeup(&log);
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
-void
-end_op(void)
+// Wait in begin_opn() for the commit or the end_op() that makes
+// room. Waiters sleep exclusively, so an end_op() that frees a few
+// blocks wakes one of them rather than all; each that gets in passes
+// the wakeup on while there is room. Caller holds log.lock.
+static void
+opsleep(void)
 {
-  int do_commit = 0;
+  log.opwait++;
+  sleepexcl(&log, &log.lock);
+  log.opwait--;
+}
 
+// End an op started with begin_opn(n).
+// commits if this was the last outstanding operation,
+// unless the committer thread does that for us.
+void
+end_opn(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
+  if(GROUPCOMMIT){
+    if(log.outstanding == 0 && log.lh.n + MAXOPBLOCKS > log.cap)
+      log.commitreq = 1; // the next begin_op() would have to wait
+    // the committer may be waiting for this op to finish
+    if(log.outstanding == 0 && (log.committing || log.commitreq))
+      wakeup(&log.lh);
+    wakeup(&log);
+    release(&log.lock);
+    return;
+  }
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
+  if(log.outstanding == 0 && log.lh.n > 0){
     log.committing = 1;
+    commitbatch();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -161,46 +305,179 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
-
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the closed batch's modified blocks from cache into their log
+// buffers, pinned with B_DIRTY until write_log() writes them, so that
+// the next batch's ops can go on changing the cached blocks.
 static void
-write_log(void)
+snapshot(void)
 {
+  struct buf *from, *to;
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (tail = 0; tail < log.wlh.n; tail++) {
+    to = bread(log.dev, log.start+tail+1); // log block
+    from = bread(log.dev, log.wlh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    to->flags |= B_DIRTY;
     brelse(from);
     brelse(to);
   }
 }
 
+// Write the log buffers snapshot() filled to the log.
+static void
+write_log(void)
+{
+  struct buf *to[WBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.wlh.n; tail += n) {
+    n = log.wlh.n - tail < WBATCH ? log.wlh.n - tail : WBATCH;
+    for (i = 0; i < n; i++)
+      to[i] = bread(log.dev, log.start+tail+i+1); // log block
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
+  }
+}
+
+// Close the batch being built and commit it. Caller holds log.lock,
+// has set log.committing and seen no ops outstanding. New ops may
+// start once the batch is copied out; they fill the next batch while
+// this one goes to disk. Returns with log.lock held again.
+static void
+commitbatch(void)
+{
+  uint gen;
+  int n;
+
+  // the batch before may still be on its way to disk (without the committer)
+  while(log.writing)
+    sleep(&log, &log.lock);
+  log.wlh = log.lh;
+  log.lh.n = 0;
+  gen = log.gen++;
+  log.writing = 1;
+  release(&log.lock);
+
+  snapshot();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  n = log.wlh.n;
+  tracerec(TR_COMMIT, gen, n);
+  commit();
+  tracerec(TR_COMMITDONE, gen, n);
+
+  acquire(&log.lock);
+  log.writing = 0;
+  log.committed = gen;
+  wakeup(&log);
+}
+
+// Body of the committer thread, which commits the batch of
+// finished operations whenever it asks to be committed or ages.
+static void
+committer(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(log.lh.n == 0 || (!log.commitreq && ticks - log.batchstart < COMMITTICKS)){
+      if(log.lh.n == 0)
+        log.commitreq = 0;
+      sleep(&log.lh, &log.lock);
+    }
+    // keep new ops out of the batch, then wait for the running ones
+    log.committing = 1;
+    while(log.outstanding > 0)
+      sleep(&log.lh, &log.lock);
+    log.commitreq = 0;
+    commitbatch();
+  }
+}
+
+// Number of the batch the current FS op's writes belong to.
+// Stable between begin_op() and end_op(), since a batch is
+// only closed when no ops are outstanding.
+uint
+loggen(void)
+{
+  return log.gen;
+}
+
+// Wait until batch gen, and every batch before it, is on disk,
+// asking the committer to commit it right away rather than
+// when it ages. loggen() of the current batch waits for all
+// FS ops that have finished so far.
+void
+logwait(uint gen)
+{
+  acquire(&log.lock);
+  // the batch being built has nothing in it: wait only for the one before
+  if(gen == log.gen && log.lh.n == 0)
+    gen--;
+  while(log.committed < gen){
+    log.commitreq = 1;
+    wakeup(&log.lh);
+    sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// Called on every clock tick to start the committer on a batch
+// that has been waiting COMMITTICKS.
+void
+logtick(void)
+{
+  if(!GROUPCOMMIT)
+    return;
+  acquire(&log.lock);
+  if(log.lh.n > 0 && !log.committing && ticks - log.batchstart >= COMMITTICKS)
+    wakeup(&log.lh);
+  release(&log.lock);
+}
+
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  uint64 t0;
+  int n;
+
+  if (log.wlh.n > 0) {
+    t0 = rdtsc();
+    n = log.wlh.n;
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
     install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
+    log.wlh.n = 0;
     write_head();    // Erase the transaction from the log
+
+    acquire(&log.lock);
+    log.stat.commits++;
+    log.stat.logged += n;
+    if(n > log.stat.maxcommit)
+      log.stat.maxcommit = n;
+    log.stat.commitkcyc += (rdtsc() - t0) >> 10;
+    release(&log.lock);
   }
 }
 
+// Copy the log counters into *st.
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  release(&log.lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
 // commit()/write_log() will do the disk write.
@@ -215,19 +492,25 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
+  log.stat.writes++;
   for (i = 0; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
+  if (i < log.lh.n)
+    log.stat.absorbed++;
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n){
+    if (i == 0)
+      log.batchstart = ticks;
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
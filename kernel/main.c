@@ -25,15 +25,21 @@ main(void)
   char * y = __STAB_END__;
   char * z = __STABSTR_BEGIN__;
   char * w = __STABSTR_END__;
+  uint64 t[5]; // boot phase timestamps, printed once the TSC is calibrated
+  t[0] = rdtsc();
   // suppress unused variable warning
   (void)x;
   (void)y;
   (void)z;
   (void)w;
+  // %gs for mycpu() on this cpu, which pushcli() uses from the first lock on
+  bootseginit();
   // solves another bootstrap problem around paging - need to allocate pages in order to use the rest of the
   // memory, but can't allocate those pages without first freeing the rest of the memory, which requires
-  // allocating pages... This function frees the the memory between 'end' and 4MB
-  kinit1(end, P2V(4*1024*1024)); // phys page allocator
+  // allocating pages... This function frees the the memory between 'end' and BOOTMAP
+  // the boot loader's framebuffer, if any, has to be found before kinit1() reuses its information
+  fbinit();        // framebuffer console
+  kinit1(end, P2V(BOOTMAP)); // phys page allocator
   // allocates a page of memory to hold the fancy full-fledged page directory
   // sets it up with mappings for the kernel's instructions and data, all of physical memory, and I/O space
   // switches to that page directory, throwing away entrypgdir
@@ -42,6 +48,7 @@ main(void)
   mpinit();        // detect other processors
   // programs this CPU's local interrupt controller so it'll deliver timer interrupts, exceptions, etc.
   lapicinit();     // interrupt controller
+  t[1] = rdtsc();
   // sets up this CPU's kernel segment descriptors in its GDT
   // we still won't really use segmentation, but we'll at least use the permission bits
   seginit();       // segment descriptors
@@ -58,25 +65,39 @@ main(void)
   // xv6 uses this to communicate with emulators like QEMU and Bochs
   uartinit();      // serial port
   pinit();         // initializes empty process table
+  futexinit();     // locks for futexwait() and futexwake()
   // sets up IDT (interrupt descriptor table) so the CPU can find interrupt handlers to deal with exceptions
   // and interrupts
   tvinit();        // trap vectors
   // initializes the buffer cache, a linked list of buffers holding cached copies of disk data
   binit();         // buffer cache
+  pcacheinit();    // page cache for program text
   // sets up the file table, a global array of all open files in the system
   // there are other parts of the file system that need to be initialized, e.g. logging layer and inode layer
   // but those might require sleeping which we can only do from user mode, so we'll do that in the first
   // user process we set up
   fileinit();      // file table
+  pipeinit();      // pipe objects
+  netinit();       // network stack and sockets
+  statinit();      // stat device
   // initializes the disk controller
   // checks whether the file system disk is present (because both the kernel and bootloader are on the boot
   // disk, which is separate from the disk with user programs)
   // sets up disk interrupts
   ideinit();       // disk 
+  virtioinit();    // virtio disk, if there is one, takes over the file system disk
+  t[2] = rdtsc();
   // loads entry code for all other CPUs into memory, and runs setup process for each new CPU
   startothers();   // start other processors
-  // finishes initializing page allocator by freeing memoery between 4MB and PHYSTOP
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  t[3] = rdtsc();
+  // finishes initializing page allocator by freeing memoery between BOOTMAP and PHYSTOP
+  // (or, with DEFERMEM, just recording that range for kalloc() to take pages from later)
+  kinit2(P2V(BOOTMAP), P2V(PHYSTOP)); // must come after startothers()
+  e1000init();     // network card, if there is one; its receive buffers need kinit2()
+  t[4] = rdtsc();
+  cprintf("boot: kinit1+mp+lapic %dus, devices %dus, startothers %dus, kinit2 %dus\n",
+          divl(cyc2ns(t[1] - t[0]), 1000), divl(cyc2ns(t[2] - t[1]), 1000),
+          divl(cyc2ns(t[3] - t[2]), 1000), divl(cyc2ns(t[4] - t[3]), 1000));
   // creates the first user process, which will run initialization steps to be done in user space
   // then starts a shell
   userinit();      // first user process
@@ -90,8 +111,10 @@ main(void)
 static void
 mpenter(void)
 {
-  switchkvm();
+  // seginit() first, for the mycpu() in switchkvm(); entrypgdir maps
+  // all of the kernel's data meanwhile
   seginit();
+  switchkvm();
   lapicinit();
   mpmain();
 }
@@ -102,20 +125,23 @@ mpmain(void)
 {
   cprintf("cpu%d: starting %d\n", cpuid(), cpuid());
   idtinit();       // load idt register
+  sysenterinit();  // fast system calls
   xchg(&(mycpu()->started), 1); // tell startothers() we're up
   scheduler();     // start running processes
 }
 
 pde_t entrypgdir[];  // For entry.S
 
-// Start the non-boot (AP) processors.
+// Start the non-boot (AP) processors, all at once: they run entryother.S
+// and mpenter() side by side, so boot waits for the slowest rather than
+// for each in turn.
 static void
 startothers(void)
 {
   extern uchar _binary_entryother_start[], _binary_entryother_size[];
   uchar *code;
   struct cpu *c;
-  char *stack;
+  int n;
 
   // Write entry code to unused memory at 0x7000.
   // The linker has placed the image of entryother.S in
@@ -123,24 +149,31 @@ startothers(void)
   code = P2V(0x7000);
   memmove(code, _binary_entryother_start, (uint)_binary_entryother_size);
 
+  // Tell entryother.S what stacks to use, where to enter, and what
+  // pgdir to use. We cannot use kpgdir yet, because the AP processor
+  // is running in low  memory, so we use entrypgdir for the APs too.
+  // Each AP takes the next stack from the table below code-16 as it
+  // gets there; which cpu it is, seginit() finds out.
+  n = 0;
   for(c = cpus; c < cpus+ncpu; c++){
     if(c == mycpu())  // We've started already.
       continue;
+    *(void**)(code-20-4*n) = kalloc() + KSTACKSIZE;
+    n++;
+  }
+  *(int*)(code-4) = n;
+  *(void(**)(void))(code-8) = mpenter;
+  *(int**)(code-12) = (void *) V2P(entrypgdir);
+  *(int*)(code-16) = 0;
+  if(n == 0)
+    return;
 
-    // Tell entryother.S what stack to use, where to enter, and what
-    // pgdir to use. We cannot use kpgdir yet, because the AP processor
-    // is running in low  memory, so we use entrypgdir for the APs too.
-    stack = kalloc();
-    *(void**)(code-4) = stack + KSTACKSIZE;
-    *(void(**)(void))(code-8) = mpenter;
-    *(int**)(code-12) = (void *) V2P(entrypgdir);
-
-    lapicstartap(c->apicid, V2P(code));
+  lapicstartaps(V2P(code));
 
-    // wait for cpu to finish mpmain()
+  // wait for every cpu to finish mpmain()
+  for(c = cpus; c < cpus+ncpu; c++)
     while(c->started == 0)
       ;
-  }
 }
 
 // The boot page table used in entry.S and entryother.S.
@@ -150,12 +183,19 @@ startothers(void)
 
 __attribute__((__aligned__(PGSIZE))) // required by paging hardware
 pde_t entrypgdir[NPDENTRIES] = { // 1024 entries of type unsigned int
-  // Map VA's [0, 4MB) to PA's [0, 4MB)
+  // Map VA's [0, BOOTMAP) to PA's [0, BOOTMAP), 16MB
   // Set pages as present, writable and 4MB in size
   [0] = (0) | PTE_P | PTE_W | PTE_PS, // C allows setting specific entries in an array, rest set to 0
-  // Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
+  [1] = (1*SUPERPGSIZE) | PTE_P | PTE_W | PTE_PS,
+  [2] = (2*SUPERPGSIZE) | PTE_P | PTE_W | PTE_PS,
+  [3] = (3*SUPERPGSIZE) | PTE_P | PTE_W | PTE_PS,
+  // Map VA's [KERNBASE, KERNBASE+BOOTMAP) to PA's [0, BOOTMAP)
   // Same as [PDX(KERNBASE)] - page directory index part of virtual address
+  // the per-cpu arrays for NCPU cpus make the kernel much bigger than 4MB
   [KERNBASE>>PDXSHIFT] = (0) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+1] = (1*SUPERPGSIZE) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+2] = (2*SUPERPGSIZE) | PTE_P | PTE_W | PTE_PS,
+  [(KERNBASE>>PDXSHIFT)+3] = (3*SUPERPGSIZE) | PTE_P | PTE_W | PTE_PS,
 };
 
 //PAGEBREAK!
@@ -0,0 +1,445 @@
+// Memory mappings: mmap() and munmap().
+//
+// Each process has a small table of mappings (p->vma), placed from KERNBASE
+// down so the heap can keep growing up towards them. Nothing is mapped by
+// mmap() itself, except shared anonymous memory (see below): vmafault()
+// maps each page the first time it's touched, as lazyfault() does for the heap.
+//
+// A page of a file in a private mapping comes straight from the page cache
+// (see pcache.c), mapped copy-on-write, so reading a mapped file copies
+// nothing, and every process mapping the same page of a file shares it.
+// A shared mapping gets a copy of the cache's page instead, which it maps
+// writable: its stores mustn't show through private mappings or running
+// programs. munmap() (or exit() or exec()) writes the pages the hardware
+// marked dirty back to the file; until then, read() and other processes
+// mapping the file don't see them. The last, partial page of a file is a
+// private copy, and a mapping never changes the file's size: what lies past
+// the end is zero and isn't written back.
+//
+// Shared mappings are PTE_SHARED, which fork() leaves writable in both
+// processes instead of making them copy-on-write, so a child shares them
+// with its parent. Shared anonymous memory is allocated by mmap() for that
+// reason: a page the parent never touched couldn't be shared otherwise.
+//
+// The threads of a process (see clone()) share its table, p->leader->vma,
+// and change it holding the page table's lock (see uvmlock()). A page that
+// munmap() unmaps is freed only once no other cpu can have it in its TLB.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Is va in one of p's mappings?
+// Without the lock, for trap() to pick the fault handler: vmafault() checks again.
+int
+invma(struct proc *p, uint va)
+{
+  return va < KERNBASE && findvma(p, va) != 0;
+}
+
+// Does [va, va+n) lie within one of p's mappings? For argptr().
+int
+vmarange(struct proc *p, uint va, uint n)
+{
+  struct vma *v;
+  int r;
+
+  if(va + n < va)
+    return 0;
+  uvmlock(p->pgdir);
+  r = (v = findvma(p, va)) != 0 && va + n <= v->end;
+  uvmunlock(p->pgdir);
+  return r;
+}
+
+// Lowest address mapped, which the heap mustn't grow past.
+// Caller holds p's page table lock, or p isn't threaded.
+uint
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint base;
+
+  base = KERNBASE;
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++)
+    if(v->end && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Find room for len bytes, as high as possible, or return 0.
+static uint
+vmaplace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint top, a;
+
+  top = KERNBASE;
+again:
+  if(top - PGROUNDUP(p->sz) < len)
+    return 0;
+  a = top - len;
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++)
+    if(v->end && v->start < top && v->end > a){
+      top = v->start;
+      goto again;
+    }
+  return a;
+}
+
+// Write a dirty page of shared mapping v at va back to the file,
+// in pieces no bigger than filewrite() uses.
+static void
+vmawriteback(struct vma *v, uint va, char *page)
+{
+  struct inode *ip;
+  uint off, n, i, n1;
+  int nblocks, max;
+
+  ip = v->f->ip;
+  off = v->off + (va - v->start);
+  nblocks = logopmax();
+  max = ((nblocks-1-3-2) / 2) * BSIZE;
+  for(i = 0; i < PGSIZE; i += n1){
+    begin_opn(nblocks);
+    ilock(ip);
+    n = off + i < ip->size ? ip->size - (off + i) : 0;
+    n1 = PGSIZE - i;
+    if(n1 > max)
+      n1 = max;
+    if(n1 > n)
+      n1 = n;
+    if(n1 > 0)
+      writei(ip, page + i, off + i, n1);
+    iunlock(ip);
+    end_opn(nblocks);
+    if(n1 == 0)
+      break;
+  }
+}
+
+// Write the dirty pages of [start, end) in v, a copy of one of p's
+// shared file mappings holding its own reference to the file, back
+// to the file. Writing sleeps, so each page is held by a reference
+// rather than the lock while it's written.
+static void
+vmasync(struct proc *p, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  char *page;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    page = 0;
+    uvmlock(p->pgdir);
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & (PTE_P|PTE_D)) == (PTE_P|PTE_D)){
+      page = P2V(PTE_ADDR(*pte));
+      kincref(page);
+    }
+    uvmunlock(p->pgdir);
+    if(pte == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(page){
+      vmawriteback(v, a, page);
+      kfree(page);
+    }
+  }
+}
+
+// Map len bytes of f from offset off (or anonymous memory if f is 0)
+// into the current process. Returns the address, or 0 on error.
+uint
+mmap(struct file *f, uint off, uint len, int prot, int flags)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint a;
+  char *mem;
+  int perm;
+
+  if(len == 0 || len > KERNBASE || off % PGSIZE != 0)
+    return 0;
+  len = PGROUNDUP(len);
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return 0;
+  if(f){
+    if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+      return 0;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return 0;
+  }
+
+  uvmlock(p->pgdir);
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &p->leader->vma[NVMA] || (a = vmaplace(p, len)) == 0){
+    uvmunlock(p->pgdir);
+    return 0;
+  }
+  v->start = a;
+  v->end = a + len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+
+  if(f == 0 && (flags & MAP_SHARED) && prot != PROT_NONE){
+    perm = PTE_U | PTE_SHARED | ((prot & PROT_WRITE) ? PTE_W : 0);
+    for(; a < v->end; a += PGSIZE){
+      if((mem = kzalloc()) == 0)
+        goto bad;
+      if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0){
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
+  uvmunlock(p->pgdir);
+  return v->start;
+
+bad:
+  // nothing returned the range to user code yet, so no TLB has it
+  uvmdetach(p->pgdir, v->start, a);
+  v->end = 0;
+  uvmunlock(p->pgdir);
+  uvmreap(p->pgdir, v->start, a);
+  return 0;
+}
+
+// Unmap [addr, addr+len) of the current process, which may cover
+// any part of any number of mappings. Returns -1 if that would split
+// a mapping in two and there is no room for the second half.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv, sv;
+  struct file *closef[NVMA];
+  uint end, s, e;
+  int i, nclose;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if(end < addr || end > KERNBASE)
+    return -1;
+
+  // write back the dirty pages of shared file mappings first, one mapping at a time
+  for(i = 0; i < NVMA; i++){
+    uvmlock(p->pgdir);
+    v = &p->leader->vma[i];
+    if(v->end == 0 || v->end <= addr || v->start >= end ||
+       v->f == 0 || !(v->flags & MAP_SHARED)){
+      uvmunlock(p->pgdir);
+      continue;
+    }
+    sv = *v;
+    filedup(sv.f);
+    uvmunlock(p->pgdir);
+    vmasync(p, &sv, addr > sv.start ? addr : sv.start, end < sv.end ? end : sv.end);
+    fileclose(sv.f);
+  }
+
+  uvmlock(p->pgdir);
+  nv = 0;
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++)
+    if(v->end && addr > v->start && end < v->end){
+      for(nv = p->leader->vma; nv < &p->leader->vma[NVMA]; nv++)
+        if(nv->end == 0)
+          break;
+      if(nv == &p->leader->vma[NVMA]){
+        uvmunlock(p->pgdir);
+        return -1;
+      }
+    }
+
+  nclose = 0;
+  for(v = p->leader->vma; v < &p->leader->vma[NVMA]; v++){
+    if(v->end == 0 || v->end <= addr || v->start >= end)
+      continue;
+    s = addr > v->start ? addr : v->start;
+    e = end < v->end ? end : v->end;
+    uvmdetach(p->pgdir, s, e);
+    if(s == v->start && e == v->end){
+      if(v->f)
+        closef[nclose++] = v->f;
+      v->end = 0;
+    } else if(s == v->start){
+      v->off += e - v->start;
+      v->start = e;
+    } else if(e == v->end){
+      v->end = s;
+    } else {
+      // nv was reserved above
+      *nv = *v;
+      nv->start = e;
+      nv->off = v->off + (e - v->start);
+      if(nv->f)
+        filedup(nv->f);
+      v->end = s;
+    }
+  }
+  uvmunlock(p->pgdir);
+
+  uvmflush(p->pgdir, addr, end, 1);
+  uvmreap(p->pgdir, addr, end);
+  for(i = 0; i < nclose; i++)
+    fileclose(closef[i]);
+  return 0;
+}
+
+// Handle a fault on va in one of p's mappings (see invma()). Returns 0
+// if a page was mapped, -1 if it is there already (e.g. a write to a
+// read-only mapping), the mapping is PROT_NONE, there is no memory, or
+// the file would have to be read holding a spinlock (see textfault()).
+int
+vmafault(struct proc *p, uint va)
+{
+  struct vma *v, sv;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem, *page;
+  uint off, n;
+  int perm, r;
+
+  va = PGROUNDDOWN(va);
+  uvmlock(p->pgdir);
+  if((v = findvma(p, va)) == 0 || v->prot == PROT_NONE ||
+     ((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P)) ||
+     (v->f && mycpu()->ncli > 1)){
+    uvmunlock(p->pgdir);
+    return -1;
+  }
+  // a copy, with the file held open: another thread may munmap() it while we read
+  sv = *v;
+  if(sv.f)
+    filedup(sv.f);
+  uvmunlock(p->pgdir);
+  perm = PTE_U | ((sv.prot & PROT_WRITE) ? PTE_W : 0);
+  if(sv.flags & MAP_SHARED)
+    perm |= PTE_SHARED;
+
+  if(sv.f == 0){
+    if((mem = kzalloc()) == 0)
+      return -1;
+  } else {
+    ip = sv.f->ip;
+    off = sv.off + (va - sv.start);
+    ilockshared(ip);
+    if(off + PGSIZE <= ip->size){
+      iunlockshared(ip);
+      mem = pcacheget(ip, off);
+      if(mem && (sv.flags & MAP_SHARED)){
+        // a page of its own, for munmap() to write back
+        if((page = kalloc()) != 0)
+          memmove(page, mem, PGSIZE);
+        kfree(mem);
+        mem = page;
+      } else if((sv.flags & MAP_PRIVATE) && (perm & PTE_W))
+        // the page belongs to the cache: a private mapping just borrows it
+        perm = (perm & ~PTE_W) | PTE_COW;
+    } else {
+      if((mem = kzalloc()) != 0){
+        n = off < ip->size ? ip->size - off : 0;
+        if(n > 0 && readi(ip, mem, off, n) != n){
+          kfree(mem);
+          mem = 0;
+        }
+      }
+      iunlockshared(ip);
+    }
+    fileclose(sv.f);
+    if(mem == 0)
+      return -1;
+  }
+
+  // the mapping may have gone, or another thread mapped the page, meanwhile
+  r = 0;
+  uvmlock(p->pgdir);
+  if((v = findvma(p, va)) == 0 || v->start != sv.start || v->f != sv.f)
+    r = -1;
+  else if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    r = 0;
+  else if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) == 0)
+    mem = 0;
+  else
+    r = -1;
+  uvmunlock(p->pgdir);
+  if(mem)
+    kfree(mem);
+  return r;
+}
+
+// Give child np the mappings of p, sharing their pages as fork() does
+// the rest of memory. Returns -1 if out of memory, with none copied.
+int
+mmapcopy(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv;
+
+  // np isn't running yet: its own table holds the copy while uvmshare() takes the lock
+  uvmlock(p->pgdir);
+  for(v = p->leader->vma, nv = np->vma; v < &p->leader->vma[NVMA]; v++, nv++)
+    if(v->end){
+      *nv = *v;
+      if(nv->f)
+        filedup(nv->f);
+    }
+  uvmunlock(p->pgdir);
+
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++)
+    if(nv->end && uvmshare(p->pgdir, np->pgdir, nv->start, nv->end) < 0)
+      goto bad;
+  return 0;
+
+bad:
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++)
+    if(nv->end){
+      if(nv->f)
+        fileclose(nv->f);
+      nv->end = 0;
+    }
+  return -1;
+}
+
+// Remove all of p's mappings, for exit() and exec(), once p has no other threads.
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end){
+      if(v->f && (v->flags & MAP_SHARED))
+        vmasync(p, v, v->start, v->end);
+      uvmunmap(p->pgdir, v->start, v->end);
+      if(v->f)
+        fileclose(v->f);
+      v->end = 0;
+    }
+}
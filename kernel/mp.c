@@ -1,5 +1,6 @@
 // Multiprocessor support
-// Search memory for MP description structures.
+// Find the processors and the I/O APIC in the ACPI MADT, or, on machines
+// without one, in the older MP description structures.
 // http://developer.intel.com/design/pentium/datashts/24201606.pdf
 
 #include "types.h"
@@ -7,6 +8,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mp.h"
+#include "acpi.h"
 #include "x86.h"
 #include "mmu.h"
 #include "proc.h"
@@ -89,6 +91,162 @@ mpconfig(struct mp **pmp)
   return conf;
 }
 
+// ACPI tables are wherever the firmware put them, usually near the top of
+// physical memory: above PHYSTOP, where the kernel maps nothing. acpimap()
+// maps those at their own physical address, with 4MB pages in the user
+// half of the page directory, which holds nothing this early in boot;
+// acpiunmap() takes them out again once the tables have been read.
+#define NACPIMAP 8
+static uint acpipdx[NACPIMAP];
+static int nacpimap;
+
+// The n bytes at physical address pa, or 0 if they are out of reach.
+static void*
+acpimap(uint pa, uint n)
+{
+  pde_t *pgdir;
+  uint a;
+
+  if(pa + n < pa || pa + n > KERNBASE)
+    return 0;
+  if(pa + n <= PHYSTOP)
+    return P2V(pa);
+  pgdir = P2V(rcr3());
+  for(a = pa & ~(SUPERPGSIZE-1); a < pa + n; a += SUPERPGSIZE){
+    if(pgdir[PDX(a)] & PTE_P)
+      continue;
+    if(nacpimap == NACPIMAP)
+      return 0;
+    pgdir[PDX(a)] = a | PTE_P | PTE_PS;
+    acpipdx[nacpimap++] = PDX(a);
+  }
+  return (void*)pa;
+}
+
+static void
+acpiunmap(void)
+{
+  pde_t *pgdir;
+
+  pgdir = P2V(rcr3());
+  while(nacpimap > 0)
+    pgdir[acpipdx[--nacpimap]] = 0;
+  lcr3(rcr3());
+}
+
+// Look for the RSDP in the len bytes at pa 'a', on 16-byte boundaries.
+static struct acpirsdp*
+rsdpsearch1(uint a, int len)
+{
+  uchar *e, *p, *addr;
+
+  addr = P2V(a);
+  e = addr+len;
+  for(p = addr; p + 20 <= e; p += 16)
+    if(memcmp(p, "RSD PTR ", 8) == 0 && sum(p, 20) == 0)
+      return (struct acpirsdp*)p;
+  return 0;
+}
+
+// The RSDP is in the first KB of the EBDA, or in the BIOS ROM
+// between 0xE0000 and 0xFFFFF.
+static struct acpirsdp*
+rsdpsearch(void)
+{
+  uchar *bda;
+  uint p;
+  struct acpirsdp *rsdp;
+
+  bda = (uchar *) P2V(0x400);
+  if((p = ((bda[0x0F]<<8)| bda[0x0E]) << 4) && (rsdp = rsdpsearch1(p, 1024)))
+    return rsdp;
+  return rsdpsearch1(0xE0000, 0x20000);
+}
+
+// The ACPI table with signature sig, mapped and checked, or 0.
+// The RSDT lists the tables, or, if there is none, the XSDT does.
+static struct acpihdr*
+acpitable(struct acpirsdp *rsdp, char *sig)
+{
+  struct acpihdr *sdt, *h;
+  uint pa, i, w;
+
+  if(rsdp->rsdt){
+    pa = rsdp->rsdt;
+    w = 4;
+  } else if(rsdp->revision >= 2 && rsdp->xsdt && (rsdp->xsdt >> 32) == 0){
+    pa = rsdp->xsdt;
+    w = 8;
+  } else
+    return 0;
+  if((sdt = acpimap(pa, sizeof(*sdt))) == 0 || (sdt = acpimap(pa, sdt->length)) == 0 ||
+     sum((uchar*)sdt, sdt->length) != 0)
+    return 0;
+  for(i = sizeof(*sdt); i + w <= sdt->length; i += w){
+    // an XSDT entry above 4GB is out of reach
+    if(w == 8 && *(uint*)((uchar*)sdt + i + 4) != 0)
+      continue;
+    pa = *(uint*)((uchar*)sdt + i);
+    if((h = acpimap(pa, sizeof(*h))) == 0 || memcmp(h->signature, sig, 4) != 0)
+      continue;
+    if((h = acpimap(pa, h->length)) != 0 && sum((uchar*)h, h->length) == 0)
+      return h;
+  }
+  return 0;
+}
+
+// Take the processors, the local APIC address and the I/O APIC from the
+// ACPI MADT. Returns 0 if there is none (or it lists no processors).
+// Processors listed only with x2APIC ids (MADT_X2APIC) are left out:
+// the kernel drives the local APICs in xAPIC mode, with 8-bit ids.
+static int
+acpiconfig(void)
+{
+  struct acpirsdp *rsdp;
+  struct acpimadt *madt;
+  struct madtlapic *lp;
+  struct madtioapic *io;
+  struct madtlapicaddr *la;
+  uchar *p, *e;
+  uint lapicpa;
+
+  if((rsdp = rsdpsearch()) == 0)
+    return 0;
+  if((madt = (struct acpimadt*)acpitable(rsdp, "APIC")) == 0){
+    acpiunmap();
+    return 0;
+  }
+  lapicpa = madt->lapicaddr;
+  e = (uchar*)madt + madt->hdr.length;
+  for(p = (uchar*)(madt+1); p + 2 <= e && p[1] >= 2 && p + p[1] <= e; p += p[1]){
+    switch(p[0]){
+    case MADT_LAPIC:
+      lp = (struct madtlapic*)p;
+      if((lp->flags & MADT_ENABLED) && ncpu < NCPU){
+        cpus[ncpu].apicid = lp->apicid;
+        ncpu++;
+      }
+      break;
+    case MADT_IOAPIC:
+      // the one with the ISA interrupts, which ioapic.c drives
+      io = (struct madtioapic*)p;
+      if(io->gsibase == 0)
+        ioapicid = io->apicid;
+      break;
+    case MADT_LAPICADDR:
+      la = (struct madtlapicaddr*)p;
+      if((la->addr >> 32) == 0)
+        lapicpa = la->addr;
+      break;
+    }
+  }
+  acpiunmap();
+  if(ncpu == 0)
+    return 0;
+  lapic = (uint*)lapicpa;
+  return 1;
+}
+
 void
 mpinit(void)
 {
@@ -99,6 +257,8 @@ mpinit(void)
   struct mpproc *proc;
   struct mpioapic *ioapic;
 
+  if(acpiconfig())
+    return;
   if((conf = mpconfig(&mp)) == 0)
     panic("Expect to run on an SMP");
   ismp = 1;
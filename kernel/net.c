@@ -0,0 +1,406 @@
+// The network stack above the driver (e1000.c): packet buffers, ARP, and
+// just enough IPv4 to carry UDP datagrams to and from sockets (sock.c).
+// The address is fixed, the one qemu's user-mode network gives its guest.
+// There is no IP fragmentation or reassembly, and no UDP checksums: the
+// datagrams go out with none, and come in over a link whose frames the card
+// has checked already.
+// Each layer hands the packet to the next as it is, pulling its header off
+// on the way in and pushing one on on the way out (see net.h), so a datagram
+// is only copied between user memory and its packet buffer.
+// Datagrams to 127.x.x.x or to our own address go straight back up the stack.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "net.h"
+#include "socket.h"
+#include "vmstat.h"
+
+#define MYIP      IPADDR(10, 0, 2, 15)
+#define GATEWAY   IPADDR(10, 0, 2, 2)
+#define NETMASK   IPADDR(255, 255, 255, 0)
+#define BROADCAST 0xFFFFFFFF
+#define NARP      16
+
+static uchar mymac[ETHADDRLEN];
+static uchar ethbroadcast[ETHADDRLEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static int attached;
+static uint nrx, ntx, ndrop;
+static ushort ipid;
+
+// IP addresses on the link and their ethernet addresses, as ARP found out.
+// A packet to an address not found out yet waits in its entry (the latest
+// one only) until the reply comes.
+static struct {
+  struct spinlock lock;
+  struct {
+    uint ip;          // 0 if the entry is free
+    int valid;        // mac known
+    uchar mac[ETHADDRLEN];
+    struct pkt *wait;
+  } e[NARP];
+  int next;           // entry to take over when full
+} arp;
+
+static void iprx(struct pkt*);
+
+void
+netinit(void)
+{
+  initlock(&arp.lock, "arp");
+  sockinit();
+}
+
+// Called by the driver once the card is up.
+void
+netattach(uchar *mac)
+{
+  memmove(mymac, mac, ETHADDRLEN);
+  attached = 1;
+}
+
+// A fresh packet with room for PKTRXSIZE bytes received, or for a frame to
+// build: data starts at PKTHEAD, with room for headers in front. 0 if out of memory.
+struct pkt*
+pktalloc(void)
+{
+  struct pkt *p;
+
+  if((p = (struct pkt*)kalloc()) == 0)
+    return 0;
+  p->next = 0;
+  p->data = (char*)p + PKTHEAD;
+  p->len = 0;
+  p->faddr = 0;
+  p->fport = 0;
+  return p;
+}
+
+void
+pktfree(struct pkt *p)
+{
+  kfree((char*)p);
+}
+
+// Put n more bytes in front of p's data, for a header; returns where they go.
+char*
+pktpush(struct pkt *p, uint n)
+{
+  if(p->data - n < (char*)(p + 1))
+    panic("pktpush");
+  p->data -= n;
+  p->len += n;
+  return p->data;
+}
+
+// Take n bytes off the front of p's data, a header the caller has
+// looked at; returns them, or 0 if p is shorter than that.
+char*
+pktpull(struct pkt *p, uint n)
+{
+  char *h;
+
+  if(p->len < n)
+    return 0;
+  h = p->data;
+  p->data += n;
+  p->len -= n;
+  return h;
+}
+
+static void
+drop(struct pkt *p)
+{
+  __sync_fetch_and_add(&ndrop, 1);
+  pktfree(p);
+}
+
+// Send p, a whole ethernet frame, and give it up. Returns -1 if it was dropped.
+int
+nettx(struct pkt *p)
+{
+  if(!attached){
+    drop(p);
+    return -1;
+  }
+  if(e1000tx(p) < 0){
+    __sync_fetch_and_add(&ndrop, 1);
+    return -1;
+  }
+  __sync_fetch_and_add(&ntx, 1);
+  return 0;
+}
+
+// The internet checksum of n bytes at v: 0 over a header with its checksum in it.
+static ushort
+cksum(void *v, int n)
+{
+  ushort *w;
+  uint sum;
+
+  sum = 0;
+  for(w = v; n > 1; n -= 2)
+    sum += *w++;
+  if(n > 0)
+    sum += *(uchar*)w;
+  while(sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return ~sum;
+}
+
+static int
+loopback(uint ip)
+{
+  return (ip >> 24) == 127 || ip == MYIP;
+}
+
+// Put an ethernet header in front of p, with destination mac, and send it.
+static int
+ethtx(struct pkt *p, int type, uchar *mac)
+{
+  struct eth *e;
+
+  e = (struct eth*)pktpush(p, sizeof(*e));
+  memmove(e->dst, mac, ETHADDRLEN);
+  memmove(e->src, mymac, ETHADDRLEN);
+  e->type = htons(type);
+  return nettx(p);
+}
+
+static int
+arptx(int op, uchar *tha, uint tip)
+{
+  struct pkt *p;
+  struct arp *a;
+
+  if((p = pktalloc()) == 0)
+    return -1;
+  a = (struct arp*)p->data;
+  p->len = sizeof(*a);
+  a->hrd = htons(ARP_ETHER);
+  a->pro = htons(ETH_IP);
+  a->hln = ETHADDRLEN;
+  a->pln = 4;
+  a->op = htons(op);
+  memmove(a->sha, mymac, ETHADDRLEN);
+  a->sip = htonl(MYIP);
+  memmove(a->tha, op == ARP_REQUEST ? ethbroadcast : tha, ETHADDRLEN);
+  a->tip = htonl(tip);
+  return ethtx(p, ETH_ARP, op == ARP_REQUEST ? ethbroadcast : tha);
+}
+
+// The entry for ip, or one taken over for it. Caller holds arp.lock.
+static int
+arpentry(uint ip)
+{
+  int i;
+
+  for(i = 0; i < NARP; i++)
+    if(arp.e[i].ip == ip)
+      return i;
+  for(i = 0; i < NARP; i++)
+    if(arp.e[i].ip == 0)
+      break;
+  if(i == NARP){
+    i = arp.next;
+    arp.next = (arp.next + 1) % NARP;
+  }
+  if(arp.e[i].wait)
+    drop(arp.e[i].wait);
+  arp.e[i].ip = ip;
+  arp.e[i].valid = 0;
+  arp.e[i].wait = 0;
+  return i;
+}
+
+// Send IP packet p to ip, a host on the link: straight away if we know its
+// ethernet address, else once ARP has found it out.
+static int
+iptxlink(struct pkt *p, uint ip)
+{
+  uchar mac[ETHADDRLEN];
+  int i, ask;
+
+  if(ip == BROADCAST)
+    return ethtx(p, ETH_IP, ethbroadcast);
+  acquire(&arp.lock);
+  i = arpentry(ip);
+  if(arp.e[i].valid){
+    memmove(mac, arp.e[i].mac, ETHADDRLEN);
+    release(&arp.lock);
+    return ethtx(p, ETH_IP, mac);
+  }
+  // only the first packet to wait asks; a later one replaces it
+  ask = arp.e[i].wait == 0;
+  if(arp.e[i].wait)
+    drop(arp.e[i].wait);
+  arp.e[i].wait = p;
+  release(&arp.lock);
+  if(ask)
+    arptx(ARP_REQUEST, 0, ip);
+  return 0;
+}
+
+// Learn that ip is at mac, and send what was waiting for that.
+static void
+arplearn(uint ip, uchar *mac)
+{
+  struct pkt *p;
+  int i;
+
+  acquire(&arp.lock);
+  i = arpentry(ip);
+  memmove(arp.e[i].mac, mac, ETHADDRLEN);
+  arp.e[i].valid = 1;
+  p = arp.e[i].wait;
+  arp.e[i].wait = 0;
+  release(&arp.lock);
+  if(p)
+    ethtx(p, ETH_IP, mac);
+}
+
+static void
+arprx(struct pkt *p)
+{
+  struct arp *a;
+  uint sip, tip;
+
+  if((a = (struct arp*)pktpull(p, sizeof(*a))) == 0 ||
+     a->hrd != htons(ARP_ETHER) || a->pro != htons(ETH_IP) ||
+     a->hln != ETHADDRLEN || a->pln != 4){
+    drop(p);
+    return;
+  }
+  sip = ntohl(a->sip);
+  tip = ntohl(a->tip);
+  if(tip != MYIP){
+    drop(p);
+    return;
+  }
+  if(sip != 0)
+    arplearn(sip, a->sha);
+  if(a->op == htons(ARP_REQUEST))
+    arptx(ARP_REPLY, a->sha, sip);
+  pktfree(p);
+}
+
+// Put an IP header in front of p and send it to dst, or take it
+// back in if dst is us. Returns -1 if it was dropped.
+static int
+iptx(struct pkt *p, int proto, uint dst)
+{
+  struct ip *ip;
+
+  ip = (struct ip*)pktpush(p, sizeof(*ip));
+  ip->vhl = 4 << 4 | sizeof(*ip) / 4;
+  ip->tos = 0;
+  ip->len = htons(p->len);
+  ip->id = htons(__sync_fetch_and_add(&ipid, 1));
+  ip->off = 0;
+  ip->ttl = 64;
+  ip->proto = proto;
+  ip->src = htonl(loopback(dst) ? dst : MYIP);
+  ip->dst = htonl(dst);
+  ip->sum = 0;
+  ip->sum = cksum(ip, sizeof(*ip));
+  if(loopback(dst)){
+    iprx(p);
+    return 0;
+  }
+  if(!attached){
+    drop(p);
+    return -1;
+  }
+  if((dst & NETMASK) != (MYIP & NETMASK) && dst != BROADCAST)
+    dst = GATEWAY;
+  return iptxlink(p, dst);
+}
+
+// Send p's data as a UDP datagram from port sport to dport at addr, and give p up.
+// Returns -1 if it was dropped.
+int
+udptx(struct pkt *p, ushort sport, uint addr, ushort dport)
+{
+  struct udp *u;
+
+  u = (struct udp*)pktpush(p, sizeof(*u));
+  u->sport = htons(sport);
+  u->dport = htons(dport);
+  u->len = htons(p->len);
+  u->sum = 0;
+  return iptx(p, IP_UDP, addr);
+}
+
+static void
+udprx(struct pkt *p, uint src)
+{
+  struct udp *u;
+  uint len;
+
+  if((u = (struct udp*)pktpull(p, sizeof(*u))) == 0 ||
+     (len = ntohs(u->len)) < sizeof(*u) || len - sizeof(*u) > p->len){
+    drop(p);
+    return;
+  }
+  p->len = len - sizeof(*u);
+  p->faddr = src;
+  p->fport = ntohs(u->sport);
+  if(sockdeliver(p, ntohs(u->dport)) < 0)
+    drop(p);
+}
+
+static void
+iprx(struct pkt *p)
+{
+  struct ip *ip;
+  uint hl, len, dst;
+
+  ip = (struct ip*)p->data;
+  if(p->len < sizeof(*ip) || (ip->vhl >> 4) != 4 ||
+     (hl = (ip->vhl & 0xF) * 4) < sizeof(*ip) || hl > p->len ||
+     cksum(ip, hl) != 0 ||
+     (len = ntohs(ip->len)) < hl || len > p->len){
+    drop(p);
+    return;
+  }
+  dst = ntohl(ip->dst);
+  // no reassembly: fragments are dropped
+  if((ntohs(ip->off) & (IP_MF|IP_OFFMASK)) || ip->proto != IP_UDP ||
+     (dst != MYIP && dst != BROADCAST && !loopback(dst))){
+    drop(p);
+    return;
+  }
+  p->len = len; // without the ethernet padding
+  pktpull(p, hl);
+  udprx(p, ntohl(ip->src));
+}
+
+// A packet came in, and is ours to keep or free.
+void
+netrx(struct pkt *p)
+{
+  struct eth *e;
+
+  __sync_fetch_and_add(&nrx, 1);
+  if((e = (struct eth*)pktpull(p, sizeof(*e))) == 0){
+    drop(p);
+    return;
+  }
+  if(e->type == htons(ETH_ARP))
+    arprx(p);
+  else if(e->type == htons(ETH_IP))
+    iprx(p);
+  else
+    drop(p);
+}
+
+// Add the packet counts to *st, for the stat device.
+void
+netstat(struct vmstat *st)
+{
+  st->netrx = nrx;
+  st->nettx = ntx;
+  st->netdrop = ndrop;
+}
@@ -0,0 +1,129 @@
+// Page cache: pages of program files, shared by every process running the program.
+//
+// exec() doesn't read a program into memory any more. It records where each
+// segment comes from in the file, and textfault() maps each page when the
+// process first touches it, straight from here: ten processes running sh
+// share one copy of sh's text, and a page nobody touches is never even read.
+// Pages are mapped read-only (copy-on-write if the segment is writable),
+// so a process writing to one gets its own copy, as with fork().
+//
+// An entry holds one reference to its page (see kincref()), every mapping another,
+// so a page replaced in the cache stays with the processes still using it.
+// Writing to a file (or freeing it) forgets its pages; processes already
+// running it keep the old contents, as if they had read the file at exec().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define PCSETS 32
+#define PCWAYS 4
+
+struct pcent {
+  uint dev;
+  uint inum;
+  uint off;           // byte offset in the file, not always page aligned
+  char *page;         // 0: entry unused
+};
+
+static struct {
+  struct spinlock lock;
+  struct pcent ent[PCSETS][PCWAYS];
+  uchar next[PCSETS]; // way to replace next
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct pcent*
+pcfind(uint dev, uint inum, uint off, int *set)
+{
+  struct pcent *e;
+
+  *set = (dev * 31 + inum * 17 + off / PGSIZE) % PCSETS;
+  for(e = pcache.ent[*set]; e < pcache.ent[*set] + PCWAYS; e++)
+    if(e->page && e->off == off && e->inum == inum && e->dev == dev)
+      return e;
+  return 0;
+}
+
+// Return the page holding ip's contents from byte off on, which the
+// file must have a whole page of, with a reference for the caller:
+// kfree() drops it. Returns 0 if out of memory or the read fails.
+// Caller must not hold ip->lock.
+char*
+pcacheget(struct inode *ip, uint off)
+{
+  struct pcent *e;
+  char *mem;
+  int set, n;
+
+  acquire(&pcache.lock);
+  if((e = pcfind(ip->dev, ip->inum, off, &set)) != 0){
+    mem = e->page;
+    kincref(mem);
+    release(&pcache.lock);
+    return mem;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  ilockshared(ip);
+  n = readi(ip, mem, off, PGSIZE);
+  if(n != PGSIZE){
+    iunlockshared(ip);
+    kfree(mem);
+    return 0;
+  }
+
+  // insert before letting go of ip: a writer's pcacheforget() would
+  // otherwise find nothing to drop, and this page would go in stale after it
+  acquire(&pcache.lock);
+  ip->pcached = 1; // no writer can be running, we hold the lock
+  if((e = pcfind(ip->dev, ip->inum, off, &set)) != 0){
+    // someone else read the same page meanwhile; use theirs
+    kfree(mem);
+    mem = e->page;
+  } else {
+    e = &pcache.ent[set][pcache.next[set]];
+    pcache.next[set] = (pcache.next[set] + 1) % PCWAYS;
+    if(e->page)
+      kfree(e->page);
+    e->dev = ip->dev;
+    e->inum = ip->inum;
+    e->off = off;
+    e->page = mem;
+  }
+  kincref(mem);
+  release(&pcache.lock);
+  iunlockshared(ip);
+  return mem;
+}
+
+// ip's contents are changing: forget the pages cached for it.
+// Caller holds ip->lock exclusively.
+void
+pcacheforget(struct inode *ip)
+{
+  struct pcent *e;
+
+  if(!ip->pcached)
+    return;
+  acquire(&pcache.lock);
+  for(e = pcache.ent[0]; e < pcache.ent[PCSETS]; e++)
+    if(e->page && e->inum == ip->inum && e->dev == ip->dev){
+      kfree(e->page);
+      e->page = 0;
+    }
+  release(&pcache.lock);
+  ip->pcached = 0;
+}
@@ -1,61 +1,83 @@
 //
-// simple PCI-Express initialization, only
-// works for qemu and its e1000 card.
+// Minimal PCI support: config space access and a scan of the
+// devices, for drivers that need to find their controller (the IDE
+// bus master, virtio, e1000) and let it do DMA.
+// Uses configuration mechanism #1, which every PC chipset and qemu
+// implement, on buses 0 to PCIBUSES-1.
 //
 
-/*#include "types.h"*/
-/*#include "param.h"*/
-/*#include "memlayout.h"*/
-/*#include "riscv.h"*/
-/*#include "spinlock.h"*/
-/*#include "proc.h"*/
-/*#include "defs.h"*/
-/**/
-/*void*/
-/*pci_init()*/
-/*{*/
-/*  // we'll place the e1000 registers at this address.*/
-/*  // vm.c maps this range.*/
-/*  uint64 e1000_regs = 0x40000000L;*/
-/**/
-/*  // qemu -machine virt puts PCIe config space here.*/
-/*  // vm.c maps this range.*/
-/*  uint32  *ecam = (uint32 *) 0x30000000L;*/
-/**/
-/*  // look at each possible PCI device on bus 0.*/
-/*  for(int dev = 0; dev < 32; dev++){*/
-/*    int bus = 0;*/
-/*    int func = 0;*/
-/*    int offset = 0;*/
-/*    uint32 off = (bus << 16) | (dev << 11) | (func << 8) | (offset);*/
-/*    volatile uint32 *base = ecam + off;*/
-/*    uint32 id = base[0];*/
-/**/
-/*    // 100e:8086 is an e1000*/
-/*    if(id == 0x100e8086){*/
-/*      // command and status register.*/
-/*      // bit 0 : I/O access enable*/
-/*      // bit 1 : memory access enable*/
-/*      // bit 2 : enable mastering*/
-/*      base[1] = 7;*/
-/*      __sync_synchronize();*/
-/**/
-/*      for(int i = 0; i < 6; i++){*/
-/*        uint32 old = base[4+i];*/
-/**/
-/*        // writing all 1's to the BAR causes it to be*/
-/*        // replaced with its size.*/
-/*        base[4+i] = 0xffffffff;*/
-/*        __sync_synchronize();*/
-/**/
-/*        base[4+i] = old;*/
-/*      }*/
-/**/
-/*      // tell the e1000 to reveal its registers at*/
-/*      // physical address 0x40000000.*/
-/*      base[4+0] = e1000_regs;*/
-/**/
-/*      e1000_init((uint32*)e1000_regs);*/
-/*    }*/
-/*  }*/
-/*}*/
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define CONFIG_ADDRESS 0xCF8
+#define CONFIG_DATA    0xCFC
+#define PCIBUSES       8
+
+static uint
+pciaddr(int bus, int dev, int func, int off)
+{
+  return 0x80000000 | bus << 16 | dev << 11 | func << 8 | (off & 0xFC);
+}
+
+uint
+pciread(struct pcifunc *f, int off)
+{
+  outl(CONFIG_ADDRESS, pciaddr(f->bus, f->dev, f->func, off));
+  return inl(CONFIG_DATA);
+}
+
+void
+pciwrite(struct pcifunc *f, int off, uint v)
+{
+  outl(CONFIG_ADDRESS, pciaddr(f->bus, f->dev, f->func, off));
+  outl(CONFIG_DATA, v);
+}
+
+// Find the first function on the bus matching vendor, device, class
+// and subclass (any of which may be PCI_ANY) and fill in *f.
+// Returns 0, or -1 if there is none.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcifunc *f)
+{
+  uint id, cl;
+  int i, nfunc;
+
+  for(f->bus = 0; f->bus < PCIBUSES; f->bus++){
+    for(f->dev = 0; f->dev < 32; f->dev++){
+      nfunc = 1;
+      for(f->func = 0; f->func < nfunc; f->func++){
+        id = pciread(f, PCI_ID);
+        if((id & 0xFFFF) == 0xFFFF) // nothing there
+          continue;
+        // multi-function device: header type has bit 7 set
+        if(f->func == 0 && (pciread(f, 0x0C) & 0x800000))
+          nfunc = 8;
+        cl = pciread(f, PCI_CLASS);
+        if((vendor != PCI_ANY && (id & 0xFFFF) != vendor) ||
+           (device != PCI_ANY && (id >> 16) != device) ||
+           (class != PCI_ANY && (cl >> 24) != class) ||
+           (subclass != PCI_ANY && ((cl >> 16) & 0xFF) != subclass))
+          continue;
+        f->vendor = id & 0xFFFF;
+        f->device = id >> 16;
+        f->class = cl >> 24;
+        f->subclass = (cl >> 16) & 0xFF;
+        f->progif = (cl >> 8) & 0xFF;
+        for(i = 0; i < 6; i++)
+          f->bar[i] = pciread(f, PCI_BAR0 + 4*i);
+        f->irq = pciread(f, PCI_INTR) & 0xFF;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Turn on I/O and memory decoding and bus mastering for f.
+void
+pcienable(struct pcifunc *f)
+{
+  pciwrite(f, PCI_COMMAND, pciread(f, PCI_COMMAND) | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
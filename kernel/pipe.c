@@ -7,34 +7,103 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+#define PIPEWAKE (PIPESIZE/2)
 
+// The buffer is a ring over PIPEPAGES separately allocated pages.
+// Reads and writes copy whole runs that are contiguous in one page,
+// and only wake the other side when it is actually asleep and there
+// is enough for it to do: a reader once the writer is done or has
+// buffered PIPEWAKE bytes, a writer once PIPEWAKE bytes are free, or
+// whatever less it needs to finish its write.
+//
+// The ring has one producer and one consumer at a time: writers take
+// wlock, readers rlock, and each side only ever advances its own counter.
+// So the data moves without the lock the two sides share. A side publishes
+// its counter after copying (with a barrier between). It only takes
+// p->lock to sleep when the ring is full or empty, or to wake the other
+// side when that one is asleep. Each side announces its sleep (rwait,
+// wwait) and then checks the ring again. The other side advances its
+// counter and then checks the announcement. With a barrier between
+// each step, at least one of them sees the other, so no wakeup is lost.
+// A pipeline of two processes thus moves data without touching the other
+// side's lock, as long as neither side has to wait.
 struct pipe {
-  struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  struct spinlock lock;  // the sleeps and wakeups, readopen and writeopen
+  struct sleeplock rlock;
+  struct sleeplock wlock;
+  char *data[PIPEPAGES];
+  uint nread;     // number of bytes read, advanced holding rlock
+  uint nwrite;    // number of bytes written, advanced holding wlock
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // readers asleep on nread
+  int wwait;      // writers asleep on nwrite
+  int rpoll;      // poll()s waiting for something to read, like a reader asleep
+  int wpoll;      // poll()s waiting for room
+  uint wneed;     // free space that will let one of them go on
 };
 
+static struct slabcache pipecache;
+
+void
+pipeinit(void)
+{
+  slabinit(&pipecache, "pipecache", sizeof(struct pipe));
+}
+
+// Where byte number off goes in p's ring, and how many bytes from
+// there are contiguous.
+static char*
+pipebuf(struct pipe *p, uint off, uint *run)
+{
+  off %= PIPESIZE;
+  *run = PGSIZE - off % PGSIZE;
+  return p->data[off / PGSIZE] + off % PGSIZE;
+}
+
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->data[i])
+      kfree(p->data[i]);
+  slabfree(&pipecache, p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = slaballoc(&pipecache)) == 0)
     goto bad;
+  for(i = 0; i < PIPEPAGES; i++)
+    p->data[i] = 0;
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->data[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->rwait = 0;
+  p->wwait = 0;
+  p->rpoll = 0;
+  p->wpoll = 0;
   initlock(&p->lock, "pipe");
+  initsleeplock(&p->rlock, "piperead");
+  initsleeplock(&p->wlock, "pipewrite");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -48,7 +117,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,53 +138,149 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// Is there nothing to read in p right now? For filereadv().
+int
+pipeempty(struct pipe *p)
+{
+  return p->nread == p->nwrite;
+}
+
+// Which of events (POLLIN for the read end, POLLOUT for the write end)
+// wouldn't block now, and POLLHUP once the other end is closed. A poller
+// counts as a sleeping reader or writer, so that the other side wakes it.
+int
+pipepoll(struct pipe *p, int writable, int events, struct polltab *pt)
+{
+  int r;
+
+  r = 0;
+  if(!writable && (events & POLLIN)){
+    pollwait(pt, &p->nread, &p->rpoll);
+    // rpoll before nwrite, see above (the atomic add is a barrier)
+    if(p->nread != p->nwrite)
+      r |= POLLIN;
+    if(!p->writeopen)
+      r |= POLLHUP;
+  }
+  if(writable && (events & POLLOUT)){
+    pollwait(pt, &p->nwrite, &p->wpoll);
+    if(!p->readopen)
+      r |= POLLERR;
+    else if(p->nwrite != p->nread + PIPESIZE)
+      r |= POLLOUT;
+  }
+  return r;
+}
+
+// Wake the sleeping side of p, whose counter is at chan.
+static void
+pipewake(struct pipe *p, void *chan)
+{
+  acquire(&p->lock);
+  wakeup(chan);
+  release(&p->lock);
+}
+
 //PAGEBREAK: 40
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
+  uint run, m;
+  char *dst;
   int i;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  acquiresleep(&p->wlock);
+  for(i = 0; i < n; i += m){
+    if(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+      acquire(&p->lock);
+      m = n - i < PIPEWAKE ? n - i : PIPEWAKE;
+      if(p->wwait++ == 0 || m < p->wneed)
+        p->wneed = m;
+      __sync_synchronize(); // wwait before nread, see above
+      while(p->nwrite == p->nread + PIPESIZE){
+        if(p->readopen == 0 || myproc()->killed){
+          p->wwait--;
+          release(&p->lock);
+          releasesleep(&p->wlock);
+          return -1;
+        }
+        if(p->rwait)
+          wakeup(&p->nread);
+        sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->wwait--;
+      release(&p->lock);
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    dst = pipebuf(p, p->nwrite, &run);
+    m = p->nread + PIPESIZE - p->nwrite;
+    if(m > run)
+      m = run;
+    if(m > n - i)
+      m = n - i;
+    if(ucopy(dst, addr + i, m) < 0){
+      n = -1;  // what was copied before stays written
+      break;
+    }
+    __sync_synchronize(); // the data before the count
+    p->nwrite += m;
+    __sync_synchronize(); // nwrite before rwait
+    // let a reader on another cpu drain a well-filled buffer
+    if(p->rwait && p->nwrite - p->nread >= PIPEWAKE)
+      pipewake(p, &p->nread);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
+  if(p->rwait || p->rpoll)
+    pipewake(p, &p->nread);  //DOC: pipewrite-wakeup1
+  releasesleep(&p->wlock);
   return n;
 }
 
 int
 piperead(struct pipe *p, char *addr, int n)
 {
+  uint run, m;
+  char *src;
   int i;
 
-  acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
-      release(&p->lock);
-      return -1;
+  acquiresleep(&p->rlock);
+  if(p->nread == p->nwrite){  //DOC: pipe-empty
+    acquire(&p->lock);
+    p->rwait++;
+    __sync_synchronize(); // rwait before nwrite
+    while(p->nread == p->nwrite && p->writeopen){
+      if(myproc()->killed){
+        p->rwait--;
+        release(&p->lock);
+        releasesleep(&p->rlock);
+        return -1;
+      }
+      sleep(&p->nread, &p->lock); //DOC: piperead-sleep
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    p->rwait--;
+    release(&p->lock);
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  __sync_synchronize(); // the count before the data
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    src = pipebuf(p, p->nread, &run);
+    m = p->nwrite - p->nread;
+    if(m > run)
+      m = run;
+    if(m > n - i)
+      m = n - i;
+    if(ucopy(addr + i, src, m) < 0){
+      i = -1;  // the data stays in the pipe
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    }
+    __sync_synchronize(); // done with the data before giving the room back
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
-  release(&p->lock);
+  __sync_synchronize(); // nread before wwait
+  if((p->wwait && p->nread + PIPESIZE - p->nwrite >= p->wneed) || p->wpoll)
+    pipewake(p, &p->nwrite);  //DOC: piperead-wakeup
+  releasesleep(&p->rlock);
   return i;
 }
@@ -6,13 +6,54 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "slab.h"
+#include "traps.h"
+#include "sched.h"
+#include "procinfo.h"
+#include "trace.h"
+
+// Run queue of RUNNABLE processes, one per CPU.
+// A process is on a run queue exactly when it is RUNNABLE, so the
+// scheduler picks the next process in O(1) instead of scanning ptable.
+// A process goes back on the queue of the CPU it last ran on, to keep
+// its cache warm; a CPU with nothing to run steals from the busiest queue,
+// but not a process that ran less than MIGRATENS ago, whose cache is
+// still warm where it was. A process never goes on the queue of a CPU
+// its affinity mask leaves out (see setaffinity()).
+// Each queue has a FIFO list per scheduling class.
+struct runq {
+  struct proc *head[NSCHED];
+  struct proc *tail[NSCHED];
+  int n;
+  int ipicks;  // interactive picks in a row while a batch process waited
+} __attribute__((aligned(CACHELINE)));
 
 // global process table
+// It starts as the static array of NPROC slots and grows a slot at a
+// time from an object cache (see slab.c), up to NPROCMAX; slots are
+// never given back. all links every slot, free the UNUSED ones.
+// ptable.lock also protects the run queues and the wait queues, which
+// keep the SLEEPING processes hashed by channel so that wakeup() only
+// looks at the sleepers that could be on its channel
+// Every cpu takes ptable.lock, so it has a cache line to itself, as each
+// run queue does.
 struct {
-  struct spinlock lock;
-  struct proc proc[NPROC];
+  struct spinlock lock __attribute__((aligned(CACHELINE)));
+  struct proc proc[NPROC] __attribute__((aligned(CACHELINE)));
+  struct proc *all;
+  struct proc *free;
+  int nproc;
+  struct runq rq[NCPU];
+  struct proc *waitq[NWAITQ];
+  struct pollent *pollq[NWAITQ];
+  struct proc *pidhash[NPIDHASH]; // processes in use, by pid
+  struct slabcache cache;
 } ptable;
 
+#define WAITQ(chan) (&ptable.waitq[(uint)(chan) % NWAITQ])
+#define POLLQ(chan) (&ptable.pollq[(uint)(chan) % NWAITQ])
+#define PIDHASH(pid) (&ptable.pidhash[(uint)(pid) % NPIDHASH])
+
 // first process - so other files can set it up
 static struct proc *initproc;
 
@@ -21,11 +62,124 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void pollwake1(void *chan);
+static void runnable(struct proc *p);
+
+// Add n zeroed slots starting at p to the process table.
+// Caller must hold ptable.lock (or be pinit()).
+static void
+paddslots(struct proc *slots, int n)
+{
+  struct proc *p;
+
+  // backwards, so that the lowest slot comes first
+  for(p = slots + n - 1; p >= slots; p--){
+    p->pnext = ptable.all;
+    ptable.all = p;
+    p->freenext = ptable.free;
+    ptable.free = p;
+    ptable.nproc++;
+  }
+}
+
+// Grow the process table by a slot.
+// Returns 0 if it is at NPROCMAX or out of memory.
+// Caller must hold ptable.lock.
+static int
+pgrow(void)
+{
+  struct proc *p;
+
+  if(ptable.nproc >= NPROCMAX || (p = slaballoc(&ptable.cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  paddslots(p, 1);
+  return 1;
+}
+
+// Take p off its parent's kids or zombies list. Caller must hold ptable.lock.
+static void
+kunlink(struct proc *p)
+{
+  if(p->knext)
+    p->knext->kprev = p->kprev;
+  *p->kprev = p->knext;
+  p->knext = 0;
+  p->kprev = 0;
+}
+
+// Make p a child of parent, on its kids or its zombies list as p has
+// exited or not. Caller must hold ptable.lock.
+static void
+setparent(struct proc *p, struct proc *parent)
+{
+  struct proc **head;
+
+  if(p->kprev)
+    kunlink(p);
+  p->parent = parent;
+  if(parent == 0)
+    return;
+  head = p->state == ZOMBIE ? &parent->zombies : &parent->kids;
+  p->knext = *head;
+  if(*head)
+    (*head)->kprev = &p->knext;
+  *head = p;
+  p->kprev = head;
+}
+
+// Pass p's children, exited or not, to init, except for the threads
+// among them, which pass to leader. Wakes a new parent that gets a zombie.
+// Caller must hold ptable.lock.
+static void
+abandon(struct proc *p, struct proc *leader)
+{
+  struct proc *q, *to;
+
+  while((q = p->kids) != 0 || (q = p->zombies) != 0){
+    to = q->leader == q ? initproc : leader;
+    setparent(q, to);
+    if(q->state == ZOMBIE)
+      wakeup1(to);
+  }
+}
+
+// The process with the given pid, or 0. Caller must hold ptable.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = *PIDHASH(pid); p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Mark p UNUSED and put it back on the free list.
+// Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  if(p->kprev)
+    kunlink(p);
+  if(p->hprev){
+    if(p->hnext)
+      p->hnext->hprev = p->hprev;
+    *p->hprev = p->hnext;
+    p->hprev = 0;
+  }
+  p->state = UNUSED;
+  p->freenext = ptable.free;
+  ptable.free = p;
+}
 
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  slabinit(&ptable.cache, "proccache", sizeof(struct proc));
+  paddslots(ptable.proc, NPROC);
 }
 
 // DANGER - Must be called with interrupts disabled
@@ -35,20 +189,15 @@ cpuid() {
   return mycpu()-cpus;
 }
 
-// Must be called with interrupts disabled to avoid the caller being
-// rescheduled on another CPU between reading lapicid and running through the loop.
-// Normally would use pushcli() or popcli(), but they call this function - infinite recursion
+// Find this cpu's struct cpu by its local APIC ID, the slow way: only
+// seginit() does, to point %gs at it for mycpu().
 struct cpu*
-mycpu(void)
+lapiccpu(void)
 {
   int apicid, i;
-  
-  if(readeflags()&FL_IF)
-    panic("mycpu called with interrupts enabled\n");
-  
+
   apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
+  // APIC IDs are not guaranteed to be contiguous.
   for (i = 0; i < ncpu; ++i) {
     if (cpus[i].apicid == apicid)
       return &cpus[i];
@@ -56,6 +205,20 @@ mycpu(void)
   panic("unknown apicid\n");
 }
 
+// Must be called with interrupts disabled to avoid the caller being
+// rescheduled on another CPU between reading %gs:0 and using the result.
+// Normally would use pushcli() or popcli(), but they call this function - infinite recursion
+// The kernel's %gs selects SEG_KCPU, whose base is this cpu's cpu->self
+// (see seginit()), so this is one load rather than a search of cpus[].
+// Before seginit() on the boot cpu, it is cpus[0] (see bootseginit()).
+struct cpu*
+mycpu(void)
+{
+  if(readeflags()&FL_IF)
+    panic("mycpu called with interrupts enabled\n");
+  return (struct cpu*)readgs0();
+}
+
 // Disable interrupts so that we are not rescheduled
 // while reading proc from the cpu structure
 struct proc*
@@ -81,29 +244,55 @@ myproc(void) {
 static struct proc*
 allocproc(void)
 {
-  struct proc *p;
+  struct proc *p, **h;
   char *sp;
 
   acquire(&ptable.lock);
 
-  // find UNUSED slot in global process table
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  // no slot found, return null
-  release(&ptable.lock);
-  return 0;
+  // take an UNUSED slot from the free list, growing the table if needed
+  if(ptable.free == 0 && !pgrow()){
+    // no slot found, return null
+    release(&ptable.lock);
+    return 0;
+  }
+  p = ptable.free;
+  ptable.free = p->freenext;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  h = PIDHASH(p->pid);
+  p->hnext = *h;
+  if(*h)
+    (*h)->hprev = &p->hnext;
+  *h = p;
+  p->hprev = h;
+  p->parent = 0;
+  p->kids = p->zombies = 0;
+  p->knext = 0;
+  p->kprev = 0;
+  p->cpu = -1; // not run yet, fork() places it
+  memset(p->affinity, 0xFF, sizeof(p->affinity));
+  p->offcpu = 0;
+  p->tidx = -1;
+  p->class = SCHED_INTERACTIVE;
+  p->nice = 0;
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+  p->leader = p;
+  p->threaded = 0;
+  p->argf = 0;
+  p->ustack = 0;
+  p->runcyc = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->nfault = p->nbread = p->nbwrite = 0;
 
   release(&ptable.lock);
 
   // Allocate page for process's kernel thread to use as a stack
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
 
@@ -180,33 +369,98 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  runnable(p);
 
   release(&ptable.lock);
 }
 
+// Start a kernel thread running fn(), which must never return.
+// It is a process without a user half: it has the kernel mappings only,
+// is never a child of anyone, and returns from forkret() straight into
+// fn() rather than into trapret.
+struct proc*
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return 0;
+  if((p->pgdir = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
+    return 0;
+  }
+  p->sz = 0;
+  ((uint*)p->tf)[-1] = (uint)fn; // where allocproc() put trapret
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  runnable(p);
+  release(&ptable.lock);
+  return p;
+}
+
+// Set the size of p's memory to sz, for p and the threads sharing it.
+// Caller must hold p's page table lock, which serializes the changes.
+static void
+setsz(struct proc *p, uint sz)
+{
+  struct proc *q;
+
+  if(!p->threaded){
+    p->sz = sz;
+    return;
+  }
+  acquire(&ptable.lock);
+  for(q = ptable.all; q; q = q->pnext)
+    if(q->state != UNUSED && q->pgdir == p->pgdir)
+      q->sz = sz;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory (address space) by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size, or -1 on failure.
+// With LAZYSBRK, growing only raises the size: trap() allocates each page on first touch.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, newsz;
   struct proc *curproc = myproc();
 
-  // get current size
+  // against the other threads' sbrk() and page faults
+  uvmlock(curproc->pgdir);
   sz = curproc->sz;
-  // grow or shrink process
+  newsz = sz + n;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
-  } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    if(newsz < sz || newsz >= KERNBASE || newsz > mmapbase(curproc))
+      goto bad;
+    if(LAZYSBRK){
+      // still refuse growth that could never be backed, so malloc() sees running out of memory as
+      // a failed sbrk() rather than a fault later on
+      if((PGROUNDUP(newsz) - PGROUNDUP(sz)) / PGSIZE > kfreecount())
+        goto bad;
+    } else if(allocuvm(curproc->pgdir, sz, newsz) == 0)
+      goto bad;
+  } else if(newsz > sz)
+    goto bad;
+  setsz(curproc, newsz);
+  if(n >= 0){
+    uvmunlock(curproc->pgdir);
+    return sz;
   }
-  curproc->sz = sz;
-  // update page directory and TSS
-  switchuvm(curproc);
-  return 0;
+  // the pages are only freed once no other thread's TLB can reach them
+  uvmdetach(curproc->pgdir, newsz, sz);
+  uvmunlock(curproc->pgdir);
+  uvmflush(curproc->pgdir, newsz, sz, 1);
+  uvmreap(curproc->pgdir, newsz, sz);
+  return sz;
+
+bad:
+  uvmunlock(curproc->pgdir);
+  return -1;
 }
 
 // Create a new process copying p as the parent.
@@ -228,15 +482,12 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){ // copy page directory
-    kfree(np->kstack); // fail - free stack allocproc() created and set child state UNUSED
-    np->kstack = 0;
-    np->state = UNUSED;
-    return -1;
-  }
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0) // copy page directory
+    goto bad;
+  if(mmapcopy(np, curproc) < 0) // and the mappings above the heap
+    goto bad;
   // copy size and trap frame (ensures child starts executing after trapret() with same register contents)
   np->sz = curproc->sz;
-  np->parent = curproc; // set parent
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -244,26 +495,249 @@ fork(void)
   np->tf->eax = 0;
 
   // copy open files and cwd
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
+  // the files belong to the thread group (see clone()), whose other threads may be opening
+  // and closing them meanwhile; a parent that outgrew NOFILE passes on a table as big as its own
+  uvmlock(curproc->pgdir);
+  if(curproc->leader->nofile > NOFILE){
+    if((np->ofile = (struct file**)kalloc()) == 0){
+      uvmunlock(curproc->pgdir);
+      np->ofile = np->ofile0;
+      goto bad;
+    }
+    memset(np->ofile, 0, PGSIZE);
+    np->nofile = curproc->leader->nofile;
+  }
+  for(i = 0; i < np->nofile; i++)
+    if(curproc->leader->ofile[i])
+      np->ofile[i] = filedup(curproc->leader->ofile[i]);
+  uvmunlock(curproc->pgdir);
   np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  np->nseg = curproc->nseg;
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
 
   // copy parent process name
   // like strncpy(), but guaranteed to nul-terminate
   // fairly common practice to write your own safe wrappers for some C stdlib functions, especially ones
   // in string.h, which are so often error-prone and dangerous
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->class = curproc->class;
+  np->nice = curproc->nice;
+  memmove(np->affinity, curproc->affinity, sizeof(np->affinity));
 
   pid = np->pid;
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  setparent(np, curproc); // on curproc's kids list, now that the fork can't fail
+  runnable(np);
 
   release(&ptable.lock);
 
   return pid; // for parent
+
+bad:
+  // fail - free what allocproc() and fork() allocated and set child state UNUSED
+  for(i = 0; i < NVMA; i++)
+    if(np->vma[i].end){
+      if(np->vma[i].f)
+        fileclose(np->vma[i].f);
+      np->vma[i].end = 0;
+    }
+  if(np->pgdir){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+  }
+  if(np->ofile != np->ofile0)
+    kfree((char*)np->ofile);
+  kfree(np->kstack);
+  np->kstack = 0;
+  acquire(&ptable.lock);
+  freeproc(np);
+  release(&ptable.lock);
+  return -1;
+}
+
+// Create a thread of the current process: a process of its own to the
+// scheduler, but sharing the current one's memory, open files and mappings.
+// It starts in user space running fn(arg) on the stack [stack, stack+size),
+// which the caller checked is user memory; fn must call exit() rather than
+// return, to the bogus address 0xffffffff. The creator reaps it with join().
+// Returns the thread's pid, or -1.
+int
+clone(uint fn, uint arg, uint stack, uint size)
+{
+  struct proc *np;
+  struct proc *curproc = myproc();
+  uint sp, frame[2];
+
+  sp = (stack + size) & ~3;
+  if(size < sizeof(frame) || sp - sizeof(frame) < stack)
+    return -1;
+  sp -= sizeof(frame);
+  // a lazily allocated or copy-on-write stack page faults in like a user write would
+  frame[0] = 0xffffffff;
+  frame[1] = arg;
+  if(ucopy((void*)sp, frame, sizeof(frame)) < 0)
+    return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // the group's files and mappings are looked up through the leader
+  np->leader = curproc->leader;
+  np->threaded = 1;
+  curproc->threaded = 1;
+  uvmlock(curproc->pgdir); // against growproc(), which sets every thread's sz
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  uvmunlock(curproc->pgdir);
+  np->ustack = (void*)stack;
+  *np->tf = *curproc->tf;
+  np->tf->eax = 0;
+  np->tf->eip = fn;
+  np->tf->esp = sp;
+
+  // the current directory is the thread's own; chdir() in one thread leaves the others alone
+  np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  np->nseg = curproc->nseg;
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->class = curproc->class;
+  np->nice = curproc->nice;
+  memmove(np->affinity, curproc->affinity, sizeof(np->affinity));
+
+  acquire(&ptable.lock);
+  setparent(np, curproc);
+  runnable(np);
+  release(&ptable.lock);
+  return np->pid;
+}
+
+// Put zombie thread p (see clone()) back in the table: what it shares
+// with its group stays. Caller must hold ptable.lock.
+static void
+freethread(struct proc *p)
+{
+  kfree(p->kstack);
+  p->kstack = 0;
+  p->pgdir = 0;
+  p->pid = 0;
+  p->leader = p;
+  p->threaded = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  freeproc(p); // off its parent's zombies list
+  p->parent = 0;
+}
+
+// Does leader have any threads left, zombies included?
+// Caller must hold ptable.lock.
+static int
+hasthreads(struct proc *leader)
+{
+  struct proc *p;
+
+  for(p = ptable.all; p; p = p->pnext)
+    if(p != leader && p->state != UNUSED && p->leader == leader)
+      return 1;
+  return 0;
+}
+
+// Wait for a thread created by this one to exit and return its pid,
+// with the stack it was given in *stack.
+// Return -1 if this process has created no threads, or has been killed.
+int
+join(void **stack)
+{
+  struct proc *p;
+  int havethreads, pid;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for(;;){
+    for(p = curproc->zombies; p; p = p->knext){
+      if(p->leader == p)
+        continue;
+      pid = p->pid;
+      *stack = p->ustack;
+      freethread(p);
+      // the last one gone: back to the single-threaded ways
+      if(curproc->leader == curproc && !hasthreads(curproc))
+        curproc->threaded = 0;
+      release(&ptable.lock);
+      return pid;
+    }
+    havethreads = 0;
+    for(p = curproc->kids; p && !havethreads; p = p->knext)
+      if(p->leader != p)
+        havethreads = 1;
+    if(!havethreads || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(curproc, &ptable.lock);
+  }
+}
+
+// Exit the current thread (see clone()), leaving what it shares to the group.
+static void
+exitthread(void)
+{
+  struct proc *curproc = myproc();
+
+  begin_op();
+  iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
+  end_op();
+  curproc->cwd = 0;
+  curproc->exe = 0;
+
+  acquire(&ptable.lock);
+
+  // the creator might be sleeping in join(), the leader in exit()
+  wakeup1(curproc->parent);
+  wakeup1(curproc->leader);
+
+  // threads it created pass to the leader, other children to init
+  abandon(curproc, curproc->leader);
+
+  curproc->state = ZOMBIE;
+  setparent(curproc, curproc->parent); // onto its zombies list
+  sched();
+  panic("zombie exit");
+}
+
+// Kill the threads of the current process, the group leader, wait
+// for them all to exit and reap them, for exit() to tear down the rest.
+static void
+killthreads(void)
+{
+  struct proc *curproc = myproc();
+  struct proc *p;
+  int n;
+
+  acquire(&ptable.lock);
+  for(;;){
+    n = 0;
+    for(p = ptable.all; p; p = p->pnext){
+      if(p == curproc || p->state == UNUSED || p->state == ZOMBIE || p->leader != curproc)
+        continue;
+      p->killed = 1;
+      if(p->state == SLEEPING)
+        runnable(p);
+      n++;
+    }
+    if(n == 0)
+      break;
+    sleep(curproc, &ptable.lock);
+  }
+  for(p = ptable.all; p; p = p->pnext)
+    if(p != curproc && p->state == ZOMBIE && p->leader == curproc)
+      freethread(p);
+  curproc->threaded = 0;
+  release(&ptable.lock);
 }
 
 // Exit the current process.  Does not return.
@@ -273,41 +747,52 @@ void
 exit(void)
 {
   struct proc *curproc = myproc();
-  struct proc *p;
   int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
+  if(curproc->leader != curproc)
+    exitthread();
+  // memory, files and mappings may only go once no thread uses them
+  if(curproc->threaded)
+    killthreads();
+
+  // Write back and drop its mappings, which may hold files open.
+  mmapexit(curproc);
+
   // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
+  for(fd = 0; fd < curproc->nofile; fd++){
     if(curproc->ofile[fd]){
       fileclose(curproc->ofile[fd]);
       curproc->ofile[fd] = 0;
     }
   }
+  if(curproc->ofile != curproc->ofile0){
+    kfree((char*)curproc->ofile);
+    curproc->ofile = curproc->ofile0;
+    curproc->nofile = NOFILE;
+  }
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
-  // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
-  }
+  // Pass abandoned children to init. Its threads are all gone (killthreads()).
+  abandon(curproc, initproc);
 
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
+  setparent(curproc, curproc->parent); // onto its zombies list, for wait()
   sched();
   panic("zombie exit");
 }
@@ -323,27 +808,29 @@ wait(void)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    // Look through the exited children, not the whole table.
+    for(p = curproc->zombies; p; p = p->knext){
+      // threads are join()ed instead
+      if(p->leader != p)
         continue;
-      havekids = 1;
-      if(p->state == ZOMBIE){
-        // Found one.
-        pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
-        release(&ptable.lock);
-        return pid;
-      }
+      // Found one.
+      pid = p->pid;
+      kfree(p->kstack);
+      p->kstack = 0;
+      freevm(p->pgdir);
+      p->pgdir = 0;
+      p->pid = 0;
+      p->name[0] = 0;
+      p->killed = 0;
+      freeproc(p); // off curproc's zombies list
+      p->parent = 0;
+      release(&ptable.lock);
+      return pid;
     }
+    havekids = 0;
+    for(p = curproc->kids; p && !havekids; p = p->knext)
+      if(p->leader == p)
+        havekids = 1;
 
     // No point waiting if we don't have any children.
     if(!havekids || curproc->killed){
@@ -356,11 +843,345 @@ wait(void)
   }
 }
 
+// Get an idle cpu out of the hlt in scheduler(). Sets c->kick before
+// sending the IPI, so that a cpu which has not reached its hlt yet
+// sees the flag and doesn't halt at all.
+// Caller must hold ptable.lock.
+static void
+kick(struct cpu *c)
+{
+  c->idle = 0;
+  if(c == mycpu())
+    return;
+  c->kick = 1;
+  lapicipi(c->apicid, T_IRQ0 + IRQ_WAKE);
+}
+
+// Whether p's affinity mask lets it run on CPU i.
+static int
+mayrun(struct proc *p, int i)
+{
+  return (p->affinity[i/32] >> (i%32)) & 1;
+}
+
+// Make p RUNNABLE and append it to a run queue: that of the CPU it
+// last ran on, or the shortest one it may run on if it has never run
+// (or may not run there any more).
+// A SLEEPING p also comes off its wait queue.
+// Caller must hold ptable.lock.
+static void
+runnable(struct proc *p)
+{
+  struct runq *q;
+  int i;
+
+  if(p->cpu < 0 || !mayrun(p, p->cpu)){
+    p->cpu = -1;
+    for(i = 0; i < ncpu; i++)
+      if(mayrun(p, i) &&
+         (p->cpu < 0 || ptable.rq[i].n < ptable.rq[p->cpu].n))
+        p->cpu = i;
+  }
+  if(p->state == SLEEPING){
+    // off its wait queue
+    if(p->wnext)
+      p->wnext->wprev = p->wprev;
+    *p->wprev = p->wnext;
+  }
+  q = &ptable.rq[p->cpu];
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  if(q->tail[p->class])
+    q->tail[p->class]->rqnext = p;
+  else
+    q->head[p->class] = p;
+  q->tail[p->class] = p;
+  q->n++;
+
+  // an interactive process shouldn't wait out a batch process's long slice
+  if(p->class == SCHED_INTERACTIVE && cpus[p->cpu].proc &&
+     cpus[p->cpu].proc->class == SCHED_BATCH)
+    cpus[p->cpu].proc->slice = 0;
+
+  // if the owning cpu is halted, wake it; if it is busy, wake some idle
+  // cpu so that it can steal p instead of p waiting out the slice
+  if(cpus[p->cpu].idle)
+    kick(&cpus[p->cpu]);
+  else
+    for(i = 0; i < ncpu; i++)
+      if(cpus[i].idle && mayrun(p, i)){
+        kick(&cpus[i]);
+        break;
+      }
+}
+
+// Take the process at the head of q's list for class.
+// Caller must hold ptable.lock.
+static struct proc*
+rqpop1(struct runq *q, int class)
+{
+  struct proc *p;
+
+  if((p = q->head[class]) == 0)
+    return 0;
+  if((q->head[class] = p->rqnext) == 0)
+    q->tail[class] = 0;
+  q->n--;
+  p->rqnext = 0;
+  return p;
+}
+
+// Take RUNNABLE p off its run queue. Caller must hold ptable.lock.
+static void
+rqremove(struct proc *p)
+{
+  struct runq *q;
+  struct proc **pp, *prev;
+
+  q = &ptable.rq[p->cpu];
+  prev = 0;
+  for(pp = &q->head[p->class]; *pp != p; pp = &(*pp)->rqnext)
+    prev = *pp;
+  *pp = p->rqnext;
+  if(q->tail[p->class] == p)
+    q->tail[p->class] = prev;
+  q->n--;
+  p->rqnext = 0;
+}
+
+// Take the next process to run from q: interactive ones first, but
+// let a waiting batch process have every BATCHSHARE'th turn so it
+// can't starve. Caller must hold ptable.lock.
+static struct proc*
+rqpop(struct runq *q)
+{
+  struct proc *p;
+
+  if(q->head[SCHED_BATCH] == 0)
+    q->ipicks = 0;
+  else if(q->ipicks >= BATCHSHARE || q->head[SCHED_INTERACTIVE] == 0){
+    q->ipicks = 0;
+    return rqpop1(q, SCHED_BATCH);
+  }
+  if((p = rqpop1(q, SCHED_INTERACTIVE)) != 0 && q->head[SCHED_BATCH])
+    q->ipicks++;
+  return p;
+}
+
+// Length of p's time slice in ticks.
+static int
+quantum(struct proc *p)
+{
+  int q;
+
+  q = p->class == SCHED_BATCH ? QBATCH : 1;
+  q = q * (NICE_MAX + 1 - p->nice) / (NICE_MAX + 1);
+  return q > 0 ? q : 1;
+}
+
+// The first process on q that CPU id may take from it: one that may run
+// there and whose cache has gone cold, interactive ones first.
+// Caller must hold ptable.lock.
+static struct proc*
+rqstealable(struct runq *q, int id, uint64 now)
+{
+  struct proc *p;
+  int class;
+
+  for(class = 0; class < NSCHED; class++)
+    for(p = q->head[class]; p; p = p->rqnext)
+      if(mayrun(p, id) && cyc2ns(now - p->offcpu) >= MIGRATENS)
+        return p;
+  return 0;
+}
+
+// Choose the next process for CPU id: the head of its own run queue,
+// else one it may steal from the longest other queue that has one.
+// The process then belongs to CPU id. Caller must hold ptable.lock.
+static struct proc*
+rqpick(int id)
+{
+  struct proc *p, *q;
+  uint64 now;
+  int i, n;
+
+  if((p = rqpop(&ptable.rq[id])) == 0){
+    now = rdtsc();
+    n = 0;
+    for(i = 0; i < ncpu; i++)
+      if(i != id && ptable.rq[i].n > n && (q = rqstealable(&ptable.rq[i], id, now)) != 0){
+        p = q;
+        n = ptable.rq[i].n;
+      }
+    if(p == 0)
+      return 0;
+    rqremove(p);
+  }
+  p->cpu = id;
+  p->slice = quantum(p);
+  return p;
+}
+
+// Timer queues. Instead of every sleeper waking on each tick to check
+// its deadline, a process doing a timed sleep goes on a min-heap in
+// its cpu's struct cpu, and the lapic timer is run in one-shot mode,
+// set for the earliest of that heap's top and the next scheduler tick.
+// A cpu only needs ticks while it runs a process (to preempt it), and
+// cpu 0 keeps ticking since it maintains ticks for uptime() and drives
+// group commit; an idle cpu with an empty heap turns its timer off.
+// All of this is protected by ptable.lock.
+
+static void
+tqswap(struct cpu *c, int i, int j)
+{
+  struct proc *p;
+
+  p = c->timerq[i];
+  c->timerq[i] = c->timerq[j];
+  c->timerq[j] = p;
+  c->timerq[i]->tidx = i;
+  c->timerq[j]->tidx = j;
+}
+
+// Restore the heap order around index i after its deadline changed
+// or it was filled in from elsewhere.
+static void
+tqfix(struct cpu *c, int i)
+{
+  int child;
+
+  while(i > 0 && c->timerq[i]->deadline < c->timerq[(i-1)/2]->deadline){
+    tqswap(c, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+  for(;;){
+    child = 2*i + 1;
+    if(child >= c->ntimer)
+      break;
+    if(child+1 < c->ntimer && c->timerq[child+1]->deadline < c->timerq[child]->deadline)
+      child++;
+    if(c->timerq[i]->deadline <= c->timerq[child]->deadline)
+      break;
+    tqswap(c, i, child);
+    i = child;
+  }
+}
+
+static void
+tqinsert(struct cpu *c, struct proc *p)
+{
+  p->tcpu = c - cpus;
+  p->tidx = c->ntimer++;
+  c->timerq[p->tidx] = p;
+  tqfix(c, p->tidx);
+}
+
+static void
+tqremove(struct proc *p)
+{
+  struct cpu *c;
+  int i;
+
+  c = &cpus[p->tcpu];
+  i = p->tidx;
+  p->tidx = -1;
+  if(i == --c->ntimer)
+    return;
+  c->timerq[i] = c->timerq[c->ntimer];
+  c->timerq[i]->tidx = i;
+  tqfix(c, i);
+}
+
+// Set this cpu's lapic timer for its next event, if that changed.
+// Caller must hold ptable.lock.
+static void
+timerarm(struct cpu *c)
+{
+  uint64 now, next;
+
+  now = nsecs();
+  next = 0;
+  if(c->proc || c == &cpus[0]){
+    if(c->nexttick <= now)
+      c->nexttick = now + TICKNS;
+    next = c->nexttick;
+  }
+  if(c->ntimer > 0 && (next == 0 || c->timerq[0]->deadline < next))
+    next = c->timerq[0]->deadline;
+  if(next == c->armed)
+    return;
+  c->armed = next;
+  lapiconeshot(next == 0 ? 0 : next > now ? next - now : 1);
+}
+
+// Timer interrupt: wake the processes whose deadline has passed and
+// rearm the timer. Returns 1 if a scheduler tick was due, so that the
+// caller should account it, 0 if the interrupt was only for a sleeper.
+int
+timerintr(void)
+{
+  struct cpu *c;
+  struct proc *p;
+  uint64 now;
+  int tick;
+
+  acquire(&ptable.lock);
+  c = mycpu();
+  now = nsecs();
+  while(c->ntimer > 0 && c->timerq[0]->deadline <= now){
+    p = c->timerq[0];
+    tqremove(p);
+    if(p->state == SLEEPING && p->chan == &p->deadline)
+      runnable(p);
+  }
+  tick = c->nexttick <= now;
+  c->armed = 0; // it just went off
+  timerarm(c);
+  release(&ptable.lock);
+  return tick;
+}
+
+// Sleep for ns nanoseconds, or until killed.
+// Returns 0, or -1 if the process was killed.
+int
+sleepns(uint64 ns)
+{
+  struct proc *p;
+  uint64 deadline;
+
+  p = myproc();
+  deadline = nsecs() + ns;
+  acquire(&ptable.lock);
+  while(!p->killed && nsecs() < deadline){
+    p->deadline = deadline;
+    tqinsert(mycpu(), p);
+    timerarm(mycpu());
+    sleep(&p->deadline, &ptable.lock);
+    if(p->tidx >= 0) // woken early by kill()
+      tqremove(p);
+  }
+  release(&ptable.lock);
+  return p->killed ? -1 : 0;
+}
+
+// Make p the process running on c: scheduler() and sched() do this before
+// swtch()ing to it. Caller must hold ptable.lock.
+static void
+dispatch(struct cpu *c, struct proc *p)
+{
+  tracerec(TR_SWITCH, c->proc ? c->proc->pid : 0, p->pid);
+  c->proc = p;
+  timerarm(c); // a running process needs ticks to be preempted
+  switchuvm(p);
+  p->state = RUNNING;
+  p->oncpu = rdtsc();
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU's mpmain() setup ends with calling scheduler().
 // Scheduler never returns.  It loops, doing:
-//  - choose a RUNNABLE process from the process table to run
+//  - choose a RUNNABLE process from this CPU's run queue, or steal one
 //  - swtch to that process to resume it
 //  - eventually process swtches back to the scheduler.
 // Interrupts were disabled in the bootloader, in xv6 the scheduler enables them for the first time
@@ -370,6 +1191,8 @@ void
 scheduler(void)
 {
   struct proc *p;
+  uint64 t;
+  int ran;
   struct cpu *c = mycpu(); // ok to call because interrupts are disabled
   c->proc = 0; // a CPU running the scheduler isn't running a process
   
@@ -379,13 +1202,15 @@ scheduler(void)
     // needs to acquire the lock)
     sti();
 
-    // Loop over process table looking for a RUNNABLE process to run.
+    // Look for a RUNNABLE process to run.
     acquire(&ptable.lock); // acquiring a lock disables interrupts
 
     // scheduling algorithm
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    // run whatever is runnable back to back, switching from one process's page table
+    // straight to the next's: the kernel half is global (see pgeinit()), so it survives
+    // the lcr3() in switchuvm() and there's nothing to gain from a detour through kpgdir
+    ran = 0;
+    while((p = rqpick(c - cpus)) != 0){
 
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
@@ -393,9 +1218,7 @@ scheduler(void)
       // switch to the process pgdir
       // kernel code continues to be safe to execute because it uses addresses in the higher half, which are
       // the same for every page directory (setupkvm())
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
+      dispatch(c, p);
 
       // pick up where process left off - in kernel mode, which handled a syscall, interrupt or exception
       // before calling the scheduler
@@ -417,14 +1240,38 @@ scheduler(void)
       swtch(&(c->scheduler), p->context);
 
       // Eventually process will swtch back
-      switchkvm(); // switch back to kpgdir
-
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
+      ran = 1;
+    }
+    if(ran){
+      // switch back to kpgdir while still holding ptable.lock: once it's released, the
+      // last process may exit and be freed by wait() on another cpu, page table and all
+      switchkvm();
+      release(&ptable.lock);
+      continue;
     }
-    release(&ptable.lock);
 
+    // Nothing to run anywhere: instead of spinning on ptable.lock, halt
+    // until an interrupt arrives. runnable() sends a wakeup IPI to idle
+    // cpus, and the timer wakes us at least once a tick.
+    c->idle = 1;
+    timerarm(c);
+    release(&ptable.lock);
+    if(kzerofill()){
+      // spent a little time zeroing pages for kzalloc(); look again
+      c->idle = 0;
+      continue;
+    }
+    cli();
+    if(!c->kick){
+      t = nsecs();
+      stihlt();
+      c->idlens += nsecs() - t;
+    }
+    c->kick = 0;
+    c->idle = 0;
   }
 }
 
@@ -444,6 +1291,7 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc();
+  struct proc *next;
 
   if(!holding(&ptable.lock)) // should be holding process table lock
     panic("sched ptable.lock");
@@ -456,8 +1304,29 @@ sched(void)
   // pushcli() and popcli() check whether interrupts were enabled before turning them off while holding
   // a lock, but this is really a property of this kernel thread, not of this CPU, so we need to save that
   intena = mycpu()->intena;
-  // call swtch() to pick up where the scheduler left off (line after its own call to swtch())
-  swtch(&p->context, mycpu()->scheduler);
+  p->offcpu = rdtsc();
+  p->runcyc += p->offcpu - p->oncpu;
+  if(p->state == RUNNABLE)
+    p->nivcsw++;
+  else
+    p->nvcsw++;
+  // hand the CPU straight to the next process on the run queue, one swtch() instead of two through
+  // the scheduler: it resumes in its own sched() (or forkret()) and releases ptable.lock for us
+  // a process that yields with nothing else to run just carries on
+  // only a CPU with nothing to run goes back to scheduler(), to halt
+  if((next = rqpick(cpuid())) != 0){
+    if(next == p){
+      p->state = RUNNING;
+      p->oncpu = rdtsc();
+    } else {
+      dispatch(mycpu(), next);
+      swtch(&p->context, next->context);
+    }
+  } else {
+    // call swtch() to pick up where the scheduler left off (line after its own call to swtch())
+    tracerec(TR_SWITCH, p->pid, 0);
+    swtch(&p->context, mycpu()->scheduler);
+  }
   // this process will resume executing eventually, at which point we'll restore the data about whether
   // interrupts were enabled and let it run again
   mycpu()->intena = intena;
@@ -471,7 +1340,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE; // can be picked up in next scheduling round
+  runnable(myproc()); // can be picked up in next scheduling round, after the ones already waiting
   sched(); // switch into scheduler
   release(&ptable.lock); // release lock when we eventually return here
 }
@@ -554,10 +1423,14 @@ forkret(void)
 // DANGER - any lock passed to sleep() must always get acquired before ptable.lock to avoid deadlock
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
-void
-sleep(void *chan, struct spinlock *lk)
+// An exclusive sleeper (see sleepexcl()) goes to the back of the
+// queue, the others to the front, so wakeup() finds exclusive
+// sleepers in the order they went to sleep.
+static void
+sleep1(void *chan, struct spinlock *lk, int excl)
 {
   struct proc *p = myproc();
+  struct proc **pp;
   
   if(p == 0)
     panic("sleep"); // CPU is running a process and not the scheduler (which can't go to sleep)
@@ -581,6 +1454,17 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->excl = excl;
+  pp = WAITQ(chan);
+  if(excl)
+    while(*pp)
+      pp = &(*pp)->wnext;
+  p->wprev = pp;
+  p->wnext = *pp;
+  if(p->wnext)
+    p->wnext->wprev = &p->wnext;
+  *pp = p;
+  tracerec(TR_SLEEP, (uint)chan, 0);
 
   // perform context switch into scheduler so it can run a new process
   // remember we have to be holding the process table lock
@@ -599,6 +1483,23 @@ sleep(void *chan, struct spinlock *lk)
     acquire(lk);
   }
 }
+
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleep1(chan, lk, 0);
+}
+
+// Sleep on chan as one of a group of waiters of which only one can go
+// on at a time, such as the processes waiting for a sleep-lock: wakeup()
+// then wakes only the first of them instead of the whole herd. Whoever
+// is woken must use up the wakeup, or pass it on with another wakeup()
+// if it leaves something for the next one to do.
+void
+sleepexcl(void *chan, struct spinlock *lk)
+{
+  sleep1(chan, lk, 1);
+}
 // reasoning for this implementation not missing any wakeup calls
 // after all, we release the original lock before putting the process to sleep
 // we're holding the process table lock at that point, which at least means interrupts are disabled
@@ -607,19 +1508,30 @@ sleep(void *chan, struct spinlock *lk)
 // we will see how this gets solved in wakeup()
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
+// Wake up all processes sleeping on chan, except that of those
+// sleeping with sleepexcl() only the first is woken.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc *p, *next;
+  int excl;
+
+  excl = 0;
+  for(p = *WAITQ(chan); p; p = next){
+    next = p->wnext;
+    if(p->chan == chan){
+      if(p->excl && excl++)
+        continue;
+      tracerec(TR_WAKEUP, (uint)chan, p->pid);
+      runnable(p);
+    }
+  }
+  if(*POLLQ(chan))
+    pollwake1(chan);
 }
 
-// Wake up all processes sleeping on chan.
+// Wake up the processes sleeping on chan, see wakeup1().
 void
 wakeup(void *chan)
 {
@@ -628,6 +1540,122 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Wake up at most n of the processes sleeping on chan, for futexwake().
+// Returns the number woken.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p, *next;
+  int woken;
+
+  woken = 0;
+  acquire(&ptable.lock);
+  for(p = *WAITQ(chan); p && woken < n; p = next){
+    next = p->wnext;
+    if(p->chan == chan){
+      tracerec(TR_WAKEUP, (uint)chan, p->pid);
+      runnable(p);
+      woken++;
+    }
+  }
+  release(&ptable.lock);
+  return woken;
+}
+
+// poll() waits on the channels of several files at once. It puts a pollent
+// for each of them on a queue hashed by channel, like the wait queues, and
+// sleeps on its own &p->deadline (so that a timeout can end the wait too).
+// A wakeup() on any of the channels sees the entry and wakes the poller.
+// Entries go on the queues before poll() looks at the files: a wakeup
+// after that sets p->pollwoken, and pollend() won't sleep.
+
+// Wake the pollers with an entry for chan. Caller holds ptable.lock.
+static void
+pollwake1(void *chan)
+{
+  struct pollent *e;
+  struct proc *p;
+
+  for(e = *POLLQ(chan); e; e = e->next){
+    if(e->chan != chan)
+      continue;
+    p = e->p;
+    p->pollwoken = 1;
+    if(p->state == SLEEPING && p->chan == &p->deadline){
+      tracerec(TR_WAKEUP, (uint)chan, p->pid);
+      runnable(p);
+    }
+  }
+}
+
+// Start a round of poll(), with the entries in pt's e[max].
+void
+pollbegin(struct polltab *pt)
+{
+  pt->n = 0;
+  acquire(&ptable.lock);
+  myproc()->pollwoken = 0;
+  release(&ptable.lock);
+}
+
+// Called by the files' poll functions: wake the poller on a wakeup(chan).
+// If count isn't 0, it counts the pollers (until pollend()), for a file
+// that only does the wakeup when somebody waits (see pipepoll()).
+void
+pollwait(struct polltab *pt, void *chan, int *count)
+{
+  struct pollent *e;
+
+  if(pt->n == pt->max)
+    panic("pollwait");
+  e = &pt->e[pt->n++];
+  e->chan = chan;
+  e->p = myproc();
+  e->count = count;
+  acquire(&ptable.lock);
+  e->prev = POLLQ(chan);
+  e->next = *e->prev;
+  if(e->next)
+    e->next->prev = &e->next;
+  *e->prev = e;
+  release(&ptable.lock);
+  if(count)
+    __sync_fetch_and_add(count, 1);
+}
+
+// End the round: unless one of the channels had a wakeup since pollbegin(),
+// sleep first if asked to, until there is one or the deadline passes (if not 0).
+// Then take the entries off the queues.
+void
+pollend(struct polltab *pt, int wait, uint64 deadline)
+{
+  struct proc *p;
+  struct pollent *e;
+
+  p = myproc();
+  acquire(&ptable.lock);
+  if(wait && !p->pollwoken && !p->killed && (deadline == 0 || nsecs() < deadline)){
+    if(deadline){
+      p->deadline = deadline;
+      tqinsert(mycpu(), p);
+      timerarm(mycpu());
+    }
+    sleep(&p->deadline, &ptable.lock);
+    if(p->tidx >= 0) // woken before the deadline
+      tqremove(p);
+  }
+  for(e = pt->e; e < &pt->e[pt->n]; e++){
+    if(e->next)
+      e->next->prev = e->prev;
+    *e->prev = e->next;
+  }
+  release(&ptable.lock);
+  for(e = pt->e; e < &pt->e[pt->n]; e++)
+    if(e->count)
+      __sync_fetch_and_sub(e->count, 1);
+  pt->n = 0;
+}
+
 // One of the functions that can get called both by the kernel and as a syscall
 // Kernel uses it to terminate malicious or buggy processes
 // Killing a process immediately would present all kinds of risks (corrupting kernel data structures being
@@ -647,20 +1675,163 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if(p->state == SLEEPING)
+      runnable(p);
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+static char *states[] = {
+[UNUSED]    "unused",
+[EMBRYO]    "embryo",
+[SLEEPING]  "sleep ",
+[RUNNABLE]  "runble",
+[RUNNING]   "run   ",
+[ZOMBIE]    "zombie"
+};
+
+// Set the scheduling class and nice value of process pid,
+// or of the calling process if pid is 0.
+int
+setsched(int pid, int class, int nice)
+{
+  struct proc *p;
+
+  if(class < 0 || class >= NSCHED || nice < 0 || nice > NICE_MAX)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) != 0){
+    if(p->state == RUNNABLE){
+      // move it to the list for its new class
+      rqremove(p);
+      p->class = class;
+      runnable(p);
+    } else
+      p->class = class;
+    p->nice = nice;
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Let process pid (or the calling process, if pid is 0) run only on the
+// CPUs in mask, NCPUWORDS words with a bit each (bit i%32 of word i/32
+// for CPU i). It moves off a CPU that mask leaves out the next time it
+// stops running there, which for the calling process is before
+// setaffinity() returns.
+int
+setaffinity(int pid, uint *mask)
+{
+  struct proc *p;
+  uint m[NCPUWORDS], any;
+  int i, move;
+
+  any = 0;
+  for(i = 0; i < NCPUWORDS; i++){
+    // no bits for CPUs that aren't there
+    if(ncpu <= 32*i)
+      m[i] = 0;
+    else if(ncpu < 32*(i+1))
+      m[i] = mask[i] & ((1u << (ncpu - 32*i)) - 1);
+    else
+      m[i] = mask[i];
+    any |= m[i];
+  }
+  if(any == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) != 0){
+    memmove(p->affinity, m, sizeof(m));
+    move = 0;
+    if(p->cpu >= 0 && !mayrun(p, p->cpu)){
+      if(p->state == RUNNABLE){
+        rqremove(p);
+        runnable(p);
+      } else if(p == myproc())
+        move = 1;
+      else if(p->state == RUNNING)
+        p->slice = 0; // yield at its next tick
     }
+    release(&ptable.lock);
+    if(move)
+      yield(); // runnable() puts it on a cpu it may run on
+    return 0;
   }
   release(&ptable.lock);
   return -1;
 }
 
+// Fill in up to n entries of the user's pi with the processes in use.
+// They are gathered a page at a time under ptable.lock, then copied out
+// without it, since the copy may fault; so a listing of more than a
+// page's worth isn't all from one moment.
+// Returns the number of entries filled in, or -1.
+int
+procinfo(struct procinfo *pi, int n)
+{
+  struct proc *p;
+  struct procinfo *buf, *e;
+  int i, m, max, skip;
+  char *s;
+
+  if((buf = (struct procinfo*)kalloc()) == 0)
+    return -1;
+  max = PGSIZE / sizeof(*buf);
+  i = 0;
+  do {
+    m = 0;
+    skip = i;  // the ones already copied out
+    acquire(&ptable.lock);
+    for(p = ptable.all; p && m < max && i + m < n; p = p->pnext){
+      if(p->state == UNUSED || skip-- > 0)
+        continue;
+      e = &buf[m++];
+      e->pid = p->pid;
+      e->ppid = p->parent ? p->parent->pid : 0;
+      // without the padding procdump() lines up with
+      safestrcpy(e->state, states[p->state], sizeof(e->state));
+      for(s = e->state; *s && *s != ' '; s++)
+        ;
+      *s = 0;
+      e->class = p->class;
+      e->nice = p->nice;
+      e->cpu = p->cpu;
+      memmove(e->affinity, p->affinity, sizeof(e->affinity));
+      e->sz = p->sz;
+      safestrcpy(e->name, p->name, sizeof(e->name));
+      e->cycles = p->runcyc;
+      if(p->state == RUNNING)
+        e->cycles += rdtsc() - p->oncpu;
+      e->ms = divl(cyc2ns(e->cycles), 1000000);
+      e->nvcsw = p->nvcsw;
+      e->nivcsw = p->nivcsw;
+      e->nfault = p->nfault;
+      e->nbread = p->nbread;
+      e->nbwrite = p->nbwrite;
+    }
+    release(&ptable.lock);
+    if(ucopy(&pi[i], buf, m*sizeof(*buf)) < 0){
+      kfree((char*)buf);
+      return -1;
+    }
+    i += m;
+  } while(m == max && i < n);
+  kfree((char*)buf);
+  return i;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console. (keyboard interrupt handler function sets this up)
@@ -668,27 +1839,20 @@ kill(int pid)
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [EMBRYO]    "embryo",
-  [SLEEPING]  "sleep ",
-  [RUNNABLE]  "runble",
-  [RUNNING]   "run   ",
-  [ZOMBIE]    "zombie"
-  };
   int i;
   struct proc *p;
   char *state;
-  uint pc[10];
+  uint pc[10], now, idle;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->pnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s %s/%d", p->pid, state, p->name,
+            p->class == SCHED_BATCH ? "batch" : "inter", p->nice);
     // sleep() and wakeup() syscalls involve some lock trickery
     // so sleeping processes could be a common cause of concurrency issues like deadlocks
     // Thus print out call stack of sleeping processes
@@ -699,4 +1863,12 @@ procdump(void)
     }
     cprintf("\n");
   }
+
+  // how busy each cpu has been since boot
+  now = divl(nsecs(), 1000000);
+  for(i = 0; i < ncpu; i++){
+    idle = divl(cpus[i].idlens, 1000000);
+    cprintf("cpu%d: %d%% busy (%d/%d ms idle)\n", i,
+            now ? 100 - idle*100/now : 0, idle, now);
+  }
 }
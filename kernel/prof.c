@@ -0,0 +1,90 @@
+// Sampling profiler.
+//
+// While profiling is on, every scheduler tick records where it
+// interrupted the cpu: the eip, and for kernel code the return addresses
+// of the frames below it, into a ring of the cpu's last PROFSIZE samples.
+// Each cpu writes only its own ring, with interrupts off, so sampling
+// takes no lock. profile(PROF_READ) gathers the rings for the prof tool,
+// which looks the addresses up in kernel.sym (stabs, which the kernel
+// has no copy of, would say no more than that).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "prof.h"
+
+static struct {
+  struct profsample s[PROFSIZE];
+  uint n;                 // samples taken; the latest is s[(n-1) % PROFSIZE]
+} __attribute__((aligned(CACHELINE))) ring[NCPU];
+
+static volatile int profiling;
+
+// Record a sample of the interrupted context tf, from the timer interrupt.
+void
+profsample(struct trapframe *tf)
+{
+  struct profsample *s;
+  struct proc *p;
+  uint *ebp;
+  int i, c;
+
+  if(!profiling)
+    return;
+  c = cpuid();
+  s = &ring[c].s[ring[c].n++ % PROFSIZE];
+  p = myproc();
+  s->pid = p ? p->pid : 0;
+  s->user = (tf->cs & 3) == DPL_USER;
+  s->pc[0] = tf->eip;
+  i = 1;
+  if(!s->user){
+    ebp = (uint*)tf->ebp;
+    for(; i < PROFDEPTH; i++){
+      if(ebp == 0 || ebp < (uint*)KERNBASE || ebp == (uint*)0xffffffff)
+        break;
+      s->pc[i] = ebp[1];     // saved %eip
+      ebp = (uint*)ebp[0];   // saved %ebp
+    }
+  }
+  for(; i < PROFDEPTH; i++)
+    s->pc[i] = 0;
+}
+
+// profile(cmd, buf, n): PROF_START, PROF_STOP, or PROF_READ
+// up to n samples into buf, returning how many.
+int
+profile(int cmd, struct profsample *buf, int n)
+{
+  int c, i, m, got;
+  uint first;
+
+  switch(cmd){
+  case PROF_START:
+    profiling = 0;
+    for(c = 0; c < ncpu; c++)
+      ring[c].n = 0;
+    profiling = 1;
+    return 0;
+  case PROF_STOP:
+    profiling = 0;
+    return 0;
+  case PROF_READ:
+    // the rings may change under us while profiling: take what is there
+    got = 0;
+    for(c = 0; c < ncpu && got < n; c++){
+      m = ring[c].n < PROFSIZE ? ring[c].n : PROFSIZE;
+      first = ring[c].n - m;
+      for(i = 0; i < m && got < n; i++)
+        if(ucopy(&buf[got++], &ring[c].s[(first + i) % PROFSIZE], sizeof(*buf)) < 0)
+          return -1;
+      ring[c].n = 0;
+    }
+    return got;
+  }
+  return -1;
+}
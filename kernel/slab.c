@@ -0,0 +1,111 @@
+// Object caches: memory for kernel structures smaller than a page.
+//
+// kalloc() only hands out whole pages, which wastes most of a page on a
+// pipe or a file. A cache instead carves pages into objects of one size
+// and keeps the free ones in its depot. Each cpu also keeps a magazine
+// of up to MAGSIZE free objects per cache, which slaballoc() and
+// slabfree() use with interrupts off and no lock at all; only when a
+// magazine is empty or full do they move half a magazine between it and
+// the depot under the cache's lock. So an object freed on a cpu is the
+// next one handed out there, while it is still in that cpu's cache.
+// Pages stay with their cache once carved.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slabobj {
+  struct slabobj *next;
+};
+
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  int i;
+
+  size = (size + 7) & ~7;
+  if(size > PGSIZE)
+    panic("slabinit");
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->free = 0;
+  c->nfree = 0;
+  c->npages = 0;
+  for(i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+}
+
+// Fill magazine m halfway from the depot, carving a fresh page
+// into the depot first if it is empty. Caller must hold c->lock.
+static void
+slabfill(struct slabcache *c, struct magazine *m)
+{
+  struct slabobj *o;
+  char *pg, *p;
+
+  if(c->free == 0 && (pg = kalloc()) != 0){
+    c->npages++;
+    // backwards, so that the page is handed out from its start
+    for(p = pg + (PGSIZE / c->size - 1) * c->size; p >= pg; p -= c->size){
+      o = (struct slabobj*)p;
+      o->next = c->free;
+      c->free = o;
+      c->nfree++;
+    }
+  }
+  while(m->n < MAGSIZE/2 && (o = c->free) != 0){
+    c->free = o->next;
+    c->nfree--;
+    m->obj[m->n++] = o;
+  }
+}
+
+// Allocate an object from cache c. Its contents are garbage.
+// Returns 0 if out of memory.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *v;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    slabfill(c, m);
+    release(&c->lock);
+  }
+  v = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  return v;
+}
+
+// Give back object v, which slaballoc(c) returned.
+void
+slabfree(struct slabcache *c, void *v)
+{
+  struct magazine *m;
+  struct slabobj *o;
+
+#ifdef POISON
+  memset(v, 1, c->size);
+#endif
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2){
+      o = m->obj[--m->n];
+      o->next = c->free;
+      c->free = o;
+      c->nfree++;
+    }
+    release(&c->lock);
+  }
+  m->obj[m->n++] = v;
+  popcli();
+}
@@ -16,24 +16,68 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
   lk->pid = 0;
+  lk->owner = 0;
+}
+
+// Is the holder of lk running on another cpu, and so likely to let go
+// soon? Reads without ptable.lock, which is fine for a hint:
+// proc slots are never freed, and the caller checks again anyway.
+static int
+ownerrunning(struct sleeplock *lk)
+{
+  struct proc *p;
+
+  p = *(struct proc * volatile *)&lk->owner;
+  return p && *(volatile enum procstate *)&p->state == RUNNING;
+}
+
+// Wait a little for the holder of lk to let go, if it is busy on
+// another cpu: cheaper than sleeping and being woken if the critical
+// section is short. Caller holds lk->lk; returns with it held again.
+// spun counts the cycles spent so far, up to SLEEPSPIN.
+static void
+spinwait(struct sleeplock *lk, uint64 *spun)
+{
+  uint64 t0;
+
+  t0 = rdtsc();
+  release(&lk->lk);
+  while(*(volatile uint*)&lk->locked && ownerrunning(lk) && *spun + (rdtsc() - t0) < SLEEPSPIN)
+    pause();
+  *spun += rdtsc() - t0;
+  acquire(&lk->lk);
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 spun;
+
   // make sure sleep-lock acquisition is atomic
   // also makes sure interrupts are disabled during this function and reenabled
   // does add some overhead in the form of spinning until the lock is free, but the code here should be short
   // what we really want to do is avoid spinning once the sleep-lock is acquired, i.e. spinning after the
   // function is done
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->wwait++;
+  spun = 0;
+  while (lk->locked || lk->readers) {
+    // a holder running on another cpu may be about to release: spin for a while first
+    if(lk->locked && spun < SLEEPSPIN && ownerrunning(lk)){
+      spinwait(lk, &spun);
+      continue;
+    }
     // must always be called inside a while loop to make sure we don't miss any wakeup calls
-    sleep(lk, &lk->lk);
+    // only one of the exclusive waiters can have the lock, so releasesleep() wakes just one
+    sleepexcl(lk, &lk->lk);
   }
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
 }
 
@@ -43,10 +87,37 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Shared mode, for code that only reads what the lock protects:
+// any number of processes can hold the lock this way at once, while
+// nobody holds it exclusively. New readers wait behind exclusive
+// waiters, so a steady stream of readers can't starve a writer.
+// A process must not take shared a lock it already holds.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait)
+    sleep(lk, &lk->lk);
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -0,0 +1,262 @@
+// UDP sockets. A socket is a file (FD_SOCK) with a queue of the datagrams
+// received on the port it is bound to. net.c delivers them there as the
+// packets they came in, and reading takes them off the queue: recvmmsg()
+// takes a whole batch each time it locks the queue, and copies each one
+// straight from its packet to user memory.
+// Sending builds the datagram in a fresh packet and hands it down to net.c.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "slab.h"
+#include "net.h"
+#include "socket.h"
+#include "poll.h"
+
+#define SOCKQMAX  256     // datagrams a socket queues before dropping more
+#define NSOCKHASH 64
+#define PORTFIRST 49152   // ports bind() picks from when asked for 0
+
+struct sock {
+  struct spinlock lock;   // the queue
+  ushort port;            // bound to, 0 if not yet (protected by socks.lock)
+  struct sock *next;      // on the hash chain for port
+  struct pkt *head;       // datagrams received, oldest first
+  struct pkt **tail;
+  int n;
+};
+
+// Bound sockets, hashed by port.
+static struct {
+  struct spinlock lock;
+  struct sock *hash[NSOCKHASH];
+  ushort nextport;
+  struct slabcache cache;
+} socks;
+
+void
+sockinit(void)
+{
+  initlock(&socks.lock, "socks");
+  slabinit(&socks.cache, "sockcache", sizeof(struct sock));
+  socks.nextport = PORTFIRST;
+}
+
+// Caller holds socks.lock.
+static struct sock*
+socklookup(ushort port)
+{
+  struct sock *s;
+
+  for(s = socks.hash[port % NSOCKHASH]; s; s = s->next)
+    if(s->port == port)
+      return s;
+  return 0;
+}
+
+// A new unbound socket, in a new file. Returns 0 or -1.
+int
+sockalloc(struct file **f)
+{
+  struct sock *s;
+
+  if((*f = filealloc()) == 0)
+    return -1;
+  if((s = slaballoc(&socks.cache)) == 0){
+    fileclose(*f);
+    return -1;
+  }
+  initlock(&s->lock, "sock");
+  s->port = 0;
+  s->next = 0;
+  s->head = 0;
+  s->tail = &s->head;
+  s->n = 0;
+  (*f)->type = FD_SOCK;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->sock = s;
+  return 0;
+}
+
+// Bind s to port, or to a free port of the kernel's choosing if port is 0.
+// Returns -1 if s is bound already or port is taken.
+int
+sockbind(struct sock *s, ushort port)
+{
+  int i;
+
+  acquire(&socks.lock);
+  if(s->port != 0){
+    release(&socks.lock);
+    return -1;
+  }
+  if(port == 0){
+    for(i = 0; i < 65536 - PORTFIRST; i++){
+      port = socks.nextport;
+      socks.nextport = socks.nextport == 65535 ? PORTFIRST : socks.nextport + 1;
+      if(socklookup(port) == 0)
+        break;
+    }
+    if(i == 65536 - PORTFIRST)
+      port = 0;
+  }
+  if(port == 0 || socklookup(port)){
+    release(&socks.lock);
+    return -1;
+  }
+  s->port = port;
+  s->next = socks.hash[port % NSOCKHASH];
+  socks.hash[port % NSOCKHASH] = s;
+  release(&socks.lock);
+  return 0;
+}
+
+void
+sockclose(struct sock *s)
+{
+  struct sock **pp;
+  struct pkt *p, *next;
+
+  // once off the hash chain, net.c can't deliver to it any more
+  acquire(&socks.lock);
+  if(s->port != 0){
+    for(pp = &socks.hash[s->port % NSOCKHASH]; *pp != s; pp = &(*pp)->next)
+      ;
+    *pp = s->next;
+  }
+  release(&socks.lock);
+  for(p = s->head; p; p = next){
+    next = p->next;
+    pktfree(p);
+  }
+  slabfree(&socks.cache, s);
+}
+
+// Queue datagram p for the socket bound to port, and wake a reader.
+// Returns -1 if there is none or its queue is full; the caller frees p then.
+int
+sockdeliver(struct pkt *p, ushort port)
+{
+  struct sock *s;
+
+  acquire(&socks.lock);
+  if((s = socklookup(port)) == 0){
+    release(&socks.lock);
+    return -1;
+  }
+  acquire(&s->lock);
+  release(&socks.lock);
+  if(s->n >= SOCKQMAX){
+    release(&s->lock);
+    return -1;
+  }
+  p->next = 0;
+  *s->tail = p;
+  s->tail = &p->next;
+  // only a reader that found the queue empty sleeps
+  if(s->n++ == 0)
+    wakeup(s);
+  release(&s->lock);
+  return 0;
+}
+
+// Send the n bytes at buf as a datagram from s to port at addr, binding s
+// first if it isn't. Returns n, or -1.
+int
+socksend(struct sock *s, char *buf, int n, uint addr, ushort port)
+{
+  struct pkt *p;
+
+  if(n < 0 || n > UDPMAX || port == 0)
+    return -1;
+  // another thread may bind it meanwhile, which is as good
+  if(s->port == 0 && sockbind(s, 0) < 0 && s->port == 0)
+    return -1;
+  if((p = pktalloc()) == 0)
+    return -1;
+  if(ucopy(p->data, buf, n) < 0){
+    pktfree(p);
+    return -1;
+  }
+  p->len = n;
+  if(udptx(p, s->port, addr, port) < 0)
+    return -1;
+  return n;
+}
+
+// Wait for datagrams to arrive on s, then take up to n of them off its queue
+// into pkts, all at once. Returns how many, or -1 if killed while waiting.
+int
+sockrecvn(struct sock *s, struct pkt **pkts, int n)
+{
+  struct pkt *p;
+  int i;
+
+  acquire(&s->lock);
+  while(s->head == 0){
+    if(myproc()->killed){
+      release(&s->lock);
+      return -1;
+    }
+    sleep(s, &s->lock);
+  }
+  for(i = 0; i < n && (p = s->head) != 0; i++){
+    s->head = p->next;
+    pkts[i] = p;
+  }
+  if(s->head == 0)
+    s->tail = &s->head;
+  s->n -= i;
+  release(&s->lock);
+  return i;
+}
+
+// POLLIN if a datagram is queued on s; sending never waits.
+int
+sockpoll(struct sock *s, int events, struct polltab *pt)
+{
+  int r;
+
+  r = events & POLLOUT;
+  if(events & POLLIN){
+    acquire(&s->lock);
+    // sockdeliver() wakes s whenever the queue was empty
+    pollwait(pt, s, 0);
+    if(s->head)
+      r |= POLLIN;
+    release(&s->lock);
+  }
+  return r;
+}
+
+// Receive one datagram from s into buf, up to n bytes of it (the rest is
+// lost), and say who sent it in *from, a kernel struct, if from isn't 0.
+// Returns the bytes copied, or -1.
+int
+sockread(struct sock *s, char *buf, int n, struct sockaddr_in *from)
+{
+  struct pkt *p;
+
+  if(sockrecvn(s, &p, 1) < 0)
+    return -1;
+  if(n > p->len)
+    n = p->len;
+  if(ucopy(buf, p->data, n) < 0){
+    pktfree(p);
+    return -1;
+  }
+  if(from){
+    from->family = AF_INET;
+    from->port = p->fport;
+    from->addr = p->faddr;
+  }
+  pktfree(p);
+  return n;
+}
@@ -9,12 +9,43 @@
 #include "proc.h"
 #include "spinlock.h"
 
+#define NLOCKSTAT 64
+
+static struct lockstat lockstat[NLOCKSTAT];
+static uint nlockstat;
+static uint lockstatbusy; // guards adding to lockstat[]; can't be a spinlock itself
+
+// Find or make the lockstat entry for name, or 0 when the table is full.
+// initlock() runs before mpinit() knows the cpus, so no pushcli() here;
+// interrupt handlers don't initialize locks, so none can spin on this cpu.
+static struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *s;
+
+  while(xchg(&lockstatbusy, 1) != 0)
+    pause();
+  for(s = lockstat; s < &lockstat[nlockstat]; s++)
+    if(s->name == name || strncmp(s->name, name, 32) == 0)
+      break;
+  if(s == &lockstat[nlockstat]){
+    if(nlockstat < NLOCKSTAT)
+      lockstat[nlockstat++].name = name;
+    else
+      s = 0;
+  }
+  xchg(&lockstatbusy, 0);
+  return s;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0; // no cpu
+  lk->stat = lockstatfor(name);
 }
 
 // Acquire the lock.
@@ -24,13 +55,26 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+  uint64 t0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // The xadd is atomic: every cpu gets a different ticket.
+  ticket = xadd(&lk->next, 1);
+  if(*(volatile uint*)&lk->owner != ticket){
+    t0 = rdtsc();
+    while(*(volatile uint*)&lk->owner != ticket)
+      pause();
+    if(lk->stat){
+      lk->stat->ncontended++;
+      lk->stat->spin += rdtsc() - t0;
+    }
+  }
+  if(lk->stat)
+    lk->stat->nacquire++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -59,10 +103,10 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Release the lock: serve the next ticket, equivalent to lk->owner++.
+  // Only the holder writes owner, so this needs no lock prefix, but it has
+  // to be a single store the compiler can't split or move.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
 
   popcli();
 }
@@ -91,11 +135,28 @@ holding(struct spinlock *lock)
 {
   int r;
   pushcli();
-  r = lock->locked && lock->cpu == mycpu();
+  r = lock->owner != lock->next && lock->cpu == mycpu();
   popcli();
   return r;
 }
 
+// Print the lock profile to the console, for ^L.
+// No lock: the counters are only read, and may be slightly stale.
+void
+lockdump(void)
+{
+  struct lockstat *s;
+  uint64 ns;
+
+  cprintf("lock acquired contended spin-ms\n");
+  for(s = lockstat; s < &lockstat[nlockstat]; s++){
+    if(s->nacquire == 0)
+      continue;
+    ns = cyc2ns(s->spin);
+    cprintf("%s %d %d %d\n", s->name, s->nacquire, s->ncontended,
+            (uint)(ns >> 32) < 1000000 ? divl(ns, 1000000) : -1);
+  }
+}
 
 // Pushcli/popcli are like cli/sti except that they are matched:
 // it takes two popcli to undo two pushcli.  Also, if interrupts
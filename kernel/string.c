@@ -1,14 +1,23 @@
 #include "types.h"
 #include "x86.h"
 
+// Longs at a time from the first aligned address on, so that
+// unaligned or odd-sized buffers also mostly go by rep stosl.
 void*
 memset(void *dst, int c, uint n)
 {
-  if ((int)dst%4 == 0 && n%4 == 0){
-    c &= 0xFF;
-    stosl(dst, (c<<24)|(c<<16)|(c<<8)|c, n/4);
-  } else
-    stosb(dst, c, n);
+  char *d;
+  uint head;
+
+  d = dst;
+  c &= 0xFF;
+  head = -(uint)d & 3;
+  if(head > n)
+    head = n;
+  stosb(d, c, head);
+  d += head, n -= head;
+  stosl(d, (c<<24)|(c<<16)|(c<<8)|c, n/4);
+  stosb(d + (n & ~3), c, n & 3);
   return dst;
 }
 
@@ -28,22 +37,49 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// Copies with the string instructions: longs at a time when dst and
+// src are equally aligned (whole pages, buffers, struct copies), with
+// the odd bytes at either end done by rep movsb.
 void*
 memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  uint head;
 
   s = src;
   d = dst;
+  if(n == 0)
+    return dst;
   if(s < d && s + n > d){
+    // overlapping, to a higher address: copy backwards
     s += n;
     d += n;
-    while(n-- > 0)
-      *--d = *--s;
-  } else
-    while(n-- > 0)
-      *d++ = *s++;
+    if((((uint)s ^ (uint)d) & 3) == 0){
+      head = (uint)d & 3;
+      if(head > n)
+        head = n;
+      if(head)
+        movsbr(d - 1, s - 1, head);
+      s -= head, d -= head, n -= head;
+      if(n >= 4)
+        movslr(d - 4, s - 4, n / 4);
+      s -= n & ~3, d -= n & ~3, n &= 3;
+    }
+    if(n)
+      movsbr(d - 1, s - 1, n);
+  } else {
+    if((((uint)s ^ (uint)d) & 3) == 0){
+      head = -(uint)d & 3;
+      if(head > n)
+        head = n;
+      movsb(d, s, head);
+      s += head, d += head, n -= head;
+      movsl(d, s, n / 4);
+      s += n & ~3, d += n & ~3, n &= 3;
+    }
+    movsb(d, s, n);
+  }
 
   return dst;
 }
@@ -25,8 +25,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
-  *ip = *(int*)(addr);
-  return 0;
+  // fails rather than panics if the page can't be had (see usercopy.S)
+  return ucopy(ip, (void*)addr, 4);
 }
 // Digression on dereferencing a null pointer
 // If the kernel is using kpgdir as a page directory, address 0 isn't mapped to anything
@@ -42,26 +42,23 @@ fetchint(uint addr, int *ip)
 // a null pointer
 // But if you add any kernel code that calls this function, you must be very careful
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
-// Returns length of string, not including nul.
+// Copy the nul-terminated string at addr from the current process
+// into buf, which has room for max bytes, nul included. The copy is
+// what gets used, so another thread can't change the string once
+// it's checked.
+// Returns length of string, not including nul, or -1 if it doesn't fit.
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-  char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= curproc->sz || max <= 0)
     return -1;
-  *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
-  }
-  return -1;
+  if(max > curproc->sz - addr)
+    max = curproc->sz - addr;
+  return ucopystr(buf, (char*)addr, max);
 }
-// again, we dereference pp and addr without null checks. Be careful of using this function
+// again, we dereference buf and addr without null checks. Be careful of using this function
 
 // Fetch the nth 32-bit system call argument.
 int
@@ -70,6 +67,24 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
+// Check that the block of size bytes at addr lies within the
+// current process's address space, for the kernel to use as a buffer,
+// and that its pages are there to be read and written.
+int
+fetchptr(uint addr, int size)
+{
+  struct proc *curproc = myproc();
+
+  if(size < 0)
+    return -1;
+  // the buffer may be a mapping (see mmap()) above the heap
+  if((addr >= curproc->sz || addr+size > curproc->sz) && !vmarange(curproc, addr, size))
+    return -1;
+  // the system call may use the buffer holding locks, when it can't fault in program text or files;
+  // and it can't back out of a copy that runs out of memory halfway, so it fails here instead
+  return prefault(curproc, addr, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
 // lies within the process address space.
@@ -77,27 +92,24 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
- 
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(fetchptr(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a string pointer,
+// and copy the string into buf, of max bytes, as fetchstr() does.
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
   int addr;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -121,6 +133,35 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_fsync(void);
+extern int sys_sync(void);
+extern int sys_logstat(void);
+extern int sys_setsched(void);
+extern int sys_procinfo(void);
+extern int sys_nanosleep(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futexwait(void);
+extern int sys_futexwake(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_ringenter(void);
+extern int sys_trapstat(void);
+extern int sys_profile(void);
+extern int sys_trace(void);
+extern int sys_socket(void);
+extern int sys_bind(void);
+extern int sys_sendto(void);
+extern int sys_recvfrom(void);
+extern int sys_recvmmsg(void);
+extern int sys_poll(void);
+extern int sys_irqstat(void);
+extern int sys_irqroute(void);
+extern int sys_setaffinity(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -144,17 +185,54 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_logstat] sys_logstat,
+[SYS_setsched] sys_setsched,
+[SYS_procinfo] sys_procinfo,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futexwait] sys_futexwait,
+[SYS_futexwake] sys_futexwake,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_ringenter] sys_ringenter,
+[SYS_trapstat] sys_trapstat,
+[SYS_profile] sys_profile,
+[SYS_trace]   sys_trace,
+[SYS_socket]  sys_socket,
+[SYS_bind]    sys_bind,
+[SYS_sendto]  sys_sendto,
+[SYS_recvfrom] sys_recvfrom,
+[SYS_recvmmsg] sys_recvmmsg,
+[SYS_poll]    sys_poll,
+[SYS_irqstat] sys_irqstat,
+[SYS_irqroute] sys_irqroute,
+[SYS_setaffinity] sys_setaffinity,
 };
 
 void
 syscall(void)
 {
   int num;
+  uint64 t0;
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    t0 = rdtsc();
     curproc->tf->eax = syscalls[num]();
+    latcount(1, num, t0);
+    // the file argfd() kept open in case another thread closed it
+    if(curproc->argf){
+      fileclose(curproc->argf);
+      curproc->argf = 0;
+    }
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
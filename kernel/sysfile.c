@@ -15,19 +15,45 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "logstat.h"
+#include "mman.h"
+#include "uio.h"
+#include "ring.h"
+#include "net.h"
+#include "socket.h"
+#include "poll.h"
+
+// The open files belong to the thread group (see clone()): p->leader->ofile,
+// changed holding the page table's lock.
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// In a threaded process, another thread could close the descriptor while
+// the system call goes on using the file, so the file is kept open until
+// the call returns (see syscall()). One argfd() per system call.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc();
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
-    return -1;
+  if(!p->threaded){
+    if(fd < 0 || fd >= p->nofile || (f=p->ofile[fd]) == 0)
+      return -1;
+  } else {
+    uvmlock(p->pgdir);
+    if(fd < 0 || fd >= p->leader->nofile || (f=p->leader->ofile[fd]) == 0){
+      uvmunlock(p->pgdir);
+      return -1;
+    }
+    if(p->argf)
+      panic("argfd");
+    p->argf = filedup(f);
+    uvmunlock(p->pgdir);
+  }
   if(pfd)
     *pfd = fd;
   if(pf)
@@ -37,21 +63,130 @@ argfd(int n, int *pfd, struct file **pf)
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
+// Once the NOFILE descriptors in struct proc are all in use, the table
+// moves to a page of its own with room for NOFILEMAX.
 static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct file **ofile;
+  struct proc *curproc = myproc()->leader;
 
-  for(fd = 0; fd < NOFILE; fd++){
+  uvmlock(curproc->pgdir);
+  for(fd = 0; fd < curproc->nofile; fd++){
     if(curproc->ofile[fd] == 0){
       curproc->ofile[fd] = f;
+      uvmunlock(curproc->pgdir);
       return fd;
     }
   }
+  if(curproc->nofile < NOFILEMAX && (ofile = (struct file**)kalloc()) != 0){
+    memset(ofile, 0, PGSIZE);
+    memmove(ofile, curproc->ofile0, sizeof(curproc->ofile0));
+    curproc->ofile = ofile;
+    curproc->nofile = NOFILEMAX;
+    curproc->ofile[fd] = f;
+    uvmunlock(curproc->pgdir);
+    return fd;
+  }
+  uvmunlock(curproc->pgdir);
   return -1;
 }
 
+// The file descriptor fd refers to, with a reference for the caller
+// to drop with fileclose(), or 0.
+static struct file*
+fdget(int fd)
+{
+  struct proc *curproc = myproc()->leader;
+  struct file *f;
+
+  uvmlock(curproc->pgdir);
+  f = 0;
+  if(fd >= 0 && fd < curproc->nofile && curproc->ofile[fd])
+    f = filedup(curproc->ofile[fd]);
+  uvmunlock(curproc->pgdir);
+  return f;
+}
+
+// close(fd)
+static int
+fdclose(int fd)
+{
+  struct proc *curproc = myproc()->leader;
+  struct file *f;
+
+  uvmlock(curproc->pgdir);
+  f = 0;
+  if(fd >= 0 && fd < curproc->nofile){
+    f = curproc->ofile[fd];
+    curproc->ofile[fd] = 0;
+  }
+  uvmunlock(curproc->pgdir);
+  if(f == 0)
+    return -1;
+  fileclose(f);
+  return 0;
+}
+
+// Take descriptor fd, which refers to f, out of the table.
+// Returns -1 if another thread closed it first.
+static int
+fdfree(int fd, struct file *f)
+{
+  struct proc *curproc = myproc()->leader;
+  int r;
+
+  uvmlock(curproc->pgdir);
+  r = -1;
+  if(curproc->ofile[fd] == f){
+    curproc->ofile[fd] = 0;
+    r = 0;
+  }
+  uvmunlock(curproc->pgdir);
+  return r;
+}
+
+// Wait until every change to the file's inode and data made so far
+// is on disk. With group commit, writes are otherwise only durable
+// once their batch commits on its own.
+int
+sys_fsync(void)
+{
+  struct file *f;
+  uint gen;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  gen = f->ip->gen;
+  iunlock(f->ip);
+  logwait(gen);
+  return 0;
+}
+
+// Wait until every FS operation that has finished is on disk.
+int
+sys_sync(void)
+{
+  logwait(loggen());
+  return 0;
+}
+
+// Copy the file system log's counters to user space.
+int
+sys_logstat(void)
+{
+  struct logstat *st, s;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  logstat(&s);
+  return ucopy(st, &s, sizeof(s));  // not under the log lock: the copy may fault
+}
+
 int
 sys_dup(void)
 {
@@ -90,38 +225,151 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Copy the array of cnt iovecs at the nth argument to iov, and check
+// each buffer. The copy is what gets used, so that another thread
+// can't change a buffer once it's checked.
+static int
+argiov(int n, struct iovec *iov, int cnt)
+{
+  char *p;
+  uint total;
+  int i;
+
+  if(cnt < 0 || cnt > IOV_MAX || argptr(n, &p, cnt*sizeof(*iov)) < 0)
+    return -1;
+  if(ucopy(iov, p, cnt*sizeof(*iov)) < 0)
+    return -1;
+  total = 0;
+  for(i = 0; i < cnt; i++){
+    if((int)iov[i].len < 0 || fetchptr((uint)iov[i].base, iov[i].len) < 0)
+      return -1;
+    if((total += iov[i].len) > 0x7fffffff)
+      return -1;
+  }
+  return 0;
+}
+
+// readv(fd, iov, cnt) - read into cnt buffers in turn
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, iov, cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+// writev(fd, iov, cnt) - write cnt buffers in turn
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &cnt) < 0 || argiov(1, iov, cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// pread(fd, buf, n, off) - read at byte off of a file, leaving its offset alone
+int
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.base = p;
+  iov.len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+// pwrite(fd, buf, n, off) - write at byte off of a file, leaving its offset alone
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  iov.base = p;
+  iov.len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
 int
 sys_close(void)
 {
   int fd;
+
+  if(argint(0, &fd) < 0)
+    return -1;
+  return fdclose(fd);
+}
+
+// mmap(addr, len, prot, flags, fd, off): addr is only a hint, and
+// the kernel picks the address anyway.
+int
+sys_mmap(void)
+{
   struct file *f;
+  int len, prot, flags, off;
+  uint addr;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argint(5, &off) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
-  fileclose(f);
-  return 0;
+  f = 0;
+  if(!(flags & MAP_ANONYMOUS) && argfd(4, 0, &f) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || (addr = mmap(f, off, len, prot, flags)) == 0)
+    return -1;
+  return addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(addr, len);
 }
 
 int
 sys_fstat(void)
 {
   struct file *f;
-  struct stat *st;
+  struct stat *st, s;
 
   if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
-  return filestat(f, st);
+  if(filestat(f, &s) < 0)
+    return -1;
+  return ucopy(st, &s, sizeof(s));
 }
 
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  if(argstr(0, old, sizeof(old)) < 0 || argstr(1, new, sizeof(new)) < 0)
     return -1;
 
   begin_op();
@@ -186,10 +434,10 @@ sys_unlink(void)
 {
   struct inode *ip, *dp;
   struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ], path[MAXPATH];
   uint off;
 
-  if(argstr(0, &path) < 0)
+  if(argstr(0, path, sizeof(path)) < 0)
     return -1;
 
   begin_op();
@@ -218,6 +466,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -282,17 +531,14 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-int
-sys_open(void)
+// open(path, omode), with path already checked
+static int
+openpath(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
@@ -314,32 +560,120 @@ sys_open(void)
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
   }
-  iunlock(ip);
-  end_op();
-
+  // ready before it's in the table, where another thread can use it at once
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  if((fd = fdalloc(f)) < 0){
+    f->type = FD_NONE;
+    fileclose(f);
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  end_op();
   return fd;
 }
 
+int
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
+// Carry out one queued operation of ringenter(), a copy of the entry.
+static int
+ringop(struct ringsqe *e)
+{
+  struct file *f;
+  struct iovec iov;
+  char path[MAXPATH];
+  int r;
+
+  switch(e->op){
+  case RING_OPEN:
+    if(fetchstr((uint)e->addr, path, sizeof(path)) < 0)
+      return -1;
+    return openpath(path, e->n);
+  case RING_CLOSE:
+    return fdclose(e->fd);
+  case RING_READ:
+  case RING_WRITE:
+    if(e->n < 0 || e->off < -1 || fetchptr((uint)e->addr, e->n) < 0 || (f = fdget(e->fd)) == 0)
+      return -1;
+    iov.base = e->addr;
+    iov.len = e->n;
+    if(e->op == RING_READ)
+      r = filereadv(f, &iov, 1, e->off);
+    else
+      r = filewritev(f, &iov, 1, e->off);
+    fileclose(f);
+    return r;
+  }
+  return -1;
+}
+
+// ringenter(struct ring *r, int n) - carry out up to n of the operations
+// queued in r, see ring.h, and return how many. Stops early when the
+// queue runs dry or there is no room left for completions.
+// One trap into the kernel for a whole batch of small reads and writes.
+int
+sys_ringenter(void)
+{
+  struct ring *r;
+  struct ringsqe e;
+  struct ringcqe c;
+  uint head, sqtail, cqhead, cqtail;
+  int n, done;
+
+  if(argptr(0, (void*)&r, sizeof(*r)) < 0 || argint(1, &n) < 0)
+    return -1;
+  for(done = 0; done < n && !myproc()->killed; done++){
+    if(ucopy(&head, &r->sqhead, sizeof(head)) < 0 ||
+       ucopy(&sqtail, &r->sqtail, sizeof(sqtail)) < 0 ||
+       ucopy(&cqhead, &r->cqhead, sizeof(cqhead)) < 0 ||
+       ucopy(&cqtail, &r->cqtail, sizeof(cqtail)) < 0)
+      break;
+    if(head == sqtail || cqtail - cqhead >= RINGSIZE)
+      break;
+    __sync_synchronize(); // the entry only after seeing sqtail
+    if(ucopy(&e, &r->sq[head % RINGSIZE], sizeof(e)) < 0)
+      break;
+    c.res = ringop(&e);
+    c.data = e.data;
+    if(ucopy(&r->cq[cqtail % RINGSIZE], &c, sizeof(c)) < 0)
+      break;
+    __sync_synchronize(); // the completion before the count
+    cqtail++;
+    head++;
+    if(ucopy(&r->cqtail, &cqtail, sizeof(cqtail)) < 0 ||
+       ucopy(&r->sqhead, &head, sizeof(head)) < 0)
+      break;
+  }
+  return done;
+}
+
 int
 sys_mkdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -352,11 +686,11 @@ int
 sys_mknod(void)
 {
   struct inode *ip;
-  char *path;
+  char path[MAXPATH];
   int major, minor;
 
   begin_op();
-  if((argstr(0, &path)) < 0 ||
+  if((argstr(0, path, sizeof(path))) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
@@ -371,12 +705,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
   struct proc *curproc = myproc();
   
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -396,33 +730,43 @@ sys_chdir(void)
 int
 sys_exec(void)
 {
-  char *path, *argv[MAXARG];
-  int i;
+  char path[MAXPATH], *argv[MAXARG], *args, *s;
+  int i, n, r;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
+  // the argument strings are copied in too, a page of them at most
+  if((args = kalloc()) == 0)
+    return -1;
   memset(argv, 0, sizeof(argv));
+  s = args;
+  r = -1;
   for(i=0;; i++){
     if(i >= NELEM(argv))
-      return -1;
+      goto out;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-      return -1;
+      goto out;
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
-    if(fetchstr(uarg, &argv[i]) < 0)
-      return -1;
+    if((n = fetchstr(uarg, s, args + PGSIZE - s)) < 0)
+      goto out;
+    argv[i] = s;
+    s += n + 1;
   }
-  return exec(path, argv);
+  r = exec(path, argv);
+out:
+  kfree(args);
+  return r;
 }
 
 int
 sys_pipe(void)
 {
-  int *fd;
+  int *fd, fds[2];
   struct file *rf, *wf;
   int fd0, fd1;
 
@@ -433,12 +777,214 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdfree(fd0, rf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
-  fd[0] = fd0;
-  fd[1] = fd1;
-  return 0;
+  fds[0] = fd0;
+  fds[1] = fd1;
+  // on failure the process is dying, and exit closes them
+  return ucopy(fd, fds, sizeof(fds));
+}
+
+// socket(domain, type, protocol): a UDP socket, the only kind there is.
+int
+sys_socket(void)
+{
+  int domain, type, fd;
+  struct file *f;
+
+  if(argint(0, &domain) < 0 || argint(1, &type) < 0)
+    return -1;
+  if(domain != AF_INET || type != SOCK_DGRAM)
+    return -1;
+  if(sockalloc(&f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// The socket fd refers to, through argument n.
+static struct sock*
+argsock(int n)
+{
+  struct file *f;
+
+  if(argfd(n, 0, &f) < 0 || f->type != FD_SOCK)
+    return 0;
+  return f->sock;
+}
+
+// bind(fd, struct sockaddr_in *addr): receive what comes to addr's port
+// (of any of our addresses); port 0 picks a free one.
+int
+sys_bind(void)
+{
+  struct sock *s;
+  struct sockaddr_in *sa, a;
+
+  if((s = argsock(0)) == 0 || argptr(1, (void*)&sa, sizeof(*sa)) < 0 ||
+     ucopy(&a, sa, sizeof(a)) < 0)
+    return -1;
+  if(a.family != AF_INET)
+    return -1;
+  return sockbind(s, a.port);
+}
+
+// sendto(fd, buf, n, struct sockaddr_in *to)
+int
+sys_sendto(void)
+{
+  struct sock *s;
+  struct sockaddr_in *sa, to;
+  char *buf;
+  int n;
+
+  if((s = argsock(0)) == 0 || argint(2, &n) < 0 || argptr(1, &buf, n) < 0 ||
+     argptr(3, (void*)&sa, sizeof(*sa)) < 0 || ucopy(&to, sa, sizeof(to)) < 0)
+    return -1;
+  if(to.family != AF_INET)
+    return -1;
+  return socksend(s, buf, n, to.addr, to.port);
+}
+
+// recvfrom(fd, buf, n, struct sockaddr_in *from): one datagram, from may be 0.
+int
+sys_recvfrom(void)
+{
+  struct sock *s;
+  struct sockaddr_in *sa, from;
+  char *buf;
+  int n;
+  uint a;
+
+  if((s = argsock(0)) == 0 || argint(2, &n) < 0 || argptr(1, &buf, n) < 0 ||
+     argint(3, (int*)&a) < 0)
+    return -1;
+  sa = 0;
+  if(a != 0 && argptr(3, (void*)&sa, sizeof(*sa)) < 0)
+    return -1;
+  if((n = sockread(s, buf, n, sa ? &from : 0)) < 0)
+    return -1;
+  if(sa && ucopy(sa, &from, sizeof(from)) < 0)
+    return -1;
+  return n;
+}
+
+#define RECVBATCH 64
+
+// recvmmsg(fd, struct mmsg *msgs, n): wait for a datagram, then return it and
+// up to n-1 more already queued, one in each of msgs (see socket.h). Returns
+// how many, or -1. One system call and one trip through the socket's lock
+// for a whole batch of small datagrams.
+int
+sys_recvmmsg(void)
+{
+  struct sock *s;
+  struct mmsg *m, mm;
+  struct pkt *pkts[RECVBATCH];
+  int n, got, i, len;
+
+  if((s = argsock(0)) == 0 || argint(2, &n) < 0 || n <= 0 ||
+     argptr(1, (void*)&m, n*sizeof(*m)) < 0)
+    return -1;
+  if(n > RECVBATCH)
+    n = RECVBATCH;
+  if((got = sockrecvn(s, pkts, n)) < 0)
+    return -1;
+  for(i = 0; i < got; i++){
+    // the process may change msgs meanwhile, so check what is used
+    if(ucopy(&mm, &m[i], sizeof(mm)) < 0)
+      break;
+    len = mm.len;
+    if(len < 0 || fetchptr((uint)mm.buf, len) < 0)
+      break;
+    if(len > pkts[i]->len)
+      len = pkts[i]->len;
+    mm.len = pkts[i]->len;
+    mm.from.family = AF_INET;
+    mm.from.port = pkts[i]->fport;
+    mm.from.addr = pkts[i]->faddr;
+    if(ucopy(mm.buf, pkts[i]->data, len) < 0 ||
+       ucopy(&m[i].len, &mm.len, sizeof(mm.len)) < 0 ||
+       ucopy(&m[i].from, &mm.from, sizeof(mm.from)) < 0)
+      break;
+    pktfree(pkts[i]);
+  }
+  // past a bad buffer the datagrams are lost, as at a full queue
+  for(n = i; i < got; i++)
+    pktfree(pkts[i]);
+  return n > 0 ? n : -1;
+}
+
+// poll(struct pollfd *fds, n, timeout): wait until one of the n files in
+// fds can be read or written without blocking (as its events ask), or for
+// timeout milliseconds (forever if it is negative), and say which in each
+// revents. Returns how many have revents set, 0 on a timeout, or -1.
+// Each round looks at every file, with its channels queued for a wakeup;
+// poll() sleeps only if none was ready and none of them had one meanwhile.
+int
+sys_poll(void)
+{
+  struct pollfd *fds, pf;
+  struct file **f;
+  struct polltab pt;
+  short rev;
+  int n, ms, i, r, ready, bad;
+  uint64 deadline;
+  char *mem;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NPOLLFD || argint(2, &ms) < 0 ||
+     argptr(0, (void*)&fds, n*sizeof(*fds)) < 0)
+    return -1;
+  deadline = ms > 0 ? nsecs() + (uint64)ms * 1000000 : 0;
+  // the files, held while polling, then room for the queue entries
+  if((mem = kalloc()) == 0)
+    return -1;
+  f = (struct file**)mem;
+  pt.e = (struct pollent*)(mem + NPOLLFD*sizeof(*f));
+  pt.max = (PGSIZE - NPOLLFD*sizeof(*f)) / sizeof(*pt.e);
+  for(i = 0; i < n; i++)
+    f[i] = ucopy(&pf, &fds[i], sizeof(pf)) < 0 ? 0 : fdget(pf.fd);
+
+  bad = 0;
+  for(;;){
+    pollbegin(&pt);
+    ready = 0;
+    for(i = 0; i < n; i++){
+      if(ucopy(&pf, &fds[i], sizeof(pf)) < 0){
+        bad = 1;
+        break;
+      }
+      if(pf.fd < 0)
+        r = 0; // skipped, as in unix
+      else if(f[i] == 0)
+        r = POLLNVAL;
+      else
+        r = filepoll(f[i], pf.events, &pt);
+      rev = r;
+      if(ucopy(&fds[i].revents, &rev, sizeof(rev)) < 0){
+        bad = 1;
+        break;
+      }
+      if(r)
+        ready++;
+    }
+    if(bad || ready || ms == 0 || myproc()->killed ||
+       (deadline && nsecs() >= deadline)){
+      pollend(&pt, 0, 0);
+      break;
+    }
+    pollend(&pt, 1, deadline);
+  }
+
+  for(i = 0; i < n; i++)
+    if(f[i])
+      fileclose(f[i]);
+  kfree(mem);
+  return bad || (myproc()->killed && !ready) ? -1 : ready;
 }
@@ -6,6 +6,12 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "procinfo.h"
+#include "trapstat.h"
+#include "traps.h"
+#include "irqstat.h"
+#include "prof.h"
+#include "trace.h"
 
 int
 sys_fork(void)
@@ -36,6 +42,162 @@ sys_kill(void)
   return kill(pid); // tags pid with 'killed' field, trap() will check this
 }
 
+// setsched(pid, class, nice)
+int
+sys_setsched(void)
+{
+  int pid, class, nice;
+
+  if(argint(0, &pid) < 0 || argint(1, &class) < 0 || argint(2, &nice) < 0)
+    return -1;
+  return setsched(pid, class, nice);
+}
+
+// setaffinity(pid, mask), mask being NCPUWORDS uints
+int
+sys_setaffinity(void)
+{
+  int pid;
+  uint *mask, m[NCPUWORDS];
+
+  if(argint(0, &pid) < 0 || argptr(1, (char**)&mask, sizeof(m)) < 0 ||
+     ucopy(m, mask, sizeof(m)) < 0)
+    return -1;
+  return setaffinity(pid, m);
+}
+
+// procinfo(struct procinfo *pi, int n) - list up to n processes
+int
+sys_procinfo(void)
+{
+  struct procinfo *pi;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROCMAX)
+    n = NPROCMAX;
+  if(argptr(0, (void*)&pi, n*sizeof(*pi)) < 0)
+    return -1;
+  return procinfo(pi, n);
+}
+
+// trapstat(st) - copy the trap and system call latency histograms into *st
+int
+sys_trapstat(void)
+{
+  struct trapstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return trapstat(st);
+}
+
+// irqstat(st) - copy each cpu's interrupt counts, and the IRQ routing, into *st
+int
+sys_irqstat(void)
+{
+  struct irqstat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return irqstat(st);
+}
+
+// irqroute(irq, cpu) - send device interrupt irq to cpu from now on
+int
+sys_irqroute(void)
+{
+  int irq, cpu;
+
+  if(argint(0, &irq) < 0 || argint(1, &cpu) < 0)
+    return -1;
+  return irqroute(irq, cpu);
+}
+
+// profile(cmd, buf, n) - control the kernel profiler, see prof.c
+int
+sys_profile(void)
+{
+  struct profsample *buf;
+  int cmd, n;
+
+  if(argint(0, &cmd) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(n > NCPU * PROFSIZE)
+    n = NCPU * PROFSIZE;
+  if(argptr(1, (void*)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return profile(cmd, buf, n);
+}
+
+// trace(cmd, buf, n) - control and read the event trace, see trace.c
+int
+sys_trace(void)
+{
+  struct traceev *buf;
+  int cmd, n;
+
+  if(argint(0, &cmd) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(n > NCPU * TRACESIZE)
+    n = NCPU * TRACESIZE;
+  if(argptr(1, (void*)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return tracectl(cmd, buf, n);
+}
+
+// clone(fn, arg, stack, size) - start a thread running fn(arg) on the given stack
+int
+sys_clone(void)
+{
+  int fn, arg, size;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(3, &size) < 0 ||
+     argptr(2, &stack, size) < 0)
+    return -1;
+  return clone(fn, arg, (uint)stack, size);
+}
+
+// join(void **stack) - wait for a thread to exit, and get back its stack
+int
+sys_join(void)
+{
+  void **stack, *s;
+  int pid;
+
+  if(argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+    return -1;
+  if((pid = join(&s)) >= 0 && ucopy(stack, &s, sizeof(s)) < 0)
+    return -1;
+  return pid;
+}
+
+// futexwait(uint *addr, uint val) - sleep while *addr == val, until futexwake(addr)
+int
+sys_futexwait(void)
+{
+  char *addr;
+  int val;
+
+  if(argptr(0, &addr, sizeof(uint)) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait((uint)addr, val);
+}
+
+// futexwake(uint *addr, int n) - wake up to n processes in futexwait(addr)
+int
+sys_futexwake(void)
+{
+  char *addr;
+  int n;
+
+  if(argptr(0, &addr, sizeof(uint)) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake((uint)addr, n);
+}
+
 int
 sys_getpid(void)
 {
@@ -45,15 +207,11 @@ sys_getpid(void)
 int
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 // sleep plays a dual role in xv6
@@ -62,27 +220,31 @@ sys_sbrk(void)
 // thus sleep() makes process state SLEEPING on a *channel* (int)
 // e.g. kernel puts a process waiting on the disk to sleep using a channel assigned to the disk
 // and disk interrupt wakes up any processes sleeping on the disk channel
-// for process use, the channel is the address of the ticks counter
-// thus process awoken at every timer interrupt; we loop until the right amount of ticks have passed
+// for timed sleeps, sleepns() puts the process on its cpu's timer queue and sleeps on its own deadline,
+// so only the timer interrupt for that deadline wakes it
 int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0) // ticks to sleep for
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){ // hasten process death
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock); // releases lock and reacquires before waking up
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return myproc()->killed ? -1 : 0;
+  return sleepns((uint64)n * TICKNS);
+}
+
+// sleep for sec seconds plus nsec nanoseconds, which need not be a whole number of ticks
+int
+sys_nanosleep(void)
+{
+  int sec, nsec;
+
+  if(argint(0, &sec) < 0 || argint(1, &nsec) < 0)
+    return -1;
+  if(sec < 0 || nsec < 0 || nsec >= 1000000000)
+    return -1;
+  return sleepns((uint64)sec * 1000000000 + nsec);
 }
 
 // return how many clock tick interrupts have occurred
@@ -0,0 +1,102 @@
+// Event tracing.
+//
+// Scheduling, sleep and wakeup, the buffer cache, the disks and the log
+// record what they do into a ring of the cpu's last TRACESIZE events,
+// cheaply enough to leave on all the time: when something took too long,
+// the trace tool can still show what led up to it, without printing to
+// the console and changing the timing. A cpu only writes its own ring,
+// with interrupts off, so recording takes no lock; tracectl() copies the
+// rings out without one either, dropping events overwritten meanwhile.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "trace.h"
+
+static struct {
+  struct traceev ev[TRACESIZE];
+  volatile uint n;        // events recorded; the latest is ev[(n-1) % TRACESIZE]
+  uint first;             // events before this one were cleared
+} __attribute__((aligned(CACHELINE))) ring[NCPU];
+
+static volatile int tracing = 1;
+
+// Record an event of type with arguments a0 and a1.
+void
+tracerec(int type, uint a0, uint a1)
+{
+  struct traceev *e;
+  struct cpu *c;
+  int i;
+
+  if(!tracing)
+    return;
+  pushcli();
+  c = mycpu();
+  i = c - cpus;
+  e = &ring[i].ev[ring[i].n % TRACESIZE];
+  e->ns = nsecs();
+  e->type = type;
+  e->cpu = i;
+  e->pid = c->proc ? c->proc->pid : 0;
+  e->arg[0] = a0;
+  e->arg[1] = a1;
+  __sync_synchronize();
+  ring[i].n++;
+  popcli();
+}
+
+// trace(cmd, buf, n): TRACE_STOP, TRACE_START, TRACE_CLEAR, or TRACE_READ
+// up to n events into buf, returning how many. Events come cpu by cpu,
+// each cpu's oldest first.
+int
+tracectl(int cmd, struct traceev *buf, int n)
+{
+  uint first, last, i;
+  int c, got, keep;
+
+  switch(cmd){
+  case TRACE_STOP:
+    tracing = 0;
+    return 0;
+  case TRACE_START:
+    tracing = 1;
+    return 0;
+  case TRACE_CLEAR:
+    for(c = 0; c < ncpu; c++)
+      ring[c].first = ring[c].n;
+    return 0;
+  case TRACE_READ:
+    got = 0;
+    for(c = 0; c < ncpu && got < n; c++){
+      last = ring[c].n;
+      first = ring[c].first;
+      if(last - first > TRACESIZE)
+        first = last - TRACESIZE;
+      if(last - first > n - got)
+        first = last - (n - got);
+      keep = got;
+      for(i = first; i != last; i++)
+        if(ucopy(&buf[got++], &ring[c].ev[i % TRACESIZE], sizeof(*buf)) < 0)
+          return -1;
+      __sync_synchronize();
+      // the cpu went on recording over the oldest ones we copied
+      if(ring[c].n - first > TRACESIZE){
+        i = ring[c].n - TRACESIZE - first;
+        if(i >= got - keep)
+          got = keep;
+        else {
+          if(ucopy(&buf[keep], &buf[keep + i], (got - keep - i) * sizeof(*buf)) < 0)
+            return -1;
+          got -= i;
+        }
+      }
+    }
+    return got;
+  }
+  return -1;
+}
@@ -7,6 +7,8 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "trapstat.h"
+#include "irqstat.h"
 
 // Two jobs
 // 1) put trap handler functions in 'vectors' into an IDT
@@ -15,9 +17,19 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
-struct spinlock tickslock;
+struct spinlock tickslock __attribute__((aligned(CACHELINE)));
 uint ticks; // number of timer interrupts so far (rough timer)
 
+// Latency histograms, see latcount(). Each cpu counts into its own,
+// so the hot path takes no lock and shares no cache line.
+static struct {
+  struct trapstat st;
+} __attribute__((aligned(CACHELINE))) tstat[NCPU];
+
+// Interrupts taken by each cpu, by IRQ number, see irqstat(). A row is
+// two cache lines of its own.
+static uint nintr[NCPU][NIRQ] __attribute__((aligned(CACHELINE)));
+
 // loads all assembly trap handler functions in 'vectors' into the IDT
 void
 tvinit(void)
@@ -38,24 +50,128 @@ tvinit(void)
 // Interrupt gates clear IF
 // From here on until 'trap', interrupts follow the same code path as system calls and exceptions, building
 // up a trap frame
-// 'trap' for a timer interrupt does 2 things - increment ticks variable, and call wakeup, which may cause
-// the interrupt to return in a diffent process
+// 'trap' for a timer interrupt wakes the sleepers whose deadline passed (timerintr()) and, on a scheduler
+// tick, increments the ticks variable and may yield, which causes the interrupt to return in a diffent process
 void
 idtinit(void)
 {
   lidt(idt, sizeof(idt));
 }
 
+extern void sysentry(void);
+extern char ucopyend[], ucopyfault[];
+
+// Set up the fast system call entry on this cpu, if it has one:
+// sysenter jumps straight to sysentry (see trapasm.S) on the kernel
+// stack that switchuvm() puts in MSR_SYSENTER_ESP, without the IDT
+// lookup and privilege checks of int $T_SYSCALL, which keeps working.
+// usys.S checks CPUID for sysenter the same way.
+void
+sysenterinit(void)
+{
+  uint a, b, c, d;
+
+  rcpuid(1, &a, &b, &c, &d);
+  if(!(d & (1<<11))) // has SEP
+    return;
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+  wrmsr(MSR_SYSENTER_ESP, 0); // until a process runs
+  mycpu()->sysenter = 1;
+}
+
+// Count trap number n (or system call number n, if sys) as having
+// taken from TSC time t0 until now.
+void
+latcount(int sys, int n, uint64 t0)
+{
+  uint64 c;
+  uint d, b;
+
+  if(n < 0 || n >= (sys ? NSYSLAT : NTRAPLAT))
+    return;
+  c = rdtsc() - t0;
+  d = (c >> 32) ? 0xFFFFFFFF : (uint)c >> LATSHIFT;
+  for(b = 0; d > 1 && b < NLATBIN - 1; b++)
+    d >>= 1;
+  // the process may move to another cpu, but not between these
+  pushcli();
+  if(sys)
+    tstat[cpuid()].st.sys[n][b]++;
+  else
+    tstat[cpuid()].st.trap[n][b]++;
+  popcli();
+}
+
+// Sum the cpus' histograms into the user's *st, a row at a time.
+// Returns -1 if a copy fails.
+int
+trapstat(struct trapstat *st)
+{
+  uint cycns, row[NLATBIN];
+  int i, j, c;
+
+  cycns = cyc2ns(1024);
+  if(ucopy(&st->cycns, &cycns, sizeof(cycns)) < 0)
+    return -1;
+  for(i = 0; i < NTRAPLAT; i++){
+    memset(row, 0, sizeof(row));
+    for(c = 0; c < ncpu; c++)
+      for(j = 0; j < NLATBIN; j++)
+        row[j] += tstat[c].st.trap[i][j];
+    if(ucopy(st->trap[i], row, sizeof(row)) < 0)
+      return -1;
+  }
+  for(i = 0; i < NSYSLAT; i++){
+    memset(row, 0, sizeof(row));
+    for(c = 0; c < ncpu; c++)
+      for(j = 0; j < NLATBIN; j++)
+        row[j] += tstat[c].st.sys[i][j];
+    if(ucopy(st->sys[i], row, sizeof(row)) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// The cpus' interrupt counts and where the I/O APIC routes each input,
+// into the user's *st. Returns -1 if a copy fails.
+int
+irqstat(struct irqstat *st)
+{
+  int c, i, cpu[NIRQ];
+  uint zero[NIRQ];
+
+  if(ucopy(&st->ncpu, &ncpu, sizeof(ncpu)) < 0)
+    return -1;
+  for(i = 0; i < NIRQ; i++)
+    cpu[i] = irqcpu(i);
+  if(ucopy(st->cpu, cpu, sizeof(cpu)) < 0)
+    return -1;
+  memset(zero, 0, sizeof(zero));
+  for(c = 0; c < NCPU; c++)
+    if(ucopy(st->count[c], c < ncpu ? nintr[c] : zero, sizeof(zero)) < 0)
+      return -1;
+  return 0;
+}
+
 //PAGEBREAK: 41
 // called by alltraps, switches based on trap number pushed on stack
 void
 trap(struct trapframe *tf)
 {
+  int tick = 0;
+  uint64 t0;
+
+  t0 = rdtsc();
+  // interrupt gates leave interrupts off, so this stays on one cpu
+  if(tf->trapno >= T_IRQ0 && tf->trapno < T_IRQ0 + NIRQ)
+    nintr[cpuid()][tf->trapno - T_IRQ0]++;
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed) // process done or caused an exception
       exit();
     myproc()->tf = tf;
     syscall();
+    latcount(0, T_SYSCALL, t0);
     if(myproc()->killed)
       exit();
     return;
@@ -63,14 +179,25 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
+    // one-shot timer: wakes expired sleepers and rearms for the next event
+    tick = timerintr();
+    if(tick)
+      profsample(tf); // at the scheduler tick rate, see prof.c
+    if(tick && cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks); // checks if any processes went to sleep until the next tick; switch to running any process it finds
       release(&tickslock);
+      logtick(); // group commit of batches that have waited long enough
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKE: // another cpu made a process runnable for us
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_TLB: // another cpu changed our page table, see uvmflush()
+    tlbintr();
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE: // disk interrupt
     ideintr();
     lapiceoi();
@@ -94,8 +221,60 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  // sysenter leaves TF set, so a process that set it traps on the first
+  // instruction of sysentry, in the kernel; sysentry clears it, just let it
+  case T_DEBUG:
+    if((tf->cs&3) == 0 && tf->eip == (uint)sysentry){
+      tf->eflags &= ~FL_TF;
+      break;
+    }
+    goto bad;
+
+  case T_PGFLT:
+    if(myproc())
+      myproc()->nfault++;
+    // a write to a copy-on-write page, from user code or from the kernel writing to a user buffer
+    // (e.g. read()), gets a private copy of the page and restarts the faulting instruction
+    if(myproc() && (tf->err & 2) && cowfault(myproc()->pgdir, rcr2()) == 0)
+      break;
+    // a page of the program is read from its file (or the page cache) the first time it is touched
+    if(myproc() && intext(myproc(), rcr2())){
+      if(textfault(myproc(), rcr2()) == 0)
+        break;
+    // so is a page of a mapped file, or of anonymous mapped memory (see mmap())
+    } else if(myproc() && invma(myproc(), rcr2())){
+      if(vmafault(myproc(), rcr2()) == 0)
+        break;
+    // the first touch of a heap page that sbrk() didn't allocate gets a zeroed page
+    } else if(myproc() && lazyfault(myproc()->pgdir, myproc()->sz, rcr2()) == 0)
+      break;
+    // another thread may have fixed the page up meanwhile, just retry then
+    if(myproc() && uvmmapped(myproc()->pgdir, rcr2(), tf->err))
+      break;
+    // a system call's copy to or from user memory (see usercopy.S) that can't have
+    // the page, e.g. for want of memory, fails instead; the process dies once the
+    // system call unwinds
+    if(myproc() && (tf->cs&3) == 0 && rcr2() < KERNBASE &&
+       tf->eip >= (uint)ucopy && tf->eip < (uint)ucopyend){
+      myproc()->killed = 1;
+      tf->eip = (uint)ucopyfault;
+      break;
+    }
+    // fall through
+
   //PAGEBREAK: 13
   default: // rest of traps are software exceptions
+  bad:
+    // PCI devices interrupt on whichever line the BIOS assigned them, maybe the same one
+    if((virtioirq && tf->trapno == T_IRQ0 + virtioirq) ||
+       (e1000irq && tf->trapno == T_IRQ0 + e1000irq)){
+      if(virtioirq && tf->trapno == T_IRQ0 + virtioirq)
+        virtiointr();
+      if(e1000irq && tf->trapno == T_IRQ0 + e1000irq)
+        e1000intr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -112,6 +291,7 @@ trap(struct trapframe *tf)
     // whatever it's doing
     myproc()->killed = 1;
   }
+  latcount(0, tf->trapno, t0);
 
   // Force process exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
@@ -119,10 +299,10 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick, once its time slice is used up.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tick && --myproc()->slice <= 0)
     yield();
 
   // Check if the process has been killed since we yielded
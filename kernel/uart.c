@@ -18,8 +18,26 @@
 
 #define COM1    0x3f8
 
+#define IER_RX  0x01    // interrupt when a byte arrives
+#define IER_TX  0x02    // interrupt when the transmitter is empty
+#define LSR_RX  0x01    // line status: a byte has arrived
+#define LSR_TX  0x20    // line status: transmit holding register (and FIFO) empty
+
+#define TXBUF   1024
+
 static int uart;    // is there a uart?
 
+// Output goes into a ring, which the transmitter interrupt drains a FIFO load at a time,
+// so a CPU writing to the console doesn't wait for the (slow) serial line.
+static struct {
+  struct spinlock lock;
+  char buf[TXBUF];
+  uint r;           // bytes handed to the transmitter
+  uint w;           // bytes written; the ring holds buf[r % TXBUF] .. buf[(w-1) % TXBUF]
+  int fifo;         // bytes the transmitter takes at once: 16 with a 16550 FIFO, else 1
+  int ier;          // interrupts enabled now
+} tx;
+
 void
 uartinit(void)
 {
@@ -27,20 +45,24 @@ uartinit(void)
   
   // outb(COM1+1, 0x00);  // Disable all interrupts
 
-  // Turn off the FIFO
-  outb(COM1+2, 0);
-  // outb(COM1+2,0xC7);    // Enable FIFO, clear them, with 14-byte threshold
+  initlock(&tx.lock, "uart");
 
-  // 9600 baud, 8 data bits, 1 stop bit, parity off.
+  // Enable and clear the FIFOs, interrupting on every received byte so typing isn't delayed.
+  // Only a 16550 (or later) has working FIFOs, and says so in the top bits of IIR.
+  outb(COM1+2, 0x07);
+  tx.fifo = (inb(COM1+2) & 0xC0) == 0xC0 ? 16 : 1;
+
+  // 115200 baud, 8 data bits, 1 stop bit, parity off.
 
   // Set DLAB (Divisor Latch Access Bit); enable divisor
   // When set, +0 and +1 map to low and high bytes of Divisor register for setting the baud rate
   outb(COM1+3, 0x80);
-  outb(COM1+0, 115200/9600); // Set divisor/set baud rate to 9600 (lo byte)
+  outb(COM1+0, 115200/115200); // Set divisor/set baud rate to 115200 (lo byte)
   outb(COM1+1, 0); // (hi byte)
   outb(COM1+3, 0x03);    // Lock divisor, break disable, 1 stop bit, no parity, 8 data bits
   outb(COM1+4, 0); // ?
-  outb(COM1+1, 0x01);    // Enable receive interrupts (IRQ_COM1=4), maybe 0x0B for RTS/DSR set?
+  tx.ier = IER_RX;
+  outb(COM1+1, tx.ier);  // Enable receive interrupts (IRQ_COM1=4); transmit ones only while there is output
   // try removing the test if things aren't working
   // outb(COM1+4, 0x1E);    // Set in loopback mode, test the serial chip
   // oub(COM1+0, 0xAE);    // Send a test byte
@@ -57,22 +79,80 @@ uartinit(void)
   // enable interrupts.
   inb(COM1+2);
   inb(COM1+0);
-  ioapicenable(IRQ_COM1, 0);
+  ioapicenable(IRQ_COM1, IRQ_ANYCPU);
 
   // Announce that we're here.
   for(p="xv6...\n"; *p; p++)
     uartputc(*p);
 }
 
+// Hand the transmitter as much of the ring as it takes,
+// and ask for an interrupt when it is done if more is left.
+// Caller holds tx.lock.
+static void
+uartstart(void)
+{
+  int n, ier;
+
+  if(inb(COM1+5) & LSR_TX)
+    for(n = 0; n < tx.fifo && tx.r != tx.w; n++)
+      outb(COM1+0, tx.buf[tx.r++ % TXBUF]);
+  ier = tx.r != tx.w ? IER_RX|IER_TX : IER_RX;
+  if(ier != tx.ier){
+    tx.ier = ier;
+    outb(COM1+1, ier);
+  }
+}
+
+// Queue n bytes for output.
+void
+uartwrite(char *s, int n)
+{
+  int i;
+
+  if(!uart)
+    return;
+  acquire(&tx.lock);
+  for(i = 0; i < n; i++){
+    // ring full: the writer has to wait for the line after all
+    while(tx.w - tx.r == TXBUF){
+      while(!(inb(COM1+5) & LSR_TX))
+        ;
+      uartstart();
+    }
+    tx.buf[tx.w++ % TXBUF] = s[i];
+  }
+  // if the transmitter interrupt is on, uartintr() will pick the bytes up
+  if(!(tx.ier & IER_TX))
+    uartstart();
+  release(&tx.lock);
+}
+
 void
 uartputc(int c)
+{
+  char b = c;
+
+  uartwrite(&b, 1);
+}
+
+// Write c straight to the line, after whatever is still in the ring.
+// For panic(), which can't wait for interrupts or take locks another,
+// frozen CPU might be holding.
+void
+uartputcsync(int c)
 {
   int i;
 
   if(!uart)
     return;
-  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
-    microdelay(10);
+  for(;;){
+    for(i = 0; i < 128 && !(inb(COM1+5) & LSR_TX); i++)
+      microdelay(10);
+    if(tx.r == tx.w)
+      break;
+    outb(COM1+0, tx.buf[tx.r++ % TXBUF]);
+  }
   outb(COM1+0, c);
 }
 
@@ -81,7 +161,7 @@ uartgetc(void)
 {
   if(!uart)
     return -1;
-  if(!(inb(COM1+5) & 0x01))
+  if(!(inb(COM1+5) & LSR_RX))
     return -1;
   return inb(COM1+0);
 }
@@ -90,4 +170,7 @@ void
 uartintr(void)
 {
   consoleintr(uartgetc);
+  acquire(&tx.lock);
+  uartstart();
+  release(&tx.lock);
 }
@@ -0,0 +1,279 @@
+// Driver for the virtio block device, through the legacy virtio PCI interface that QEMU
+// provides (make VIRTIO=1 attaches fs.img this way).
+// Unlike IDE, where the disk takes one command at a time, the driver and the device share a
+// virtqueue in memory: the driver puts requests in the available ring and notifies the device,
+// which carries out any number of them in parallel (as the host sees fit) and reports them
+// done in the used ring, many completions per interrupt.
+// It replaces ide.c for the file system disk (ROOTDEV); disk 0 stays on IDE.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "trace.h"
+#include "vmstat.h"
+
+#define VIO_VENDOR      0x1af4
+#define VIO_BLKDEV      0x1001 // transitional virtio-blk device
+
+// legacy virtio registers, in the I/O space at BAR0
+#define VIO_DEVFEAT     0x00  // features the device offers
+#define VIO_GUESTFEAT   0x04  // features the driver accepts
+#define VIO_QADDR       0x08  // physical page number of the selected queue
+#define VIO_QSIZE       0x0C  // number of entries of the selected queue, fixed by the device
+#define VIO_QSEL        0x0E
+#define VIO_QNOTIFY     0x10  // write a queue number to tell the device to look at it
+#define VIO_STATUS      0x12
+#define VIO_ISR         0x13  // reading acknowledges the interrupt
+#define VIO_CONFIG      0x14  // device specific; virtio-blk starts with its capacity in sectors
+
+// VIO_STATUS bits, set in this order during initialization
+#define VIO_ACK         1
+#define VIO_DRIVER      2
+#define VIO_DRIVEROK    4
+#define VIO_FAILED      128
+
+// Descriptor: one buffer of a request, chained to the next one through next.
+struct vdesc {
+  uint64 addr;        // physical address
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VD_NEXT         1     // next is valid
+#define VD_WRITE        2     // the device writes the buffer (otherwise reads it)
+
+// The driver puts the first descriptor of each new request in ring[idx % size], then bumps idx.
+struct vavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+// The device does the same with finished requests.
+struct vused {
+  ushort flags;
+  ushort idx;
+  struct {
+    uint id;          // first descriptor of the request
+    uint len;
+  } ring[];
+};
+#define VU_NONOTIFY     1     // the device is polling the ring, no need to notify it
+
+// A virtio-blk request is a header the device reads, the data and a status byte it writes.
+struct vblkhdr {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+#define VBLK_IN         0     // read
+#define VBLK_OUT        1     // write
+
+#define SECTOR_SIZE     512   // virtio-blk addresses the disk in 512-byte sectors
+#define VQMAX           256   // largest queue vqmem has room for
+
+// The queue lives in physically contiguous memory: descriptors, then the available
+// ring, then the used ring starting on the next page.
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+int virtioirq;        // interrupt line of the device, 0 if there is none
+
+static struct {
+  struct spinlock lock;
+  int iobase;
+  int size;           // entries in the queue
+  uint nsector;       // capacity of the disk
+  struct vdesc *desc;
+  struct vavail *avail;
+  struct vused *used;
+  int freedesc;       // free descriptors, linked through next
+  int nfree;
+  ushort usedidx;     // how far we have processed the used ring
+  // per request, indexed by its first descriptor
+  struct {
+    struct buf *b;
+    struct vblkhdr hdr;
+    uchar status;
+  } req[VQMAX];
+} vblk;
+
+// Look for a virtio-blk device and set up its queue.
+void
+virtioinit(void)
+{
+  struct pcifunc f;
+  int i, io;
+
+  if(pcifind(VIO_VENDOR, VIO_BLKDEV, PCI_ANY, PCI_ANY, &f) < 0 || !(f.bar[0] & 1))
+    return;
+  initlock(&vblk.lock, "virtio");
+  pcienable(&f);
+  io = f.bar[0] & ~3;
+
+  outb(io + VIO_STATUS, 0); // reset
+  outb(io + VIO_STATUS, VIO_ACK);
+  outb(io + VIO_STATUS, VIO_ACK | VIO_DRIVER);
+  outl(io + VIO_GUESTFEAT, 0); // none of the optional features are needed
+
+  outw(io + VIO_QSEL, 0);
+  vblk.size = inw(io + VIO_QSIZE);
+  if(vblk.size < 3 || vblk.size > VQMAX){
+    cprintf("virtio: queue of %d entries not supported\n", vblk.size);
+    outb(io + VIO_STATUS, VIO_FAILED);
+    return;
+  }
+  vblk.desc = (struct vdesc*)vqmem;
+  vblk.avail = (struct vavail*)(vqmem + vblk.size*sizeof(struct vdesc));
+  vblk.used = (struct vused*)PGROUNDUP((uint)&vblk.avail->ring[vblk.size+1]);
+  for(i = 0; i < vblk.size; i++)
+    vblk.desc[i].next = i + 1;
+  vblk.freedesc = 0;
+  vblk.nfree = vblk.size;
+  vblk.nsector = inl(io + VIO_CONFIG);
+  outl(io + VIO_QADDR, V2P(vqmem) >> PTXSHIFT);
+
+  outb(io + VIO_STATUS, VIO_ACK | VIO_DRIVER | VIO_DRIVEROK);
+  vblk.iobase = io;
+  virtioirq = f.irq;
+  ioapicenable(virtioirq, IRQ_ANYCPU);
+}
+
+static int
+valloc(void)
+{
+  int d;
+
+  d = vblk.freedesc;
+  vblk.freedesc = vblk.desc[d].next;
+  vblk.nfree--;
+  return d;
+}
+
+static void
+vfree(int d)
+{
+  vblk.desc[d].next = vblk.freedesc;
+  vblk.freedesc = d;
+  vblk.nfree++;
+}
+
+// Interrupt handler: finish every request the device has completed since the last one.
+void
+virtiointr(void)
+{
+  struct buf *b;
+  int d, n;
+
+  acquire(&vblk.lock);
+  // acknowledge first: a request that completes after this raises a new interrupt
+  inb(vblk.iobase + VIO_ISR);
+  __sync_synchronize();
+
+  for(n = 0; vblk.usedidx != vblk.used->idx; vblk.usedidx++, n++){
+    __sync_synchronize(); // read the entry only after seeing idx
+    d = vblk.used->ring[vblk.usedidx % vblk.size].id;
+    if(vblk.req[d].status != 0)
+      panic("virtio: i/o error");
+    b = vblk.req[d].b;
+    vblk.req[d].b = 0;
+    vfree(vblk.desc[vblk.desc[d].next].next);
+    vfree(vblk.desc[d].next);
+    vfree(d);
+
+    tracerec(TR_DISKDONE, b->blockno, (b->flags & B_DIRTY) != 0);
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      // readahead, nobody is sleeping on it; hand the buffer back to the cache
+      b->flags &= ~B_ASYNC;
+      brelseasync(b);
+    } else
+      wakeup(b);
+    __sync_synchronize();
+  }
+  if(n > 0)
+    wakeup(&vblk.freedesc);
+
+  release(&vblk.lock);
+}
+
+// Add the requests the device has yet to finish to *st, for the stat device.
+void
+virtiostat(struct vmstat *st)
+{
+  if(virtioirq)
+    st->dqueue += (vblk.size - vblk.nfree) / 3; // three descriptors each
+}
+
+// Sync buf with disk, as iderw() does.
+// Queues the request and returns once it is done (or at once for B_ASYNC), while other
+// processes' requests may be in progress.
+void
+virtiorw(struct buf *b)
+{
+  int d[3];
+  uint sector;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiorw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  if(sector + BSIZE/SECTOR_SIZE > vblk.nsector)
+    panic("virtiorw: block out of range");
+
+  acquire(&vblk.lock);
+  while(vblk.nfree < 3)
+    sleep(&vblk.freedesc, &vblk.lock);
+  d[0] = valloc();
+  d[1] = valloc();
+  d[2] = valloc();
+
+  vblk.req[d[0]].b = b;
+  vblk.req[d[0]].hdr.type = (b->flags & B_DIRTY) ? VBLK_OUT : VBLK_IN;
+  vblk.req[d[0]].hdr.reserved = 0;
+  vblk.req[d[0]].hdr.sector = sector;
+  vblk.req[d[0]].status = 0xff; // the device overwrites it with 0 on success
+
+  vblk.desc[d[0]].addr = V2P(&vblk.req[d[0]].hdr);
+  vblk.desc[d[0]].len = sizeof(struct vblkhdr);
+  vblk.desc[d[0]].flags = VD_NEXT;
+  vblk.desc[d[0]].next = d[1];
+  vblk.desc[d[1]].addr = V2P(b->data);
+  vblk.desc[d[1]].len = BSIZE;
+  vblk.desc[d[1]].flags = VD_NEXT | ((b->flags & B_DIRTY) ? 0 : VD_WRITE);
+  vblk.desc[d[1]].next = d[2];
+  vblk.desc[d[2]].addr = V2P(&vblk.req[d[0]].status);
+  vblk.desc[d[2]].len = 1;
+  vblk.desc[d[2]].flags = VD_WRITE;
+  vblk.desc[d[2]].next = 0;
+
+  // publish the request, then the new idx, then tell the device unless it is already
+  // working through the ring and asked not to be told
+  vblk.avail->ring[vblk.avail->idx % vblk.size] = d[0];
+  __sync_synchronize();
+  vblk.avail->idx++;
+  __sync_synchronize();
+  tracerec(TR_DISKSTART, b->blockno, (b->flags & B_DIRTY) != 0);
+  if(!(vblk.used->flags & VU_NONOTIFY))
+    outw(vblk.iobase + VIO_QNOTIFY, 0);
+
+  // readahead doesn't wait, virtiointr() releases the buffer when the read is done
+  if(b->flags & B_ASYNC){
+    release(&vblk.lock);
+    return;
+  }
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vblk.lock);
+  release(&vblk.lock);
+}
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "traps.h"
 #include "elf.h"
 
 // some parts of this file deals with the general paging implementation
@@ -15,6 +17,34 @@ extern char data[];  // defined by kernel.ld
 // pde_t - page directory entry (int)
 pde_t *kpgdir;  // for use in scheduler()
 
+#define MSR_PAT 0x277
+
+// Make PAT entry 1, which a PTE with only PTE_PWT set selects, write-combining
+// instead of write-through, for the framebuffer (see kvmmapfb()).
+// Nothing else uses PTE_PWT. All CPUs must agree, so seginit() does this on each.
+static void
+patinit(void)
+{
+  uint a, b, c, d;
+
+  rcpuid(1, &a, &b, &c, &d);
+  if(d & (1<<16)) // has PAT
+    wrmsr(MSR_PAT, (rdmsr(MSR_PAT) & ~0xFF00ULL) | 0x0100);
+}
+
+// Make the kernel's mappings, which are the same in every page table, global
+// (see setupkvm()), so loading a process's page table on a context switch only
+// throws away the user half of the TLB. All CPUs must agree, so seginit() does this on each.
+static void
+pgeinit(void)
+{
+  uint a, b, c, d;
+
+  rcpuid(1, &a, &b, &c, &d);
+  if(d & (1<<13)) // has PGE
+    lcr4(rcr4() | CR4_PGE);
+}
+
 // Set up CPU's kernel segment descriptors as identity maps to all of memory
 // Already did this in the bootloader, but we had no notion of kernel space vs user space
 // Now we want to set permission flags for each segment so that user code can't access kernel code
@@ -31,33 +61,59 @@ seginit(void)
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  c = lapiccpu();
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0); // C equivalent of assembly SEG_ASM macro
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+  // the kernel's %gs reaches this cpu's struct cpu, for mycpu();
+  // alltraps reloads it after a trap from user space
+  c->self = c;
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->self, 0, 0);
   lgdt(c->gdt, sizeof(c->gdt)); // load new GDT into CPU
+  loadgs(SEG_KCPU << 3);
+  patinit();
+  pgeinit();
+}
+
+// Give the boot cpu a %gs for mycpu() until seginit(), which has to wait
+// for mpinit() to say which struct cpu is its own: fbinit(), kinit1() and
+// kvmalloc() take locks before that. cpus[0] stands in meanwhile; by the
+// time seginit() moves to the real one, its pushcli()s are all undone.
+void
+bootseginit(void)
+{
+  struct cpu *c;
+
+  c = &cpus[0];
+  c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0); // as bootasm.S left %cs
+  c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
+  c->self = c;
+  c->gdt[SEG_KCPU] = SEG(STA_W, &c->self, 0, 0);
+  lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
 }
 
 // Return PTE entry in 'pgdir' corresponding to va, which in particular contains the pa base
 // alloc=1 allocates a new page table if needed, alloc=0 reports failure if a page table doesn't exist
 // Software equivalent of paging hardware to be used for manual va -> pa conversion in the kernel while
 // we setup the page directory
-static pte_t *
+pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
   pde_t *pde;
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)]; // page directory entry for va
+  if(*pde & PTE_PS) // a 4MB kernel page (see kmappages()): no page table to walk
+    return 0;
   if(*pde & PTE_P){ // entry mapped (present)
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde)); // hardware uses pa for page table pointers, we want va
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    // i.e. undo filling pages with garbage 1 in kfree()
-    memset(pgtab, 0, PGSIZE);
+    // i.e. whatever kfree() left in the page
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -70,7 +126,7 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 // physical addresses starting at pa. va and size might not
 // be page-aligned. pa must be page-aligned.
 // i.e. finishes the job of walkpgdir(), which can create page tables, but not pages themselves
-static int
+int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
@@ -120,6 +176,7 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                for the kernel's instructions and r/o data
 //   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
 //                                  rw data + free physical memory
+//   framebuffer, if fbinit() found one: mapped direct, write-combining
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
@@ -140,46 +197,234 @@ static struct kmap { // simultaneously define struct type and variable
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
                                                       // unsigned integer overflow '0 - DEVSPACE' is fine
                                                       // signed integer overflow is undefined behaviour
+ { 0,               0,             0,         0},     // framebuffer, filled in by kvmmapfb()
 };
 
+// Add the framebuffer at physical address pa to the kernel mappings. It lies
+// above physical memory, so it can be mapped at its own address, below DEVSPACE.
+// PTE_PWT makes it write-combining (see patinit()): the CPU collects writes
+// to it in bursts rather than doing each one separately and uncached.
+// Called by fbinit() before kvmalloc(). Returns the virtual address, 0 if out of reach.
+char*
+kvmmapfb(uint pa, uint size)
+{
+  struct kmap *k = &kmap[NELEM(kmap)-1];
+
+  if(pa % PGSIZE || pa < KERNBASE+PHYSTOP || pa + size > DEVSPACE || pa + size < pa)
+    return 0;
+  k->virt = (void*)pa;
+  k->phys_start = pa;
+  k->phys_end = pa + size;
+  k->perm = PTE_W | PTE_PWT;
+  return (char*)pa;
+}
+
+// Map [va, va+size) to pa like mappages() does, but with a 4MB page wherever a whole 4MB
+// of the range is aligned in both va and pa: one page directory entry instead of a page table
+// of 1024 entries, and one TLB entry instead of 1024. entry.S has had PSE on since boot.
+// This leaves kmap only a page table for the first 4MB (with the read-only kernel text in it)
+// and for the edges of the framebuffer, where every pgdir used to take a page table per 4MB
+// of PHYSTOP and DEVSPACE: some 250KB per process.
+static int
+kmappages(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if((uint)va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && size >= SUPERPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_PS | PTE_P;
+      n = SUPERPGSIZE;
+    } else {
+      // up to the next 4MB boundary with 4KB pages
+      n = SUPERPGSIZE - (uint)va % SUPERPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n; // wraps to 0 at the end of DEVSPACE, as size reaches 0
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // Set up a pgdir with page table for kernel mappings in kmap
 // The kernel expects this in every pgdir
+// Only kpgdir gets page tables of its own for them: the kernel mappings never
+// change after boot, so every other pgdir points its kernel half at kpgdir's
+// page tables, and setting one up for fork() or exec() is a page and a copy.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0) // allocate page for pgdir
+  if((pgdir = (pde_t*)kzalloc()) == 0) // allocate page for pgdir, cleared of whatever kfree() left
     return 0;
-  memset(pgdir, 0, PGSIZE); // clear garbage from kfree()
+  if(kpgdir){
+    memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+            (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+    return pgdir;
+  }
   if (P2V(PHYSTOP) > (void*)DEVSPACE) // as good a place to check as any
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++) // map all entries in kmap
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      // abort - free all page tables and pgdir
-      freevm(pgdir);
-      return 0;
-    }
+    if(k->virt && kmappages(pgdir, k->virt, k->phys_end - k->phys_start,
+                (uint)k->phys_start, k->perm | PTE_G) < 0)
+      panic("setupkvm"); // at boot, for kpgdir
   return pgdir;
 }
 
+// Processes that share a page table (a process and its threads, see clone())
+// can change it at the same time on different CPUs: two threads faulting on the
+// same page, or one calling sbrk() while another faults. Changes to a user page
+// table are made holding its lock, one of a few that all page tables hash to.
+// mmap.c and sysfile.c use the same lock for the mappings and the open files
+// those processes share.
+#define NUVMLOCK 16
+static struct spinlock uvmlocks[NUVMLOCK];
+
+// TLB shootdowns, see uvmflush(): each cpu's pending request is guarded by its
+// tlblock. A flush of up to INVLPGMAX pages goes page by page.
+#define INVLPGMAX 32
+static struct {
+  struct spinlock lock;
+} __attribute__((aligned(CACHELINE))) tlblock[NCPU];
+
+static struct spinlock*
+uvmlockof(pde_t *pgdir)
+{
+  return &uvmlocks[(V2P(pgdir) / PGSIZE) % NUVMLOCK];
+}
+
+void
+uvmlock(pde_t *pgdir)
+{
+  acquire(uvmlockof(pgdir));
+}
+
+void
+uvmunlock(pde_t *pgdir)
+{
+  release(uvmlockof(pgdir));
+}
+
+// Drop this CPU's TLB entries for [start, end) of the page table it runs on:
+// page by page with invlpg for a few pages, else all at once by reloading %cr3.
+static void
+tlbinval(uint start, uint end)
+{
+  uint a;
+
+  if(end - start > INVLPGMAX*PGSIZE){
+    lcr3(rcr3());
+    return;
+  }
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE)
+    invlpg((void*)a);
+}
+
+// Make every CPU with page table pgdir loaded drop its TLB entries for [start, end),
+// after the caller changed or removed mappings there: this one right away, the others
+// (running threads of the current process, see clone(), or idle with pgdir still in
+// %cr3) with an IRQ_TLB interrupt. A request to a cpu that has one pending already
+// is merged into that one, and rides on the interrupt sent for it. With wait, returns
+// only once they have all flushed, so that the caller can free the pages it unmapped;
+// waiting needs interrupts, so the caller must not hold a spinlock then.
+void
+uvmflush(pde_t *pgdir, uint start, uint end, int wait)
+{
+  struct cpu *c, *me;
+  struct spinlock *lk;
+  char sent[NCPU];
+  int ipi;
+
+  if(start >= end)
+    return;
+  __sync_synchronize(); // the page table changes before the requests
+  pushcli();
+  if(wait && mycpu()->ncli > 1)
+    panic("uvmflush locks");
+  me = mycpu();
+  if(me->pgdir == pgdir)
+    tlbinval(start, end);
+  memset(sent, 0, sizeof(sent));
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    // a cpu that switches to pgdir after this loads the new entries anyway
+    if(c == me || c->pgdir != pgdir)
+      continue;
+    lk = &tlblock[c - cpus].lock;
+    acquire(lk);
+    ipi = !c->tlbflush;
+    if(ipi){
+      c->tlbstart = start;
+      c->tlbend = end;
+      c->tlbflush = 1;
+    } else {
+      if(start < c->tlbstart)
+        c->tlbstart = start;
+      if(end > c->tlbend)
+        c->tlbend = end;
+    }
+    release(lk);
+    if(ipi)
+      lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    sent[c - cpus] = 1;
+  }
+  popcli();
+  if(wait)
+    for(c = cpus; c < &cpus[ncpu]; c++)
+      while(sent[c - cpus] && c->tlbflush)
+        pause();
+}
+
+// IRQ_TLB: another CPU changed the page table this one has loaded.
+void
+tlbintr(void)
+{
+  struct cpu *c;
+  struct spinlock *lk;
+
+  c = mycpu();
+  lk = &tlblock[c - cpus].lock;
+  // flush holding the lock, so a request made meanwhile waits to be merged or sent anew,
+  // and a waiting uvmflush() only sees tlbflush clear once the entries are gone
+  acquire(lk);
+  if(c->tlbflush){
+    tlbinval(c->tlbstart, c->tlbend);
+    c->tlbflush = 0;
+  }
+  release(lk);
+}
+
 // Called by main() to replace entrypgdir with kpgdir with mappings for kernel address space (upper half)
-// At this point the free list still only contains pages for physical memory between 0-4MB
+// At this point the free list still only contains pages for physical memory between 0-BOOTMAP
 // the rest will have to wait until kinit2() for kpgdir to be fully set up
 void
 kvmalloc(void)
 {
+  int i;
+
+  for(i = 0; i < NUVMLOCK; i++)
+    initlock(&uvmlocks[i], "uvm");
+  for(i = 0; i < NCPU; i++)
+    initlock(&tlblock[i].lock, "tlb");
   kpgdir = setupkvm(); // setup kpgdir with all required kernel mappings
-  switchkvm(); // load kpgdir into hardware
+  // load kpgdir into hardware; not switchkvm(), as there is no mycpu() until seginit()
+  lcr3(V2P(kpgdir));
 }
 
 // Use kpgdir as the CPU's page directory, for when no process is running
 void
 switchkvm(void)
 {
+  pushcli();
+  mycpu()->pgdir = kpgdir; // before the switch, see uvmflush()
   lcr3(V2P(kpgdir)); // page directory stored in %cr3 control register
+  popcli();
 }
 
 // Digression on user processes
@@ -191,7 +436,7 @@ switchkvm(void)
 // - load program into memory in the new page directory - loaduvm()
 // - skip a page, leaving it mapped but user-inaccessible, the next page becomes the process's stack - user
 //   programs that blow their stack will trigger a page fault or GPF instead of overwriting - clearpteu
-// - copy some arguments into the stack - copyout() copies data into a page in a page directory
+// - copy the arguments into the stack page, through the kernel's mapping of it - uva2ka()
 // - switch to the new page directory - switchuvm()
 // - get rid of the old page directory - freevm()
 // - one edge case - running the first process - inituvm() sets up the first process's page directory
@@ -224,6 +469,10 @@ switchuvm(struct proc *p)
   // limit forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3); // load TSS segment selector into TR
+  // sysenter doesn't look at the TSS, it takes the kernel stack from an MSR
+  if(mycpu()->sysenter)
+    wrmsr(MSR_SYSENTER_ESP, (uint)p->kstack + KSTACKSIZE);
+  mycpu()->pgdir = p->pgdir; // before the switch, see uvmflush()
   lcr3(V2P(p->pgdir)); // switch to process's address space (load process page directory)
   popcli();
 }
@@ -240,8 +489,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE); // clear garbage from kfree()
+  mem = kzalloc(); // cleared of whatever kfree() left
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U); // put in pgdir at address 0
   memmove(mem, init, sz); // copy code from init into new page
 }
@@ -294,13 +542,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
     // for loop easier than deallocuvm() because we know pages aren't mapped
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     // now have a page, but it's not yet mapped in the page directory
     // also might fail because it allocates pages for page tables
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
@@ -346,22 +593,74 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
-// Free all pages in user space, all page tables, and 'pgdir'
+// Unmap the pages of [start, end) of pgdir, which other CPUs may be using: take them out of the
+// page table (uvmdetach(), holding pgdir's lock), uvmflush() the other CPUs, then free them
+// (uvmreap()). A detached entry keeps its page's address, without PTE_P, until uvmreap().
+// uvmunmap() does all three; mmap.c calls the steps itself to detach along with its own changes.
+void
+uvmdetach(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = PGROUNDUP(start); a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    *pte &= ~PTE_P;
+  }
+}
+
+void
+uvmreap(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  uvmlock(pgdir);
+  for(a = PGROUNDUP(start); a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P) && PTE_ADDR(*pte)){
+      kfree(P2V(PTE_ADDR(*pte)));
+      *pte = 0;
+    }
+  }
+  uvmunlock(pgdir);
+}
+
+void
+uvmunmap(pde_t *pgdir, uint start, uint end)
+{
+  uvmlock(pgdir);
+  uvmdetach(pgdir, start, end);
+  uvmunlock(pgdir);
+  uvmflush(pgdir, start, end, 1);
+  uvmreap(pgdir, start, end);
+}
+
+// Free all pages in user space, their page tables, and 'pgdir'
+// The kernel half's page tables are kpgdir's (see setupkvm()), and stay.
 void
 freevm(pde_t *pgdir)
 {
-  uint i;
+  pte_t *pt;
+  uint i, j;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  // free all pages in user space
-  deallocuvm(pgdir, KERNBASE, 0);
-  // free page tables
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){ // page table exists
-      char * v = P2V(PTE_ADDR(pgdir[i]));
-      kfree(v);
-    }
+  // a page table at a time, rather than a walkpgdir() for each page
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    pt = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++)
+      if(pt[j] & PTE_P)
+        kfree(P2V(PTE_ADDR(pt[j])));
+    kfree((char*)pt);
   }
   // free page directory
   kfree((char*)pgdir);
@@ -385,56 +684,278 @@ clearpteu(pde_t *pgdir, char *uva)
 
 // Given a parent process's page table and virtual address space size, create a copy
 // of it for a child.
+// Copy-on-write - instead of copying every page up front, the child maps the same physical pages as the
+// parent, and writable pages are made read-only in both and tagged PTE_COW
+// the first write by either process then page faults and cowfault() gives the writer its own copy
+// most fork()ed children exec() almost immediately, so most pages are never copied at all
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
+
+  if((d = setupkvm()) == 0) // set up new page directory and take care of kernel half of address space
+    return 0;
+  if(uvmshare(pgdir, d, 0, sz) < 0){
+    // pages the parent lost PTE_W on stay PTE_COW, the next write just takes the cowfault() fast path
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Map the pages of [start, end) of pgdir into d too, as copyuvm() does: copy-on-write,
+// except shared mappings (PTE_SHARED), which stay writable in both. Returns -1 if out of memory.
+int
+uvmshare(pde_t *pgdir, pde_t *d, uint start, uint end)
+{
   pte_t *pte;
   uint pa, i, flags;
+  int r;
+
+  r = 0;
+  uvmlock(pgdir); // the parent's threads may be faulting pages in meanwhile
+  for(i = start; i < end; i += PGSIZE){ // pages in user half of parent process address space
+    // use walkpgdir() to get the parent's pte, then share its physical page with the child
+    // lazily grown heaps may have holes the parent never touched; the child faults those in on its own
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if((*pte & PTE_W) && !(*pte & PTE_SHARED)){
+      // neither process may write the shared page any more
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    }
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte) & ~PTE_D;
+    // put the shared page into child's page directory
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0){
+      r = -1;
+      break;
+    }
+    kincref(P2V(pa)); // freevm() of either process now only drops a reference
+  }
+  uvmunlock(pgdir);
+  // parent may have cached writable translations for the pages we just write-protected
+  // fork() always copies the current process, so pgdir is loaded
+  // and so may the parent's threads on other cpus, which mustn't write to them from now on
+  uvmflush(pgdir, start, end, 1);
+  return r;
+}
+
+// Handle a write fault on user virtual address va in pgdir.
+// If the page is copy-on-write, give the process a private writable copy of it and return 0.
+// Returns -1 if this is not a copy-on-write fault or if there is no memory left for the copy.
+// Called from trap() on T_PGFLT, and from copyout() since the kernel writes through its own mapping.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
   char *mem;
+  int copied;
+
+  if(va >= KERNBASE)
+    return -1;
+  uvmlock(pgdir);
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0 ||
+     (*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW)){
+    uvmunlock(pgdir);
+    return -1;
+  }
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
 
-  if((d = setupkvm()) == 0) // set up new page directory and take care of kernel half of address space
+  copied = 0;
+  if(krefcount(P2V(pa)) == 1){
+    // every other process sharing the page already made its own copy, just take it back
+    *pte = pa | flags;
+  } else {
+    if((mem = kalloc()) == 0){
+      uvmunlock(pgdir);
+      return -1;
+    }
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa)); // drop our reference to the shared page
+    copied = 1;
+  }
+  uvmunlock(pgdir);
+  va = PGROUNDDOWN(va);
+  // our threads on other cpus would go on reading the old page; no need to wait for them,
+  // since it isn't freed (a write through a stale entry just faults again, see trap())
+  if(copied)
+    uvmflush(pgdir, va, va + PGSIZE, 0);
+  else if(rcr3() == V2P(pgdir))
+    invlpg((void*)va);
+  return 0;
+}
+
+// Handle a fault on user virtual address va in pgdir, where sz is the size of the process.
+// sbrk() only grows the process size, so the first touch of a page below sz that was never mapped
+// lands here and gets a freshly zeroed page. Returns 0 if a page was mapped, or -1 if va is outside
+// the process, is mapped already (e.g. the stack guard page), or there is no memory left.
+int
+lazyfault(pde_t *pgdir, uint sz, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= sz || va >= KERNBASE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+  if((mem = kzalloc()) == 0)
+    return -1;
+  uvmlock(pgdir);
+  // another thread (see clone()) may have faulted on the same page
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) != 0 && (*pte & PTE_P)){
+    uvmunlock(pgdir);
+    kfree(mem);
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){ // pages in user half of parent process address space from 0 to sz
-    // want to copy a page from parent's virtual address i to the child's address i
-    // (may map to different physical addresses)
-    // must figure out the corresponding kernel virtual address for parent's i
-    // use walkpgdir() to get pte, then get the page's physical address
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0) // allocate page for child process
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE); // copy everything from parent page to child page
-    // put new page into child's page directory
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem); // have to free here else we can't find it later (memory leak)
-      goto bad;
+  }
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    uvmunlock(pgdir);
+    kfree(mem);
+    return -1;
+  }
+  uvmunlock(pgdir);
+  return 0;
+}
+
+// Is user address va mapped in pgdir the way a fault with error code err wanted
+// it? It can be, by the time trap() looks, when another thread (see clone()) just
+// handled a fault on the same page, or cowfault() made it writable here while a
+// stale read-only translation lingered on this cpu; the access can just be retried.
+int
+uvmmapped(pde_t *pgdir, uint va, uint err)
+{
+  pte_t *pte;
+  uint want;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return 0;
+  want = PTE_P | PTE_U | ((err & 2) ? PTE_W : 0);
+  if((*pte & want) != want)
+    return 0;
+  invlpg((void*)va);
+  return 1;
+}
+
+// The segment of p's program whose file part holds the page at va, or 0.
+static struct execseg*
+textseg(struct proc *p, uint va)
+{
+  struct execseg *s;
+
+  va = PGROUNDDOWN(va);
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(va >= s->va && va < s->va + s->filesz)
+      return s;
+  return 0;
+}
+
+// Is the page at va one exec() left in p's program file?
+int
+intext(struct proc *p, uint va)
+{
+  return p->exe && va < KERNBASE && textseg(p, va) != 0;
+}
+
+// Handle a fault on a page exec() left in p's program file (see intext()).
+// A whole page of the file is shared through the page cache, the last,
+// partial one gets a private copy with the rest zeroed. Returns 0 if a
+// page was mapped, -1 if it is there already (e.g. a write to read-only
+// text), there is no memory, or the fault came from kernel code holding
+// a spinlock, which mustn't sleep reading the disk (argptr() makes
+// sure system calls find their buffers mapped beforehand).
+int
+textfault(struct proc *p, uint va)
+{
+  struct execseg *s;
+  pte_t *pte;
+  char *mem;
+  uint off, n;
+  int perm;
+
+  if((s = textseg(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+  if(mycpu()->ncli > 0)
+    return -1;
+
+  off = s->off + (va - s->va);
+  n = s->va + s->filesz - va;
+  if(n >= PGSIZE){
+    if((mem = pcacheget(p->exe, off)) == 0)
+      return -1;
+    perm = PTE_U | s->perm;
+  } else {
+    if((mem = kzalloc()) == 0)
+      return -1;
+    ilockshared(p->exe);
+    if(readi(p->exe, mem, off, n) != n){
+      iunlockshared(p->exe);
+      kfree(mem);
+      return -1;
     }
+    iunlockshared(p->exe);
+    perm = PTE_U | (s->perm ? PTE_W : 0);
   }
-  return d;
+  // another thread of p (see clone()) may have mapped it while we read
+  uvmlock(p->pgdir);
+  if((pte = walkpgdir(p->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P)){
+    uvmunlock(p->pgdir);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    uvmunlock(p->pgdir);
+    kfree(mem);
+    return -1;
+  }
+  uvmunlock(p->pgdir);
+  return 0;
+}
+
+// Map the pages of [va, va+n) that are still in p's program file or
+// in one of its mappings, so the kernel can use them as a buffer while
+// holding locks; allocate the heap pages sbrk() left for the first touch;
+// and if write, give it private copies of copy-on-write pages. Without the
+// memory for those, a copy would fail halfway (see usercopy.S), so the
+// system call fails here instead: returns -1.
+int
+prefault(struct proc *p, uint va, uint n, int write)
+{
+  uint a;
+  pte_t *pte;
 
-bad:
-  freevm(d);
+  if(n == 0)
+    return 0;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    if(intext(p, a))
+      textfault(p, a);
+    else if(invma(p, a))
+      vmafault(p, a);
+    else if(lazyfault(p->pgdir, p->sz, a) < 0 && a < p->sz && !uvmmapped(p->pgdir, a, 0))
+      return -1;
+    if(write && (pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_COW) &&
+       cowfault(p->pgdir, a) < 0 && !uvmmapped(p->pgdir, a, 2))
+      return -1;
+  }
   return 0;
 }
 
 //PAGEBREAK!
 // Map user virtual address to kernel address while checking the page is present and has user permission flag
-// DANGEROUS - calls walkpgdir() with no null check
-// copyout(), exec(), sys_exec(), shell, init - be careful if you touch any of these
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  // no null check - bad practice because programmer has to guarantee safe usage of uva2ka(), functions
-  // that call uva2ka(), etc.
-  if((*pte & PTE_P) == 0)
+  // with lazy sbrk() the page table itself may not exist yet
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -450,6 +971,7 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   // need to get kernel virtual address corresponding to 'va', but if data crosses a page boundary
@@ -457,6 +979,14 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   // each iteration gets the next kernel virtual address and copies the next chunk of data
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // we write through the kernel's mapping of the page, so the paging hardware won't catch writes to a
+    // copy-on-write page for us
+    if(va0 < KERNBASE && (pte = walkpgdir(pgdir, (char*)va0, 0)) != 0 && (*pte & PTE_COW))
+      if(cowfault(pgdir, va0) < 0)
+        return -1;
+    // nor mark a shared page dirty, for munmap() to write back
+    if(va0 < KERNBASE && (pte = walkpgdir(pgdir, (char*)va0, 0)) != 0 && (*pte & PTE_SHARED))
+      *pte |= PTE_D;
     pa0 = uva2ka(pgdir, (char*)va0); // using 'pa0' is confusing here as it's not a physical address
     if(pa0 == 0)
       return -1;
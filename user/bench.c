@@ -0,0 +1,299 @@
+// Microbenchmarks, for a baseline to compare changes against.
+//   bench [name...]   run the named benchmarks, or all of them
+// Each prints one line, "name value unit": TSC cycles per operation
+// for the latencies, MB/s or operations/s (from uptime()) for the rest.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "x86.h"
+
+#define FILEMB   2
+#define CHUNK    4096
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+static char buf[CHUNK];
+static char *self;         // how to exec ourselves
+static uint seed = 1;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void
+fail(char *what)
+{
+  printf(2, "bench: %s failed\n", what);
+  exit();
+}
+
+static void
+cycles(char *name, uint64 t0, uint n)
+{
+  printf(1, "%s %d cycles\n", name, divl(rdtsc() - t0, n));
+}
+
+// n operations or mb megabytes took from tick t0 to now
+static void
+rate(char *name, int t0, uint n, char *unit)
+{
+  int t;
+
+  // ticks are 10ms
+  if((t = uptime() - t0) == 0)
+    t = 1;
+  printf(1, "%s %d %s\n", name, n * 100 / t, unit);
+}
+
+static void
+nullsys(void)
+{
+  uint64 t0;
+  int i;
+
+  t0 = rdtsc();
+  for(i = 0; i < 100000; i++)
+    getpid();
+  cycles("getpid", t0, 100000);
+}
+
+static void
+forkexit(void)
+{
+  uint64 t0;
+  int i, pid;
+
+  t0 = rdtsc();
+  for(i = 0; i < 200; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  cycles("fork+exit", t0, 200);
+}
+
+static void
+forkexec(void)
+{
+  char *argv[] = { self, "-exit", 0 };
+  uint64 t0;
+  int i, pid;
+
+  t0 = rdtsc();
+  for(i = 0; i < 100; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(self, argv);
+      fail("exec");
+    }
+    wait();
+  }
+  cycles("fork+exec", t0, 100);
+}
+
+// a byte back and forth between two processes
+static void
+pipelat(void)
+{
+  int a[2], b[2], i, pid;
+  uint64 t0;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    while(read(a[0], &c, 1) == 1)
+      write(b[1], &c, 1);
+    exit();
+  }
+  t0 = rdtsc();
+  for(i = 0; i < 10000; i++){
+    write(a[1], "x", 1);
+    if(read(b[0], &c, 1) != 1)
+      fail("pipe read");
+  }
+  cycles("pipe-roundtrip", t0, 10000);
+  close(a[1]);
+  wait();
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+}
+
+static void
+pipebw(void)
+{
+  int p[2], t0, pid, mb, i;
+
+  mb = 16;
+  if(pipe(p) < 0)
+    fail("pipe");
+  t0 = uptime();
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(p[0]);
+    for(i = 0; i < mb * (1024*1024 / CHUNK); i++)
+      if(write(p[1], buf, CHUNK) != CHUNK)
+        fail("pipe write");
+    exit();
+  }
+  close(p[1]);
+  while(read(p[0], buf, CHUNK) > 0)
+    ;
+  wait();
+  rate("pipe-bandwidth", t0, mb, "MB/s");
+  close(p[0]);
+}
+
+static void
+fileseq(void)
+{
+  int fd, i, t0, n;
+
+  n = FILEMB * (1024*1024 / CHUNK);
+  unlink("benchfile");
+  if((fd = open("benchfile", O_CREATE|O_RDWR)) < 0)
+    fail("create");
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    if(write(fd, buf, CHUNK) != CHUNK)
+      fail("write");
+  fsync(fd);
+  rate("file-seq-write", t0, FILEMB, "MB/s");
+  close(fd);
+
+  if((fd = open("benchfile", O_RDONLY)) < 0)
+    fail("open");
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    if(read(fd, buf, CHUNK) != CHUNK)
+      fail("read");
+  rate("file-seq-read", t0, FILEMB, "MB/s");
+  close(fd);
+}
+
+// 512-byte pieces at random places in the file fileseq() wrote
+static void
+filerand(void)
+{
+  int fd, i, t0, n, nblk;
+
+  nblk = FILEMB * 1024 * 2;
+  n = 2000;
+  if((fd = open("benchfile", O_RDWR)) < 0)
+    fail("open benchfile (run file-seq first)");
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    if(pread(fd, buf, 512, (rand() % nblk) * 512) != 512)
+      fail("pread");
+  rate("file-rand-read", t0, n, "ops/s");
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    if(pwrite(fd, buf, 512, (rand() % nblk) * 512) != 512)
+      fail("pwrite");
+  fsync(fd);
+  rate("file-rand-write", t0, n, "ops/s");
+  close(fd);
+  unlink("benchfile");
+}
+
+static void
+createunlink(void)
+{
+  char name[8];
+  int i, fd, t0, n;
+
+  n = 200;
+  mkdir("benchdir");
+  chdir("benchdir");
+  name[0] = 'f';
+  name[4] = 0;
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + i / 10 % 10;
+    name[3] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+  }
+  rate("create", t0, n, "ops/s");
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + i / 10 % 10;
+    name[3] = '0' + i % 10;
+    if(unlink(name) < 0)
+      fail("unlink");
+  }
+  rate("unlink", t0, n, "ops/s");
+  chdir("..");
+  unlink("benchdir");
+}
+
+// grow the heap a page at a time, touching each page
+static void
+sbrkgrow(void)
+{
+  uint64 t0;
+  char *p;
+  int i, n;
+
+  n = 1024;
+  t0 = rdtsc();
+  for(i = 0; i < n; i++){
+    if((p = sbrk(4096)) == (char*)-1)
+      fail("sbrk");
+    *p = 1;
+  }
+  cycles("sbrk-page", t0, n);
+  sbrk(-n * 4096);
+}
+
+static struct {
+  char *name;
+  void (*fn)(void);
+} benches[] = {
+  { "getpid",     nullsys },
+  { "fork-exit",  forkexit },
+  { "fork-exec",  forkexec },
+  { "pipe-lat",   pipelat },
+  { "pipe-bw",    pipebw },
+  { "file-seq",   fileseq },
+  { "file-rand",  filerand },
+  { "create",     createunlink },
+  { "sbrk",       sbrkgrow },
+};
+
+int
+main(int argc, char *argv[])
+{
+  int i, j;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit();
+  self = argv[0];
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  for(i = 0; i < NELEM(benches); i++){
+    if(argc > 1){
+      for(j = 1; j < argc && strcmp(argv[j], benches[i].name) != 0; j++)
+        ;
+      if(j == argc)
+        continue;
+    }
+    benches[i].fn();
+  }
+  printf(1, "bench: done\n");
+  exit();
+}
@@ -1,54 +1,287 @@
 // Simple grep.  Only supports ^ . * $ operators.
+// The pattern is compiled to a list of items, one per character or
+// character*, which is an NFA with a state per item; lines run through
+// a DFA built from it lazily, a set of NFA states at a time, so each byte
+// of input costs a table lookup however many *s the pattern has. A line
+// can only match where the pattern's leading literal characters appear,
+// so the search skips to those (Boyer-Moore-Horspool) and looks at just
+// the lines they are in.
 
 #include "types.h"
 #include "stat.h"
 #include "user.h"
 
-char buf[1024];
-int match(char*, char*);
+#define MAXITEM  128   // items in a pattern
+#define NDSTATE  64    // DFA states kept; the cache starts over when full
+#define SETWORDS ((MAXITEM+1+31)/32)
+#define ANY      256   // item.c for .
+
+char buf[32*1024];
+char out[4096];
+int nout;
+
+struct item {
+  int c;      // character to match, or ANY
+  int star;   // zero or more of them
+};
+
+struct item item[MAXITEM];
+int nitem;    // state nitem accepts
+int bol, eol; // anchored by ^ and $
+
+char pre[MAXITEM];  // literal characters every match starts with (unless bol)
+int plen;
+int literal;  // the pattern is just pre
+int shift[256];
+
+// A DFA state: a set of NFA states, and the states it goes to on each
+// byte, once looked at.
+struct dstate {
+  uint set[SETWORDS];
+  int accept;
+  int dead;   // no state in it: with ^, no match from here on
+  struct dstate *next[256];
+};
+
+struct dstate dstate[NDSTATE];
+int ndstate;
+struct dstate *dstart;
 
 void
-grep(char *pattern, int fd)
+compile(char *re)
 {
-  int n, m;
-  char *p, *q;
+  int i;
 
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
+  if(*re == '^'){
+    bol = 1;
+    re++;
+  }
+  // as in Kernighan & Pike's matchhere(): * after a character, $ only at the end
+  while(*re){
+    if(re[0] == '$' && re[1] == '\0'){
+      eol = 1;
+      break;
+    }
+    if(nitem == MAXITEM){
+      printf(2, "grep: pattern too long\n");
+      exit();
     }
-    if(p == buf)
-      m = 0;
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    item[nitem].c = re[0] == '.' ? ANY : (uchar)re[0];
+    item[nitem].star = re[1] == '*';
+    re += item[nitem].star ? 2 : 1;
+    nitem++;
+  }
+
+  if(!bol)
+    for(plen = 0; plen < nitem && !item[plen].star && item[plen].c != ANY; plen++)
+      pre[plen] = item[plen].c;
+  literal = plen > 0 && plen == nitem && !eol;
+  for(i = 0; i < 256; i++)
+    shift[i] = plen;
+  for(i = 0; i < plen - 1; i++)
+    shift[(uchar)pre[i]] = plen - 1 - i;
+}
+
+// Add NFA state i to set, and those a * lets it skip to.
+void
+addstate(uint *set, int i)
+{
+  for(;;){
+    set[i/32] |= 1u << (i%32);
+    if(i == nitem || !item[i].star)
+      break;
+    i++;
+  }
+}
+
+// The DFA state for set, from the cache or added to it.
+struct dstate*
+dfind(uint *set)
+{
+  struct dstate *d;
+  int i;
+
+  for(d = dstate; d < &dstate[ndstate]; d++)
+    if(memcmp(d->set, set, sizeof(d->set)) == 0)
+      return d;
+  if(ndstate == NDSTATE){
+    ndstate = 0;
+    dstart = 0;
+  }
+  d = &dstate[ndstate++];
+  memmove(d->set, set, sizeof(d->set));
+  memset(d->next, 0, sizeof(d->next));
+  d->accept = (set[nitem/32] >> (nitem%32)) & 1;
+  d->dead = 1;
+  for(i = 0; i < SETWORDS; i++)
+    if(set[i])
+      d->dead = 0;
+  return d;
+}
+
+struct dstate*
+start(void)
+{
+  uint set[SETWORDS];
+
+  if(dstart == 0){
+    memset(set, 0, sizeof(set));
+    addstate(set, 0);
+    dstart = dfind(set);
+  }
+  return dstart;
+}
+
+// Where d goes on byte c, worked out from the NFA the first time.
+struct dstate*
+step(struct dstate *d, int c)
+{
+  struct dstate *nd;
+  uint set[SETWORDS];
+  int i, n;
+
+  memset(set, 0, sizeof(set));
+  for(i = 0; i < nitem; i++)
+    if(((d->set[i/32] >> (i%32)) & 1) && (item[i].c == ANY || item[i].c == c))
+      addstate(set, item[i].star ? i : i+1);
+  // without ^, a match may start at any byte
+  if(!bol)
+    addstate(set, 0);
+  n = ndstate;
+  nd = dfind(set);
+  // unless the cache started over, which took d with it
+  if(ndstate >= n)
+    d->next[c] = nd;
+  return nd;
+}
+
+// Does the line [s, e) match?
+int
+matchline(char *s, char *e)
+{
+  struct dstate *d, *nd;
+
+  d = start();
+  for(; s < e; s++){
+    if(d->accept && !eol)
+      return 1;
+    if((nd = d->next[(uchar)*s]) == 0)
+      nd = step(d, (uchar)*s);
+    d = nd;
+    if(d->dead)
+      return 0;
+  }
+  return d->accept;
+}
+
+// The first place in [s, e) the literal prefix is, or 0.
+char*
+findprefix(char *s, char *e)
+{
+  uchar *p;
+  int i;
+
+  if(plen == 1)
+    return memchr(s, pre[0], e - s);
+  for(p = (uchar*)s; p + plen <= (uchar*)e; p += shift[p[plen-1]]){
+    for(i = plen - 1; i >= 0 && p[i] == (uchar)pre[i]; i--)
+      ;
+    if(i < 0)
+      return (char*)p;
+  }
+  return 0;
+}
+
+void
+flush(void)
+{
+  if(nout > 0)
+    write(1, out, nout);
+  nout = 0;
+}
+
+// Print the line [s, e) and a newline.
+void
+output(char *s, char *e)
+{
+  int n;
+
+  n = e - s;
+  if(nout + n + 1 > sizeof(out))
+    flush();
+  if(n + 1 > sizeof(out)){
+    write(1, s, n);
+    write(1, "\n", 1);
+    return;
+  }
+  memmove(out + nout, s, n);
+  out[nout + n] = '\n';
+  nout += n + 1;
+}
+
+// Print the lines of [p, e) that match. Only the last may lack its newline.
+void
+scan(char *p, char *e)
+{
+  char *q, *x;
+
+  x = 0;
+  while(p < e){
+    if(plen > 0){
+      // lines without the prefix can't match: skip to the next one with it
+      if((x = findprefix(p, e)) == 0)
+        return;
+      for(q = x; q > p && q[-1] != '\n'; q--)
+        ;
+      p = q;
     }
+    if((q = memchr(p, '\n', e - p)) == 0)
+      q = e;
+    if((literal && x + plen <= q) || matchline(p, q))
+      output(p, q);
+    p = q + 1;
   }
 }
 
+void
+grep(int fd)
+{
+  int n, m;
+  char *e;
+
+  m = 0;
+  for(;;){
+    n = read(fd, buf+m, sizeof(buf)-m);
+    if(n > 0)
+      m += n;
+    // the complete lines, up to the last newline; at the end of the
+    // file, or with a line too long for buf, all of it
+    for(e = buf + m; e > buf && e[-1] != '\n'; e--)
+      ;
+    if(n <= 0 || (e == buf && m == sizeof(buf)))
+      e = buf + m;
+    scan(buf, e);
+    m -= e - buf;
+    memmove(buf, e, m);
+    if(n <= 0)
+      break;
+  }
+  flush();
+}
+
 int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char *pattern;
 
   if(argc <= 1){
     printf(2, "usage: grep pattern [file ...]\n");
     exit();
   }
-  pattern = argv[1];
+  compile(argv[1]);
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(0);
     exit();
   }
 
@@ -57,51 +290,8 @@ main(int argc, char *argv[])
       printf(1, "grep: cannot open %s\n", argv[i]);
       exit();
     }
-    grep(pattern, fd);
+    grep(fd);
     close(fd);
   }
   exit();
 }
-
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
-
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
-
-int
-match(char *re, char *text)
-{
-  if(re[0] == '^')
-    return matchhere(re+1, text);
-  do{  // must look at empty string
-    if(matchhere(re, text))
-      return 1;
-  }while(*text++ != '\0');
-  return 0;
-}
-
-// matchhere: search for re at beginning of text
-int matchhere(char *re, char *text)
-{
-  if(re[0] == '\0')
-    return 1;
-  if(re[1] == '*')
-    return matchstar(re[0], re+2, text);
-  if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
-    return matchhere(re+1, text+1);
-  return 0;
-}
-
-// matchstar: search for c*re at beginning of text
-int matchstar(int c, char *re, char *text)
-{
-  do{  // a * matches zero or more instances
-    if(matchhere(re, text))
-      return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
-  return 0;
-}
-
@@ -10,7 +10,7 @@ char *argv[] = { "sh", 0 };
 int
 main(void)
 {
-  int pid, wpid;
+  int pid, wpid, fd;
 
   if(open("console", O_RDWR) < 0){
     mknod("console", 1, 1);
@@ -18,6 +18,25 @@ main(void)
   }
   dup(0);  // stdout
   dup(0);  // stderr
+  if((fd = open("stat", O_RDONLY)) < 0)
+    mknod("stat", 2, 0); // counters for vmstat, see devstat.c
+  else
+    close(fd);
+
+  // make bench's file system has commands to run at boot, before the shell
+  if((fd = open("autorun", O_RDONLY)) >= 0){
+    if((pid = fork()) == 0){
+      close(0);
+      dup(fd);
+      close(fd);
+      exec("sh", argv);
+      printf(1, "init: exec sh failed\n");
+      exit();
+    }
+    close(fd);
+    while(pid > 0 && (wpid=wait()) >= 0 && wpid != pid)
+      ;
+  }
 
   for(;;){
     printf(1, "init: starting sh\n");
@@ -0,0 +1,54 @@
+// List the interrupts each cpu has taken since boot, by IRQ number, and
+// the cpu each device input is routed to ('-' for the inter-processor
+// and local ones). irq n cpu sends input n to that cpu from now on.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "traps.h"
+#include "irqstat.h"
+
+static struct irqstat st;
+
+int
+main(int argc, char *argv[])
+{
+  int i, c, n;
+
+  if(argc > 1){
+    if(argc != 3){
+      printf(2, "usage: irq [irq cpu]\n");
+      exit();
+    }
+    if(irqroute(atoi(argv[1]), atoi(argv[2])) < 0){
+      printf(2, "irq: can't route %s to cpu %s\n", argv[1], argv[2]);
+      exit();
+    }
+    exit();
+  }
+
+  if(irqstat(&st) < 0){
+    printf(2, "irq: failed\n");
+    exit();
+  }
+  printf(1, "IRQ\tROUTE");
+  for(c = 0; c < st.ncpu; c++)
+    printf(1, "\tCPU%d", c);
+  printf(1, "\n");
+  for(i = 0; i < NIRQ; i++){
+    n = 0;
+    for(c = 0; c < st.ncpu; c++)
+      n += st.count[c][i];
+    if(n == 0 && st.cpu[i] < 0)
+      continue;
+    if(st.cpu[i] < 0)
+      printf(1, "%d\t-", i);
+    else
+      printf(1, "%d\t%d", i, st.cpu[i]);
+    for(c = 0; c < st.ncpu; c++)
+      printf(1, "\t%d", st.count[c][i]);
+    printf(1, "\n");
+  }
+  exit();
+}
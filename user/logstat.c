@@ -0,0 +1,41 @@
+// Print the file system log's counters, to see how well
+// transactions are batched and how much log_write() absorbs.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "logstat.h"
+
+// print n/d with one decimal place
+static void
+ratio(char *what, uint n, uint d)
+{
+  if(d == 0){
+    printf(1, "%s -\n", what);
+    return;
+  }
+  printf(1, "%s %d.%d\n", what, n / d, (n % d) * 10 / d);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct logstat st;
+
+  if(logstat(&st) < 0){
+    printf(2, "logstat: failed\n");
+    exit();
+  }
+  printf(1, "fs ops          %d\n", st.ops);
+  printf(1, "ops that waited %d\n", st.opwaits);
+  printf(1, "log writes      %d\n", st.writes);
+  printf(1, "absorbed        %d\n", st.absorbed);
+  printf(1, "commits         %d\n", st.commits);
+  printf(1, "blocks logged   %d\n", st.logged);
+  printf(1, "largest commit  %d\n", st.maxcommit);
+  ratio("blocks/commit  ", st.logged, st.commits);
+  ratio("ops/commit     ", st.ops, st.commits);
+  ratio("absorbed %     ", st.absorbed * 100, st.writes);
+  ratio("kcycles/commit ", st.commitkcyc, st.commits);
+  exit();
+}
@@ -0,0 +1,92 @@
+// Time memmove() and memset() against plain byte loops, on page-aligned
+// buffers and on buffers that are off by a byte.
+//   membench [megabytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define BUFSIZE (256*1024)
+
+char src[BUFSIZE + 4096], dst[BUFSIZE + 4096];
+
+static void
+bytecopy(char *d, char *s, int n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+static void
+byteset(char *d, int c, int n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+// Run one of the copies over mb megabytes; returns ticks taken.
+static int
+run(int how, char *d, char *s, int mb)
+{
+  int i, n, t0;
+
+  n = mb * (1024*1024 / BUFSIZE);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    switch(how){
+    case 0: bytecopy(d, s, BUFSIZE); break;
+    case 1: memmove(d, s, BUFSIZE); break;
+    case 2: byteset(d, i, BUFSIZE); break;
+    case 3: memset(d, i, BUFSIZE); break;
+    }
+  }
+  return uptime() - t0;
+}
+
+static void
+report(char *what, int mb, int t)
+{
+  // ticks are 10ms
+  if(t == 0)
+    t = 1;
+  printf(1, "%s %d MB/s\n", what, mb * 100 / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *s, *d;
+  int mb;
+
+  mb = argc > 1 ? atoi(argv[1]) : 64;
+  if(mb <= 0){
+    printf(2, "usage: membench [megabytes]\n");
+    exit();
+  }
+  // page-aligned, then both pointers one byte off an aligned address
+  s = (char*)(((uint)src + 4095) & ~4095);
+  d = (char*)(((uint)dst + 4095) & ~4095);
+  report("byte loop copy, aligned  ", mb, run(0, d, s, mb));
+  report("memmove, aligned         ", mb, run(1, d, s, mb));
+  report("byte loop copy, unaligned", mb, run(0, d+1, s+1, mb));
+  report("memmove, unaligned       ", mb, run(1, d+1, s+1, mb));
+  report("memmove, misaligned      ", mb, run(1, d+1, s+2, mb));
+  report("byte loop set            ", mb, run(2, d, s, mb));
+  report("memset                   ", mb, run(3, d, s, mb));
+  report("memset, unaligned        ", mb, run(3, d+1, s, mb));
+
+  // and check that the copies were right
+  memset(s, 'a', 4096);
+  s[100] = 'b';
+  memmove(s+1, s, 200);
+  if(s[0] != 'a' || s[101] != 'b' || s[100] != 'a'){
+    printf(2, "membench: overlapping memmove is wrong\n");
+    exit();
+  }
+  memmove(s, s+3, 200);
+  if(s[98] != 'b' || s[97] != 'a'){
+    printf(2, "membench: overlapping memmove is wrong\n");
+    exit();
+  }
+  exit();
+}
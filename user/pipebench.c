@@ -0,0 +1,67 @@
+// Measure pipe throughput: a child writes a number of megabytes into a
+// pipe in chunks of a given size, the parent reads and times them.
+//   pipebench [megabytes [chunk]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MAXCHUNK 65536
+
+char buf[MAXCHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], mb, chunk, n, pid, t0, t1;
+  uint total, got;
+
+  mb = argc > 1 ? atoi(argv[1]) : 64;
+  chunk = argc > 2 ? atoi(argv[2]) : 4096;
+  if(mb <= 0 || chunk <= 0 || chunk > MAXCHUNK){
+    printf(2, "usage: pipebench [megabytes [chunk <= %d]]\n", MAXCHUNK);
+    exit();
+  }
+  total = (uint)mb << 20;
+  if(pipe(fds) < 0){
+    printf(2, "pipebench: pipe failed\n");
+    exit();
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf(2, "pipebench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(got = 0; got < total; got += n){
+      n = total - got < chunk ? total - got : chunk;
+      if(write(fds[1], buf, n) != n){
+        printf(2, "pipebench: write failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], buf, chunk)) > 0)
+    got += n;
+  t1 = uptime();
+  wait();
+  close(fds[0]);
+
+  if(got != total){
+    printf(2, "pipebench: read %d of %d bytes\n", got, total);
+    exit();
+  }
+  // ticks are 10ms
+  if(t1 == t0)
+    t1 = t0 + 1;
+  printf(1, "%d MB in %d ticks with %d-byte chunks: %d MB/s\n",
+         mb, t1 - t0, chunk, mb * 100 / (t1 - t0));
+  exit();
+}
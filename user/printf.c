@@ -2,14 +2,63 @@
 #include "stat.h"
 #include "user.h"
 
+// Output is buffered per file descriptor: printf() builds its output in the
+// descriptor's buffer, and write()s it out when the buffer fills, on fflush(),
+// before fork() and exit() (see ulib.c), and, for the console, at the end of
+// each printf(), so that interactive output (prompts included) shows up at
+// once. Files and pipes so get a whole buffer per system call, the console
+// a line or so. Whether a descriptor is the console is decided on its first
+// printf(). write() goes around the buffer: fflush() first when mixing them.
+
+#define NOUTBUF 8       // descriptors below this have a buffer
+#define OUTBUFSZ 512
+
+#define OB_UNKNOWN 0    // not looked at yet
+#define OB_CALL 1       // flush at the end of each printf()
+#define OB_FULL 2       // flush only when full
+
+struct outbuf {
+  char buf[OUTBUFSZ];
+  int n;
+  int mode;
+};
+
+static struct outbuf outbuf[NOUTBUF];
+
+static void
+obflush(int fd, struct outbuf *ob)
+{
+  if(ob->n > 0)
+    write(fd, ob->buf, ob->n);
+  ob->n = 0;
+}
+
+void
+fflush(int fd)
+{
+  if(fd >= 0 && fd < NOUTBUF)
+    obflush(fd, &outbuf[fd]);
+}
+
+void
+fflushall(void)
+{
+  int fd;
+
+  for(fd = 0; fd < NOUTBUF; fd++)
+    obflush(fd, &outbuf[fd]);
+}
+
 static void
-putc(int fd, char c)
+putc(int fd, struct outbuf *ob, char c)
 {
-  write(fd, &c, 1);
+  if(ob->n == OUTBUFSZ)
+    obflush(fd, ob);
+  ob->buf[ob->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(int fd, struct outbuf *ob, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -32,7 +81,7 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(fd, ob, buf[i]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
@@ -42,6 +91,18 @@ printf(int fd, const char *fmt, ...)
   char *s;
   int c, i, state;
   uint *ap;
+  struct outbuf *ob, tmp;
+  struct stat st;
+
+  if(fd >= 0 && fd < NOUTBUF)
+    ob = &outbuf[fd];
+  else {
+    ob = &tmp;
+    ob->n = 0;
+    ob->mode = OB_CALL;
+  }
+  if(ob->mode == OB_UNKNOWN)
+    ob->mode = fstat(fd, &st) < 0 || st.type == T_DEV ? OB_CALL : OB_FULL;
 
   state = 0;
   ap = (uint*)(void*)&fmt + 1;
@@ -51,14 +112,14 @@ printf(int fd, const char *fmt, ...)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(fd, ob, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(fd, ob, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(fd, ob, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -66,20 +127,22 @@ printf(int fd, const char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(fd, ob, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        putc(fd, ob, *ap);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        putc(fd, ob, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(fd, ob, '%');
+        putc(fd, ob, c);
       }
       state = 0;
     }
   }
+  if(ob->mode == OB_CALL)
+    obflush(fd, ob);
 }
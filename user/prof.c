@@ -0,0 +1,166 @@
+// Profile the kernel while a command runs: prof cmd [args...]
+// Starts the kernel profiler (see profile()), runs the command, and
+// prints the kernel functions the timer interrupt found the cpus in,
+// most sampled first: "self" counts samples in the function itself,
+// "total" those with it anywhere in the sampled call chain. Samples
+// are system-wide, and each cpu keeps only its last PROFSIZE, about
+// ten seconds' worth. Names come from /kernel.sym.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "fcntl.h"
+#include "prof.h"
+
+#define NSYM 2048
+
+struct sym {
+  uint addr;
+  char name[28];
+  int self;
+  int total;
+};
+
+static struct sym syms[NSYM];
+static int nsym;
+static struct profsample samples[NCPU*PROFSIZE];
+
+static uint
+hex(char *s)
+{
+  uint v;
+
+  v = 0;
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      v = v*16 + *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      v = v*16 + *s - 'a' + 10;
+    else
+      return v;
+  }
+}
+
+// read "address name" lines, keeping the kernel text ones, sorted
+static void
+loadsyms(char *path)
+{
+  char line[64], *p;
+  struct sym t;
+  int fd, i, j;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    printf(2, "prof: cannot open %s\n", path);
+    return;
+  }
+  while(nsym < NSYM && fgets(fd, line, sizeof(line)) != 0 && line[0]){
+    if((t.addr = hex(line)) < 0x80100000 || strlen(line) < 10)
+      continue;
+    p = line + 9;
+    for(i = 0; p[i] && p[i] != '\n' && i < sizeof(t.name)-1; i++)
+      t.name[i] = p[i];
+    t.name[i] = 0;
+    for(j = nsym++; j > 0 && syms[j-1].addr > t.addr; j--)
+      syms[j] = syms[j-1];
+    syms[j] = t;
+  }
+  close(fd);
+}
+
+// the symbol pc is in, or 0
+static struct sym*
+lookup(uint pc)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = nsym;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(syms[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 ? &syms[lo-1] : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sym *s, *seen[PROFDEPTH], t;
+  int i, j, k, n, pid, user, unknown, idle;
+
+  if(argc < 2){
+    printf(2, "usage: prof cmd [args...]\n");
+    exit();
+  }
+  loadsyms("/kernel.sym");
+
+  if(profile(PROF_START, 0, 0) < 0){
+    printf(2, "prof: profile failed\n");
+    exit();
+  }
+  if((pid = fork()) < 0){
+    printf(2, "prof: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    printf(2, "prof: exec %s failed\n", argv[1]);
+    exit();
+  }
+  while(wait() != pid)
+    ;
+  profile(PROF_STOP, 0, 0);
+  n = profile(PROF_READ, samples, NCPU*PROFSIZE);
+
+  user = unknown = idle = 0;
+  for(i = 0; i < n; i++){
+    if(samples[i].user){
+      user++;
+      continue;
+    }
+    if(samples[i].pid == 0)
+      idle++;
+    for(j = 0; j < PROFDEPTH && samples[i].pc[j]; j++){
+      s = lookup(samples[i].pc[j]);
+      seen[j] = s;
+      if(s == 0){
+        if(j == 0)
+          unknown++;
+        continue;
+      }
+      if(j == 0)
+        s->self++;
+      // count recursion once
+      for(k = 0; k < j && seen[k] != s; k++)
+        ;
+      if(k == j)
+        s->total++;
+    }
+  }
+
+  // most self samples first; few symbols are sampled, so sort those
+  k = 0;
+  for(i = 0; i < nsym; i++)
+    if(syms[i].total)
+      syms[k++] = syms[i];
+  for(i = 1; i < k; i++){
+    t = syms[i];
+    for(j = i; j > 0 && (syms[j-1].self < t.self ||
+        (syms[j-1].self == t.self && syms[j-1].total < t.total)); j--)
+      syms[j] = syms[j-1];
+    syms[j] = t;
+  }
+
+  printf(1, "%d samples: %d user, %d kernel (%d with no process)\n",
+         n, user, n - user, idle);
+  printf(1, "self\ttotal\tfunction\n");
+  for(i = 0; i < k; i++)
+    printf(1, "%d\t%d\t%s\n", syms[i].self, syms[i].total, syms[i].name);
+  if(unknown)
+    printf(1, "%d\t\t?\n", unknown);
+  exit();
+}
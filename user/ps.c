@@ -0,0 +1,75 @@
+// List processes with their scheduling class, nice value and the cpus
+// they may run on. ps batch|inter pid [nice] changes the first two,
+// ps pin pid cpu... the last. The mask column is in hex, bit i for cpu i.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "sched.h"
+#include "procinfo.h"
+
+struct procinfo pi[NPROCMAX];
+
+// Print cpu mask m in hex, leaving out the leading zero words.
+void
+printmask(uint *m)
+{
+  int w, i;
+
+  for(w = NCPUWORDS - 1; w > 0 && m[w] == 0; w--)
+    ;
+  printf(1, "%x", m[w]);
+  while(--w >= 0)
+    for(i = 28; i >= 0; i -= 4)
+      printf(1, "%x", (m[w] >> i) & 0xF);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint mask[NCPUWORDS];
+  int i, n, class, cpu;
+
+  if(argc >= 4 && strcmp(argv[1], "pin") == 0){
+    memset(mask, 0, sizeof(mask));
+    for(i = 3; i < argc; i++){
+      if((cpu = atoi(argv[i])) < 0 || cpu >= NCPU){
+        printf(2, "ps: no cpu %s\n", argv[i]);
+        exit();
+      }
+      mask[cpu/32] |= 1u << (cpu%32);
+    }
+    if(setaffinity(atoi(argv[2]), mask) < 0)
+      printf(2, "ps: setaffinity %s failed\n", argv[2]);
+    exit();
+  }
+  if(argc > 1){
+    if(strcmp(argv[1], "batch") == 0)
+      class = SCHED_BATCH;
+    else if(strcmp(argv[1], "inter") == 0)
+      class = SCHED_INTERACTIVE;
+    else
+      class = -1;
+    if(class < 0 || argc < 3){
+      printf(2, "usage: ps [batch|inter pid [nice] | pin pid cpu...]\n");
+      exit();
+    }
+    if(setsched(atoi(argv[2]), class, argc > 3 ? atoi(argv[3]) : 0) < 0){
+      printf(2, "ps: setsched %s failed\n", argv[2]);
+      exit();
+    }
+    exit();
+  }
+
+  n = procinfo(pi, NPROCMAX);
+  printf(1, "PID\tPPID\tSTATE\tCLASS\tNICE\tCPU\tMASK\tSIZE\tNAME\n");
+  for(i = 0; i < n; i++){
+    printf(1, "%d\t%d\t%s\t%s\t%d\t%d\t", pi[i].pid, pi[i].ppid,
+           pi[i].state, pi[i].class == SCHED_BATCH ? "batch" : "inter",
+           pi[i].nice, pi[i].cpu);
+    printmask(pi[i].affinity);
+    printf(1, "\t%d\t%s\n", pi[i].sz, pi[i].name);
+  }
+  exit();
+}
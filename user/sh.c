@@ -1,6 +1,7 @@
 // Shell.
 
 #include "types.h"
+#include "stat.h"
 #include "user.h"
 #include "fcntl.h"
 
@@ -49,19 +50,109 @@ struct backcmd {
   struct cmd *cmd;
 };
 
+#define MAXPIPE 16  // most stages in a pipeline
+
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+void runcmd(struct cmd*);
+void runline(struct cmd*);
 
-// Execute cmd.  Never returns.
+// Wait for process pid, reaping any others (background commands) meanwhile.
+void
+waitfor(int pid)
+{
+  int w;
+
+  while((w = wait()) >= 0 && w != pid)
+    ;
+}
+
+// Run cmd in the shell itself if it is a builtin: cd or exit.
+// Returns 0 if it isn't one.
+int
+builtin(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+
+  if(cmd->type != EXEC)
+    return 0;
+  ecmd = (struct execcmd*)cmd;
+  if(ecmd->argv[0] == 0)
+    return 1;
+  if(strcmp(ecmd->argv[0], "cd") == 0){
+    if(ecmd->argv[1] == 0 || ecmd->argv[2] != 0)
+      printf(2, "usage: cd dir\n");
+    else if(chdir(ecmd->argv[1]) < 0)
+      printf(2, "cannot cd %s\n", ecmd->argv[1]);
+    return 1;
+  }
+  if(strcmp(ecmd->argv[0], "exit") == 0)
+    exit();
+  return 0;
+}
+
+// Run a pipeline with one child per stage, each reading from the
+// stage before it, and wait for them all.
+void
+runpipe(struct cmd *cmd)
+{
+  struct cmd *stage;
+  int p[2], pids[MAXPIPE], in, last, n, i, w;
+
+  in = -1;
+  n = 0;
+  for(;;){
+    last = cmd->type != PIPE;
+    stage = last ? cmd : ((struct pipecmd*)cmd)->left;
+    if(n == MAXPIPE){
+      printf(2, "pipeline too long\n");
+      break;
+    }
+    if(!last && pipe(p) < 0)
+      panic("pipe");
+    if((pids[n] = fork1()) == 0){
+      if(in >= 0){
+        close(0);
+        dup(in);
+        close(in);
+      }
+      if(!last){
+        close(1);
+        dup(p[1]);
+        close(p[0]);
+        close(p[1]);
+      }
+      runcmd(stage);
+    }
+    n++;
+    if(in >= 0)
+      close(in);
+    in = -1;
+    if(last)
+      break;
+    close(p[1]);
+    in = p[0];
+    cmd = ((struct pipecmd*)cmd)->right;
+  }
+  if(in >= 0)
+    close(in);
+  while(n > 0 && (w = wait()) >= 0)
+    for(i = 0; i < n; i++)
+      if(pids[i] == w){
+        pids[i] = pids[--n];
+        break;
+      }
+}
+
+// Execute cmd in a child of the shell.  Never returns.
+// A command execs in place, without forking again.
 void
 runcmd(struct cmd *cmd)
 {
-  int p[2];
-  struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
-  struct pipecmd *pcmd;
   struct redircmd *rcmd;
 
   if(cmd == 0)
@@ -72,9 +163,9 @@ runcmd(struct cmd *cmd)
     panic("runcmd");
 
   case EXEC:
+    if(builtin(cmd))
+      break;
     ecmd = (struct execcmd*)cmd;
-    if(ecmd->argv[0] == 0)
-      exit();
     exec(ecmd->argv[0], ecmd->argv);
     printf(2, "exec %s failed\n", ecmd->argv[0]);
     break;
@@ -91,43 +182,59 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait();
+    runline(lcmd->left);
     runcmd(lcmd->right);
     break;
 
   case PIPE:
-    pcmd = (struct pipecmd*)cmd;
-    if(pipe(p) < 0)
-      panic("pipe");
-    if(fork1() == 0){
-      close(1);
-      dup(p[1]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->left);
-    }
-    if(fork1() == 0){
-      close(0);
-      dup(p[0]);
-      close(p[0]);
-      close(p[1]);
-      runcmd(pcmd->right);
-    }
-    close(p[0]);
-    close(p[1]);
-    wait();
-    wait();
+  case BACK:
+    runline(cmd);
+    break;
+  }
+  exit();
+}
+
+// Run cmd from the shell, and return once it is done (or, for a
+// background command, started). Builtins and lists run in the shell
+// itself; each command and each pipeline stage gets one child.
+void
+runline(struct cmd *cmd)
+{
+  struct listcmd *lcmd;
+  int pid;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  default:
+    panic("runline");
+
+  case EXEC:
+    if(builtin(cmd))
+      break;
+    // fall through
+  case REDIR:
+    if((pid = fork1()) == 0)
+      runcmd(cmd);
+    waitfor(pid);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    runline(lcmd->left);
+    runline(lcmd->right);
+    break;
+
+  case PIPE:
+    runpipe(cmd);
     break;
 
   case BACK:
-    bcmd = (struct backcmd*)cmd;
     if(fork1() == 0)
-      runcmd(bcmd->cmd);
+      runcmd(((struct backcmd*)cmd)->cmd);
     break;
   }
-  exit();
 }
 
 int
@@ -135,16 +242,67 @@ getcmd(char *buf, int nbuf)
 {
   printf(2, "$ ");
   memset(buf, 0, nbuf);
-  gets(buf, nbuf);
+  fgets(0, buf, nbuf);
   if(buf[0] == 0) // EOF
     return -1;
   return 0;
 }
 
+// sh file runs the commands in file. The whole file is read and parsed
+// up front, so that a syntax error on any line runs none of it, and the
+// commands then run one after another with no reading or parsing between
+// them. Lines starting with # are comments.
+void
+runscript(char *path)
+{
+  struct stat st;
+  struct cmd **cmds;
+  char *text, *s, *e;
+  int fd, n, m, nline, ncmd, i, bad;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    printf(2, "sh: cannot open %s\n", path);
+    exit();
+  }
+  if(fstat(fd, &st) < 0 || (text = malloc(st.size + 1)) == 0)
+    panic("sh: cannot read script");
+  for(n = 0; n < st.size && (m = read(fd, text + n, st.size - n)) > 0; n += m)
+    ;
+  close(fd);
+  text[n] = 0;
+
+  nline = 1;
+  for(s = text; *s; s++)
+    if(*s == '\n')
+      nline++;
+  if((cmds = malloc(nline * sizeof(cmds[0]))) == 0)
+    panic("sh: cannot read script");
+  ncmd = 0;
+  bad = 0;
+  for(s = text, i = 1; *s; s = e, i++){
+    for(e = s; *e && *e != '\n'; e++)
+      ;
+    if(*e)
+      *e++ = 0;
+    if(*s == '#')
+      continue;
+    if((cmds[ncmd] = parsecmd(s)) == 0){
+      printf(2, "sh: %s: line %d\n", path, i);
+      bad = 1;
+    } else
+      ncmd++;
+  }
+  if(bad)
+    exit();
+  for(i = 0; i < ncmd; i++)
+    runline(cmds[i]);
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -155,18 +313,19 @@ main(void)
     }
   }
 
+  if(argc > 1){
+    runscript(argv[1]);
+    exit();
+  }
+
   // Read and run input commands.
+  // They are parsed here, not in a child, so that builtins can run in
+  // the shell itself.
   while(getcmd(buf, sizeof(buf)) >= 0){
-    if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
-      // Chdir must be called by the parent, not the child.
-      buf[strlen(buf)-1] = 0;  // chop \n
-      if(chdir(buf+3) < 0)
-        printf(2, "cannot cd %s\n", buf+3);
+    if((cmd = parsecmd(buf)) == 0)
       continue;
-    }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    runline(cmd);
+    freecmd(cmd);
   }
   exit();
 }
@@ -260,6 +419,7 @@ backcmd(struct cmd *subcmd)
 // Parsing
 
 char whitespace[] = " \t\r\n\v";
+int parseerr;  // set by syntax(): parsecmd() gives up on the line
 char symbols[] = "<|>&;()";
 
 int
@@ -324,18 +484,35 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// Report a syntax error, the first on a line only. The parser goes on
+// to the end of the line as best it can, and parsecmd() then returns 0:
+// the shell parses in its own process, and a bad line mustn't end it.
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    printf(2, "%s\n", msg);
+  parseerr = 1;
+}
+
+// Parse the line s, or return 0 if it has a syntax error.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +556,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +584,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +612,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +676,32 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free cmd and the commands in it.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
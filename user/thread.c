@@ -0,0 +1,126 @@
+// Threads on top of clone() and join(), and locks for them.
+// Each thread gets a stack of its own from malloc(), which
+// thread_join() frees once the thread has exited.
+// Spin locks suit the shortest critical sections; mutexes and condition
+// variables sleep in the kernel (see futexwait()) while they wait,
+// and only make a system call when there is waiting to do.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define TSTACK 4096
+
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+void
+lock_release(lock_t *lk)
+{
+  __sync_synchronize();
+  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+}
+
+// locked: 0 free, 1 held, 2 held and maybe waited for, so unlock must wake
+void
+mutex_init(mutex_t *m)
+{
+  m->locked = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  uint c;
+
+  if((c = __sync_val_compare_and_swap(&m->locked, 0, 1)) == 0)
+    return;
+  // announce a waiter, unless the holder let go meanwhile
+  if(c != 2)
+    c = xchg(&m->locked, 2);
+  while(c != 0){
+    futexwait(&m->locked, 2);
+    c = xchg(&m->locked, 2);
+  }
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->locked, 1) != 1){
+    m->locked = 0;
+    futexwake(&m->locked, 1);
+  }
+}
+
+// seq counts signals, so a wait can tell it missed one while unlocking
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+// Wait for a signal, with m held; may also return without one.
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futexwait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futexwake(&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futexwake(&c->seq, 0x7fffffff);
+}
+
+// Start a thread running fn(arg), which must exit() when done.
+// Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *stack;
+  int pid;
+
+  if((stack = malloc(TSTACK)) == 0)
+    return -1;
+  if((pid = clone(fn, arg, stack, TSTACK)) < 0)
+    free(stack);
+  return pid;
+}
+
+// Wait for a thread this one started to exit, and return its pid.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
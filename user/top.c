@@ -0,0 +1,84 @@
+// Show who is using the cpus and the disk: every second, the processes
+// that ran or did disk I/O during it, by cpu time, busiest first.
+// %CPU is of one cpu; the counts are for that second, TIME since the
+// process started. top [n] stops after n updates, 0 for never.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "x86.h"
+#include "procinfo.h"
+
+static struct procinfo snap[2][NPROCMAX];
+static int nsnap[2];
+static int order[NPROCMAX];
+static uint dcyc[NPROCMAX];
+
+// the entry for pid in the earlier snapshot, which is most likely at i
+static struct procinfo*
+before(struct procinfo *old, int n, int pid, int i)
+{
+  int j;
+
+  if(i < n && old[i].pid == pid)
+    return &old[i];
+  for(j = 0; j < n; j++)
+    if(old[j].pid == pid)
+      return &old[j];
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct procinfo *p, *q, zero;
+  int i, j, k, cur, count, nshow;
+  uint64 t0, t1;
+  uint elapsed, total;
+
+  count = argc > 1 ? atoi(argv[1]) : 5;
+  memset(&zero, 0, sizeof(zero));
+  cur = 0;
+  nsnap[cur] = procinfo(snap[cur], NPROCMAX);
+  t0 = rdtsc();
+  for(k = 0; count == 0 || k < count; k++){
+    sleep(100);
+    cur = !cur;
+    nsnap[cur] = procinfo(snap[cur], NPROCMAX);
+    t1 = rdtsc();
+    elapsed = (uint)((t1 - t0) >> 10);
+    t0 = t1;
+    if(elapsed == 0)
+      elapsed = 1;
+
+    nshow = 0;
+    total = 0;
+    for(i = 0; i < nsnap[cur]; i++){
+      p = &snap[cur][i];
+      if((q = before(snap[!cur], nsnap[!cur], p->pid, i)) == 0)
+        q = &zero;
+      dcyc[i] = (uint)((p->cycles - q->cycles) >> 10);
+      total += dcyc[i];
+      if(dcyc[i] == 0 && p->nbread == q->nbread && p->nbwrite == q->nbwrite)
+        continue;
+      for(j = nshow++; j > 0 && dcyc[order[j-1]] < dcyc[i]; j--)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+
+    printf(1, "\n%d processes, %d%% cpu\n", nsnap[cur], total / (elapsed/100 + 1));
+    printf(1, "PID\t%%CPU\tTIME\tVCSW\tIVCSW\tFAULTS\tREAD\tWRITE\tNAME\n");
+    for(j = 0; j < nshow; j++){
+      i = order[j];
+      p = &snap[cur][i];
+      if((q = before(snap[!cur], nsnap[!cur], p->pid, i)) == 0)
+        q = &zero;
+      printf(1, "%d\t%d\t%d.%d\t%d\t%d\t%d\t%d\t%d\t%s\n", p->pid,
+             dcyc[i] / (elapsed/100 + 1), p->ms / 1000, p->ms / 100 % 10,
+             p->nvcsw - q->nvcsw, p->nivcsw - q->nivcsw, p->nfault - q->nfault,
+             p->nbread - q->nbread, p->nbwrite - q->nbwrite, p->name);
+    }
+  }
+  exit();
+}
@@ -0,0 +1,132 @@
+// Dump the kernel's event trace, all cpus merged in time order.
+//   trace              the events recorded lately
+//   trace -c           forget them
+//   trace cmd [args]   forget them, run cmd, then dump what it led to
+// Times are microseconds after the first event shown.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "trace.h"
+
+static struct traceev ev[NCPU*TRACESIZE];
+
+static char *names[] = {
+[TR_SWITCH]     "switch",
+[TR_SLEEP]      "sleep",
+[TR_WAKEUP]     "wakeup",
+[TR_BHIT]       "bhit",
+[TR_BMISS]      "bmiss",
+[TR_DISKSTART]  "diskstart",
+[TR_DISKDONE]   "diskdone",
+[TR_COMMIT]     "commit",
+[TR_COMMITDONE] "commitdone",
+};
+
+// v / 1000, without the 64-bit division the compiler would call libgcc for
+static uint
+div1000(uint64 v)
+{
+  uint64 q;
+  int i;
+
+  q = 0;
+  for(i = 63; i >= 0; i--){
+    if((v >> i) >= 1000){
+      v -= (uint64)1000 << i;
+      q |= (uint64)1 << i;
+    }
+  }
+  return q;
+}
+
+static void
+show(struct traceev *e, uint64 t0)
+{
+  printf(1, "%d\t%d\t%d\t", div1000(e->ns - t0), e->cpu, e->pid);
+  switch(e->type){
+  case TR_SWITCH:
+    printf(1, "switch %d -> %d\n", e->arg[0], e->arg[1]);
+    break;
+  case TR_SLEEP:
+    printf(1, "sleep 0x%x\n", e->arg[0]);
+    break;
+  case TR_WAKEUP:
+    printf(1, "wakeup 0x%x pid %d\n", e->arg[0], e->arg[1]);
+    break;
+  case TR_BHIT:
+  case TR_BMISS:
+    printf(1, "%s %d/%d\n", names[e->type], e->arg[0], e->arg[1]);
+    break;
+  case TR_DISKSTART:
+  case TR_DISKDONE:
+    printf(1, "%s %s %d\n", names[e->type], e->arg[1] ? "write" : "read", e->arg[0]);
+    break;
+  case TR_COMMIT:
+  case TR_COMMITDONE:
+    printf(1, "%s batch %d, %d blocks\n", names[e->type], e->arg[0], e->arg[1]);
+    break;
+  default:
+    printf(1, "event %d %d %d\n", e->type, e->arg[0], e->arg[1]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int start[NCPU+1], next[NCPU];
+  int i, n, nrun, best, pid;
+  uint64 t0;
+
+  if(argc > 1 && strcmp(argv[1], "-c") == 0){
+    trace(TRACE_CLEAR, 0, 0);
+    exit();
+  }
+  if(argc > 1){
+    trace(TRACE_CLEAR, 0, 0);
+    if((pid = fork()) < 0){
+      printf(2, "trace: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "trace: exec %s failed\n", argv[1]);
+      exit();
+    }
+    while(wait() != pid)
+      ;
+  }
+
+  // stop while copying out, or our own printing would crowd out the events
+  trace(TRACE_STOP, 0, 0);
+  n = trace(TRACE_READ, ev, NCPU*TRACESIZE);
+  trace(TRACE_START, 0, 0);
+  if(n <= 0)
+    exit();
+
+  // the events come in one run per cpu, each in time order; merge the runs
+  nrun = 0;
+  for(i = 0; i < n; i++)
+    if(i == 0 || ev[i].cpu != ev[i-1].cpu)
+      start[nrun++] = i;
+  start[nrun] = n;
+  for(i = 0; i < nrun; i++)
+    next[i] = start[i];
+  t0 = ev[0].ns;
+  for(i = 1; i < nrun; i++)
+    if(ev[start[i]].ns < t0)
+      t0 = ev[start[i]].ns;
+
+  printf(1, "usec\tcpu\tpid\tevent\n");
+  for(;;){
+    best = -1;
+    for(i = 0; i < nrun; i++)
+      if(next[i] < start[i+1] && (best < 0 || ev[next[i]].ns < ev[next[best]].ns))
+        best = i;
+    if(best < 0)
+      break;
+    show(&ev[next[best]++], t0);
+  }
+  exit();
+}
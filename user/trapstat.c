@@ -0,0 +1,133 @@
+// Print trap and system call latencies since boot: count, median
+// and 99th percentile of each trap number and system call that has
+// happened, from the kernel's histograms (see trapstat()). The
+// percentiles are the upper end of the histogram bin they fall in,
+// so they are within a factor of two.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "syscall.h"
+#include "trapstat.h"
+
+static char *names[NSYSLAT] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_fsync]   "fsync",
+[SYS_sync]    "sync",
+[SYS_logstat] "logstat",
+[SYS_setsched] "setsched",
+[SYS_procinfo] "procinfo",
+[SYS_nanosleep] "nanosleep",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futexwait] "futexwait",
+[SYS_futexwake] "futexwake",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_ringenter] "ringenter",
+[SYS_trapstat] "trapstat",
+[SYS_profile] "profile",
+[SYS_trace]   "trace",
+[SYS_socket]  "socket",
+[SYS_bind]    "bind",
+[SYS_sendto]  "sendto",
+[SYS_recvfrom] "recvfrom",
+[SYS_recvmmsg] "recvmmsg",
+[SYS_poll]    "poll",
+[SYS_irqstat] "irqstat",
+[SYS_irqroute] "irqroute",
+[SYS_setaffinity] "setaffinity",
+};
+
+static struct trapstat st;
+
+// nanoseconds at the top of bin b
+static uint
+binns(int b)
+{
+  uint c;
+
+  c = 1 << (b + LATSHIFT + 1);
+  if(c >= 1024)
+    return (c >> 10) * st.cycns;
+  return c * st.cycns >> 10;
+}
+
+// bin that holds the pct-th percentile of the n counts in h
+static int
+percentile(uint *h, uint n, int pct)
+{
+  uint sum, want;
+  int b;
+
+  want = n / 100 * pct + n % 100 * pct / 100;
+  if(want == 0)
+    want = 1;
+  sum = 0;
+  for(b = 0; b < NLATBIN - 1; b++){
+    sum += h[b];
+    if(sum >= want)
+      break;
+  }
+  return b;
+}
+
+static void
+show(char *name, int num, uint *h)
+{
+  uint n;
+  int b;
+
+  n = 0;
+  for(b = 0; b < NLATBIN; b++)
+    n += h[b];
+  if(n == 0)
+    return;
+  if(name)
+    printf(1, "%s", name);
+  else
+    printf(1, "%d", num);
+  printf(1, "\t%d\t%d\t%d\n", n, binns(percentile(h, n, 50)), binns(percentile(h, n, 99)));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(trapstat(&st) < 0){
+    printf(2, "trapstat: failed\n");
+    exit();
+  }
+  printf(1, "syscall\tcount\tp50 ns\tp99 ns\n");
+  for(i = 0; i < NSYSLAT; i++)
+    show(names[i], i, st.sys[i]);
+  printf(1, "\ntrap\tcount\tp50 ns\tp99 ns\n");
+  for(i = 0; i < NTRAPLAT; i++)
+    show(0, i, st.trap[i]);
+  exit();
+}
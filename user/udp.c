@@ -0,0 +1,111 @@
+// Send and receive UDP datagrams, to try out the network (make NET=1).
+//   udp -l port                   receive on port, and every second that
+//                                 datagrams come in, say how many and how big
+//   udp addr port [count [size]]  send count (1) datagrams of size bytes (64)
+//                                 to port at addr, given as a.b.c.d
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "socket.h"
+
+#define BATCH 32
+
+static char bufs[BATCH][2048];
+
+static void
+usage(void)
+{
+  printf(2, "usage: udp -l port | udp addr port [count [size]]\n");
+  exit();
+}
+
+// a.b.c.d in host byte order, or 0
+static uint
+parseaddr(char *s)
+{
+  uint a, b;
+  int i;
+
+  a = 0;
+  for(i = 0; i < 4; i++){
+    if(*s < '0' || *s > '9')
+      return 0;
+    for(b = 0; *s >= '0' && *s <= '9'; s++)
+      b = b*10 + *s - '0';
+    if(b > 255 || *s != (i < 3 ? '.' : 0))
+      return 0;
+    s++;
+    a = a << 8 | b;
+  }
+  return a;
+}
+
+static void
+listen(int port)
+{
+  struct sockaddr_in a;
+  struct mmsg m[BATCH];
+  uint n, bytes, calls, t;
+  int fd, i, got;
+
+  if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    usage();
+  a.family = AF_INET;
+  a.addr = INADDR_ANY;
+  a.port = port;
+  if(bind(fd, &a) < 0){
+    printf(2, "udp: cannot bind port %d\n", port);
+    exit();
+  }
+  n = bytes = calls = 0;
+  t = uptime();
+  for(;;){
+    for(i = 0; i < BATCH; i++){
+      m[i].buf = bufs[i];
+      m[i].len = sizeof(bufs[i]);
+    }
+    if((got = recvmmsg(fd, m, BATCH)) < 0){
+      printf(2, "udp: recvmmsg failed\n");
+      exit();
+    }
+    calls++;
+    n += got;
+    for(i = 0; i < got; i++)
+      bytes += m[i].len;
+    if(uptime() - t >= 100){
+      printf(1, "%d datagrams, %d bytes, %d per call\n", n, bytes, n / calls);
+      n = bytes = calls = 0;
+      t = uptime();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sockaddr_in a;
+  int fd, i, count, size;
+
+  if(argc == 3 && strcmp(argv[1], "-l") == 0)
+    listen(atoi(argv[2]));
+  if(argc < 3)
+    usage();
+  a.family = AF_INET;
+  if((a.addr = parseaddr(argv[1])) == 0)
+    usage();
+  a.port = atoi(argv[2]);
+  count = argc > 3 ? atoi(argv[3]) : 1;
+  size = argc > 4 ? atoi(argv[4]) : 64;
+  if(size < 0 || size > sizeof(bufs[0]))
+    usage();
+  if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    usage();
+  memset(bufs[0], 'x', size);
+  for(i = 0; i < count; i++)
+    if(sendto(fd, bufs[0], size, &a) != size){
+      printf(2, "udp: sendto failed after %d\n", i);
+      exit();
+    }
+  exit();
+}
@@ -36,7 +36,19 @@ strlen(const char *s)
 void*
 memset(void *dst, int c, uint n)
 {
-  stosb(dst, c, n);
+  char *d;
+  uint head;
+
+  // longs at a time from the first aligned address on
+  d = dst;
+  c &= 0xFF;
+  head = -(uint)d & 3;
+  if(head > n)
+    head = n;
+  stosb(d, c, head);
+  d += head, n -= head;
+  stosl(d, (c<<24)|(c<<16)|(c<<8)|c, n/4);
+  stosb(d + (n & ~3), c, n & 3);
   return dst;
 }
 
@@ -49,16 +61,53 @@ strchr(const char *s, char c)
   return 0;
 }
 
+void*
+memchr(const void *v, int c, uint n)
+{
+  const uchar *s;
+
+  for(s = v; n > 0; n--, s++)
+    if(*s == (uchar)c)
+      return (void*)s;
+  return 0;
+}
+
+// Input for fgets() is buffered per file descriptor, so reading a line from
+// a file or pipe takes one read() per buffer rather than one per character.
+// Bytes read ahead stay in the buffer for the next fgets(); read() on the
+// same descriptor doesn't see them. The console returns a line per read()
+// anyway, so interactive input is unaffected.
+
+#define NINBUF 8       // descriptors below this have a buffer
+#define INBUFSZ 512
+
+static struct {
+  char buf[INBUFSZ];
+  int off;             // next byte to hand out
+  int n;               // bytes in buf
+} inbuf[NINBUF];
+
+// Read a line (with its newline) of at most max-1 bytes from fd into buf.
+// buf is empty at end of file or on error.
 char*
-gets(char *buf, int max)
+fgets(int fd, char *buf, int max)
 {
   int i, cc;
   char c;
 
   for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
+    if(fd < 0 || fd >= NINBUF){
+      if(read(fd, &c, 1) < 1)
+        break;
+    } else {
+      if(inbuf[fd].off == inbuf[fd].n){
+        if((cc = read(fd, inbuf[fd].buf, INBUFSZ)) < 1)
+          break;
+        inbuf[fd].off = 0;
+        inbuf[fd].n = cc;
+      }
+      c = inbuf[fd].buf[inbuf[fd].off++];
+    }
     buf[i++] = c;
     if(c == '\n' || c == '\r')
       break;
@@ -67,6 +116,12 @@ gets(char *buf, int max)
   return buf;
 }
 
+char*
+gets(char *buf, int max)
+{
+  return fgets(0, buf, max);
+}
+
 int
 stat(const char *n, struct stat *st)
 {
@@ -97,10 +152,68 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  int head;
 
   dst = vdst;
   src = vsrc;
-  while(n-- > 0)
-    *dst++ = *src++;
+  if(n <= 0)
+    return vdst;
+  if(src < dst && src + n > dst){
+    // overlapping, to a higher address: copy backwards
+    movsbr(dst + n - 1, src + n - 1, n);
+    return vdst;
+  }
+  // longs at a time when dst and src are equally aligned
+  if((((uint)src ^ (uint)dst) & 3) == 0){
+    head = -(uint)dst & 3;
+    if(head > n)
+      head = n;
+    movsb(dst, src, head);
+    dst += head, src += head, n -= head;
+    movsl(dst, src, n / 4);
+    dst += n & ~3, src += n & ~3, n &= 3;
+  }
+  movsb(dst, src, n);
   return vdst;
 }
+
+// gcc may call memcpy for structure copies.
+void*
+memcpy(void *dst, const void *src, uint n)
+{
+  return memmove(dst, src, n);
+}
+
+int
+memcmp(const void *v1, const void *v2, uint n)
+{
+  const uchar *s1, *s2;
+
+  s1 = v1;
+  s2 = v2;
+  for(; n > 0; n--, s1++, s2++)
+    if(*s1 != *s2)
+      return *s1 - *s2;
+  return 0;
+}
+
+// fork() and exit() flush printf()'s buffers first (see printf.c), so
+// that output is neither lost nor written twice. Programs that don't
+// use printf.c have no buffers, and fflushall is then 0.
+void fflushall(void) __attribute__((weak));
+
+int
+fork(void)
+{
+  if(fflushall)
+    fflushall();
+  return _fork();
+}
+
+int
+exit(void)
+{
+  if(fflushall)
+    fflushall();
+  _exit();
+}
@@ -2,9 +2,23 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mman.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+// Blocks of MMAPMIN bytes or more get a mapping of their own instead
+// (see mmap()), which free() gives straight back to the kernel rather
+// than leaving the heap fragmented with it.
+// Small blocks come in size classes instead, each with a free list of its
+// own, so malloc() and free() of them take the head of a list rather than
+// walking the whole free list; blocks of a class are carved a page at a
+// time out of the general list and stay in their class once freed.
+// A lock keeps the free lists together when threads (see thread.c) allocate at once.
+
+#define MMAPMIN (64*1024)
+#define NCLASS 8                     // size classes of 2, 4, 8 ... 256 units
+#define CLASSMAX (2 << (NCLASS-1))   // units in the largest class
+#define CHUNK 512                    // units carved into blocks of a class at a time
 
 typedef long Align;
 
@@ -20,13 +34,17 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+static Header mapped;  // s.ptr of a block that is a mapping of its own
+static Header classed; // s.ptr of an allocated size class block, whose s.size is the class
+static Header *classp[NCLASS]; // free blocks of each class, linked through s.ptr
+static lock_t mlock;
 
-void
-free(void *ap)
+// Put block bp back on the free list, holding mlock.
+static void
+freeblock(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +61,25 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+
+  bp = (Header*)ap - 1;
+  if(bp->s.ptr == &mapped){
+    munmap(bp, bp->s.size * sizeof(Header));
+    return;
+  }
+  lock_acquire(&mlock);
+  if(bp->s.ptr == &classed){
+    bp->s.ptr = classp[bp->s.size];
+    classp[bp->s.size] = bp;
+  } else
+    freeblock(bp);
+  lock_release(&mlock);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,17 +93,16 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  freeblock(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// Take a block of nunits from the general free list, holding mlock.
+static Header*
+kralloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +117,63 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// Fill class c's empty free list with a chunk's worth of blocks, holding mlock.
+static int
+carve(int c)
+{
+  Header *p, *end;
+  uint bu;
+
+  if((p = kralloc(CHUNK)) == 0)
+    return -1;
+  bu = 2 << c;
+  for(end = p + CHUNK; p + bu <= end; p += bu){
+    p->s.size = c;
+    p->s.ptr = classp[c];
+    classp[c] = p;
+  }
+  return 0;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+  int c;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nbytes >= MMAPMIN){
+    p = mmap(0, nunits * sizeof(Header), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+      return 0;
+    p->s.ptr = &mapped;
+    p->s.size = nunits;
+    return (void*)(p + 1);
+  }
+  lock_acquire(&mlock);
+  if(nunits <= CLASSMAX){
+    for(c = 0; (2 << c) < nunits; c++)
+      ;
+    if(classp[c] == 0 && carve(c) < 0){
+      lock_release(&mlock);
+      return 0;
+    }
+    p = classp[c];
+    classp[c] = p->s.ptr;
+    p->s.ptr = &classed;
+  } else
+    p = kralloc(nunits);
+  lock_release(&mlock);
+  if(p == 0)
+    return 0;
+  return (void*)(p + 1);
+}
@@ -4,9 +4,17 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "ring.h"
+#include "socket.h"
+#include "poll.h"
+#include "sched.h"
+#include "procinfo.h"
 #include "syscall.h"
 #include "traps.h"
+#include "irqstat.h"
 #include "memlayout.h"
+#include "mman.h"
 
 char buf[8192];
 char name[3];
@@ -70,6 +78,1016 @@ exitiputtest(void)
   printf(stdout, "exitiput test ok\n");
 }
 
+// does fork() share pages copy-on-write correctly?
+// parent and child must each see only their own writes, including
+// writes the kernel makes on their behalf in read().
+void
+cowtest(void)
+{
+  char *a, *p;
+  int fds[2], i, pid;
+  enum { NPG = 40 };
+
+  printf(stdout, "cow test\n");
+
+  a = sbrk(NPG*4096);
+  if(a == (char*)-1){
+    printf(stdout, "cow test sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + NPG*4096; p += 4096)
+    *(int*)p = (int)p;
+
+  for(i = 0; i < 3; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "cow test fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(p = a; p < a + NPG*4096; p += 4096){
+        if(*(int*)p != (int)p){
+          printf(stdout, "cow test child saw wrong data\n");
+          exit();
+        }
+        *(int*)p = -1;
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < 3; i++)
+    wait();
+  for(p = a; p < a + NPG*4096; p += 4096){
+    if(*(int*)p != (int)p){
+      printf(stdout, "cow test parent saw child's write\n");
+      exit();
+    }
+  }
+
+  // the kernel writing into a shared page must copy it too
+  if(pipe(fds) != 0){
+    printf(stdout, "cow test pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[1]);
+    if(read(fds[0], a, 4) != 4 || *(int*)a != 0x12345678){
+      printf(stdout, "cow test read into shared page failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[0]);
+  i = 0x12345678;
+  write(fds[1], &i, 4);
+  close(fds[1]);
+  wait();
+  if(*(int*)a != (int)a){
+    printf(stdout, "cow test child's read() changed parent\n");
+    exit();
+  }
+
+  sbrk(-NPG*4096);
+  printf(stdout, "cow test OK\n");
+}
+
+// does sbrk() hand out pages lazily, and do the untouched holes
+// survive fork(), being passed to system calls, and shrinking?
+void
+lazytest(void)
+{
+  char *a, *p;
+  int fd, pid;
+  enum { NPG = 4096 };  // 16MB, far more than the test ever touches
+
+  printf(stdout, "lazy sbrk test\n");
+
+  a = sbrk(NPG*4096);
+  if(a == (char*)-1){
+    printf(stdout, "lazy sbrk test sbrk failed\n");
+    exit();
+  }
+  // touch a scattering of pages; each must read as zero first
+  for(p = a; p < a + NPG*4096; p += 97*4096){
+    if(*p != 0){
+      printf(stdout, "lazy sbrk test page not zeroed\n");
+      exit();
+    }
+    *p = 'x';
+  }
+
+  // the child sees the touched pages and faults in its own holes
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "lazy sbrk test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(a[97*4096] != 'x' || a[4096] != 0){
+      printf(stdout, "lazy sbrk test child saw wrong data\n");
+      exit();
+    }
+    a[4096] = 'y';
+    exit();
+  }
+  wait();
+  if(a[4096] != 0){
+    printf(stdout, "lazy sbrk test child's page leaked into parent\n");
+    exit();
+  }
+
+  // the kernel faulting on a hole must map it too
+  fd = open("README", 0);
+  if(fd < 0){
+    printf(stdout, "lazy sbrk test open README failed\n");
+    exit();
+  }
+  if(read(fd, a + 5*4096 + 4000, 200) != 200){
+    printf(stdout, "lazy sbrk test read into hole failed\n");
+    exit();
+  }
+  close(fd);
+
+  sbrk(-NPG*4096);
+  printf(stdout, "lazy sbrk test OK\n");
+}
+
+// fsync() and sync() should succeed on files and fail on pipes
+void
+fsynctest(void)
+{
+  int fd, fds[2], i;
+  char buf[512];
+
+  printf(stdout, "fsync test\n");
+
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "fsync test create failed\n");
+    exit();
+  }
+  memset(buf, 'f', sizeof(buf));
+  for(i = 0; i < 4; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(stdout, "fsync test write failed\n");
+      exit();
+    }
+    if(fsync(fd) != 0){
+      printf(stdout, "fsync test fsync failed\n");
+      exit();
+    }
+  }
+  // nothing new to commit, must not wait forever
+  if(fsync(fd) != 0 || sync() != 0){
+    printf(stdout, "fsync test idle fsync failed\n");
+    exit();
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf(stdout, "fsync test pipe failed\n");
+    exit();
+  }
+  if(fsync(fds[0]) != -1){
+    printf(stdout, "fsync test fsync on pipe succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(unlink("fsyncfile") != 0 || sync() != 0){
+    printf(stdout, "fsync test unlink failed\n");
+    exit();
+  }
+  printf(stdout, "fsync test OK\n");
+}
+
+// setsched() should reject bad arguments, and procinfo() should
+// report the class it set
+void
+schedtest(void)
+{
+  struct procinfo pi[NPROC];
+  int i, n, pid;
+
+  printf(stdout, "sched test\n");
+  if(setsched(0, NSCHED, 0) != -1 || setsched(0, SCHED_BATCH, NICE_MAX+1) != -1){
+    printf(stdout, "sched test bad arguments accepted\n");
+    exit();
+  }
+  if(setsched(0, SCHED_BATCH, 5) != 0){
+    printf(stdout, "sched test setsched failed\n");
+    exit();
+  }
+  pid = getpid();
+  n = procinfo(pi, NPROC);
+  for(i = 0; i < n; i++)
+    if(pi[i].pid == pid)
+      break;
+  if(i == n || pi[i].class != SCHED_BATCH || pi[i].nice != 5){
+    printf(stdout, "sched test procinfo doesn't show class\n");
+    exit();
+  }
+  // burn a few slices as a batch process, then go back
+  for(i = 0; i < 1000000; i++)
+    ;
+  if(setsched(0, SCHED_INTERACTIVE, 0) != 0){
+    printf(stdout, "sched test reset failed\n");
+    exit();
+  }
+  printf(stdout, "sched test OK\n");
+}
+
+// setaffinity() pins a process, and its children, to the cpus it names
+void
+affinitytest(void)
+{
+  struct procinfo pi[NPROC];
+  uint mask[NCPUWORDS];
+  int i, n, pid, me;
+
+  printf(stdout, "affinity test\n");
+  memset(mask, 0, sizeof(mask));
+  if(setaffinity(0, mask) != -1){
+    printf(stdout, "affinity test bad arguments accepted\n");
+    exit();
+  }
+  mask[0] = 1;
+  if(setaffinity(0, (uint*)0xFFFFFFF0) != -1 || setaffinity(-5, mask) != -1){
+    printf(stdout, "affinity test bad arguments accepted\n");
+    exit();
+  }
+  if(setaffinity(0, mask) != 0){
+    printf(stdout, "affinity test setaffinity failed\n");
+    exit();
+  }
+  for(i = 0; i < 1000000; i++)
+    ;
+  pid = fork();
+  if(pid == 0){
+    for(i = 0; i < 1000000; i++)
+      ;
+    exit();
+  }
+  me = getpid();
+  n = procinfo(pi, NPROC);
+  for(i = 0; i < n; i++)
+    if((pi[i].pid == me && (pi[i].cpu != 0 || memcmp(pi[i].affinity, mask, sizeof(mask)) != 0)) ||
+       (pi[i].pid == pid && memcmp(pi[i].affinity, mask, sizeof(mask)) != 0)){
+      printf(stdout, "affinity test pid %d not pinned\n", pi[i].pid);
+      exit();
+    }
+  wait();
+  memset(mask, 0xFF, sizeof(mask));
+  if(setaffinity(0, mask) != 0){
+    printf(stdout, "affinity test reset failed\n");
+    exit();
+  }
+  printf(stdout, "affinity test OK\n");
+}
+
+// a process can have more than NOFILE files open, and its child
+// inherits all of them
+void
+fdtabletest(void)
+{
+  int i, n, pid;
+
+  printf(stdout, "fd table test\n");
+  for(n = 3; n < 4*NOFILE; n++)
+    if(dup(1) != n){
+      printf(stdout, "fd table test dup %d failed\n", n);
+      exit();
+    }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(write(n-1, "", 0) != 0){
+      printf(stdout, "fd table test child lost fd %d\n", n-1);
+      exit();
+    }
+    exit();
+  }
+  wait();
+  for(i = 3; i < n; i++)
+    close(i);
+  printf(stdout, "fd table test OK\n");
+}
+
+// names cached by lookups, found or not, must follow creates and unlinks,
+// and a removed directory's names must not show up in a new one
+void
+dcachetest(void)
+{
+  int fd;
+
+  printf(stdout, "dcache test\n");
+  unlink("dcdir/f");
+  unlink("dcdir");
+  if(open("dcdir/f", 0) >= 0){
+    printf(stdout, "dcache test: dcdir/f exists\n");
+    exit();
+  }
+  if(mkdir("dcdir") != 0 || (fd = open("dcdir/f", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "dcache test: create dcdir/f failed\n");
+    exit();
+  }
+  close(fd);
+  if((fd = open("dcdir/f", 0)) < 0){
+    printf(stdout, "dcache test: dcdir/f not found after create\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dcdir/f") != 0 || open("dcdir/f", 0) >= 0){
+    printf(stdout, "dcache test: dcdir/f found after unlink\n");
+    exit();
+  }
+  if((fd = open("dcdir/f", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "dcache test: create dcdir/f again failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dcdir/f") != 0 || unlink("dcdir") != 0 || mkdir("dcdir") != 0){
+    printf(stdout, "dcache test: recreate dcdir failed\n");
+    exit();
+  }
+  if(open("dcdir/f", 0) >= 0){
+    printf(stdout, "dcache test: dcdir/f survived its directory\n");
+    exit();
+  }
+  unlink("dcdir");
+  printf(stdout, "dcache test OK\n");
+}
+
+// initialized data, so it is in the file and gets paged in from it
+char textbuf[2*4096] = "usertests initialized data";
+
+// the kernel reading into pages of the program that haven't been
+// touched yet, and a child's writes to them, which must stay its own
+void
+textpagetest(void)
+{
+  int fd, n, pid;
+
+  printf(stdout, "text page test\n");
+  if((fd = open("README", 0)) < 0){
+    printf(stdout, "text page test: open README failed\n");
+    exit();
+  }
+  n = read(fd, textbuf + 100, sizeof(textbuf) - 100);
+  close(fd);
+  if(n <= 0 || strcmp(textbuf, "usertests initialized data") != 0){
+    printf(stdout, "text page test: read into data failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    textbuf[0] = 'X';
+    exit();
+  }
+  wait();
+  if(textbuf[0] != 'u'){
+    printf(stdout, "text page test: child's write showed up\n");
+    exit();
+  }
+  printf(stdout, "text page test OK\n");
+}
+
+// mmap(): a shared file mapping shows the file and writes its changes
+// back, private anonymous memory is copied on fork(), shared isn't,
+// and munmap() can punch a hole in the middle of a mapping
+void
+mmaptest(void)
+{
+  char *p, *q, buf[64];
+  int fd, i, pid;
+
+  printf(stdout, "mmap test\n");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 2*4096+100; i++){
+    buf[0] = 'a' + i % 26;
+    if(write(fd, buf, 1) != 1){
+      printf(stdout, "mmap test: write failed\n");
+      exit();
+    }
+  }
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap test: mmap of file failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*4096+100; i++)
+    if(p[i] != 'a' + i % 26){
+      printf(stdout, "mmap test: wrong contents at %d\n", i);
+      exit();
+    }
+  if(p[2*4096+100] != 0){
+    printf(stdout, "mmap test: not zero past the end\n");
+    exit();
+  }
+  // the kernel takes a mapping as a system call buffer
+  if(write(fd, p + 4096, 10) != 10){
+    printf(stdout, "mmap test: write from mapping failed\n");
+    exit();
+  }
+  p[0] = 'X';
+  p[2*4096+99] = 'Y';
+  // a private mapping of the file comes from the page cache, which mustn't see it
+  q = mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(q == MAP_FAILED || q[0] != 'a'){
+    printf(stdout, "mmap test: shared store showed through a private mapping\n");
+    exit();
+  }
+  munmap(q, 4096);
+  if(munmap(p, 3*4096) < 0){
+    printf(stdout, "mmap test: munmap failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapfile", 0);
+  if(read(fd, buf, 1) != 1 || buf[0] != 'X'){
+    printf(stdout, "mmap test: write to mapping lost\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  q = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED || p[0] != 0 || q[0] != 0){
+    printf(stdout, "mmap test: anonymous mmap failed\n");
+    exit();
+  }
+  p[0] = 'p';
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    p[0] = 'c';
+    q[4096] = 'c';
+    exit();
+  }
+  wait();
+  if(p[0] != 'p' || q[4096] != 'c'){
+    printf(stdout, "mmap test: fork shared the wrong memory\n");
+    exit();
+  }
+  if(munmap(q + 4096, 4096) < 0 || munmap(q, 4096) < 0 || munmap(q + 2*4096, 4096) < 0 ||
+     munmap(p, 4096) < 0){
+    printf(stdout, "mmap test: munmap of part failed\n");
+    exit();
+  }
+  printf(stdout, "mmap test OK\n");
+}
+
+// clone(): threads share memory, including the heap one of them grows,
+// and open files; join() reaps them, and exit() of the process takes
+// down threads still running
+static lock_t tlock;
+static int tcount, tfd;
+
+static void
+threadinc(void *arg)
+{
+  int i, n;
+  char *p;
+
+  n = (int)arg;
+  for(i = 0; i < n; i++){
+    lock_acquire(&tlock);
+    tcount++;
+    lock_release(&tlock);
+  }
+  if((p = malloc(100)) == 0 || write(tfd, "x", 1) != 1){
+    printf(stdout, "thread test: malloc or write in thread failed\n");
+    exit();
+  }
+  free(p);
+  exit();
+}
+
+static void
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+void
+threadtest(void)
+{
+  int i, pid, fds[2];
+  char buf[8];
+
+  printf(stdout, "thread test\n");
+  lock_init(&tlock);
+  tcount = 0;
+  if(pipe(fds) < 0){
+    printf(stdout, "thread test: pipe failed\n");
+    exit();
+  }
+  tfd = fds[1];
+  for(i = 0; i < 4; i++)
+    if(thread_create(threadinc, (void*)10000) < 0){
+      printf(stdout, "thread test: thread_create failed\n");
+      exit();
+    }
+  for(i = 0; i < 4; i++)
+    if(thread_join() < 0){
+      printf(stdout, "thread test: thread_join failed\n");
+      exit();
+    }
+  if(thread_join() != -1 || wait() != -1){
+    printf(stdout, "thread test: joined a thread that isn't there\n");
+    exit();
+  }
+  if(tcount != 40000){
+    printf(stdout, "thread test: count %d, not 40000\n", tcount);
+    exit();
+  }
+  if(read(fds[0], buf, 4) != 4){
+    printf(stdout, "thread test: threads' writes lost\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "thread test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    thread_create(threadspin, 0);
+    thread_create(threadspin, 0);
+    if(exec("echo", (char*[]){"echo", 0}) != -1)
+      printf(stdout, "thread test: exec with threads running\n");
+    exit();
+  }
+  if(wait() != pid){
+    printf(stdout, "thread test: wait failed\n");
+    exit();
+  }
+  printf(stdout, "thread test OK\n");
+}
+
+// futexwait() and futexwake(): a wait on a word that no longer holds the
+// value returns at once, and mutexes and condition variables built on them
+// hand work from one thread to others without spinning
+static mutex_t fmutex;
+static cond_t fcond;
+static int fitems, fdone, fsum;
+
+static void
+futexconsumer(void *arg)
+{
+  mutex_lock(&fmutex);
+  for(;;){
+    while(fitems == 0 && !fdone)
+      cond_wait(&fcond, &fmutex);
+    if(fitems == 0)
+      break;
+    fitems--;
+    fsum++;
+  }
+  mutex_unlock(&fmutex);
+  exit();
+}
+
+void
+futextest(void)
+{
+  uint word;
+  int i;
+
+  printf(stdout, "futex test\n");
+  word = 1;
+  if(futexwait(&word, 0) != -1 || futexwake(&word, 1) != 0){
+    printf(stdout, "futex test: wait on changed word slept, or wake woke\n");
+    exit();
+  }
+  mutex_init(&fmutex);
+  cond_init(&fcond);
+  fitems = fdone = fsum = 0;
+  for(i = 0; i < 3; i++)
+    if(thread_create(futexconsumer, 0) < 0){
+      printf(stdout, "futex test: thread_create failed\n");
+      exit();
+    }
+  for(i = 0; i < 3000; i++){
+    mutex_lock(&fmutex);
+    fitems++;
+    cond_signal(&fcond);
+    mutex_unlock(&fmutex);
+  }
+  mutex_lock(&fmutex);
+  fdone = 1;
+  cond_broadcast(&fcond);
+  mutex_unlock(&fmutex);
+  for(i = 0; i < 3; i++)
+    if(thread_join() < 0){
+      printf(stdout, "futex test: thread_join failed\n");
+      exit();
+    }
+  if(fsum != 3000){
+    printf(stdout, "futex test: consumed %d of 3000\n", fsum);
+    exit();
+  }
+  printf(stdout, "futex test OK\n");
+}
+
+// writev() writes its buffers in order and readv() fills them in order,
+// both moving the offset; pread() and pwrite() work at an offset of
+// their own and leave it alone
+void
+iovtest(void)
+{
+  struct iovec iov[3];
+  char a[5], b[300], c[2];
+  int fd, i;
+
+  printf(stdout, "iov test\n");
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "iov test: create failed\n");
+    exit();
+  }
+  memset(b, 'b', sizeof(b));
+  iov[0].base = "aaaaa";
+  iov[0].len = 5;
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  iov[2].base = "cc";
+  iov[2].len = 2;
+  if(writev(fd, iov, 3) != 307){
+    printf(stdout, "iov test: writev failed\n");
+    exit();
+  }
+  if(pwrite(fd, "X", 1, 5) != 1 || pread(fd, c, 2, 303) != 2 || c[0] != 'b' || c[1] != 'b'){
+    printf(stdout, "iov test: pwrite or pread failed\n");
+    exit();
+  }
+  // pwrite() left the offset at the end
+  if(write(fd, "d", 1) != 1){
+    printf(stdout, "iov test: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("iovfile", O_RDONLY);
+  iov[0].base = a;
+  iov[1].base = b;
+  iov[2].base = c;
+  if(readv(fd, iov, 3) != 307){
+    printf(stdout, "iov test: readv failed\n");
+    exit();
+  }
+  for(i = 0; i < 5; i++)
+    if(a[i] != 'a'){
+      printf(stdout, "iov test: wrong data\n");
+      exit();
+    }
+  if(b[0] != 'X' || b[1] != 'b' || b[299] != 'b' || c[0] != 'c' || c[1] != 'c'){
+    printf(stdout, "iov test: wrong data\n");
+    exit();
+  }
+  if(read(fd, c, 2) != 1 || c[0] != 'd'){
+    printf(stdout, "iov test: readv left the offset wrong\n");
+    exit();
+  }
+  if(pread(fd, c, 1, -1) != -1 || readv(fd, iov, IOV_MAX+1) != -1){
+    printf(stdout, "iov test: bad arguments accepted\n");
+    exit();
+  }
+  close(fd);
+  unlink("iovfile");
+  printf(stdout, "iov test OK\n");
+}
+
+// ringenter() carries out a batch of queued operations in order, and
+// stops when the completion ring is full
+static struct ring ring;
+
+static void
+ringput(int op, int fd, char *addr, int n, int off)
+{
+  struct ringsqe *e;
+
+  e = &ring.sq[ring.sqtail % RINGSIZE];
+  e->op = op;
+  e->fd = fd;
+  e->addr = addr;
+  e->n = n;
+  e->off = off;
+  e->data = ring.sqtail;
+  ring.sqtail++;
+}
+
+void
+ringtest(void)
+{
+  char buf[8];
+  int fd, i;
+
+  printf(stdout, "ring test\n");
+  memset(&ring, 0, sizeof(ring));
+  ringput(RING_OPEN, 0, "ringfile", O_CREATE|O_RDWR, 0);
+  if(ringenter(&ring, 1) != 1 || (fd = ring.cq[0].res) < 0){
+    printf(stdout, "ring test: open failed\n");
+    exit();
+  }
+  ring.cqhead++;
+  ringput(RING_WRITE, fd, "abc", 3, -1);
+  ringput(RING_WRITE, fd, "de", 2, -1);
+  ringput(RING_WRITE, fd, "X", 1, 1);
+  ringput(RING_READ, fd, buf, 5, 0);
+  ringput(RING_CLOSE, fd, 0, 0, 0);
+  ringput(RING_CLOSE, fd, 0, 0, 0);
+  if(ringenter(&ring, 10) != 6){
+    printf(stdout, "ring test: batch not done\n");
+    exit();
+  }
+  for(i = 1; i < 7; i++)
+    if(ring.cq[i].data != i){
+      printf(stdout, "ring test: completions out of order\n");
+      exit();
+    }
+  if(ring.cq[1].res != 3 || ring.cq[2].res != 2 || ring.cq[3].res != 1 || ring.cq[4].res != 5 ||
+     ring.cq[5].res != 0 || ring.cq[6].res != -1 || buf[0] != 'a' || buf[1] != 'X' || buf[4] != 'e'){
+    printf(stdout, "ring test: wrong results\n");
+    exit();
+  }
+  // leave one completion unread: a full completion ring holds back the rest of the queue
+  ring.cqhead = ring.cqtail - 1;
+  for(i = 0; i < RINGSIZE + 1; i++)
+    ringput(RING_CLOSE, -1, 0, 0, 0);
+  if(ringenter(&ring, RINGSIZE + 1) != RINGSIZE - 1 || ring.sqhead + 2 != ring.sqtail){
+    printf(stdout, "ring test: overran the completion ring\n");
+    exit();
+  }
+  unlink("ringfile");
+  printf(stdout, "ring test OK\n");
+}
+
+// UDP over loopback: datagrams to 127.0.0.1 come straight back up the stack
+void
+udptest(void)
+{
+  struct sockaddr_in a, from;
+  struct mmsg m[4];
+  char buf[4][16];
+  int s, c, i;
+
+  printf(stdout, "udp test\n");
+  if((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || (c = socket(AF_INET, SOCK_DGRAM, 0)) < 0){
+    printf(stdout, "udp test: socket failed\n");
+    exit();
+  }
+  a.family = AF_INET;
+  a.addr = INADDR_ANY;
+  a.port = 7001;
+  if(bind(s, &a) != 0 || bind(c, &a) >= 0){
+    printf(stdout, "udp test: bind wrong\n");
+    exit();
+  }
+  a.addr = INADDR_LOOPBACK;
+  if(sendto(c, "one", 3, &a) != 3 || sendto(c, "two", 3, &a) != 3 || sendto(c, "three", 5, &a) != 5){
+    printf(stdout, "udp test: sendto failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    m[i].buf = buf[i];
+    m[i].len = sizeof(buf[i]);
+  }
+  m[2].len = 4; // truncated, but the length says how long it was
+  if(recvmmsg(s, m, 4) != 3 || m[0].len != 3 || memcmp(buf[0], "one", 3) != 0 ||
+     memcmp(buf[1], "two", 3) != 0 || m[2].len != 5 || memcmp(buf[2], "thre", 4) != 0){
+    printf(stdout, "udp test: recvmmsg wrong\n");
+    exit();
+  }
+  // c was bound to a port of its own by its first sendto
+  if(m[0].from.addr != INADDR_LOOPBACK || m[0].from.port < 49152){
+    printf(stdout, "udp test: wrong sender\n");
+    exit();
+  }
+  a.port = m[0].from.port;
+  if(sendto(s, "back", 4, &a) != 4 || recvfrom(c, buf[0], sizeof(buf[0]), &from) != 4 ||
+     memcmp(buf[0], "back", 4) != 0 || from.port != 7001){
+    printf(stdout, "udp test: reply wrong\n");
+    exit();
+  }
+  close(s);
+  close(c);
+  // the port is free again
+  a.port = 7001;
+  if((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0 || bind(s, &a) != 0){
+    printf(stdout, "udp test: port not freed\n");
+    exit();
+  }
+  close(s);
+  printf(stdout, "udp test OK\n");
+}
+
+// poll() reports which pipe ends are ready, waits for a writer, and times out
+void
+polltest(void)
+{
+  struct pollfd pfd[2];
+  int fds[2], pid;
+  char c;
+
+  printf(stdout, "poll test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "poll test: pipe failed\n");
+    exit();
+  }
+  pfd[0].fd = fds[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = fds[1];
+  pfd[1].events = POLLOUT;
+  if(poll(pfd, 2, 0) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLOUT){
+    printf(stdout, "poll test: empty pipe wrong\n");
+    exit();
+  }
+  if(poll(pfd, 1, 50) != 0){
+    printf(stdout, "poll test: no timeout\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    sleep(2);
+    write(fds[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLIN ||
+     read(fds[0], &c, 1) != 1 || c != 'x'){
+    printf(stdout, "poll test: no wakeup\n");
+    exit();
+  }
+  wait();
+  close(fds[1]);
+  if(poll(pfd, 1, -1) != 1 || !(pfd[0].revents & POLLHUP)){
+    printf(stdout, "poll test: no hangup\n");
+    exit();
+  }
+  pfd[1].fd = 99;
+  if(poll(&pfd[1], 1, 0) != 1 || pfd[1].revents != POLLNVAL){
+    printf(stdout, "poll test: bad fd wrong\n");
+    exit();
+  }
+  close(fds[0]);
+  printf(stdout, "poll test OK\n");
+}
+
+// irqroute() moves a device interrupt and rejects bad ones; irqstat() shows it
+void
+irqtest(void)
+{
+  static struct irqstat st;
+  int old;
+
+  printf(stdout, "irq test\n");
+  if(irqstat(&st) != 0 || st.ncpu < 1 || (old = st.cpu[IRQ_IDE]) < 0){
+    printf(stdout, "irq test: irqstat wrong\n");
+    exit();
+  }
+  if(irqroute(IRQ_IDE, st.ncpu) != -1 || irqroute(-1, 0) != -1 ||
+     irqroute(NIRQ, 0) != -1 || irqroute(IRQ_TLB, 0) != -1){
+    printf(stdout, "irq test: bad route accepted\n");
+    exit();
+  }
+  if(irqroute(IRQ_IDE, st.ncpu - 1) != 0 || irqstat(&st) != 0 ||
+     st.cpu[IRQ_IDE] != st.ncpu - 1 || irqroute(IRQ_IDE, old) != 0){
+    printf(stdout, "irq test: route failed\n");
+    exit();
+  }
+  printf(stdout, "irq test OK\n");
+}
+
+// fgets() reads ahead a buffer at a time, and must still split lines right
+void
+fgetstest(void)
+{
+  char line[16];
+  int fd, i;
+
+  printf(stdout, "fgets test\n");
+  fd = open("linefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "fgets test: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 200; i++)
+    printf(fd, "line %d\n", i);
+  printf(fd, "no newline");
+  fflush(fd);
+  close(fd);
+
+  fd = open("linefile", 0);
+  for(i = 0; i < 200; i++){
+    fgets(fd, line, sizeof(line));
+    if(line[0] != 'l' || atoi(line + 5) != i || line[strlen(line) - 1] != '\n'){
+      printf(stdout, "fgets test: bad line %d: %s\n", i, line);
+      exit();
+    }
+  }
+  fgets(fd, line, 4);
+  if(strcmp(line, "no ") != 0){
+    printf(stdout, "fgets test: short buffer got %s\n", line);
+    exit();
+  }
+  fgets(fd, line, sizeof(line));
+  if(strcmp(line, "newline") != 0){
+    printf(stdout, "fgets test: last line got %s\n", line);
+    exit();
+  }
+  fgets(fd, line, sizeof(line));
+  if(line[0] != 0){
+    printf(stdout, "fgets test: read past end of file\n");
+    exit();
+  }
+  close(fd);
+  unlink("linefile");
+  printf(stdout, "fgets test OK\n");
+}
+
+// a small file keeps its data in the inode until it outgrows it
+void
+inlinetest(void)
+{
+  char buf[100];
+  int fd, i;
+
+  printf(stdout, "inline test\n");
+  fd = open("inlinefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "inline test: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, 40) != 40 || write(fd, buf + 40, 60) != 60){
+    printf(stdout, "inline test: write failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("inlinefile", 0);
+  memset(buf, 0, sizeof(buf));
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(stdout, "inline test: short read\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    if(buf[i] != 'a' + i % 26){
+      printf(stdout, "inline test: wrong byte %d\n", i);
+      exit();
+    }
+  close(fd);
+  unlink("inlinefile");
+  printf(stdout, "inline test OK\n");
+}
+
+// nanosleep() should sleep for less than a tick at a time, and
+// sleep() and nanosleep() together should account for the time
+void
+nanosleeptest(void)
+{
+  int i, t0, t1;
+
+  printf(stdout, "nanosleep test\n");
+  if(nanosleep(0, 1000000000) != -1 || nanosleep(-1, 0) != -1){
+    printf(stdout, "nanosleep bad arguments accepted\n");
+    exit();
+  }
+  t0 = uptime();
+  for(i = 0; i < 50; i++)
+    if(nanosleep(0, 1000000) != 0){
+      printf(stdout, "nanosleep failed\n");
+      exit();
+    }
+  if(sleep(2) < 0){
+    printf(stdout, "sleep failed\n");
+    exit();
+  }
+  t1 = uptime();
+  // 50ms and 2 ticks: at least 5 ticks, and not one tick per nanosleep
+  if(t1 - t0 < 5 || t1 - t0 >= 50){
+    printf(stdout, "nanosleep test took %d ticks\n", t1 - t0);
+    exit();
+  }
+  printf(stdout, "nanosleep test OK\n");
+}
+
 // does the error path in open() for attempt to write a
 // directory call iput() in a transaction?
 // needs a hacked kernel that pauses just after the namei()
@@ -184,6 +1202,11 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// 512-byte writes in the big file: as big as a file gets with 512-byte
+// blocks, and into the double-indirect blocks with bigger ones, whose
+// biggest file wouldn't fit on the disk
+#define BIGWRITES (BSIZE == 512 ? MAXFILE : (NDIRECT + NINDIRECT + 16) * (BSIZE/512))
+
 void
 writetest1(void)
 {
@@ -197,7 +1220,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGWRITES; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +1240,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == BIGWRITES - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -1383,7 +2406,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<NPROCMAX+1; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +2414,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == NPROCMAX+1){
+    printf(1, "fork claimed to work %d times!\n", n);
     exit();
   }
 
@@ -1642,6 +2665,183 @@ bigargtest(void)
   unlink("bigarg-ok");
 }
 
+// exec() lays the arguments out on the new stack as they were given,
+// whatever their lengths (which the stack pointer is aligned down after)
+void
+execargtest(void)
+{
+  static char big[1001], want[1100], got[1100];
+  char *args[] = { "echo", "a", "", "bcd", big, "ef", 0 };
+  int fds[2], pid, n, m;
+
+  printf(stdout, "exec arg test\n");
+  memset(big, 'x', sizeof(big) - 1);
+  strcpy(want, "a  bcd ");
+  strcpy(want + strlen(want), big);
+  strcpy(want + strlen(want), " ef\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "exec arg test pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "exec arg test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("echo", args);
+    printf(2, "exec arg test exec failed\n");
+    exit();
+  }
+  close(fds[1]);
+  n = 0;
+  while(n < sizeof(got) - 1 && (m = read(fds[0], got + n, sizeof(got) - 1 - n)) > 0)
+    n += m;
+  got[n] = 0;
+  close(fds[0]);
+  wait();
+  if(strcmp(got, want) != 0){
+    printf(stdout, "exec arg test got the wrong arguments\n");
+    exit();
+  }
+  printf(stdout, "exec arg test OK\n");
+}
+
+// sh file parses the whole script before running any of it, and runs
+// pipelines a child per stage
+void
+shtest(void)
+{
+  static char good[] = "# a comment\necho one two | cat | cat > sh-out\ncd /\n";
+  static char bad[] = "echo runs > sh-out2\necho > \n";
+  char got[32];
+  char *args[] = { "sh", "sh-script", 0 };
+  int fd, n, pass;
+
+  printf(stdout, "sh test\n");
+  unlink("sh-out");
+  unlink("sh-out2");
+  for(pass = 0; pass < 2; pass++){
+    fd = open("sh-script", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(stdout, "sh test create failed\n");
+      exit();
+    }
+    if(pass == 0)
+      write(fd, good, strlen(good));
+    else
+      write(fd, bad, strlen(bad));
+    close(fd);
+    n = fork();
+    if(n < 0){
+      printf(stdout, "sh test fork failed\n");
+      exit();
+    }
+    if(n == 0){
+      exec("sh", args);
+      printf(stdout, "sh test exec failed\n");
+      exit();
+    }
+    wait();
+    unlink("sh-script");
+  }
+  fd = open("sh-out", O_RDONLY);
+  n = fd < 0 ? -1 : read(fd, got, sizeof(got) - 1);
+  close(fd);
+  if(n != 8 || memcmp(got, "one two\n", 8) != 0){
+    printf(stdout, "sh test pipeline output wrong\n");
+    exit();
+  }
+  if(open("sh-out2", O_RDONLY) >= 0){
+    printf(stdout, "sh test ran a script with a syntax error\n");
+    exit();
+  }
+  unlink("sh-out");
+  printf(stdout, "sh test OK\n");
+}
+
+// wait() finds each child once, whichever order they exit in, and never
+// the grandchildren an exiting child leaves to init; kill() finds a child by pid
+void
+waittest(void)
+{
+  enum { N = 20 };
+  int pids[N], i, j, pid, fds[2];
+  char c;
+
+  printf(stdout, "wait test\n");
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "wait test fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      // later children exit sooner
+      for(j = 0; j < (N - i) * 20000; j++)
+        ;
+      exit();
+    }
+    pids[i] = pid;
+  }
+  for(i = 0; i < N; i++){
+    pid = wait();
+    for(j = 0; j < N && pids[j] != pid; j++)
+      ;
+    if(j == N){
+      printf(stdout, "wait test got pid %d, not a child's\n", pid);
+      exit();
+    }
+    pids[j] = -1;
+  }
+  if(wait() != -1){
+    printf(stdout, "wait test waited with no children left\n");
+    exit();
+  }
+
+  // a child whose own children outlive it
+  if(pipe(fds) != 0){
+    printf(stdout, "wait test pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    for(i = 0; i < 5; i++)
+      if(fork() == 0){
+        close(fds[1]);
+        read(fds[0], &c, 1);
+        exit();
+      }
+    exit();
+  }
+  if(wait() != pid || wait() != -1){
+    printf(stdout, "wait test reaped a grandchild\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]); // the grandchildren's reads return, and init reaps them
+
+  // one that waits to be killed
+  pid = fork();
+  if(pid == 0){
+    for(;;)
+      sleep(1);
+  }
+  if(kill(pid) != 0 || wait() != pid){
+    printf(stdout, "wait test kill failed\n");
+    exit();
+  }
+  if(kill(pid) != -1){
+    printf(stdout, "wait test killed a reaped child\n");
+    exit();
+  }
+  printf(stdout, "wait test OK\n");
+}
+
 // what happens when the file system runs out of blocks?
 // answer: balloc panics, so this test is not useful.
 void
@@ -1764,6 +2964,9 @@ main(int argc, char *argv[])
   sharedfd();
 
   bigargtest();
+  execargtest();
+  shtest();
+  waittest();
   bigwrite();
   bigargtest();
   bsstest();
@@ -1780,6 +2983,25 @@ main(int argc, char *argv[])
   iputtest();
 
   mem();
+  cowtest();
+  lazytest();
+  fsynctest();
+  schedtest();
+  affinitytest();
+  nanosleeptest();
+  fdtabletest();
+  dcachetest();
+  textpagetest();
+  mmaptest();
+  threadtest();
+  futextest();
+  iovtest();
+  ringtest();
+  udptest();
+  polltest();
+  irqtest();
+  fgetstest();
+  inlinetest();
   pipe1();
   preempt();
   exitwait();
@@ -0,0 +1,131 @@
+// Sample the kernel's counters from the stat device (see devstat.c).
+//   vmstat [secs [count]]  a line every secs seconds (1), count lines (5, 0 for no end):
+//                          free and zeroed pages, buffer cache size and hit rate,
+//                          disk blocks read and written and requests queued,
+//                          FS ops, ops that waited, commits and blocks logged.
+//                          Counts are for the interval, except on the first line.
+//   vmstat -a              the counters as the device gives them
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+enum { PGFREE, PGZEROED, NBUF, BHITS, BMISSES, DREADS, DWRITES, DQUEUE,
+       LOGOPS, LOGOPWAITS, LOGCOMMITS, LOGBLOCKS, NCOUNTER };
+
+static char *names[NCOUNTER] = {
+[PGFREE]     "pgfree",
+[PGZEROED]   "pgzeroed",
+[NBUF]       "nbuf",
+[BHITS]      "bhits",
+[BMISSES]    "bmisses",
+[DREADS]     "dreads",
+[DWRITES]    "dwrites",
+[DQUEUE]     "dqueue",
+[LOGOPS]     "logops",
+[LOGOPWAITS] "logopwaits",
+[LOGCOMMITS] "logcommits",
+[LOGBLOCKS]  "logblocks",
+};
+
+static char buf[1024];
+
+// read the device into buf; returns its length or -1
+static int
+readstat(void)
+{
+  int fd, n;
+
+  if((fd = open("/stat", O_RDONLY)) < 0)
+    return -1;
+  n = read(fd, buf, sizeof(buf)-1);
+  close(fd);
+  if(n < 0)
+    return -1;
+  buf[n] = 0;
+  return n;
+}
+
+// pick the counters out of buf's "name value" lines
+static void
+parse(uint *v)
+{
+  char *p, *q;
+  int i;
+
+  memset(v, 0, NCOUNTER*sizeof(*v));
+  for(p = buf; *p; p = q){
+    for(q = p; *q && *q != ' '; q++)
+      ;
+    if(*q == 0)
+      break;
+    *q++ = 0;
+    for(i = 0; i < NCOUNTER; i++)
+      if(strcmp(p, names[i]) == 0)
+        v[i] = atoi(q);
+    while(*q && *q++ != '\n')
+      ;
+  }
+}
+
+// a as a percentage of b, without overflowing
+static uint
+pct(uint a, uint b)
+{
+  if(b == 0)
+    return 100;
+  if(a < 0xffffffff / 100)
+    return a * 100 / b;
+  return a / (b / 100);
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint v[NCOUNTER], last[NCOUNTER], d[NCOUNTER];
+  int i, k, secs, count;
+  uint lookups;
+
+  if(argc > 1 && strcmp(argv[1], "-a") == 0){
+    if(readstat() < 0){
+      printf(2, "vmstat: cannot read /stat\n");
+      exit();
+    }
+    printf(1, "%s", buf);
+    exit();
+  }
+  secs = argc > 1 ? atoi(argv[1]) : 1;
+  count = argc > 2 ? atoi(argv[2]) : 5;
+  if(secs < 1)
+    secs = 1;
+
+  memset(last, 0, sizeof(last));
+  for(k = 0; count == 0 || k < count; k++){
+    if(k > 0)
+      sleep(secs * 100);
+    if(readstat() < 0){
+      printf(2, "vmstat: cannot read /stat\n");
+      exit();
+    }
+    parse(v);
+    for(i = 0; i < NCOUNTER; i++)
+      d[i] = v[i] - last[i];
+    // gauges stay as they are
+    d[PGFREE] = v[PGFREE];
+    d[PGZEROED] = v[PGZEROED];
+    d[NBUF] = v[NBUF];
+    d[DQUEUE] = v[DQUEUE];
+    memmove(last, v, sizeof(last));
+
+    if(k % 20 == 0)
+      printf(1, "free\tzeroed\tnbuf\thit%%\tdread\tdwrite\tqueue\tops\twaits\tcommits\tlogged\n");
+    lookups = d[BHITS] + d[BMISSES];
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+           d[PGFREE], d[PGZEROED], d[NBUF],
+           pct(d[BHITS], lookups),
+           d[DREADS], d[DWRITES], d[DQUEUE],
+           d[LOGOPS], d[LOGOPWAITS], d[LOGCOMMITS], d[LOGBLOCKS]);
+  }
+  exit();
+}